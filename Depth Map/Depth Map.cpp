@@ -7,37 +7,110 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
 #include <cmath>
+#include <memory>
 #include <string>
 #include <stdexcept>
+#include "camera_projection.h"
 #include "config.h"
+#include "depth_filter.h"
+#include "depth_map.h"
+#include "depth_pyramid.h"
+#include "depth_stats.h"
+#include "exporters.h"
+#include "frame_sequence.h"
+#include "height_field_renderer.h"
+#include "mesh.h"
+#include "pipeline.h"
+#include "rtin.h"
+#include "sequence_renderer.h"
+#include "software_renderer.h"
+#include "streaming.h"
+#include "terrain_lod.h"
+#include "trace.h"
 
 
 int vertex_count = 0;
-struct DepthMap {
-    double width;
-    double height;
-    std::vector<double> data;
+
+// Матрицы и свет, общие для всех шейдеров: блок вставляется после строки #version,
+// значения лежат в одном uniform-буфере и обновляются только при изменении сцены
+const char* sceneUniformBlock = R"glsl(
+layout(std140) uniform Scene {
+    mat4 model;
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;     // Позиция камеры
+    vec3 lightPos;    // Позиция источника света
+    vec3 lightColor;  // Цвет света
+    vec3 objectColor; // Цвет объекта
+    vec2 depthRange;  // Глубина FragPos.z для нормировки: 2-й и 98-й процентили карты
+    float gridStep;   // Шаг сетки по x и y
+    float heightScale; // Множитель значения текстуры heights до глубины вершины
 };
+)glsl";
 
-DepthMap readDepthMap(const std::string& filename) {
-    std::ifstream file(filename, std::ios::binary);
-    if (!file) {
-        throw std::runtime_error("Unable to open file");
-    }
-    DepthMap depthMap;
-    file.read(reinterpret_cast<char*>(&depthMap.height), sizeof(double));
-    file.read(reinterpret_cast<char*>(&depthMap.width), sizeof(double));
-    if (depthMap.width == 0 || depthMap.height == 0) {
-        throw std::runtime_error("Invalid width or height in depth map file");
-    }
-    depthMap.data.resize(depthMap.width * depthMap.height);
-    file.read(reinterpret_cast<char*>(depthMap.data.data()), depthMap.data.size() * sizeof(double));
-    if (!file) {
-        throw std::runtime_error("Error reading depth map data");
-    }
-    return depthMap;
+// Вход вершинного шейдера: vertexPosition() и vertexNormal() вставляются после блока Scene.
+// Обычная сетка — позиция и нормаль из вершинного буфера
+const char* meshVertexInput = R"glsl(
+layout(location = 0) in vec3 meshPosition;
+layout(location = 1) in vec3 meshNormal;
+
+vec3 vertexPosition() { return meshPosition; }
+vec3 vertexNormal() { return meshNormal; }
+)glsl";
+
+// Карта высот (HeightFieldRenderer): вершина gl_VertexID — отсчёт y * width + x текстуры heights.
+// Нормаль по центральным разностям, как в computeNormalRow: у края и у нулевых соседей разность односторонняя
+const char* heightFieldVertexInput = R"glsl(
+uniform sampler2D heights;
+
+ivec2 sampleCoord() {
+    int width = textureSize(heights, 0).x;
+    return ivec2(gl_VertexID % width, gl_VertexID / width);
+}
+
+float heightAt(ivec2 p) {
+    return texelFetch(heights, p, 0).r * heightScale;
+}
+
+vec3 vertexPosition() {
+    ivec2 p = sampleCoord();
+    return vec3(vec2(p) * gridStep, heightAt(p));
+}
+
+vec3 vertexNormal() {
+    ivec2 p = sampleCoord();
+    ivec2 size = textureSize(heights, 0);
+    float z = heightAt(p);
+    // Соседи слева, справа, сверху и снизу; отсутствующий сосед заменяется самим отсчётом
+    vec4 around = vec4(p.x > 0 ? heightAt(p - ivec2(1, 0)) : 0.0,
+        p.x + 1 < size.x ? heightAt(p + ivec2(1, 0)) : 0.0,
+        p.y > 0 ? heightAt(p - ivec2(0, 1)) : 0.0,
+        p.y + 1 < size.y ? heightAt(p + ivec2(0, 1)) : 0.0);
+    vec4 has = vec4(notEqual(around, vec4(0.0)));
+    around = mix(vec4(z), around, has);
+    vec2 span = vec2(has.x + has.y, has.z + has.w) * gridStep;
+    float dzdx = span.x > 0.0 ? (around.y - around.x) / span.x : 0.0;
+    float dzdy = span.y > 0.0 ? (around.w - around.z) / span.y : 0.0;
+    return normalize(vec3(-dzdx, -dzdy, 1.0));
 }
+)glsl";
+
+// Раскладка блока Scene по std140: vec3 занимает 16 байт
+struct SceneUniforms {
+    glm::mat4 model;
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::vec4 viewPos;
+    glm::vec4 lightPos;
+    glm::vec4 lightColor;
+    glm::vec4 objectColor;
+    glm::vec2 depthRange;
+    float gridStep;
+    float heightScale;
+};
+const GLuint sceneBinding = 0;
 
 // Шейдеры
 //Torrens
@@ -45,17 +118,13 @@ DepthMap readDepthMap(const std::string& filename) {
 const char* torrensVertexShader = R"glsl(
 #version 330 core
 
-layout(location = 0) in vec3 aPos; // Позиция вершины
-layout(location = 1) in vec3 aNormal; // Нормаль вершины
-
 out vec3 FragPos; // Позиция фрагмента в мировых координатах
 out vec3 Normal;  // Интерполированная нормаль
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 void main() {
+    vec3 aPos = vertexPosition(); // Позиция вершины
+    vec3 aNormal = vertexNormal(); // Нормаль вершины
     FragPos = vec3(model * vec4(aPos, 1.0));
     Normal = mat3(transpose(inverse(model))) * aNormal; // Трансформация нормали
 
@@ -74,12 +143,6 @@ out vec4 FragColor; // Цвет фрагмента
 // Удаление экспоненциальной записи
 #define PI 3.14159265359
 
-// Параметры освещения
-uniform vec3 lightPos;   // Позиция источника света
-uniform vec3 lightColor; // Цвет света
-uniform vec3 viewPos;    // Позиция камеры
-uniform vec3 objectColor; // Цвет объекта
-
 // Микрофасетная модель
 float distributionGGX(vec3 N, vec3 H, float roughness) {
     float a = roughness * roughness;
@@ -173,17 +236,14 @@ void main() {
 const char* phongVertexShader = R"glsl(
 #version 330 core
 
-layout(location = 0) in vec3 aPos; // Позиция вершины
-layout(location = 1) in vec3 aNormal; // Нормаль вершины
-
 out vec3 FragPos; // Позиция фрагмента в мировом пространстве
 out vec3 Normal;  // Нормаль фрагмента в мировом пространстве
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 void main() {
+    vec3 aPos = vertexPosition(); // Позиция вершины
+    vec3 aNormal = vertexNormal(); // Нормаль вершины
+
     // Преобразование позиции вершины в мировое пространство
     FragPos = vec3(model * vec4(aPos, 1.0));
     
@@ -203,13 +263,8 @@ in vec3 Normal;  // Нормаль фрагмента в мировом прос
 
 out vec4 FragColor; // Итоговый цвет фрагмента
 
-uniform vec3 viewPos;      // Позиция камеры
-uniform vec3 lightPos;     // Позиция источника света
-uniform vec3 lightColor;   // Цвет света
-uniform vec3 objectColor;  // Цвет объекта
-
 void main() {
-    float depthNormalized = clamp((FragPos.z - 0.5) / (0.63 - 0.5), 0.0, 1.0);
+    float depthNormalized = clamp((FragPos.z - depthRange.x) / max(depthRange.y - depthRange.x, 1e-6), 0.0, 1.0);
 
     float specularStrength = 2.1; // Интенсивность зеркального света
     float diffuseStrength = 0.45;  // Интенсивность диффузного света
@@ -245,17 +300,14 @@ void main() {
 // Вершинный шейдер
 const char* lambertVertexShader = R"glsl(
 #version 330 core
-layout(location = 0) in vec3 aPos;
-layout(location = 1) in vec3 aNormal;
 
 out vec3 FragPos;
 out vec3 Normal;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 void main() {
+    vec3 aPos = vertexPosition();
+    vec3 aNormal = vertexNormal();
     FragPos = vec3(model * vec4(aPos, 1.0));
     Normal = mat3(transpose(inverse(model))) * aNormal;
     gl_Position = projection * view * vec4(FragPos, 1.0);
@@ -270,16 +322,12 @@ in vec3 Normal;
 
 out vec4 FragColor;
 
-uniform vec3 lightPos;
-uniform vec3 lightColor;
-uniform vec3 objectColor;
-
 void main() {
     // Нормализация нормали
     vec3 norm = normalize(Normal);
     
     // Приведение значения FragPos.z к диапазону [0, 1]
-    float depthNormalized = clamp((FragPos.z - 0.4) / (0.73 - 0.4), 0.0, 1.0);
+    float depthNormalized = clamp((FragPos.z - depthRange.x) / max(depthRange.y - depthRange.x, 1e-6), 0.0, 1.0);
     
     // Направление света (не трогаем глубину)
     vec3 lightDir = normalize(lightPos - FragPos);
@@ -332,55 +380,9 @@ void initOpenGL(GLFWwindow*& window) {
 
 }
 
-// Функция для загрузки данных карты глубины в буфер OpenGL
-GLuint loadDepthMap(const DepthMap& depthMap, std::vector<unsigned int>& indices) {
-    std::vector<float> vertices;
-
-    for (size_t y = 0; y < depthMap.height; ++y) {
-        for (size_t x = 0; x < depthMap.width; ++x) {
-            float nx = (float)x / (depthMap.width - 1) * 2.0f - 1.0f; // Нормализация x
-            float ny = (float)y / (depthMap.height - 1) * 2.0f - 1.0f; // Нормализация y
-            float z = depthMap.data[y * depthMap.width + x];
-
-            vertices.push_back(nx);
-            vertices.push_back(ny);
-            vertices.push_back(z);
-
-            // Вычисление нормали
-            float left = (x > 0) ? depthMap.data[y * depthMap.width + (x - 1)] : z;
-            float right = (x < depthMap.width - 1) ? depthMap.data[y * depthMap.width + (x + 1)] : z;
-            float top = (y > 0) ? depthMap.data[(y - 1) * depthMap.width + x] : z;
-            float bottom = (y < depthMap.height - 1) ? depthMap.data[(y + 1) * depthMap.width + x] : z;
-
-            float dzdx = right - left;
-            float dzdy = bottom - top;
-
-            glm::vec3 normal(-dzdx, -dzdy, 2.0f);
-            normal = glm::normalize(normal);
-
-            vertices.push_back(normal.x);
-            vertices.push_back(normal.y);
-            vertices.push_back(normal.z);
-        }
-    }
-
-    for (size_t y = 0; y < depthMap.height - 1; ++y) {
-        for (size_t x = 0; x < depthMap.width - 1; ++x) {
-            unsigned int v1 = y * depthMap.width + x;
-            unsigned int v2 = (y + 1) * depthMap.width + x;
-            unsigned int v3 = (y + 1) * depthMap.width + (x + 1);
-            unsigned int v4 = y * depthMap.width + (x + 1);
-
-            indices.push_back(v1);
-            indices.push_back(v2);
-            indices.push_back(v3);
-            indices.push_back(v1);
-            indices.push_back(v3);
-            indices.push_back(v4);
-        }
-    }
-
-    GLuint VBO, VAO, EBO;
+// Функция для загрузки индексированной сетки в буферы OpenGL
+void setupGridBuffers(const GridMesh& mesh, GLuint& VAO, GLuint& VBO, GLuint& EBO) {
+    TRACE_ZONE("setupGridBuffers");
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
     glGenBuffers(1, &EBO);
@@ -388,169 +390,30 @@ GLuint loadDepthMap(const DepthMap& depthMap, std::vector<unsigned int>& indices
     glBindVertexArray(VAO);
 
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+    glBufferData(GL_ARRAY_BUFFER, mesh.vertices.size() * sizeof(float), mesh.vertices.data(), GL_STATIC_DRAW);
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+    if (mesh.wideIndices()) {
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices32.size() * sizeof(uint32_t), mesh.indices32.data(), GL_STATIC_DRAW);
+    }
+    else {
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.indices16.size() * sizeof(uint16_t), mesh.indices16.data(), GL_STATIC_DRAW);
+    }
 
+    // Позиция и нормаль чередуются в одном буфере
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
 
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
     glEnableVertexAttribArray(1);
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    // EBO остаётся привязанным к VAO
     glBindVertexArray(0);
-
-    return VAO;
-}
-
-void exportToPly(const DepthMap& depthMap, const std::string& filename) {
-    std::ofstream file(filename);
-    if (!file) {
-        throw std::runtime_error("Unable to open file");
-    }
-
-    std::vector<std::vector<unsigned int>> vertexes;
-    unsigned int ply_count = 0;
-    for (double y = 0; y < depthMap.height; ++y) {
-        std::vector<unsigned int> vertex_line;
-        for (double x = 0; x < depthMap.width; ++x) {
-            double z = depthMap.data[y * depthMap.width + x];
-            vertex_line.push_back(ply_count);
-            ply_count++;
-        }
-        if (!vertex_line.empty()) {
-            vertexes.push_back(vertex_line);
-        }
-    }
-
-    std::vector<std::vector<unsigned int>> faces;
-    for (int y = 0; y < vertexes.size() - 1; ++y) {
-        for (int x = 0; x < vertexes[y].size() - 1; ++x) {
-            unsigned int v1 = vertexes[y][x];
-            unsigned int v2 = (x < vertexes[y + 1].size()) ? vertexes[y + 1][x] : vertexes[y + 1].back();
-            unsigned int v3 = (x + 1 < vertexes[y + 1].size()) ? vertexes[y + 1][x + 1] : vertexes[y + 1].back();
-            unsigned int v4 = (x + 1 < vertexes[y].size()) ? vertexes[y][x + 1] : vertexes[y].back();
-
-            std::vector<unsigned int> face1 = { v1, v2, v3 };
-            std::vector<unsigned int> face2 = { v1, v4, v3 };
-
-            faces.push_back(face1);
-            faces.push_back(face2);
-        }
-    }
-
-    file << "ply\n";
-    file << "format ascii 1.0\n";
-    file << "element vertex " << ply_count << "\n";
-    file << "property double x\n";
-    file << "property double y\n";
-    file << "property double z\n";
-    file << "property uchar red\n";
-    file << "property uchar green\n";
-    file << "property uchar blue\n";
-    file << "element face " << faces.size() << "\n";
-    file << "property list uchar uint vertex_indices\n";
-    file << "end_header\n";
-
-    for (double y = 0; y < depthMap.height; ++y) {
-        for (double x = 0; x < depthMap.width; ++x) {
-            double z = depthMap.data[y * depthMap.width + x];
-            file << x << " " << y << " " << z << " " << 255 << " " << 200 << " " << 100 << "\n";
-        }
-    }
-
-    for (const auto& face : faces) {
-        file << "3 " << face[0] << " " << face[1] << " " << face[2] << "\n";
-    }
-}
-
-void exportToStl(const DepthMap& depthMap, const std::string& filename) {
-    std::ofstream file(filename);
-    if (!file) {
-        throw std::runtime_error("Unable to open file");
-    }
-
-    file << "solid depthmap\n";
-
-    for (int y = 0; y < depthMap.height - 1; ++y) {
-        for (int x = 0; x < depthMap.width - 1; ++x) {
-            double z1 = depthMap.data[y * depthMap.width + x];
-            double z2 = depthMap.data[y * depthMap.width + (x + 1)];
-            double z3 = depthMap.data[(y + 1) * depthMap.width + x];
-            double z4 = depthMap.data[(y + 1) * depthMap.width + (x + 1)];
-
-            // First triangle
-            file << "facet normal 0 0 0\n";
-            file << "  outer loop\n";
-            file << "    vertex " << x << " " << y << " " << z1 << "\n";
-            file << "    vertex " << x + 1 << " " << y << " " << z2 << "\n";
-            file << "    vertex " << x << " " << y + 1 << " " << z3 << "\n";
-            file << "  endloop\n";
-            file << "endfacet\n";
-
-            // Second triangle
-            file << "facet normal 0 0 0\n";
-            file << "  outer loop\n";
-            file << "    vertex " << x + 1 << " " << y << " " << z2 << "\n";
-            file << "    vertex " << x + 1 << " " << y + 1 << " " << z4 << "\n";
-            file << "    vertex " << x << " " << y + 1 << " " << z3 << "\n";
-            file << "  endloop\n";
-            file << "endfacet\n";
-        }
-    }
-
-    file << "endsolid depthmap\n";
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 }
 
-void exportToVrml(const DepthMap& depthMap, const std::string& filename) {
-    std::ofstream file(filename);
-    if (!file) {
-        throw std::runtime_error("Unable to open file");
-    }
-
-    file << "#VRML V2.0 utf8\n";
-    file << "Shape {\n";
-    file << "  appearance Appearance {\n";
-    file << "    material Material {\n";
-    file << "      diffuseColor 1 0.78 0.39\n"; // Цвет вершин
-    file << "    }\n";
-    file << "  }\n";
-    file << "  geometry IndexedFaceSet {\n";
-    file << "    coord Coordinate {\n";
-    file << "      point [\n";
-
-    for (int y = 0; y < depthMap.height; ++y) {
-        for (int x = 0; x < depthMap.width; ++x) {
-            double z = depthMap.data[y * depthMap.width + x];
-            file << "        " << x << " " << y << " " << z << ",\n";
-        }
-    }
-
-    file << "      ]\n";
-    file << "    }\n";
-    file << "    coordIndex [\n";
-
-    for (int y = 0; y < depthMap.height - 1; ++y) {
-        for (int x = 0; x < depthMap.width - 1; ++x) {
-            int v1 = y * depthMap.width + x;
-            int v2 = y * depthMap.width + (x + 1);
-            int v3 = (y + 1) * depthMap.width + x;
-            int v4 = (y + 1) * depthMap.width + (x + 1);
-
-            file << "      " << v1 << ", " << v2 << ", " << v3 << ", -1,\n";
-            file << "      " << v2 << ", " << v4 << ", " << v3 << ", -1,\n";
-        }
-    }
-
-    file << "    ]\n";
-    file << "  }\n";
-    file << "}\n";
-}
-std::ostream& operator<<(std::ostream& os, const DepthMap& p) {
-    return os << p.width << " " << p.height << std::endl;
+std::ostream& operator<<(std::ostream& os, const AnyDepthMap& p) {
+    return os << p.width() << " " << p.height() << std::endl;
 }
 
 GLFWwindow* initializeGLFW(int width, int height, const char* title) {
@@ -604,93 +467,6 @@ void getShaderSource(const std::string& shaderType, const char*& vertexShader, c
     }
 }
 
-void generateDepthMapVertices(const DepthMap& depthMap, std::vector<float>& vertices, float scale, float maxDepth = 500.0f) {
-
-    float minZ = std::numeric_limits<float>::max();
-    float maxZ = std::numeric_limits<float>::lowest(); 
-    for (int y = 0; y < depthMap.height - 1; ++y) {
-        for (int x = 0; x < depthMap.width - 1; ++x) {
-            float z1 = depthMap.data[y * depthMap.width + x] / maxDepth;
-            float z2 = depthMap.data[y * depthMap.width + x + 1] / maxDepth;
-            float z3 = depthMap.data[(y + 1) * depthMap.width + x] / maxDepth;
-            float z4 = depthMap.data[(y + 1) * depthMap.width + x + 1] / maxDepth;
-
-
-            // Обновление минимального и максимального значений
-            if (z1 != 0) {
-                minZ = std::min(minZ, z1);
-                maxZ = std::max(maxZ, z1);
-            }
-            if (z2 != 0) {
-                minZ = std::min(minZ, z2);
-                maxZ = std::max(maxZ, z2);
-            }
-            if (z3 != 0) {
-                minZ = std::min(minZ, z3);
-                maxZ = std::max(maxZ, z3);
-            }
-            if (z4 != 0) {
-                minZ = std::min(minZ, z4);
-                maxZ = std::max(maxZ, z4);
-            }
-
-
-            if (z1 != 0 && z2 != 0 && z3 != 0) {
-                vertices.push_back(x * scale); vertices.push_back(y * scale); vertices.push_back(z1);
-                vertices.push_back((x + 1) * scale); vertices.push_back(y * scale); vertices.push_back(z2);
-                vertices.push_back(x * scale); vertices.push_back((y + 1) * scale); vertices.push_back(z3);
-            }
-            if (z4 != 0 && z2 != 0 && z3 != 0) {
-                vertices.push_back(x * scale); vertices.push_back((y + 1) * scale); vertices.push_back(z3);
-                vertices.push_back((x + 1) * scale); vertices.push_back(y * scale); vertices.push_back(z2);
-                vertices.push_back((x + 1) * scale); vertices.push_back((y + 1) * scale); vertices.push_back(z4);
-            }
-        }
-    }
-    std::cout << minZ << std::endl;//Требуется для понимания разности глубины и корекции параметров в шейдере
-    std::cout << maxZ << std::endl;
-}
-
-void generateNormals(const std::vector<float>& vertices, std::vector<float>& normals) {
-    for (size_t i = 0; i < vertices.size(); i += 9) {
-        glm::vec3 v1(vertices[i], vertices[i + 1], vertices[i + 2]);
-        glm::vec3 v2(vertices[i + 3], vertices[i + 4], vertices[i + 5]);
-        glm::vec3 v3(vertices[i + 6], vertices[i + 7], vertices[i + 8]);
-
-        glm::vec3 edge1 = v2 - v1;
-        glm::vec3 edge2 = v3 - v1;
-        glm::vec3 normal = glm::normalize(glm::cross(edge1, edge2));
-
-        for (int j = 0; j < 3; ++j) {
-            normals.push_back(normal.x);
-            normals.push_back(normal.y);
-            normals.push_back(normal.z);
-        }
-    }
-}
-
-void setupBuffers(const std::vector<float>& vertices, const std::vector<float>& normals, GLuint& VAO, GLuint& VBO, GLuint& NBO) {
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &NBO);
-
-    glBindVertexArray(VAO);
-
-    // Вершины
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(0);
-
-    // Нормали
-    glBindBuffer(GL_ARRAY_BUFFER, NBO);
-    glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(float), normals.data(), GL_STATIC_DRAW);
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-    glEnableVertexAttribArray(1);
-
-    glBindVertexArray(0);
-}
-
 GLuint loadShader(const char* shaderSource, GLenum shaderType) {
     GLuint shader = glCreateShader(shaderType);
     glShaderSource(shader, 1, &shaderSource, nullptr);
@@ -706,10 +482,25 @@ GLuint loadShader(const char* shaderSource, GLenum shaderType) {
     return shader;
 }
 
+// Блок Scene и, для вершинного шейдера, функции входа вершины — сразу после строки #version
+std::string withSceneBlock(const char* source, const char* vertexInput = "") {
+    std::string text = source;
+    size_t version = text.find("#version");
+    size_t lineEnd = version == std::string::npos ? std::string::npos : text.find('\n', version);
+    if (lineEnd == std::string::npos) {
+        throw std::runtime_error("Shader source has no #version line");
+    }
+    text.insert(lineEnd + 1, std::string(sceneUniformBlock) + vertexInput);
+    return text;
+}
+
 // Функция создания шейдеров
-GLuint createShaderProgram(const char* vertexSource, const char* fragmentSource) {
-    GLuint vertexShader = loadShader(vertexSource, GL_VERTEX_SHADER);
-    GLuint fragmentShader = loadShader(fragmentSource, GL_FRAGMENT_SHADER);
+GLuint createShaderProgram(const char* vertexSource, const char* fragmentSource, const char* vertexInput) {
+    TRACE_ZONE("createShaderProgram");
+    std::string vertexText = withSceneBlock(vertexSource, vertexInput);
+    std::string fragmentText = withSceneBlock(fragmentSource);
+    GLuint vertexShader = loadShader(vertexText.c_str(), GL_VERTEX_SHADER);
+    GLuint fragmentShader = loadShader(fragmentText.c_str(), GL_FRAGMENT_SHADER);
 
     GLuint shaderProgram = glCreateProgram();
     glAttachShader(shaderProgram, vertexShader);
@@ -719,33 +510,132 @@ GLuint createShaderProgram(const char* vertexSource, const char* fragmentSource)
     glDeleteShader(vertexShader);
     glDeleteShader(fragmentShader);
 
+    // Блок Scene связывается с буфером один раз при создании программы
+    GLuint sceneIndex = glGetUniformBlockIndex(shaderProgram, "Scene");
+    if (sceneIndex != GL_INVALID_INDEX) {
+        glUniformBlockBinding(shaderProgram, sceneIndex, sceneBinding);
+    }
+    // Текстура карты высот всегда на блоке 0
+    GLint heights = glGetUniformLocation(shaderProgram, "heights");
+    if (heights >= 0) {
+        glUseProgram(shaderProgram);
+        glUniform1i(heights, 0);
+        glUseProgram(0);
+    }
+
     return shaderProgram;
 }
 
-void setTransformationMatrices(GLuint shaderProgram, const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection, glm::vec3& cameraPosition, glm::vec3& lightPosition) {
-    GLuint modelLoc = glGetUniformLocation(shaderProgram, "model");
-    GLuint viewLoc = glGetUniformLocation(shaderProgram, "view");
-    GLuint projectionLoc = glGetUniformLocation(shaderProgram, "projection");
-
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+// Диапазон глубины для шейдеров в единицах сетки (глубина / maxDepth)
+glm::vec2 depthRangeUniform(const DepthStatistics& stats, float maxDepth) {
+    return glm::vec2(stats.percentile(2.0) / maxDepth, stats.percentile(98.0) / maxDepth);
+}
 
-    // Передача позиции камеры
-    glUniform3fv(glGetUniformLocation(shaderProgram, "viewPos"), 1, glm::value_ptr(cameraPosition));
+SceneUniforms makeSceneUniforms(const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection,
+    const glm::vec3& cameraPosition, const glm::vec3& lightPosition, const glm::vec2& depthRange, float gridStep) {
+    SceneUniforms scene;
+    scene.model = model;
+    scene.view = view;
+    scene.projection = projection;
+    scene.viewPos = glm::vec4(cameraPosition, 1.0f);
+    scene.lightPos = glm::vec4(lightPosition, 1.0f);
+    scene.lightColor = glm::vec4(0.64f, 0.57f, 0.88f, 1.0f);
+    scene.objectColor = glm::vec4(0.88f, 0.71f, 0.53f, 1.0f);
+    scene.depthRange = depthRange;
+    scene.gridStep = gridStep;
+    scene.heightScale = 1.0f;
+    return scene;
+}
 
+int main(int argc, char** argv) {
+    try {
+        Config config = loadConfig(argc, argv);  // Чтение конфигурации из JSON файла и командной строки
+        TraceSession trace(config.traceFile);  // Файл пишется при выходе из main
+
+        ExportOptions exportOptions;
+        exportOptions.binary = config.exportEncoding == "binary";
+        exportOptions.normals = config.exportNormals;
+        exportOptions.threads = config.threads;
+        exportOptions.maxError = config.maxError;
+        exportOptions.level = config.meshLevel;
+        exportOptions.camera = config.camera;
+
+        DepthFilterOptions filterOptions;
+        filterOptions.medianPasses = config.medianPasses;
+        filterOptions.holeFillIterations = config.holeFillIterations;
+        filterOptions.bilateralSigmaSpace = config.bilateralSigmaSpace;
+        filterOptions.bilateralSigmaDepth = config.bilateralSigmaDepth;
+        filterOptions.threads = config.threads;
+
+        // Конвертация между .dat и сжатым .dmt
+        if (!config.convertOutput.empty()) {
+            ConvertJob job;
+            job.inputFile = config.depthMapFile;
+            job.outputFile = config.convertOutput;
+            job.loadOptions.depthScale = config.depthScale;
+            job.tiledOptions.maxError = config.quantizeError;
+            job.tiledOptions.threads = config.threads;
+            printExportReport(runConversion(job));
+            return 0;
+        }
 
-    glUniform3f(glGetUniformLocation(shaderProgram, "lightPos"), lightPosition.x, lightPosition.y, lightPosition.z);
-    glUniform3f(glGetUniformLocation(shaderProgram, "lightColor"), 0.64f, 0.57f, 0.88f);
-    glUniform3f(glGetUniformLocation(shaderProgram, "objectColor"), 0.88f, 0.71f, 0.53f);
+        // Изображение без окна и GPU
+        if (!config.renderOutput.empty()) {
+            RenderJob job;
+            job.inputFile = config.depthMapFile;
+            job.outputFile = config.renderOutput;
+            job.loadOptions.depthScale = config.depthScale;
+            if (!config.reflectionModel.empty()) {
+                job.reflectionModel = config.reflectionModel;
+            }
+            job.width = config.renderWidth;
+            job.height = config.renderHeight;
+            job.maxError = config.maxError;
+            job.loadOptions.pyramidLevels = config.meshLevel;
+            job.filterOptions = filterOptions;
+            job.level = config.meshLevel;
+            job.camera = config.camera;
+            job.threads = config.threads;
+            job.repeat = config.renderRepeat;
+            printExportReport(runHeadlessRender(job));
+            return 0;
+        }
 
-}
+        // Без окна: только загрузка и экспорт
+        if (config.headless) {
+            ExportJob job;
+            job.inputFile = config.depthMapFile;
+            job.outputFile = config.outputFile;
+            job.outputFormat = config.outputFormat;
+            job.loadOptions.depthScale = config.depthScale;
+            job.loadOptions.pyramidLevels = config.meshLevel;
+            job.filterOptions = filterOptions;
+            job.exportOptions = exportOptions;
+            job.streaming = config.streaming;
+            job.memoryBudget = static_cast<size_t>(config.memoryBudgetMB) << 20;
+            printExportReport(runHeadlessExport(job));
+            return 0;
+        }
 
-int main() {
-    try {
-        Config config = readConfig("config.json");  // Чтение конфигурации из JSON файла
+        // Облако точек камеры строится по одной карте и рисуется одним вызовом
+        bool sensor = config.camera.valid();
+        if (sensor && (!config.sequence.empty() || config.heightField)) {
+            throw std::runtime_error("Camera back-projection is not supported for frame sequences or the height field");
+        }
 
-        DepthMap depthMap = readDepthMap(config.depthMapFile);
+        DepthLoadOptions loadOptions;
+        loadOptions.depthScale = config.depthScale;
+        // Последовательность кадров вместо одной карты
+        std::unique_ptr<FrameSequence> sequence;
+        if (!config.sequence.empty()) {
+            sequence.reset(new FrameSequence(config.sequence, loadOptions));
+        }
+        // Фильтры — до пирамиды и сетки, для последовательности — на каждом кадре
+        AnyDepthMap depthMap = filterDepthMap(sequence ? sequence->next() : readDepthMap(config.depthMapFile, loadOptions),
+            filterOptions);
+        if (!sequence && config.meshLevel > 0) {
+            depthMap.setPyramid(buildDepthPyramid(depthMap, config.meshLevel, config.threads));
+        }
 
         glm::vec3 lightPosition = glm::vec3(200.0f, 200.0f, 200.0f);//glm::vec3(config.lightPosition.x, config.lightPosition.y, config.lightPosition.z);
         glm::vec3 cameraPosition = glm::vec3(100.0f, 100.0f, 60.0f);//glm::vec3(config.observerPosition.x, config.observerPosition.y, config.observerPosition.z);
@@ -754,61 +644,275 @@ int main() {
         const char* fragmentShader;
         getShaderSource(config.reflectionModel, vertexShader, fragmentShader);
 
-        GLFWwindow* window = initializeGLFW(1200, 1200, "Depth Map Visualization");
+        const int windowSize = 1200;
+        const float fieldOfView = glm::radians(45.0f);
+        GLFWwindow* window = initializeGLFW(windowSize, windowSize, "Depth Map Visualization");
         if (!window) return -1;
 
-        std::vector<float> vertices;
         float scale = 0.2f;
-        generateDepthMapVertices(depthMap, vertices, scale);
-
-        std::vector<float> normals;
-        generateNormals(vertices, normals);
-
-        GLuint VAO, VBO, NBO;
-        setupBuffers(vertices, normals, VAO, VBO, NBO);
+        // Предпросмотр одной карты по уровню пирамиды: отсчётов в 4^level раз меньше, шаг сетки в 2^level раз больше
+        size_t level = sequence ? 0 : config.meshLevel;
+        AnyDepthMap preview = depthMap.level(level);
+        float gridStep = scale * static_cast<float>(size_t(1) << level);
+        // Тайлы с уровнями детализации; адаптивная сетка и карта высот рисуются одним вызовом
+        TerrainLod terrain;
+        std::unique_ptr<SequenceMesh> sequenceMesh;
+        std::unique_ptr<HeightFieldRenderer> heightField;
+        if (sensor) {
+            PointCloud cloud;
+            backProjectDepthMap(depthMap, config.camera, cloud, level, config.threads);
+            computePointCloudNormals(cloud, config.threads);
+            SampleMesh sampleMesh;
+            if (config.maxError > 0) {
+                buildAdaptiveMesh(preview, config.maxError, sampleMesh);
+            }
+            else {
+                buildPointCloudMesh(cloud, sampleMesh, config.threads);
+            }
+            buildPointCloudGridMesh(cloud, sampleMesh, terrain.mesh);
+            std::cout << sampleMesh.triangleCount() << " triangles" << std::endl;
+        }
+        else if (config.heightField) {
+            heightField.reset(new HeightFieldRenderer(preview, 500.0f, config.threads));
+        }
+        else if (sequence) {
+            sequenceMesh.reset(new SequenceMesh(depthMap.width(), depthMap.height(), scale, 500.0f, config.lodTileSize));
+            sequenceMesh->update(depthMap, config.threads);
+        }
+        else if (config.maxError > 0) {
+            SampleMesh adaptive;
+            buildAdaptiveMesh(preview, config.maxError, adaptive);
+            buildSampleGridMesh(preview, adaptive, terrain.mesh, gridStep);
+            std::cout << adaptive.triangleCount() << " triangles" << std::endl;
+        }
+        else {
+            buildTerrainLod(preview, terrain, gridStep, 500.0f, config.lodTileSize, config.threads);
+        }
+        const GridMesh& mesh = terrain.mesh;
+        // Диапазон глубины для шейдеров берётся из статистики карты, а не подбирается вручную
+        DepthStatistics depthStats = computeDepthStatistics(depthMap, 0, config.threads);
+        std::cout << "depth: " << depthStats.validCount << " of " << depthStats.sampleCount << " samples, "
+            << depthStats.minDepth << " - " << depthStats.maxDepth << ", 2-98% " << depthStats.percentile(2.0)
+            << " - " << depthStats.percentile(98.0) << std::endl;
+
+        GLuint VAO = 0, VBO = 0, EBO = 0;
+        if (!heightField) {
+            setupGridBuffers(mesh, VAO, VBO, EBO);
+        }
+        std::unique_ptr<SequenceRenderer> sequenceRenderer;
+        if (sequenceMesh) {
+            sequenceRenderer.reset(new SequenceRenderer(*sequenceMesh));
+        }
+        GLenum indexType = mesh.wideIndices() ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
 
-        GLuint shaderProgram = createShaderProgram(vertexShader, fragmentShader);
-        //glm::vec3 viewPosition = glm::vec3(depthMap.width * scale / 2.0f, depthMap.height * scale / 2.0f, 150.0f);
+        GLuint shaderProgram = createShaderProgram(vertexShader, fragmentShader,
+            heightField ? heightFieldVertexInput : meshVertexInput);
+        //glm::vec3 viewPosition = glm::vec3(depthMap.width() * scale / 2.0f, depthMap.height() * scale / 2.0f, 150.0f);
         glm::mat4 model = glm::mat4(1.0f);
         glm::mat4 view = glm::lookAt(
             cameraPosition,
-            glm::vec3(depthMap.width * scale / 2.0f, depthMap.height * scale / 2.0f, 0.0f),
+            glm::vec3(depthMap.width() * scale / 2.0f, depthMap.height() * scale / 2.0f, 0.0f),
             glm::vec3(0.0f, -1.0f, 0.0f)
         );
-        glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)depthMap.width / (float)depthMap.height, 0.1f, 1000.0f);
+        glm::mat4 projection = glm::perspective(fieldOfView, (float)depthMap.width() / (float)depthMap.height(), 0.1f, 1000.0f);
+        // z облака — глубина в единицах карты, сетки — глубина / 500
+        float depthUnit = 500.0f;
+        if (sensor) {
+            RenderCamera camera = sensorCamera(config.camera, depthMap.width(), depthMap.height(),
+                depthStats.minDepth, depthStats.maxDepth);
+            view = glm::make_mat4(camera.view);
+            projection = glm::make_mat4(camera.projection);
+            cameraPosition = glm::make_vec3(camera.viewPosition);
+            lightPosition = glm::make_vec3(camera.lightPosition);
+            depthUnit = 1.0f;
+        }
+
+        Frustum frustum = Frustum::fromMatrix(glm::value_ptr(projection * view * model));
+        float pixelsPerUnit = windowSize / (2.0f * std::tan(fieldOfView / 2.0f));
+        size_t indexSize = mesh.wideIndices() ? sizeof(uint32_t) : sizeof(uint16_t);
+        std::vector<TileDraw> draws;
+        RenderStats stats;
+
+        // Общие uniform-значения: буфер заполняется сразу, дальше — только при изменении сцены
+        SceneUniforms scene = makeSceneUniforms(model, view, projection, cameraPosition, lightPosition,
+            depthRangeUniform(depthStats, depthUnit), gridStep);
+        if (heightField) {
+            scene.heightScale = heightField->heightScale();
+        }
+        GLuint sceneBuffer;
+        glGenBuffers(1, &sceneBuffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, sceneBuffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(SceneUniforms), &scene, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, sceneBinding, sceneBuffer);
+        bool sceneChanged = false;
+
+        // Окно перерисовывается только по событию: открытие, изменение размера, новый кадр данных
+        bool redraw = true;
+        glfwSetWindowUserPointer(window, &redraw);
+        glfwSetWindowRefreshCallback(window, [](GLFWwindow* target) {
+            *static_cast<bool*>(glfwGetWindowUserPointer(target)) = true;
+        });
+        glfwSetFramebufferSizeCallback(window, [](GLFWwindow* target, int width, int height) {
+            glViewport(0, 0, width, height);
+            *static_cast<bool*>(glfwGetWindowUserPointer(target)) = true;
+        });
+
+        double statsStart = glfwGetTime();
+        double cpuStart = processCpuSeconds();
+        double frameTime = 0.0;
+        int frames = 0;
+        double framePeriod = 1.0 / (config.sequenceFps > 0 ? config.sequenceFps : 30.0f);
+        double nextSequenceFrame = glfwGetTime() + framePeriod;
+        size_t sequenceFrames = 0;
+        size_t dirtyTiles = 0;
+        size_t uploadedBytes = 0;
+        size_t totalFrames = 0;
+        size_t totalDirtyTiles = 0;
+        size_t totalUploadedBytes = 0;
+        double sequenceStart = glfwGetTime();
 
         while (!glfwWindowShouldClose(window)) {
-            glClearColor(0.4, 0.4f, 0.4f, 1.0f);
-            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            if (sequence) {
+                // Новый кадр по расписанию; если загрузка не успевает, кадры не копятся
+                double now = glfwGetTime();
+                if (now >= nextSequenceFrame) {
+                    depthMap = filterDepthMap(sequence->next(), filterOptions);
+                    if (heightField) {
+                        uploadedBytes += heightField->upload(depthMap);
+                        scene.heightScale = heightField->heightScale();
+                    }
+                    else {
+                        dirtyTiles += sequenceMesh->update(depthMap, config.threads);
+                    }
+                    // Для окраски нужны только процентили, гистограмма кадра не строится
+                    scene.depthRange = depthRangeUniform(computeDepthStatistics(depthMap, 0, config.threads), 500.0f);
+                    sceneChanged = true;
+                    ++sequenceFrames;
+                    nextSequenceFrame = std::max(nextSequenceFrame + framePeriod, now);
+                    redraw = true;
+                }
+            }
 
-            glUseProgram(shaderProgram);
-            setTransformationMatrices(shaderProgram, model, view, projection, cameraPosition, lightPosition);
+            if (redraw) {
+                TRACE_ZONE("frame");
+                redraw = false;
+                double frameStart = glfwGetTime();
+                glClearColor(0.4, 0.4f, 0.4f, 1.0f);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+                glUseProgram(shaderProgram);
+                if (sceneChanged) {
+                    glBindBuffer(GL_UNIFORM_BUFFER, sceneBuffer);
+                    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(SceneUniforms), &scene);
+                    sceneChanged = false;
+                }
+
+                if (heightField) {
+                    draws.clear();
+                    stats = RenderStats();
+                    stats.drawCalls = 1;
+                    stats.triangles = heightField->triangleCount();
+                }
+                else if (sequenceMesh) {
+                    uploadedBytes += sequenceRenderer->upload(*sequenceMesh);
+                    sequenceRenderer->draw(*sequenceMesh);
+                    stats = RenderStats();
+                    stats.drawCalls = 1;
+                    for (uint32_t count : sequenceMesh->indexCounts()) {
+                        stats.triangles += count / 3;
+                    }
+                    draws.clear();
+                }
+                else if (terrain.tiles.empty()) {
+                    draws.assign(1, { 0, mesh.indexCount() });
+                    stats = RenderStats();
+                    stats.drawCalls = 1;
+                    stats.triangles = mesh.indexCount() / 3;
+                }
+                else {
+                    selectTerrainTiles(terrain, frustum, glm::value_ptr(cameraPosition), pixelsPerUnit, config.lodPixelError, draws, stats);
+                }
+
+                {
+                    TRACE_ZONE("draw");
+                    if (heightField) {
+                        heightField->draw();
+                    }
+                    glBindVertexArray(VAO);
+                    for (const TileDraw& draw : draws) {
+                        glDrawElements(GL_TRIANGLES, (GLsizei)draw.indexCount, indexType, (void*)(draw.firstIndex * indexSize));
+                    }
+                }
+
+                {
+                    TRACE_ZONE("swap buffers");
+                    glfwSwapBuffers(window);
+                }
+                frameTime += glfwGetTime() - frameStart;
+                ++frames;
+            }
 
-            glBindVertexArray(VAO);
-            glDrawArrays(GL_TRIANGLES, 0, vertices.size() / 3);
+            // Ожидание событий до следующего кадра последовательности или обновления заголовка
+            double wakeUp = statsStart + 0.5;
+            if (sequence) {
+                wakeUp = std::min(wakeUp, nextSequenceFrame);
+            }
+            double timeout = wakeUp - glfwGetTime();
+            if (timeout > 0) {
+                glfwWaitEventsTimeout(timeout);
+            }
+            else {
+                glfwPollEvents();
+            }
 
-            glfwSwapBuffers(window);
-            glfwPollEvents();
+            // Статистика в заголовке окна, усреднённая за полсекунды
+            if (glfwGetTime() - statsStart >= 0.5) {
+                double elapsed = glfwGetTime() - statsStart;
+                double cpu = processCpuSeconds();
+                std::ostringstream title;
+                title << "Depth Map Visualization | " << stats.drawCalls << " draws, " << stats.triangles << " triangles, "
+                    << stats.culledTiles << " culled, " << (frames ? frameTime * 1000.0 / frames : 0.0) << " ms, "
+                    << frames / elapsed << " redraws/s, CPU " << static_cast<int>((cpu - cpuStart) / elapsed * 100.0 + 0.5) << "%";
+                if (sequence) {
+                    title << " | " << sequenceFrames / elapsed << " frames/s, ";
+                    if (sequenceMesh) {
+                        title << (sequenceFrames ? dirtyTiles / sequenceFrames : 0) << "/" << sequenceMesh->tileCount() << " tiles, ";
+                    }
+                    title << uploadedBytes / elapsed / (1024.0 * 1024.0) << " MB/s";
+                }
+                glfwSetWindowTitle(window, title.str().c_str());
+                statsStart = glfwGetTime();
+                cpuStart = cpu;
+                frameTime = 0.0;
+                frames = 0;
+                totalFrames += sequenceFrames;
+                totalDirtyTiles += dirtyTiles;
+                totalUploadedBytes += uploadedBytes;
+                sequenceFrames = 0;
+                dirtyTiles = 0;
+                uploadedBytes = 0;
+            }
         }
 
+        if (sequence && totalFrames > 0) {
+            double elapsed = glfwGetTime() - sequenceStart;
+            std::cout << "sequence: " << totalFrames << " frames, " << totalFrames / elapsed << " frames/s sustained, ";
+            if (sequenceMesh) {
+                std::cout << totalDirtyTiles / totalFrames << " tiles and ";
+            }
+            std::cout << totalUploadedBytes / totalFrames / 1024 << " KB uploaded per frame" << std::endl;
+        }
+        sequenceRenderer.reset();
+        heightField.reset();
         glDeleteVertexArrays(1, &VAO);
         glDeleteBuffers(1, &VBO);
-        glDeleteBuffers(1, &NBO);
+        glDeleteBuffers(1, &EBO);
+        glDeleteBuffers(1, &sceneBuffer);
         glDeleteProgram(shaderProgram);
 
         glfwTerminate();
-        if (config.outputFormat == "ply") {
-            exportToPly(depthMap, config.outputFile + ".ply");
-        }
-        else if (config.outputFormat == "stl") {
-            exportToStl(depthMap, config.outputFile + ".stl");
-        }
-        else if (config.outputFormat == "vrml") {
-            exportToVrml(depthMap, config.outputFile + ".vrml");
-        }
-        else {
-            throw std::runtime_error("Unsupported output format: " + config.outputFormat);
-        }
+        exportOptions.level = level;
+        exportDepthMap(depthMap, config.outputFormat, config.outputFile, exportOptions);
         return 0;
     }
     catch (const std::exception& e) {
@@ -0,0 +1,86 @@
+﻿#ifndef BINARY_WRITER_H
+#define BINARY_WRITER_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+// Буфер фиксированного размера поверх ofstream для двоичной записи
+class BufferedWriter {
+public:
+    explicit BufferedWriter(std::ofstream& output, size_t capacity = 1 << 20)
+        : file(output), buffer(capacity), used(0) {
+    }
+    ~BufferedWriter() {
+        flush();
+    }
+
+    template <typename T>
+    void put(T value) {
+        if (used + sizeof(T) > buffer.size()) {
+            flush();
+        }
+        std::memcpy(buffer.data() + used, &value, sizeof(T));
+        used += sizeof(T);
+    }
+
+    void write(const void* data, size_t size) {
+        if (used + size > buffer.size()) {
+            flush();
+        }
+        if (size > buffer.size()) {
+            file.write(static_cast<const char*>(data), size);
+            return;
+        }
+        std::memcpy(buffer.data() + used, data, size);
+        used += size;
+    }
+
+    void flush() {
+        if (used > 0) {
+            file.write(reinterpret_cast<const char*>(buffer.data()), used);
+            used = 0;
+        }
+    }
+
+private:
+    std::ofstream& file;
+    std::vector<unsigned char> buffer;
+    size_t used;
+};
+
+inline bool isLittleEndianHost() {
+    const uint16_t probe = 1;
+    unsigned char first;
+    std::memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+// Запись треугольника двоичного STL: нормаль, три вершины, атрибут (50 байт)
+inline unsigned char* putStlFacet(unsigned char* out, const float v1[3], const float v2[3], const float v3[3]) {
+    float e1[3] = { v2[0] - v1[0], v2[1] - v1[1], v2[2] - v1[2] };
+    float e2[3] = { v3[0] - v1[0], v3[1] - v1[1], v3[2] - v1[2] };
+    float n[3] = {
+        e1[1] * e2[2] - e1[2] * e2[1],
+        e1[2] * e2[0] - e1[0] * e2[2],
+        e1[0] * e2[1] - e1[1] * e2[0]
+    };
+    float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (length > 0) {
+        n[0] /= length;
+        n[1] /= length;
+        n[2] /= length;
+    }
+    std::memcpy(out, n, 12);
+    std::memcpy(out + 12, v1, 12);
+    std::memcpy(out + 24, v2, 12);
+    std::memcpy(out + 36, v3, 12);
+    out[48] = 0;
+    out[49] = 0;
+    return out + 50;
+}
+
+#endif // BINARY_WRITER_H
@@ -0,0 +1,352 @@
+﻿#include "camera_projection.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include "parallel.h"
+#include "trace.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define CAMERA_PROJECTION_X86 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+size_t bandCount(size_t rows, unsigned threads) {
+    return std::max<size_t>(1, std::min<size_t>(rows, static_cast<size_t>(threads) * 4));
+}
+
+// Обратная дисторсия нормированной точки (xd, yd) неподвижными итерациями, как cv::undistortPoints
+void undistortPoint(const CameraIntrinsics& camera, double xd, double yd, float& rayX, float& rayY) {
+    double x = xd;
+    double y = yd;
+    for (int i = 0; i < 20; ++i) {
+        double r2 = x * x + y * y;
+        double radial = 1.0 + ((camera.k3 * r2 + camera.k2) * r2 + camera.k1) * r2;
+        double dx = 2.0 * camera.p1 * x * y + camera.p2 * (r2 + 2.0 * x * x);
+        double dy = camera.p1 * (r2 + 2.0 * y * y) + 2.0 * camera.p2 * x * y;
+        x = (xd - dx) / radial;
+        y = (yd - dy) / radial;
+    }
+    rayX = static_cast<float>(x);
+    rayY = static_cast<float>(y);
+}
+
+// Скалярная проекция отсчётов [begin, end) строки; ею же обрабатывается хвост строки.
+// Table: луч ry у каждого отсчёта свой (rayY), иначе один на строку (rowRayY).
+template <typename T, bool Table>
+void projectRange(const T* depth, size_t begin, size_t end, float depthScale, const float* rayX, const float* rayY,
+    float rowRayY, float* outX, float* outY, float* outZ) {
+    for (size_t x = begin; x < end; ++x) {
+        float z = static_cast<float>(sampleDepth(depth[x], depthScale));
+        z = z != 0 && z == z ? z : 0.0f;
+        outX[x] = z * rayX[x];
+        outY[x] = z * (Table ? rayY[x] : rowRayY);
+        outZ[x] = z;
+    }
+}
+
+#ifdef CAMERA_PROJECTION_X86
+
+// Четыре отсчёта во float, uint16 — сразу умноженные на масштаб
+inline __m128 loadDepth(const double* p, __m128) {
+    return _mm_movelh_ps(_mm_cvtpd_ps(_mm_loadu_pd(p)), _mm_cvtpd_ps(_mm_loadu_pd(p + 2)));
+}
+inline __m128 loadDepth(const float* p, __m128) {
+    return _mm_loadu_ps(p);
+}
+inline __m128 loadDepth(const uint16_t* p, __m128 depthScale) {
+    __m128i samples = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(p));
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(samples, _mm_setzero_si128())), depthScale);
+}
+
+template <typename T, bool Table>
+void projectRow(const T* depth, size_t width, float depthScale, const float* rayX, const float* rayY,
+    float rowRayY, float* outX, float* outY, float* outZ) {
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 scale = _mm_set1_ps(depthScale);
+    const __m128 rowY = _mm_set1_ps(rowRayY);
+
+    size_t x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128 z = loadDepth(depth + x, scale);
+        __m128 valid = _mm_and_ps(_mm_cmpneq_ps(z, zero), _mm_cmpord_ps(z, z));
+        z = _mm_and_ps(z, valid);
+        __m128 ry = Table ? _mm_loadu_ps(rayY + x) : rowY;
+        _mm_storeu_ps(outX + x, _mm_mul_ps(z, _mm_loadu_ps(rayX + x)));
+        _mm_storeu_ps(outY + x, _mm_mul_ps(z, ry));
+        _mm_storeu_ps(outZ + x, z);
+    }
+    projectRange<T, Table>(depth, x, width, depthScale, rayX, rayY, rowRayY, outX, outY, outZ);
+}
+
+#else
+
+template <typename T, bool Table>
+void projectRow(const T* depth, size_t width, float depthScale, const float* rayX, const float* rayY,
+    float rowRayY, float* outX, float* outY, float* outZ) {
+    projectRange<T, Table>(depth, 0, width, depthScale, rayX, rayY, rowRayY, outX, outY, outZ);
+}
+
+#endif
+
+// Нормаль точки i строки y: векторное произведение разностей по y и по x, направленное к камере
+void normalRow(const PointCloud& cloud, size_t y, float* nx, float* ny, float* nz) {
+    size_t width = cloud.width;
+    const float* px = cloud.x.data();
+    const float* py = cloud.y.data();
+    const float* pz = cloud.z.data();
+    size_t row = y * width;
+    for (size_t x = 0; x < width; ++x) {
+        size_t i = row + x;
+        size_t left = x > 0 && pz[i - 1] != 0 ? i - 1 : i;
+        size_t right = x + 1 < width && pz[i + 1] != 0 ? i + 1 : i;
+        size_t top = y > 0 && pz[i - width] != 0 ? i - width : i;
+        size_t bottom = y + 1 < cloud.height && pz[i + width] != 0 ? i + width : i;
+
+        float ux = px[right] - px[left], uy = py[right] - py[left], uz = pz[right] - pz[left];
+        float vx = px[bottom] - px[top], vy = py[bottom] - py[top], vz = pz[bottom] - pz[top];
+        float normal[3] = { vy * uz - vz * uy, vz * ux - vx * uz, vx * uy - vy * ux };
+        float length2 = normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2];
+        if (pz[i] == 0 || !(length2 > 0)) {
+            nx[x] = 0.0f;
+            ny[x] = 0.0f;
+            nz[x] = -1.0f;
+            continue;
+        }
+        float inverseLength = 1.0f / std::sqrt(length2);
+        nx[x] = normal[0] * inverseLength;
+        ny[x] = normal[1] * inverseLength;
+        nz[x] = normal[2] * inverseLength;
+    }
+}
+
+// Номера вершин строки y облака: непустые точки по порядку с rowStart[y], у пустых — NoVertex
+void vertexRow(const PointCloud& cloud, const std::vector<uint32_t>& rowStart, size_t y, uint32_t* out) {
+    const float* z = cloud.z.data() + y * cloud.width;
+    uint32_t next = rowStart[y];
+    for (size_t x = 0; x < cloud.width; ++x) {
+        out[x] = z[x] != 0 ? next++ : ValidSampleRemap::NoVertex;
+    }
+}
+
+} // namespace
+
+BackProjector::BackProjector(const CameraIntrinsics& cameraIntrinsics, unsigned threadCount)
+    : intrinsics(cameraIntrinsics), threads(workerCount(threadCount)) {
+    if (!intrinsics.valid()) {
+        throw std::runtime_error("Camera intrinsics require positive fx and fy");
+    }
+}
+
+void BackProjector::prepareRays(size_t width, size_t height, size_t step) {
+    if (width == rayWidth && height == rayHeight && step == rayStep) {
+        return;
+    }
+    TRACE_ZONE("BackProjector::prepareRays");
+    // Пиксель полного разрешения под центром отсчёта уровня
+    auto pixel = [step](size_t i) { return static_cast<double>(i * step) + (step - 1) * 0.5; };
+
+    if (!intrinsics.distorted()) {
+        rayX.resize(width);
+        rayY.resize(height);
+        for (size_t x = 0; x < width; ++x) {
+            rayX[x] = static_cast<float>((pixel(x) - intrinsics.cx) / intrinsics.fx);
+        }
+        for (size_t y = 0; y < height; ++y) {
+            rayY[y] = static_cast<float>((pixel(y) - intrinsics.cy) / intrinsics.fy);
+        }
+    }
+    else {
+        rayX.resize(width * height);
+        rayY.resize(width * height);
+        parallelForBands(height, bandCount(height, threads), threads, [&](size_t begin, size_t end, size_t) {
+            for (size_t y = begin; y < end; ++y) {
+                double yd = (pixel(y) - intrinsics.cy) / intrinsics.fy;
+                for (size_t x = 0; x < width; ++x) {
+                    size_t i = y * width + x;
+                    undistortPoint(intrinsics, (pixel(x) - intrinsics.cx) / intrinsics.fx, yd, rayX[i], rayY[i]);
+                }
+            }
+        });
+    }
+    rayWidth = width;
+    rayHeight = height;
+    rayStep = step;
+}
+
+void BackProjector::project(const AnyDepthMap& depthMap, size_t level, PointCloud& cloud) {
+    TRACE_ZONE("BackProjector::project");
+    AnyDepthMap source = depthMap.level(level);
+    size_t width = source.width();
+    size_t height = source.height();
+    prepareRays(width, height, size_t(1) << level);
+
+    // При том же размере кадра буферы облака не выделяются заново
+    cloud.width = width;
+    cloud.height = height;
+    cloud.x.resize(width * height);
+    cloud.y.resize(width * height);
+    cloud.z.resize(width * height);
+    cloud.nx.clear();
+    cloud.ny.clear();
+    cloud.nz.clear();
+
+    bool table = intrinsics.distorted();
+    source.visit([&](const auto& typed) {
+        typedef typename std::decay<decltype(typed)>::type::Sample T;
+        const T* data = typed.data.data();
+        float depthScale = typed.depthScale;
+        parallelForBands(height, bandCount(height, threads), threads, [&](size_t begin, size_t end, size_t) {
+            for (size_t y = begin; y < end; ++y) {
+                size_t offset = y * width;
+                if (table) {
+                    projectRow<T, true>(data + offset, width, depthScale, rayX.data() + offset, rayY.data() + offset,
+                        0.0f, cloud.x.data() + offset, cloud.y.data() + offset, cloud.z.data() + offset);
+                }
+                else {
+                    projectRow<T, false>(data + offset, width, depthScale, rayX.data(), nullptr,
+                        rayY[y], cloud.x.data() + offset, cloud.y.data() + offset, cloud.z.data() + offset);
+                }
+            }
+        });
+    });
+}
+
+void backProjectDepthMap(const AnyDepthMap& depthMap, const CameraIntrinsics& intrinsics, PointCloud& cloud,
+    size_t level, unsigned threads) {
+    BackProjector projector(intrinsics, threads);
+    projector.project(depthMap, level, cloud);
+}
+
+void computePointCloudNormals(PointCloud& cloud, unsigned threads) {
+    TRACE_ZONE("computePointCloudNormals");
+    cloud.nx.resize(cloud.size());
+    cloud.ny.resize(cloud.size());
+    cloud.nz.resize(cloud.size());
+    threads = workerCount(threads);
+    parallelForBands(cloud.height, bandCount(cloud.height, threads), threads, [&](size_t begin, size_t end, size_t) {
+        for (size_t y = begin; y < end; ++y) {
+            size_t offset = y * cloud.width;
+            normalRow(cloud, y, cloud.nx.data() + offset, cloud.ny.data() + offset, cloud.nz.data() + offset);
+        }
+    });
+}
+
+void buildPointCloudMesh(const PointCloud& cloud, SampleMesh& mesh, unsigned threads) {
+    TRACE_ZONE("buildPointCloudMesh");
+    if (cloud.size() >= ValidSampleRemap::NoVertex) {
+        throw std::runtime_error("Depth map is too large for 32-bit vertex indices");
+    }
+    size_t width = cloud.width;
+    size_t height = cloud.height;
+    threads = workerCount(threads);
+    size_t bands = bandCount(height, threads);
+
+    // Первый проход: непустые точки строк, затем префиксная сумма по строкам
+    std::vector<uint32_t> rowStart(height + 1, 0);
+    parallelForBands(height, bands, threads, [&](size_t begin, size_t end, size_t) {
+        for (size_t y = begin; y < end; ++y) {
+            const float* z = cloud.z.data() + y * width;
+            uint32_t valid = 0;
+            for (size_t x = 0; x < width; ++x) {
+                valid += z[x] != 0;
+            }
+            rowStart[y + 1] = valid;
+        }
+    });
+    for (size_t y = 0; y < height; ++y) {
+        rowStart[y + 1] += rowStart[y];
+    }
+
+    // Второй проход: номера точек вершин и число треугольников полос строк квадов
+    mesh.samples.resize(rowStart[height]);
+    size_t quadRows = height > 0 ? height - 1 : 0;
+    size_t quadBands = bandCount(quadRows, threads);
+    std::vector<size_t> offsets(quadBands + 1, 0);
+    parallelForBands(height, bands, threads, [&](size_t begin, size_t end, size_t) {
+        for (size_t y = begin; y < end; ++y) {
+            const float* z = cloud.z.data() + y * width;
+            uint32_t* out = mesh.samples.data() + rowStart[y];
+            for (size_t x = 0; x < width; ++x) {
+                if (z[x] != 0) {
+                    *out++ = static_cast<uint32_t>(y * width + x);
+                }
+            }
+        }
+    });
+    mesh.triangles.clear();
+    if (quadRows == 0) {
+        return;
+    }
+    parallelForBands(quadRows, quadBands, threads, [&](size_t begin, size_t end, size_t band) {
+        std::vector<uint32_t> top(width), bottom(width);
+        size_t count = 0;
+        vertexRow(cloud, rowStart, begin, bottom.data());
+        for (size_t y = begin; y < end; ++y) {
+            top.swap(bottom);
+            vertexRow(cloud, rowStart, y + 1, bottom.data());
+            forEachQuadFace(top.data(), bottom.data(), width, QuadDiagonal::TopLeft, [&](uint32_t, uint32_t, uint32_t) { ++count; });
+        }
+        offsets[band + 1] = count;
+    });
+    for (size_t band = 0; band < quadBands; ++band) {
+        offsets[band + 1] += offsets[band];
+    }
+
+    // Третий проход: каждая полоса пишет свои треугольники
+    mesh.triangles.resize(offsets[quadBands] * 3);
+    parallelForBands(quadRows, quadBands, threads, [&](size_t begin, size_t end, size_t band) {
+        std::vector<uint32_t> top(width), bottom(width);
+        uint32_t* out = mesh.triangles.data() + offsets[band] * 3;
+        vertexRow(cloud, rowStart, begin, bottom.data());
+        for (size_t y = begin; y < end; ++y) {
+            top.swap(bottom);
+            vertexRow(cloud, rowStart, y + 1, bottom.data());
+            forEachQuadFace(top.data(), bottom.data(), width, QuadDiagonal::TopLeft, [&](uint32_t v1, uint32_t v2, uint32_t v3) {
+                *out++ = v1;
+                *out++ = v2;
+                *out++ = v3;
+            });
+        }
+    });
+}
+
+void buildPointCloudGridMesh(const PointCloud& cloud, const SampleMesh& sampleMesh, GridMesh& mesh) {
+    TRACE_ZONE("buildPointCloudGridMesh");
+    if (!cloud.hasNormals()) {
+        throw std::runtime_error("Point cloud normals are not computed");
+    }
+    mesh.vertexCount = sampleMesh.samples.size();
+    mesh.vertices.resize(mesh.vertexCount * 6);
+    float minZ = std::numeric_limits<float>::max();
+    float maxZ = std::numeric_limits<float>::lowest();
+    float* out = mesh.vertices.data();
+    for (uint32_t sample : sampleMesh.samples) {
+        out[0] = cloud.x[sample];
+        out[1] = cloud.y[sample];
+        out[2] = cloud.z[sample];
+        out[3] = cloud.nx[sample];
+        out[4] = cloud.ny[sample];
+        out[5] = cloud.nz[sample];
+        minZ = std::min(minZ, out[2]);
+        maxZ = std::max(maxZ, out[2]);
+        out += 6;
+    }
+    mesh.minZ = mesh.vertexCount ? minZ : 0.0f;
+    mesh.maxZ = mesh.vertexCount ? maxZ : 0.0f;
+
+    mesh.indices16.clear();
+    mesh.indices32.clear();
+    if (mesh.vertexCount <= std::numeric_limits<uint16_t>::max()) {
+        mesh.indices16.reserve(sampleMesh.triangles.size());
+        for (uint32_t index : sampleMesh.triangles) {
+            mesh.indices16.push_back(static_cast<uint16_t>(index));
+        }
+    }
+    else {
+        mesh.indices32 = sampleMesh.triangles;
+    }
+}
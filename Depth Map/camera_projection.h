@@ -0,0 +1,81 @@
+﻿#ifndef CAMERA_PROJECTION_H
+#define CAMERA_PROJECTION_H
+
+#include <cstddef>
+#include <vector>
+#include "depth_map.h"
+#include "mesh.h"
+
+// Внутренние параметры камеры-обскуры в пикселях карты полного разрешения
+// и дисторсия Брауна — Конради с коэффициентами k1, k2, p1, p2, k3 (как в OpenCV)
+struct CameraIntrinsics {
+    float fx = 0.0f;
+    float fy = 0.0f;
+    float cx = 0.0f;
+    float cy = 0.0f;
+    float k1 = 0.0f;
+    float k2 = 0.0f;
+    float p1 = 0.0f;
+    float p2 = 0.0f;
+    float k3 = 0.0f;
+
+    bool valid() const { return fx > 0 && fy > 0; }
+    bool distorted() const { return k1 != 0 || k2 != 0 || p1 != 0 || p2 != 0 || k3 != 0; }
+};
+
+// Облако точек в порядке отсчётов карты: точка отсчёта i = y * width + x — (x[i], y[i], z[i])
+// в системе камеры (x вправо, y вниз, z вперёд) в единицах глубины карты. У пропусков
+// (нули и NaN) все координаты 0. Нормали заполняет computePointCloudNormals.
+struct PointCloud {
+    size_t width = 0;
+    size_t height = 0;
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+    std::vector<float> nx;
+    std::vector<float> ny;
+    std::vector<float> nz;
+
+    size_t size() const { return z.size(); }
+    bool hasNormals() const { return nx.size() == z.size(); }
+};
+
+// Обратная проекция кадров одной камеры. Точка — глубина, умноженная на луч отсчёта (rx, ry, 1).
+// Без дисторсии луч линеен по x и y, хранятся строка rx и столбец ry; с дисторсией таблица лучей
+// всех отсчётов считается итерациями обратной дисторсии при первом кадре и переиспользуется,
+// пока не изменятся размер карты или уровень. Строки проецируются полосами в threads потоках,
+// ядро строки на SSE2 (скалярный хвост), так что проход упирается в пропускную способность памяти.
+class BackProjector {
+public:
+    explicit BackProjector(const CameraIntrinsics& intrinsics, unsigned threads = 0);
+
+    // level — уровень пирамиды глубины (AnyDepthMap::level): отсчёт уровня — центр блока 2^level x 2^level
+    void project(const AnyDepthMap& depthMap, size_t level, PointCloud& cloud);
+
+private:
+    void prepareRays(size_t width, size_t height, size_t step);
+
+    CameraIntrinsics intrinsics;
+    unsigned threads;
+    size_t rayWidth = 0;
+    size_t rayHeight = 0;
+    size_t rayStep = 0;
+    std::vector<float> rayX; // width значений или width * height с дисторсией
+    std::vector<float> rayY; // height значений или width * height с дисторсией
+};
+
+void backProjectDepthMap(const AnyDepthMap& depthMap, const CameraIntrinsics& intrinsics, PointCloud& cloud,
+    size_t level = 0, unsigned threads = 0);
+
+// Нормали точек по центральным разностям соседних точек (у края и у пропусков — односторонним),
+// повёрнутые к камере. У точки без соседей — (0, 0, -1).
+void computePointCloudNormals(PointCloud& cloud, unsigned threads = 0);
+
+// Полная сетка облака: вершины — непустые точки по порядку отсчётов, треугольники квадов,
+// у которых есть все три вершины (диагональ как в PLY). Номера отсчётов в samples — номера точек облака.
+void buildPointCloudMesh(const PointCloud& cloud, SampleMesh& mesh, unsigned threads = 0);
+
+// Вершины в формате GridMesh (позиция и нормаль) для отрисовки; нормали облака должны быть посчитаны
+void buildPointCloudGridMesh(const PointCloud& cloud, const SampleMesh& sampleMesh, GridMesh& mesh);
+
+#endif // CAMERA_PROJECTION_H
@@ -1,8 +1,9 @@
-#include "config.h"
+﻿#include "config.h"
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <stdexcept>
+#include <vector>
 
 std::string trim(const std::string& str) {
     size_t first = str.find_first_not_of(' ');
@@ -13,6 +14,21 @@ std::string trim(const std::string& str) {
     return str.substr(first, (last - first + 1));
 }
 
+namespace {
+
+// Числа через запятую: "500,500,320,240"
+std::vector<float> parseFloatList(const std::string& value) {
+    std::vector<float> values;
+    std::istringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        values.push_back(std::stof(item));
+    }
+    return values;
+}
+
+} // namespace
+
 Config readConfig(const std::string& filename) {
     std::ifstream file(filename);
     if (!file) {
@@ -69,6 +85,245 @@ Config readConfig(const std::string& filename) {
         else if (key == "\"outputFormat\"") {
             config.outputFormat = value.substr(1, value.size() - 2); // Remove quotes
         }
+        else if (key == "\"depthScale\"") {
+            config.depthScale = std::stof(value);
+        }
+        else if (key == "\"headless\"") {
+            config.headless = value == "true";
+        }
+        else if (key == "\"exportEncoding\"") {
+            config.exportEncoding = value.substr(1, value.size() - 2); // Remove quotes
+        }
+        else if (key == "\"exportNormals\"") {
+            config.exportNormals = value == "true";
+        }
+        else if (key == "\"threads\"") {
+            config.threads = static_cast<unsigned>(std::stoul(value));
+        }
+        else if (key == "\"maxError\"") {
+            config.maxError = std::stof(value);
+        }
+        else if (key == "\"meshLevel\"") {
+            config.meshLevel = static_cast<unsigned>(std::stoul(value));
+        }
+        else if (key == "\"medianPasses\"") {
+            config.medianPasses = static_cast<unsigned>(std::stoul(value));
+        }
+        else if (key == "\"holeFillIterations\"") {
+            config.holeFillIterations = static_cast<unsigned>(std::stoul(value));
+        }
+        else if (key == "\"bilateralSigmaSpace\"") {
+            config.bilateralSigmaSpace = std::stof(value);
+        }
+        else if (key == "\"bilateralSigmaDepth\"") {
+            config.bilateralSigmaDepth = std::stof(value);
+        }
+        else if (key == "\"camera.fx\"") {
+            config.camera.fx = std::stof(value);
+        }
+        else if (key == "\"camera.fy\"") {
+            config.camera.fy = std::stof(value);
+        }
+        else if (key == "\"camera.cx\"") {
+            config.camera.cx = std::stof(value);
+        }
+        else if (key == "\"camera.cy\"") {
+            config.camera.cy = std::stof(value);
+        }
+        else if (key == "\"camera.k1\"") {
+            config.camera.k1 = std::stof(value);
+        }
+        else if (key == "\"camera.k2\"") {
+            config.camera.k2 = std::stof(value);
+        }
+        else if (key == "\"camera.p1\"") {
+            config.camera.p1 = std::stof(value);
+        }
+        else if (key == "\"camera.p2\"") {
+            config.camera.p2 = std::stof(value);
+        }
+        else if (key == "\"camera.k3\"") {
+            config.camera.k3 = std::stof(value);
+        }
+        else if (key == "\"lodTileSize\"") {
+            config.lodTileSize = static_cast<unsigned>(std::stoul(value));
+        }
+        else if (key == "\"lodPixelError\"") {
+            config.lodPixelError = std::stof(value);
+        }
+        else if (key == "\"streaming\"") {
+            config.streaming = value == "true";
+        }
+        else if (key == "\"memoryBudgetMB\"") {
+            config.memoryBudgetMB = static_cast<unsigned>(std::stoul(value));
+        }
+        else if (key == "\"quantizeError\"") {
+            config.quantizeError = std::stof(value);
+        }
+        else if (key == "\"sequence\"") {
+            config.sequence = value.substr(1, value.size() - 2); // Remove quotes
+        }
+        else if (key == "\"sequenceFps\"") {
+            config.sequenceFps = std::stof(value);
+        }
+        else if (key == "\"heightField\"") {
+            config.heightField = value == "true";
+        }
+        else if (key == "\"renderOutput\"") {
+            config.renderOutput = value.substr(1, value.size() - 2); // Remove quotes
+        }
+        else if (key == "\"renderWidth\"") {
+            config.renderWidth = static_cast<unsigned>(std::stoul(value));
+        }
+        else if (key == "\"renderHeight\"") {
+            config.renderHeight = static_cast<unsigned>(std::stoul(value));
+        }
+        else if (key == "\"traceFile\"") {
+            config.traceFile = value.substr(1, value.size() - 2); // Remove quotes
+        }
+    }
+
+    return config;
+}
+
+Config loadConfig(int argc, char** argv) {
+    std::string configFile = "config.json";
+    bool explicitConfig = false;
+    bool headless = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--config" && i + 1 < argc) {
+            configFile = argv[++i];
+            explicitConfig = true;
+        }
+        else if (arg == "--headless" || arg == "--convert" || arg == "--render") {
+            headless = true; // Конвертация и отрисовка на CPU тоже идут без окна
+        }
+    }
+
+    Config config;
+    if (explicitConfig || !headless || std::ifstream(configFile)) {
+        config = readConfig(configFile);
+    }
+    config.headless = config.headless || headless;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--headless") {
+            continue;
+        }
+        if (arg == "--normals") {
+            config.exportNormals = true;
+            continue;
+        }
+        if (arg == "--streaming") {
+            config.streaming = true;
+            continue;
+        }
+        if (arg == "--height-field") {
+            config.heightField = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            throw std::runtime_error("Missing value for command line option: " + arg);
+        }
+        std::string value = argv[++i];
+        if (arg == "--config") {
+            continue;
+        }
+        else if (arg == "--input") {
+            config.depthMapFile = value;
+        }
+        else if (arg == "--output") {
+            config.outputFile = value;
+        }
+        else if (arg == "--format") {
+            config.outputFormat = value;
+        }
+        else if (arg == "--depth-scale") {
+            config.depthScale = std::stof(value);
+        }
+        else if (arg == "--encoding") {
+            config.exportEncoding = value;
+        }
+        else if (arg == "--threads") {
+            config.threads = static_cast<unsigned>(std::stoul(value));
+        }
+        else if (arg == "--max-error") {
+            config.maxError = std::stof(value);
+        }
+        else if (arg == "--level") {
+            config.meshLevel = static_cast<unsigned>(std::stoul(value));
+        }
+        else if (arg == "--median") {
+            config.medianPasses = static_cast<unsigned>(std::stoul(value));
+        }
+        else if (arg == "--hole-fill") {
+            config.holeFillIterations = static_cast<unsigned>(std::stoul(value));
+        }
+        else if (arg == "--bilateral-space") {
+            config.bilateralSigmaSpace = std::stof(value);
+        }
+        else if (arg == "--bilateral-depth") {
+            config.bilateralSigmaDepth = std::stof(value);
+        }
+        else if (arg == "--intrinsics") {
+            std::vector<float> values = parseFloatList(value);
+            if (values.size() != 4) {
+                throw std::runtime_error("Expected fx,fy,cx,cy for --intrinsics");
+            }
+            config.camera.fx = values[0];
+            config.camera.fy = values[1];
+            config.camera.cx = values[2];
+            config.camera.cy = values[3];
+        }
+        else if (arg == "--distortion") {
+            std::vector<float> values = parseFloatList(value);
+            if (values.size() != 4 && values.size() != 5) {
+                throw std::runtime_error("Expected k1,k2,p1,p2[,k3] for --distortion");
+            }
+            config.camera.k1 = values[0];
+            config.camera.k2 = values[1];
+            config.camera.p1 = values[2];
+            config.camera.p2 = values[3];
+            config.camera.k3 = values.size() == 5 ? values[4] : 0.0f;
+        }
+        else if (arg == "--lod-pixel-error") {
+            config.lodPixelError = std::stof(value);
+        }
+        else if (arg == "--memory-budget") {
+            config.memoryBudgetMB = static_cast<unsigned>(std::stoul(value));
+        }
+        else if (arg == "--convert") {
+            config.convertOutput = value;
+        }
+        else if (arg == "--quantize") {
+            config.quantizeError = std::stof(value);
+        }
+        else if (arg == "--sequence") {
+            config.sequence = value;
+        }
+        else if (arg == "--sequence-fps") {
+            config.sequenceFps = std::stof(value);
+        }
+        else if (arg == "--render") {
+            config.renderOutput = value;
+        }
+        else if (arg == "--render-width") {
+            config.renderWidth = static_cast<unsigned>(std::stoul(value));
+        }
+        else if (arg == "--render-height") {
+            config.renderHeight = static_cast<unsigned>(std::stoul(value));
+        }
+        else if (arg == "--render-repeat") {
+            config.renderRepeat = static_cast<unsigned>(std::stoul(value));
+        }
+        else if (arg == "--trace") {
+            config.traceFile = value;
+        }
+        else {
+            throw std::runtime_error("Unknown command line option: " + arg);
+        }
     }
 
     return config;
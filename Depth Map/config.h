@@ -3,6 +3,7 @@
 
 #include <string>
 #include <glm/glm.hpp>
+#include "camera_projection.h"
 
 struct Config {
     std::string depthMapFile;
@@ -11,9 +12,46 @@ struct Config {
     std::string reflectionModel;
     std::string outputFile;
     std::string outputFormat;
+    float depthScale = 1.0f; // Множитель для uint16 карт глубины
+    bool headless = false;   // Только экспорт, без окна GLFW
+    std::string exportEncoding = "ascii"; // ascii или binary
+    bool exportNormals = false;
+    unsigned threads = 0; // 0 — по числу ядер
+    float maxError = 0.0f; // Погрешность адаптивной сетки по глубине, 0 — полная сетка
+    unsigned meshLevel = 0; // Уровень пирамиды глубины для сетки и экспорта, 0 — полное разрешение
+    unsigned medianPasses = 0;        // Фильтры карты перед построением сетки (depth_filter.h)
+    unsigned holeFillIterations = 0;
+    float bilateralSigmaSpace = 0.0f;
+    float bilateralSigmaDepth = 0.0f;
+    CameraIntrinsics camera; // Обратная проекция через камеру-обскуру вместо сетки x, y (при fx, fy > 0)
+    unsigned lodTileSize = 64;  // Размер тайла в квадах (степень двойки)
+    float lodPixelError = 1.0f; // Допустимая ошибка уровня детализации на экране, пиксели
+    bool streaming = false;        // Потоковый экспорт полосами строк (только без окна)
+    unsigned memoryBudgetMB = 256; // Бюджет памяти полосы
+    std::string convertOutput;     // Конвертировать карту в этот файл (.dmt или .dat) и выйти
+    float quantizeError = 0.0f;    // Допустимая ошибка квантования .dmt, 0 — без потерь
+    std::string sequence;          // Шаблон имён кадров, например frames/DepthMap_%d.dat
+    float sequenceFps = 30.0f;     // Частота смены кадров последовательности
+    bool heightField = false;      // Окно: в GPU только глубина отсчётов, позиции и нормали в шейдере
+    std::string renderOutput;      // Отрисовать на CPU в этот файл (.png или .ppm) и выйти
+    unsigned renderWidth = 1200;
+    unsigned renderHeight = 1200;
+    unsigned renderRepeat = 1;     // Повторов отрисовки для замера изображений в секунду
+    std::string traceFile;         // Трасса Chrome trace events; пусто — DEPTH_MAP_TRACE или без трассы
 };
 
 Config readConfig(const std::string& filename);
+
+// config.json (или --config <файл>) с переопределениями из командной строки:
+// --headless, --input <файл>, --output <имя>, --format ply|stl|vrml, --depth-scale <k>,
+// --encoding ascii|binary, --normals, --threads <n>, --max-error <e>, --level <n>,
+// --median <n>, --hole-fill <n>, --bilateral-space <отсчёты>, --bilateral-depth <глубина>,
+// --intrinsics <fx,fy,cx,cy>, --distortion <k1,k2,p1,p2[,k3]>,
+// --lod-pixel-error <px>, --streaming, --memory-budget <МБ>,
+// --convert <файл.dmt|файл.dat>, --quantize <e>, --sequence <шаблон>, --sequence-fps <n>, --height-field,
+// --render <файл.png|файл.ppm>, --render-width <n>, --render-height <n>, --render-repeat <n>,
+// --trace <файл.json>
+Config loadConfig(int argc, char** argv);
 std::string trim(const std::string& str);
 
 #endif // CONFIG_H
\ No newline at end of file
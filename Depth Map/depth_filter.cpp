@@ -0,0 +1,315 @@
+﻿#include "depth_filter.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "parallel.h"
+#include "trace.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define DEPTH_FILTER_X86 1
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Глубина во float с полем шириной pad из нулей со всех сторон
+struct PaddedDepth {
+    size_t width = 0;
+    size_t height = 0;
+    size_t pad = 0;
+    size_t stride = 0;
+    std::vector<float> values;
+
+    PaddedDepth(size_t w, size_t h, size_t border)
+        : width(w), height(h), pad(border), stride(w + 2 * border), values(stride * (h + 2 * border), 0.0f) {
+    }
+
+    float* row(size_t y) { return values.data() + (y + pad) * stride + pad; }
+    const float* row(size_t y) const { return values.data() + (y + pad) * stride + pad; }
+};
+
+inline void storeSample(float value, float, double& out) { out = value; }
+inline void storeSample(float value, float, float& out) { out = value; }
+inline void storeSample(float value, float depthScale, uint16_t& out) {
+    // Ненулевая глубина не должна округлиться в пропуск
+    float scaled = std::min(std::max(value / depthScale + 0.5f, 1.0f), 65535.0f);
+    out = value > 0 ? static_cast<uint16_t>(scaled) : uint16_t(0);
+}
+
+// Пропущенный сосед медианы заменяется центром
+inline float orCenter(float value, float center) { return value != 0 ? value : center; }
+
+template <typename V, typename Min, typename Max>
+inline void sortPair(V& a, V& b, Min min, Max max) {
+    V low = min(a, b);
+    b = max(a, b);
+    a = low;
+}
+
+// Медиана девяти значений сетью из 19 сравнений (Paeth): только min и max, без ветвлений.
+// V — float или регистр SSE2 с четырьмя отсчётами.
+template <typename V, typename Min, typename Max>
+inline V median9(V p[9], Min min, Max max) {
+    auto sort = [&](V& a, V& b) { sortPair(a, b, min, max); };
+    sort(p[1], p[2]); sort(p[4], p[5]); sort(p[7], p[8]);
+    sort(p[0], p[1]); sort(p[3], p[4]); sort(p[6], p[7]);
+    sort(p[1], p[2]); sort(p[4], p[5]); sort(p[7], p[8]);
+    sort(p[0], p[3]); sort(p[5], p[8]); sort(p[4], p[7]);
+    sort(p[3], p[6]); sort(p[1], p[4]); sort(p[2], p[5]);
+    sort(p[4], p[7]); sort(p[4], p[2]); sort(p[6], p[4]);
+    sort(p[4], p[2]);
+    return p[4];
+}
+
+// exp(-t) как (1 - t/8)^8: ноль при t >= 8, без вызова exp и без ветвлений
+inline float rangeWeight(float t) {
+    float u = std::max(0.0f, 1.0f - t * 0.125f);
+    u *= u;
+    u *= u;
+    return u * u;
+}
+
+#ifdef DEPTH_FILTER_X86
+
+inline __m128 selectPs(__m128 mask, __m128 a, __m128 b) {
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+}
+
+#endif
+
+// Строка медианы 3x3: a, c, b — строки выше, текущая и ниже (поле из нулей по краю
+// позволяет читать x - 1 и x + 1 без проверок). Пропуск в центре остаётся пропуском.
+void medianRow(const float* a, const float* c, const float* b, size_t width, float* out) {
+    size_t x = 0;
+#ifdef DEPTH_FILTER_X86
+    const __m128 zero = _mm_setzero_ps();
+    auto minPs = [](__m128 p, __m128 q) { return _mm_min_ps(p, q); };
+    auto maxPs = [](__m128 p, __m128 q) { return _mm_max_ps(p, q); };
+    for (; x + 4 <= width; x += 4) {
+        __m128 center = _mm_loadu_ps(c + x);
+        __m128 p[9] = {
+            _mm_loadu_ps(a + x - 1), _mm_loadu_ps(a + x), _mm_loadu_ps(a + x + 1),
+            _mm_loadu_ps(c + x - 1), center, _mm_loadu_ps(c + x + 1),
+            _mm_loadu_ps(b + x - 1), _mm_loadu_ps(b + x), _mm_loadu_ps(b + x + 1) };
+        for (__m128& value : p) {
+            value = selectPs(_mm_cmpneq_ps(value, zero), value, center);
+        }
+        __m128 median = median9(p, minPs, maxPs);
+        _mm_storeu_ps(out + x, _mm_and_ps(_mm_cmpneq_ps(center, zero), median));
+    }
+#endif
+    auto min = [](float p, float q) { return std::min(p, q); };
+    auto max = [](float p, float q) { return std::max(p, q); };
+    for (; x < width; ++x) {
+        float center = c[x];
+        float p[9] = {
+            orCenter(a[x - 1], center), orCenter(a[x], center), orCenter(a[x + 1], center),
+            orCenter(c[x - 1], center), center, orCenter(c[x + 1], center),
+            orCenter(b[x - 1], center), orCenter(b[x], center), orCenter(b[x + 1], center) };
+        float median = median9(p, min, max);
+        out[x] = center != 0 ? median : 0.0f;
+    }
+}
+
+// Строка заполнения: пропуск получает среднее ненулевых соседей 3x3, если их не меньше четырёх.
+// Так закрываются дыры, а прямой край поверхности (три соседа) не расползается.
+// Возвращает число заполненных отсчётов.
+size_t fillHoleRow(const float* a, const float* c, const float* b, size_t width, float* out) {
+    size_t filled = 0;
+    size_t x = 0;
+#ifdef DEPTH_FILTER_X86
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 minimumCount = _mm_set1_ps(4.0f);
+    for (; x + 4 <= width; x += 4) {
+        const __m128 neighbours[8] = {
+            _mm_loadu_ps(a + x - 1), _mm_loadu_ps(a + x), _mm_loadu_ps(a + x + 1),
+            _mm_loadu_ps(c + x - 1), _mm_loadu_ps(c + x + 1),
+            _mm_loadu_ps(b + x - 1), _mm_loadu_ps(b + x), _mm_loadu_ps(b + x + 1) };
+        __m128 sum = zero;
+        __m128 count = zero;
+        for (__m128 value : neighbours) {
+            sum = _mm_add_ps(sum, value);
+            count = _mm_add_ps(count, _mm_and_ps(_mm_cmpneq_ps(value, zero), one));
+        }
+        __m128 center = _mm_loadu_ps(c + x);
+        __m128 mean = _mm_div_ps(sum, _mm_max_ps(count, one));
+        __m128 fill = _mm_and_ps(_mm_cmpeq_ps(center, zero), _mm_cmpge_ps(count, minimumCount));
+        int mask = _mm_movemask_ps(fill);
+        filled += (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+        _mm_storeu_ps(out + x, selectPs(fill, mean, center));
+    }
+#endif
+    for (; x < width; ++x) {
+        const float neighbours[8] = { a[x - 1], a[x], a[x + 1], c[x - 1], c[x + 1], b[x - 1], b[x], b[x + 1] };
+        float sum = 0.0f;
+        unsigned count = 0;
+        for (float value : neighbours) {
+            sum += value;
+            count += value != 0;
+        }
+        bool fill = c[x] == 0 && count >= 4;
+        filled += fill;
+        out[x] = fill ? sum / static_cast<float>(count) : c[x];
+    }
+    return filled;
+}
+
+// Одномерный двусторонний проход по строке: соседи центра center[x] лежат на center[x + k * tapStride].
+// Цикл по смещению снаружи, по x внутри — суммы копятся в sum и weight по всей строке.
+void bilateralRow(const float* center, std::ptrdiff_t tapStride, const std::vector<float>& spatial,
+    float depthFactor, size_t width, float* sum, float* weight, float* out) {
+    std::fill(sum, sum + width, 0.0f);
+    std::fill(weight, weight + width, 0.0f);
+    std::ptrdiff_t radius = static_cast<std::ptrdiff_t>(spatial.size() / 2);
+    for (std::ptrdiff_t k = -radius; k <= radius; ++k) {
+        const float* tap = center + k * tapStride;
+        float spatialWeight = spatial[static_cast<size_t>(k + radius)];
+        size_t x = 0;
+#ifdef DEPTH_FILTER_X86
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 eighth = _mm_set1_ps(0.125f);
+        const __m128 factor = _mm_set1_ps(depthFactor);
+        const __m128 spatialWeights = _mm_set1_ps(spatialWeight);
+        for (; x + 4 <= width; x += 4) {
+            __m128 value = _mm_loadu_ps(tap + x);
+            __m128 difference = _mm_sub_ps(value, _mm_loadu_ps(center + x));
+            __m128 t = _mm_mul_ps(_mm_mul_ps(difference, difference), factor);
+            __m128 u = _mm_max_ps(zero, _mm_sub_ps(one, _mm_mul_ps(t, eighth)));
+            u = _mm_mul_ps(u, u);
+            u = _mm_mul_ps(u, u);
+            u = _mm_mul_ps(u, u);
+            __m128 w = _mm_and_ps(_mm_cmpneq_ps(value, zero), _mm_mul_ps(spatialWeights, u));
+            _mm_storeu_ps(sum + x, _mm_add_ps(_mm_loadu_ps(sum + x), _mm_mul_ps(w, value)));
+            _mm_storeu_ps(weight + x, _mm_add_ps(_mm_loadu_ps(weight + x), w));
+        }
+#endif
+        for (; x < width; ++x) {
+            float value = tap[x];
+            float difference = value - center[x];
+            float w = value != 0 ? spatialWeight * rangeWeight(difference * difference * depthFactor) : 0.0f;
+            sum[x] += w * value;
+            weight[x] += w;
+        }
+    }
+    // У ненулевого центра вес самого центра больше нуля
+    size_t x = 0;
+#ifdef DEPTH_FILTER_X86
+    const __m128 zero = _mm_setzero_ps();
+    for (; x + 4 <= width; x += 4) {
+        __m128 valid = _mm_cmpneq_ps(_mm_loadu_ps(center + x), zero);
+        __m128 w = selectPs(valid, _mm_loadu_ps(weight + x), _mm_set1_ps(1.0f));
+        _mm_storeu_ps(out + x, _mm_and_ps(valid, _mm_div_ps(_mm_loadu_ps(sum + x), w)));
+    }
+#endif
+    for (; x < width; ++x) {
+        out[x] = center[x] != 0 ? sum[x] / weight[x] : 0.0f;
+    }
+}
+
+template <typename T>
+DepthMap<T> filterTyped(const DepthMap<T>& depthMap, const DepthFilterOptions& options) {
+    size_t width = depthMap.width;
+    size_t height = depthMap.height;
+    unsigned workers = workerCount(options.threads);
+    size_t bands = std::max<size_t>(1, std::min<size_t>(height, workers * 4));
+
+    // Двусторонний фильтр разделён на проходы по строкам и по столбцам, окно — две сигмы
+    size_t radius = options.bilateral() ? static_cast<size_t>(std::ceil(2.0f * options.bilateralSigmaSpace)) : 0;
+    std::vector<float> spatial(2 * radius + 1);
+    for (size_t i = 0; i < spatial.size(); ++i) {
+        float distance = static_cast<float>(i) - static_cast<float>(radius);
+        spatial[i] = std::exp(-distance * distance / (2.0f * options.bilateralSigmaSpace * options.bilateralSigmaSpace));
+    }
+    float depthFactor = options.bilateral() ? 1.0f / (2.0f * options.bilateralSigmaDepth * options.bilateralSigmaDepth) : 0.0f;
+
+    size_t pad = std::max<size_t>(1, radius);
+    PaddedDepth current(width, height, pad);
+    PaddedDepth next(width, height, pad);
+    const T* data = depthMap.data.data();
+    float depthScale = depthMap.depthScale;
+    parallelForBands(height, bands, workers, [&](size_t begin, size_t end, size_t) {
+        for (size_t y = begin; y < end; ++y) {
+            const T* source = data + y * width;
+            float* target = current.row(y);
+            for (size_t x = 0; x < width; ++x) {
+                float value = static_cast<float>(sampleDepth(source[x], depthScale));
+                target[x] = value == value ? value : 0.0f;
+            }
+        }
+    });
+
+    for (unsigned pass = 0; pass < options.medianPasses; ++pass) {
+        TRACE_ZONE("median 3x3");
+        parallelForBands(height, bands, workers, [&](size_t begin, size_t end, size_t) {
+            for (size_t y = begin; y < end; ++y) {
+                const float* row = current.row(y);
+                medianRow(row - current.stride, row, row + current.stride, width, next.row(y));
+            }
+        });
+        std::swap(current, next);
+    }
+
+    for (unsigned iteration = 0; iteration < options.holeFillIterations; ++iteration) {
+        TRACE_ZONE("hole fill");
+        std::vector<size_t> filled(bands, 0);
+        parallelForBands(height, bands, workers, [&](size_t begin, size_t end, size_t band) {
+            for (size_t y = begin; y < end; ++y) {
+                const float* row = current.row(y);
+                filled[band] += fillHoleRow(row - current.stride, row, row + current.stride, width, next.row(y));
+            }
+        });
+        std::swap(current, next);
+        if (std::all_of(filled.begin(), filled.end(), [](size_t count) { return count == 0; })) {
+            break;
+        }
+    }
+
+    if (options.bilateral()) {
+        TRACE_ZONE("bilateral");
+        std::ptrdiff_t columnStride = static_cast<std::ptrdiff_t>(current.stride);
+        parallelForBands(height, bands, workers, [&](size_t begin, size_t end, size_t) {
+            std::vector<float> sum(width), weight(width);
+            for (size_t y = begin; y < end; ++y) {
+                bilateralRow(current.row(y), 1, spatial, depthFactor, width, sum.data(), weight.data(), next.row(y));
+            }
+        });
+        parallelForBands(height, bands, workers, [&](size_t begin, size_t end, size_t) {
+            std::vector<float> sum(width), weight(width);
+            for (size_t y = begin; y < end; ++y) {
+                bilateralRow(next.row(y), columnStride, spatial, depthFactor, width, sum.data(), weight.data(), current.row(y));
+            }
+        });
+    }
+
+    DepthMap<T> filtered;
+    filtered.width = width;
+    filtered.height = height;
+    filtered.depthScale = depthScale;
+    std::vector<T> samples(width * height);
+    parallelForBands(height, bands, workers, [&](size_t begin, size_t end, size_t) {
+        for (size_t y = begin; y < end; ++y) {
+            const float* source = current.row(y);
+            T* target = samples.data() + y * width;
+            for (size_t x = 0; x < width; ++x) {
+                storeSample(source[x], depthScale, target[x]);
+            }
+        }
+    });
+    filtered.data = DepthSamples<T>(std::move(samples));
+    return filtered;
+}
+
+} // namespace
+
+AnyDepthMap filterDepthMap(const AnyDepthMap& depthMap, const DepthFilterOptions& options) {
+    TRACE_ZONE("filterDepthMap");
+    if (!options.enabled() || depthMap.size() == 0) {
+        return depthMap;
+    }
+    return depthMap.visit([&](const auto& typed) {
+        return AnyDepthMap(filterTyped(typed, options));
+    });
+}
@@ -0,0 +1,25 @@
+﻿#ifndef DEPTH_FILTER_H
+#define DEPTH_FILTER_H
+
+#include "depth_map.h"
+
+// Фильтры карты глубины перед построением сетки. Нули и NaN — пропуски: медиана
+// и двусторонний фильтр их не заполняют и не учитывают, пропуски закрывает только
+// заполнение. Порядок: медиана, заполнение пропусков, двусторонний фильтр.
+struct DepthFilterOptions {
+    unsigned medianPasses = 0;        // Проходов медианы 3x3
+    unsigned holeFillIterations = 0;  // Итераций заполнения, каждая продвигается на отсчёт вглубь пропуска
+    float bilateralSigmaSpace = 0.0f; // Двусторонний фильтр: сигма по расстоянию в отсчётах (0 — выключен)
+    float bilateralSigmaDepth = 0.0f; // и по глубине в единицах карты (0 — выключен)
+    unsigned threads = 0;             // 0 — по числу ядер
+
+    bool bilateral() const { return bilateralSigmaSpace > 0 && bilateralSigmaDepth > 0; }
+    bool enabled() const { return medianPasses > 0 || holeFillIterations > 0 || bilateral(); }
+};
+
+// Карта с теми же размерами и типом отсчёта; без включённых фильтров возвращается исходная.
+// Фильтры считаются во float по карте с полем из пропусков по краю, так что во внутренних
+// циклах по строке нет проверок границ и ветвлений. Каждый проход идёт полосами строк в threads потоках.
+AnyDepthMap filterDepthMap(const AnyDepthMap& depthMap, const DepthFilterOptions& options);
+
+#endif // DEPTH_FILTER_H
@@ -0,0 +1,474 @@
+﻿#include "depth_map.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include "depth_pyramid.h"
+#include "tiled_depth.h"
+#include "trace.h"
+
+namespace {
+
+bool hasExtension(const std::string& filename, const char* extension) {
+    size_t length = std::strlen(extension);
+    if (filename.size() < length) {
+        return false;
+    }
+    for (size_t i = 0; i < length; ++i) {
+        char c = static_cast<char>(std::tolower(static_cast<unsigned char>(filename[filename.size() - length + i])));
+        if (c != extension[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool isLittleEndian() {
+    const uint16_t probe = 1;
+    unsigned char first;
+    std::memcpy(&first, &probe, 1);
+    return first == 1;
+}
+
+size_t checkedArea(size_t width, size_t height) {
+    if (width == 0 || height == 0) {
+        throw std::runtime_error("Invalid width or height in depth map file");
+    }
+    if (width > std::numeric_limits<size_t>::max() / height / sizeof(double)) {
+        throw std::runtime_error("Depth map dimensions are too large");
+    }
+    return width * height;
+}
+
+size_t headerDimension(double value) {
+    if (!(value > 0) || value != std::floor(value) || value > 1e9) {
+        throw std::runtime_error("Invalid width or height in depth map file");
+    }
+    return static_cast<size_t>(value);
+}
+
+template <typename T>
+double sampleValue(const unsigned char* row, size_t x) {
+    return static_cast<double>(reinterpret_cast<const T*>(row)[x]);
+}
+
+double sampleValue(SampleFormat format, const unsigned char* bytes, float depthScale) {
+    switch (format) {
+    case SampleFormat::Float64: return sampleValue<double>(bytes, 0);
+    case SampleFormat::Float32: return sampleValue<float>(bytes, 0);
+    case SampleFormat::UInt16: return sampleValue<uint16_t>(bytes, 0) * static_cast<double>(depthScale);
+    }
+    return 0.0;
+}
+
+} // namespace
+
+size_t sampleSize(SampleFormat format) {
+    switch (format) {
+    case SampleFormat::Float64: return sizeof(double);
+    case SampleFormat::Float32: return sizeof(float);
+    case SampleFormat::UInt16: return sizeof(uint16_t);
+    }
+    return 0;
+}
+
+double DepthMapView::at(size_t x, size_t y) const {
+    const unsigned char* line = origin + rowStride * static_cast<std::ptrdiff_t>(y);
+    switch (format) {
+    case SampleFormat::Float64: return sampleValue<double>(line, x);
+    case SampleFormat::Float32: return sampleValue<float>(line, x);
+    case SampleFormat::UInt16: return sampleValue<uint16_t>(line, x) * static_cast<double>(depthScale);
+    }
+    return 0.0;
+}
+
+void DepthMapView::readRows(size_t first, size_t count, double* out) const {
+    size_t elementSize = sampleSize(format);
+    for (size_t y = first; y < first + count; ++y, out += width) {
+        if (!raw) {
+            switch (format) {
+            case SampleFormat::Float64:
+                std::copy(row<double>(y), row<double>(y) + width, out);
+                break;
+            case SampleFormat::Float32:
+                std::copy(row<float>(y), row<float>(y) + width, out);
+                break;
+            case SampleFormat::UInt16: {
+                const uint16_t* source = row<uint16_t>(y);
+                double scale = depthScale;
+                for (size_t x = 0; x < width; ++x) {
+                    out[x] = source[x] * scale;
+                }
+                break;
+            }
+            }
+            continue;
+        }
+        // Невыровненные или в чужом порядке байт: каждый отсчёт через копию
+        const unsigned char* line = origin + rowStride * static_cast<std::ptrdiff_t>(y);
+        for (size_t x = 0; x < width; ++x) {
+            unsigned char bytes[sizeof(double)];
+            std::memcpy(bytes, line + x * elementSize, elementSize);
+            if (swapBytes) {
+                std::reverse(bytes, bytes + elementSize);
+            }
+            out[x] = sampleValue(format, bytes, depthScale);
+        }
+    }
+}
+
+std::shared_ptr<MappedDepthMap> MappedDepthMap::open(const std::string& filename, const DepthLoadOptions& options) {
+    std::shared_ptr<MappedDepthMap> map(new MappedDepthMap());
+    map->samples.depthScale = options.depthScale;
+    map->streaming = options.streaming;
+    if (hasExtension(filename, ".dmt")) {
+        map->parseTiled(filename);
+        return map;
+    }
+    map->file = MappedFile(filename);
+
+    if (hasExtension(filename, ".npy")) {
+        map->parseNpy(filename);
+    }
+    else if (hasExtension(filename, ".pfm")) {
+        map->parsePfm(filename);
+    }
+    else {
+        map->parseDat(filename);
+    }
+    return map;
+}
+
+// Заголовок .dat: два double (height, width), далее отсчёты.
+// Тип отсчёта определяется по размеру файла: 8, 4 или 2 байта на пиксель.
+void MappedDepthMap::parseDat(const std::string& filename) {
+    const size_t headerSize = 2 * sizeof(double);
+    if (file.size() < headerSize) {
+        throw std::runtime_error("Depth map file is too small: " + filename);
+    }
+    double header[2];
+    std::memcpy(header, file.data(), headerSize);
+    samples.height = headerDimension(header[0]);
+    samples.width = headerDimension(header[1]);
+    size_t area = checkedArea(samples.width, samples.height);
+
+    size_t payload = file.size() - headerSize;
+    if (payload == area * sizeof(double)) {
+        samples.format = SampleFormat::Float64;
+    }
+    else if (payload == area * sizeof(float)) {
+        samples.format = SampleFormat::Float32;
+    }
+    else if (payload == area * sizeof(uint16_t)) {
+        samples.format = SampleFormat::UInt16;
+    }
+    else {
+        throw std::runtime_error("Error reading depth map data: file size does not match header in " + filename);
+    }
+    attach(file.data() + headerSize, static_cast<std::ptrdiff_t>(samples.width * sampleSize(samples.format)), false);
+}
+
+// Формат NumPy .npy версии 1.x-3.x, только двумерные массивы в порядке C
+void MappedDepthMap::parseNpy(const std::string& filename) {
+    const unsigned char* bytes = file.data();
+    if (file.size() < 10 || std::memcmp(bytes, "\x93NUMPY", 6) != 0) {
+        throw std::runtime_error("Not a .npy file: " + filename);
+    }
+    unsigned major = bytes[6];
+    size_t headerLength;
+    size_t prefix;
+    if (major == 1) {
+        headerLength = bytes[8] | (bytes[9] << 8);
+        prefix = 10;
+    }
+    else {
+        if (file.size() < 12) {
+            throw std::runtime_error("Truncated .npy header: " + filename);
+        }
+        headerLength = bytes[8] | (bytes[9] << 8) | (bytes[10] << 16) | (static_cast<size_t>(bytes[11]) << 24);
+        prefix = 12;
+    }
+    if (prefix + headerLength > file.size()) {
+        throw std::runtime_error("Truncated .npy header: " + filename);
+    }
+    std::string header(reinterpret_cast<const char*>(bytes + prefix), headerLength);
+
+    size_t descrKey = header.find("'descr'");
+    size_t orderKey = header.find("'fortran_order'");
+    size_t shapeKey = header.find("'shape'");
+    if (descrKey == std::string::npos || orderKey == std::string::npos || shapeKey == std::string::npos) {
+        throw std::runtime_error("Malformed .npy header: " + filename);
+    }
+
+    size_t descrBegin = header.find('\'', header.find(':', descrKey) + 1);
+    size_t descrEnd = descrBegin == std::string::npos ? std::string::npos : header.find('\'', descrBegin + 1);
+    if (descrEnd == std::string::npos) {
+        throw std::runtime_error("Malformed .npy dtype: " + filename);
+    }
+    std::string descr = header.substr(descrBegin + 1, descrEnd - descrBegin - 1);
+    if (descr.size() != 3) {
+        throw std::runtime_error("Unsupported .npy dtype '" + descr + "' in " + filename);
+    }
+    char byteOrder = descr[0];
+    std::string type = descr.substr(1);
+    if (type == "f8") {
+        samples.format = SampleFormat::Float64;
+    }
+    else if (type == "f4") {
+        samples.format = SampleFormat::Float32;
+    }
+    else if (type == "u2") {
+        samples.format = SampleFormat::UInt16;
+    }
+    else {
+        throw std::runtime_error("Unsupported .npy dtype '" + descr + "' in " + filename);
+    }
+    bool bigEndian = byteOrder == '>' || (byteOrder == '=' && !isLittleEndian());
+    bool swapBytes = bigEndian == isLittleEndian();
+
+    size_t orderValue = header.find_first_not_of(" :", orderKey + 15);
+    if (header.compare(orderValue, 4, "True") == 0) {
+        throw std::runtime_error("Fortran-ordered .npy arrays are not supported: " + filename);
+    }
+
+    size_t shapeBegin = header.find('(', shapeKey);
+    size_t shapeEnd = header.find(')', shapeBegin);
+    if (shapeBegin == std::string::npos || shapeEnd == std::string::npos) {
+        throw std::runtime_error("Malformed .npy shape: " + filename);
+    }
+    const char* cursor = header.c_str() + shapeBegin + 1;
+    char* next;
+    unsigned long long rows = std::strtoull(cursor, &next, 10);
+    if (next == cursor || *next != ',') {
+        throw std::runtime_error("Only two-dimensional .npy arrays are supported: " + filename);
+    }
+    cursor = next + 1;
+    unsigned long long columns = std::strtoull(cursor, &next, 10);
+    if (next == cursor) {
+        throw std::runtime_error("Only two-dimensional .npy arrays are supported: " + filename);
+    }
+    // После второго измерения допустимы только пробелы и запятая: (61, 97, 3) — не карта глубины
+    while (*next == ' ') {
+        ++next;
+    }
+    if (*next == ',') {
+        ++next;
+        while (*next == ' ') {
+            ++next;
+        }
+    }
+    if (*next != ')') {
+        throw std::runtime_error("Only two-dimensional .npy arrays are supported: " + filename);
+    }
+    samples.height = static_cast<size_t>(rows);
+    samples.width = static_cast<size_t>(columns);
+    size_t area = checkedArea(samples.width, samples.height);
+
+    size_t dataOffset = prefix + headerLength;
+    if (file.size() - dataOffset < area * sampleSize(samples.format)) {
+        throw std::runtime_error("Error reading depth map data: truncated .npy payload in " + filename);
+    }
+    attach(bytes + dataOffset, static_cast<std::ptrdiff_t>(samples.width * sampleSize(samples.format)), swapBytes);
+}
+
+// Portable Float Map: "Pf" (одноканальный float32), строки хранятся снизу вверх,
+// отрицательный масштаб означает little-endian
+void MappedDepthMap::parsePfm(const std::string& filename) {
+    const char* text = reinterpret_cast<const char*>(file.data());
+    size_t size = file.size();
+    size_t position = 0;
+    auto token = [&]() {
+        while (position < size && std::isspace(static_cast<unsigned char>(text[position]))) {
+            ++position;
+        }
+        size_t begin = position;
+        while (position < size && !std::isspace(static_cast<unsigned char>(text[position]))) {
+            ++position;
+        }
+        return std::string(text + begin, position - begin);
+    };
+
+    std::string magic = token();
+    if (magic == "PF") {
+        throw std::runtime_error("Only single-channel (Pf) PFM files are supported: " + filename);
+    }
+    if (magic != "Pf") {
+        throw std::runtime_error("Not a PFM file: " + filename);
+    }
+    std::string widthToken = token();
+    std::string heightToken = token();
+    std::string scaleToken = token();
+    if (scaleToken.empty() || position >= size) {
+        throw std::runtime_error("Malformed PFM header: " + filename);
+    }
+    ++position; // Один пробельный символ перед данными
+
+    samples.width = std::strtoul(widthToken.c_str(), nullptr, 10);
+    samples.height = std::strtoul(heightToken.c_str(), nullptr, 10);
+    size_t area = checkedArea(samples.width, samples.height);
+    samples.format = SampleFormat::Float32;
+
+    bool littleEndianData = std::strtod(scaleToken.c_str(), nullptr) < 0.0;
+    if (size - position < area * sizeof(float)) {
+        throw std::runtime_error("Error reading depth map data: truncated PFM payload in " + filename);
+    }
+
+    std::ptrdiff_t stride = static_cast<std::ptrdiff_t>(samples.width * sizeof(float));
+    const unsigned char* lastRow = file.data() + position + stride * static_cast<std::ptrdiff_t>(samples.height - 1);
+    attach(lastRow, -stride, littleEndianData != isLittleEndian());
+}
+
+// Сжатый тайловый контейнер распаковывается целиком в собственный буфер
+void MappedDepthMap::parseTiled(const std::string& filename) {
+    TiledDepthReader reader(filename);
+    samples.width = reader.width();
+    samples.height = reader.height();
+    samples.format = reader.format();
+    size_t area = checkedArea(samples.width, samples.height);
+    decoded.resize(area * sampleSize(samples.format));
+    switch (samples.format) {
+    case SampleFormat::Float32:
+        reader.readAll(reinterpret_cast<float*>(decoded.data()));
+        break;
+    case SampleFormat::UInt16:
+        // Масштаб записан в файле вместе с отсчётами
+        samples.depthScale = reader.depthScale();
+        reader.readAll(reinterpret_cast<uint16_t*>(decoded.data()));
+        break;
+    default:
+        reader.readAll(reinterpret_cast<double*>(decoded.data()));
+        break;
+    }
+    samples.origin = decoded.data();
+    samples.rowStride = static_cast<std::ptrdiff_t>(samples.width * sampleSize(samples.format));
+}
+
+// Прямой доступ к отображению, если отсчёты выровнены и в родном порядке байт;
+// иначе отсчёты один раз копируются в собственный буфер сверху вниз.
+// При потоковом чтении копии нет, строки конвертирует readRows.
+void MappedDepthMap::attach(const unsigned char* first, std::ptrdiff_t stride, bool swapBytes) {
+    size_t elementSize = sampleSize(samples.format);
+    bool aligned = reinterpret_cast<uintptr_t>(first) % elementSize == 0;
+    if ((aligned && !swapBytes) || streaming) {
+        samples.origin = first;
+        samples.rowStride = stride;
+        samples.raw = !aligned || swapBytes;
+        samples.swapBytes = swapBytes;
+        return;
+    }
+
+    size_t rowBytes = samples.width * elementSize;
+    converted.resize(rowBytes * samples.height);
+    for (size_t y = 0; y < samples.height; ++y) {
+        unsigned char* target = converted.data() + y * rowBytes;
+        std::memcpy(target, first + stride * static_cast<std::ptrdiff_t>(y), rowBytes);
+        if (swapBytes) {
+            for (size_t i = 0; i < rowBytes; i += elementSize) {
+                std::reverse(target + i, target + i + elementSize);
+            }
+        }
+    }
+    samples.origin = converted.data();
+    samples.rowStride = static_cast<std::ptrdiff_t>(rowBytes);
+}
+
+void MappedDepthMap::releaseRows(size_t first, size_t count) const {
+    if (count == 0 || !file.data() || samples.origin < file.data() || samples.origin >= file.data() + file.size()) {
+        return; // Отсчёты в собственном буфере
+    }
+    size_t rowBytes = samples.width * sampleSize(samples.format);
+    const unsigned char* top = samples.origin + samples.rowStride * static_cast<std::ptrdiff_t>(first);
+    const unsigned char* bottom = samples.origin + samples.rowStride * static_cast<std::ptrdiff_t>(first + count - 1);
+    const unsigned char* begin = std::min(top, bottom);
+    file.release(begin, static_cast<size_t>(std::max(top, bottom) - begin) + rowBytes);
+}
+
+AnyDepthMap::AnyDepthMap(DepthMap<double> depthMap)
+    : sampleFormat(SampleFormat::Float64), float64(std::move(depthMap)) {
+}
+
+AnyDepthMap::AnyDepthMap(DepthMap<float> depthMap)
+    : sampleFormat(SampleFormat::Float32), float32(std::move(depthMap)) {
+}
+
+AnyDepthMap::AnyDepthMap(DepthMap<uint16_t> depthMap)
+    : sampleFormat(SampleFormat::UInt16), uint16(std::move(depthMap)) {
+}
+
+size_t AnyDepthMap::width() const {
+    return visit([](const auto& depthMap) { return depthMap.width; });
+}
+
+size_t AnyDepthMap::height() const {
+    return visit([](const auto& depthMap) { return depthMap.height; });
+}
+
+size_t AnyDepthMap::levelCount() const {
+    return 1 + (pyramidLevels ? pyramidLevels->levels.size() : 0);
+}
+
+AnyDepthMap AnyDepthMap::level(size_t index) const {
+    if (index == 0) {
+        return *this;
+    }
+    if (index >= levelCount()) {
+        throw std::runtime_error("Depth pyramid level " + std::to_string(index) + " was not built");
+    }
+    return pyramidLevels->levels[index - 1].depthMap;
+}
+
+namespace {
+
+// Отсчёты вида в типе файла. Непрерывные выровненные отсчёты в родном порядке байт
+// используются без копирования; иначе строки копируются сверху вниз с разворотом байт.
+template <typename T>
+DepthMap<T> typedDepthMap(const DepthMapView& view, std::shared_ptr<const void> owner) {
+    DepthMap<T> depthMap;
+    depthMap.width = view.width;
+    depthMap.height = view.height;
+    depthMap.depthScale = view.depthScale;
+
+    if (view.contiguous() && !view.raw) {
+        depthMap.data = DepthSamples<T>(std::move(owner), view.row<T>(0), view.width * view.height);
+        return depthMap;
+    }
+
+    std::vector<T> values(view.width * view.height);
+    size_t rowBytes = view.width * sizeof(T);
+    for (size_t y = 0; y < view.height; ++y) {
+        unsigned char* target = reinterpret_cast<unsigned char*>(values.data() + y * view.width);
+        std::memcpy(target, view.origin + view.rowStride * static_cast<std::ptrdiff_t>(y), rowBytes);
+        if (view.swapBytes) {
+            for (size_t i = 0; i < rowBytes; i += sizeof(T)) {
+                std::reverse(target + i, target + i + sizeof(T));
+            }
+        }
+    }
+    depthMap.data = DepthSamples<T>(std::move(values));
+    return depthMap;
+}
+
+} // namespace
+
+AnyDepthMap depthMapFromView(const DepthMapView& view, std::shared_ptr<const void> owner) {
+    switch (view.format) {
+    case SampleFormat::Float32: return typedDepthMap<float>(view, std::move(owner));
+    case SampleFormat::UInt16: return typedDepthMap<uint16_t>(view, std::move(owner));
+    default: return typedDepthMap<double>(view, std::move(owner));
+    }
+}
+
+AnyDepthMap readDepthMap(const std::string& filename, const DepthLoadOptions& options) {
+    TRACE_ZONE("readDepthMap");
+    std::shared_ptr<MappedDepthMap> mapped = MappedDepthMap::open(filename, options);
+    const DepthMapView& view = mapped->view();
+    AnyDepthMap depthMap = depthMapFromView(view, std::move(mapped));
+    if (options.pyramidLevels > 0) {
+        depthMap.setPyramid(buildDepthPyramid(depthMap, options.pyramidLevels));
+    }
+    return depthMap;
+}
@@ -0,0 +1,191 @@
+﻿#ifndef DEPTH_MAP_H
+#define DEPTH_MAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "mapped_file.h"
+
+// Формат отсчётов глубины в файле
+enum class SampleFormat {
+    Float64,
+    Float32,
+    UInt16
+};
+
+size_t sampleSize(SampleFormat format);
+
+struct DepthLoadOptions {
+    float depthScale = 1.0f; // Множитель для целочисленных (uint16) отсчётов
+    bool streaming = false;  // Не конвертировать файл целиком: строки читаются через readRows
+    size_t pyramidLevels = 0; // > 0 — при загрузке строится пирамида глубины (depth_pyramid.h)
+};
+
+// Вид на отсчёты карты глубины без копирования.
+// rowStride задаётся в байтах и может быть отрицательным (строки PFM идут снизу вверх).
+struct DepthMapView {
+    const unsigned char* origin = nullptr; // Начало верхней строки
+    std::ptrdiff_t rowStride = 0;
+    size_t width = 0;
+    size_t height = 0;
+    SampleFormat format = SampleFormat::Float64;
+    float depthScale = 1.0f;
+    // Отсчёты в чужом порядке байт или невыровнены (только при DepthLoadOptions::streaming);
+    // тогда row и at недоступны, читать нужно через readRows
+    bool raw = false;
+    bool swapBytes = false;
+
+    template <typename T>
+    const T* row(size_t y) const {
+        return reinterpret_cast<const T*>(origin + rowStride * static_cast<std::ptrdiff_t>(y));
+    }
+
+    double at(size_t x, size_t y) const;
+
+    // Строки [first, first + count) в double, подряд по width значений
+    void readRows(size_t first, size_t count, double* out) const;
+
+    bool contiguous() const {
+        return rowStride == static_cast<std::ptrdiff_t>(width * sampleSize(format));
+    }
+};
+
+// Отображённый в память файл карты глубины: .dat (заголовок height/width + double/float/uint16),
+// .npy (<f8, <f4, <u2), .pfm (Pf) и сжатый .dmt (см. tiled_depth.h, распаковывается при открытии). Отсчёты читаются прямо из отображения, если они
+// выровнены и имеют родной порядок байт; иначе один раз конвертируются в собственный буфер.
+class MappedDepthMap {
+public:
+    static std::shared_ptr<MappedDepthMap> open(const std::string& filename, const DepthLoadOptions& options = DepthLoadOptions());
+
+    const DepthMapView& view() const { return samples; }
+
+    // Убирает страницы строк [first, first + count) из памяти процесса (потоковое чтение)
+    void releaseRows(size_t first, size_t count) const;
+
+private:
+    MappedDepthMap() = default;
+
+    void parseDat(const std::string& filename);
+    void parseNpy(const std::string& filename);
+    void parsePfm(const std::string& filename);
+    void parseTiled(const std::string& filename);
+    void attach(const unsigned char* first, std::ptrdiff_t stride, bool swapBytes);
+
+    bool streaming = false;
+    MappedFile file;
+    std::vector<unsigned char> converted; // Используется только если отображение нельзя читать напрямую
+    std::vector<unsigned char> decoded;   // Распакованный .dmt в типе его отсчётов
+    DepthMapView samples;
+};
+
+// Отсчёты глубины: либо собственный буфер, либо вид на отображённый файл.
+// Копии разделяют одни и те же данные.
+template <typename T>
+class DepthSamples {
+public:
+    DepthSamples() = default;
+    DepthSamples(std::vector<T> input) {
+        auto buffer = std::make_shared<std::vector<T>>(std::move(input));
+        storage = buffer.get();
+        values = buffer->data();
+        count = buffer->size();
+        owner = std::move(buffer);
+    }
+    DepthSamples(std::shared_ptr<const void> source, const T* input, size_t size)
+        : owner(std::move(source)), values(input), count(size) {
+    }
+
+    const T& operator[](size_t i) const { return values[i]; }
+    const T* data() const { return values; }
+    const T* begin() const { return values; }
+    const T* end() const { return values + count; }
+    size_t size() const { return count; }
+    bool empty() const { return count == 0; }
+
+    // Указатель для записи; данные копируются, если буфер чужой или разделён
+    T* mutableData() {
+        if (!storage || owner.use_count() > 1) {
+            *this = DepthSamples(std::vector<T>(begin(), end()));
+        }
+        return storage->data();
+    }
+
+private:
+    std::shared_ptr<const void> owner;
+    std::vector<T>* storage = nullptr;
+    const T* values = nullptr;
+    size_t count = 0;
+};
+
+// Глубина отсчёта: вещественные отсчёты берутся как есть, uint16 умножаются на масштаб.
+// Выбор по типу отсчёта делается при компиляции, во внутренних циклах нет ветвлений.
+inline double sampleDepth(double value, float) { return value; }
+inline float sampleDepth(float value, float) { return value; }
+inline float sampleDepth(uint16_t value, float depthScale) { return value * depthScale; }
+
+// Карта глубины с отсчётами типа T (double, float или uint16_t с масштабом).
+// Отсчёты хранятся в исходном типе файла, без расширения до double.
+template <typename T>
+struct DepthMap {
+    typedef T Sample;
+    typedef decltype(sampleDepth(T(), 1.0f)) Depth; // double для double отсчётов, иначе float
+
+    size_t width = 0;
+    size_t height = 0;
+    DepthSamples<T> data;
+    float depthScale = 1.0f; // Используется только для uint16
+
+    Depth depth(size_t i) const { return sampleDepth(data[i], depthScale); }
+};
+
+struct DepthPyramid;
+
+// Карта глубины с типом отсчёта, известным только при выполнении (результат readDepthMap).
+// visit вызывает функцию с DepthMap<T> нужного типа, так что обработка
+// компилируется отдельно для каждого типа отсчёта.
+class AnyDepthMap {
+public:
+    AnyDepthMap() = default;
+    AnyDepthMap(DepthMap<double> depthMap);
+    AnyDepthMap(DepthMap<float> depthMap);
+    AnyDepthMap(DepthMap<uint16_t> depthMap);
+
+    SampleFormat format() const { return sampleFormat; }
+    size_t width() const;
+    size_t height() const;
+    size_t size() const { return width() * height(); }
+
+    // Пирамида глубины (DepthLoadOptions::pyramidLevels). levelCount — 1 + число уровней пирамиды;
+    // level(0) — сама карта, номер больше построенных — исключение
+    size_t levelCount() const;
+    AnyDepthMap level(size_t index) const;
+    const DepthPyramid* pyramid() const { return pyramidLevels.get(); }
+    void setPyramid(std::shared_ptr<const DepthPyramid> pyramid) { pyramidLevels = std::move(pyramid); }
+
+    template <typename F>
+    auto visit(F&& f) const -> decltype(f(std::declval<const DepthMap<double>&>())) {
+        switch (sampleFormat) {
+        case SampleFormat::Float32: return f(float32);
+        case SampleFormat::UInt16: return f(uint16);
+        default: return f(float64);
+        }
+    }
+
+private:
+    SampleFormat sampleFormat = SampleFormat::Float64;
+    DepthMap<double> float64;
+    DepthMap<float> float32;
+    DepthMap<uint16_t> uint16;
+    std::shared_ptr<const DepthPyramid> pyramidLevels;
+};
+
+// Карта глубины из вида в типе отсчётов файла; для непрерывных отсчётов в родном порядке байт
+// копирование не выполняется
+AnyDepthMap depthMapFromView(const DepthMapView& view, std::shared_ptr<const void> owner);
+
+AnyDepthMap readDepthMap(const std::string& filename, const DepthLoadOptions& options = DepthLoadOptions());
+
+#endif // DEPTH_MAP_H
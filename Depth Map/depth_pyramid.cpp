@@ -0,0 +1,123 @@
+﻿#include "depth_pyramid.h"
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+#include "parallel.h"
+#include "trace.h"
+
+namespace {
+
+// Сумма отсчётов блока: uint16 складываются в uint32, вещественные — в своём типе
+template <typename T> struct BlockSum { typedef T Type; };
+template <> struct BlockSum<uint16_t> { typedef uint32_t Type; };
+
+inline double blockMean(double sum, unsigned count) { return sum / std::max(count, 1u); }
+inline float blockMean(float sum, unsigned count) { return sum / static_cast<float>(std::max(count, 1u)); }
+inline uint16_t blockMean(uint32_t sum, unsigned count) {
+    unsigned divisor = std::max(count, 1u);
+    return static_cast<uint16_t>((sum + divisor / 2) / divisor);
+}
+
+// Нули и NaN — пропуски
+template <typename T>
+inline bool validSample(T value) { return value != 0 && value == value; }
+
+// Один отсчёт блока: значение входит в сумму и min/max, только если это не пропуск.
+// Выбор вместо ветвлений, чтобы компилятор мог векторизовать цикл по x.
+template <typename T>
+struct BlockAccumulator {
+    typename BlockSum<T>::Type sum = 0;
+    unsigned count = 0;
+    float low = std::numeric_limits<float>::infinity();
+    float high = -std::numeric_limits<float>::infinity();
+
+    void add(T value, float cellMin, float cellMax) {
+        bool valid = validSample(value);
+        sum += valid ? static_cast<typename BlockSum<T>::Type>(value) : 0;
+        count += valid;
+        low = std::min(low, valid ? cellMin : std::numeric_limits<float>::infinity());
+        high = std::max(high, valid ? cellMax : -std::numeric_limits<float>::infinity());
+    }
+};
+
+// Строки [begin, end) уровня из предыдущего. У нечётной стороны последний блок неполный:
+// индекс зажимается, и отсчёт берётся дважды — среднее и min/max от этого не меняются.
+// FirstLevel: min/max ячеек предыдущего уровня — сама глубина отсчётов.
+template <typename T, bool FirstLevel>
+void reduceRows(const DepthMap<T>& fine, const float* fineMin, const float* fineMax,
+    size_t coarseWidth, size_t begin, size_t end, T* out, float* outMin, float* outMax) {
+    const size_t width = fine.width;
+    const float depthScale = fine.depthScale;
+    for (size_t y = begin; y < end; ++y) {
+        size_t rows[2] = { 2 * y * width, std::min(2 * y + 1, fine.height - 1) * width };
+        T* target = out + y * coarseWidth;
+        float* targetMin = outMin + y * coarseWidth;
+        float* targetMax = outMax + y * coarseWidth;
+        for (size_t x = 0; x < coarseWidth; ++x) {
+            size_t columns[2] = { 2 * x, std::min(2 * x + 1, width - 1) };
+            BlockAccumulator<T> block;
+            for (size_t row : rows) {
+                const T* samples = fine.data.data() + row;
+                for (size_t column : columns) {
+                    T value = samples[column];
+                    if (FirstLevel) {
+                        float depth = static_cast<float>(sampleDepth(value, depthScale));
+                        block.add(value, depth, depth);
+                    }
+                    else {
+                        block.add(value, fineMin[row + column], fineMax[row + column]);
+                    }
+                }
+            }
+            target[x] = blockMean(block.sum, block.count);
+            targetMin[x] = block.count > 0 ? block.low : 0.0f;
+            targetMax[x] = block.count > 0 ? block.high : 0.0f;
+        }
+    }
+}
+
+} // namespace
+
+std::shared_ptr<const DepthPyramid> buildDepthPyramid(const AnyDepthMap& depthMap, size_t levels, unsigned threads) {
+    TRACE_ZONE("buildDepthPyramid");
+    auto pyramid = std::make_shared<DepthPyramid>();
+    unsigned workers = workerCount(threads);
+
+    depthMap.visit([&](const auto& source) {
+        typedef typename std::decay<decltype(source)>::type::Sample T;
+        DepthMap<T> fine = source;
+        const float* fineMin = nullptr;
+        const float* fineMax = nullptr;
+
+        while (pyramid->levels.size() < levels && (fine.width > 1 || fine.height > 1)) {
+            DepthMap<T> coarse;
+            coarse.width = (fine.width + 1) / 2;
+            coarse.height = (fine.height + 1) / 2;
+            coarse.depthScale = fine.depthScale;
+            std::vector<T> samples(coarse.width * coarse.height);
+
+            DepthPyramidLevel level;
+            level.minDepth.resize(samples.size());
+            level.maxDepth.resize(samples.size());
+            parallelForBands(coarse.height, workers * 4, workers, [&](size_t begin, size_t end, size_t) {
+                if (fineMin) {
+                    reduceRows<T, false>(fine, fineMin, fineMax, coarse.width, begin, end,
+                        samples.data(), level.minDepth.data(), level.maxDepth.data());
+                }
+                else {
+                    reduceRows<T, true>(fine, nullptr, nullptr, coarse.width, begin, end,
+                        samples.data(), level.minDepth.data(), level.maxDepth.data());
+                }
+            });
+            coarse.data = DepthSamples<T>(std::move(samples));
+            level.depthMap = coarse;
+
+            // Перемещение вектора сохраняет его буфер, так что указатели остаются верными
+            pyramid->levels.push_back(std::move(level));
+            fineMin = pyramid->levels.back().minDepth.data();
+            fineMax = pyramid->levels.back().maxDepth.data();
+            fine = coarse;
+        }
+    });
+    return pyramid;
+}
@@ -0,0 +1,27 @@
+﻿#ifndef DEPTH_PYRAMID_H
+#define DEPTH_PYRAMID_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+#include "depth_map.h"
+
+// Уровень пирамиды: вдвое меньше предыдущего по каждой стороне (нечётная сторона округляется вверх).
+// Отсчёт — среднее ненулевых отсчётов блока 2x2 предыдущего уровня в типе отсчётов исходной карты,
+// 0 — если весь блок пропущен. minDepth/maxDepth — наименьшая и наибольшая глубина отсчётов
+// полного разрешения под ячейкой (0 — под ячейкой одни пропуски).
+struct DepthPyramidLevel {
+    AnyDepthMap depthMap;
+    std::vector<float> minDepth;
+    std::vector<float> maxDepth;
+};
+
+struct DepthPyramid {
+    std::vector<DepthPyramidLevel> levels; // levels[0] — уровень 1, уровень 0 — сама карта
+};
+
+// До levels уровней, пока обе стороны не станут равны 1. Каждый уровень считается из предыдущего
+// полосами строк в threads потоках (0 — по числу ядер)
+std::shared_ptr<const DepthPyramid> buildDepthPyramid(const AnyDepthMap& depthMap, size_t levels, unsigned threads = 0);
+
+#endif // DEPTH_PYRAMID_H
@@ -0,0 +1,284 @@
+﻿#include "depth_stats.h"
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include "normal_kernel.h"
+#include "parallel.h"
+#include "trace.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define DEPTH_STATS_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define DEPTH_STATS_AVX2_TARGET
+#else
+#define DEPTH_STATS_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+
+const size_t valueBinCount = size_t(1) << 16;
+const size_t maxBandSamples = size_t(1) << 31; // Счётчики полосы 32-битные
+
+struct BandStatistics {
+    double minDepth = std::numeric_limits<double>::infinity();
+    double maxDepth = -std::numeric_limits<double>::infinity();
+    uint64_t validCount = 0;
+    std::vector<uint32_t> bins;
+};
+
+// Ключ float, упорядоченный как значения: у отрицательных инвертируются все биты, у остальных знак
+inline uint32_t orderedKey(uint32_t bits) {
+    return bits ^ (static_cast<uint32_t>(static_cast<int32_t>(bits) >> 31) | 0x80000000u);
+}
+
+float valueOfKey(uint32_t key) {
+    uint32_t bits = (key & 0x80000000u) ? key ^ 0x80000000u : ~key;
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+template <typename T>
+void accumulateScalar(const T* data, size_t count, float depthScale, BandStatistics& band) {
+    uint32_t* bins = band.bins.data();
+    for (size_t i = 0; i < count; ++i) {
+        double value = sampleDepth(data[i], depthScale);
+        if (value != 0 && value == value) {
+            band.minDepth = std::min(band.minDepth, value);
+            band.maxDepth = std::max(band.maxDepth, value);
+            ++band.validCount;
+            float single = static_cast<float>(value);
+            uint32_t bits;
+            std::memcpy(&bits, &single, sizeof(bits));
+            ++bins[orderedKey(bits) >> 16];
+        }
+    }
+}
+
+#ifdef DEPTH_STATS_X86
+
+// Два double за шаг: минимум, максимум и ключи гистограммы в регистрах, счёт интервалов скалярный
+void accumulateSse2(const double* data, size_t count, BandStatistics& band) {
+    uint32_t* bins = band.bins.data();
+    const __m128d zero = _mm_setzero_pd();
+    const __m128d infinity = _mm_set1_pd(std::numeric_limits<double>::infinity());
+    const __m128d negativeInfinity = _mm_set1_pd(-std::numeric_limits<double>::infinity());
+    const __m128i signBit = _mm_set1_epi32(static_cast<int>(0x80000000u));
+    __m128d minimum = infinity;
+    __m128d maximum = negativeInfinity;
+    uint64_t valid = 0;
+    alignas(16) uint32_t keys[4];
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        __m128d value = _mm_loadu_pd(data + i);
+        __m128d mask = _mm_and_pd(_mm_cmpneq_pd(value, zero), _mm_cmpord_pd(value, value));
+        int lanes = _mm_movemask_pd(mask);
+        if (lanes == 0) {
+            continue;
+        }
+        minimum = _mm_min_pd(minimum, _mm_or_pd(_mm_and_pd(mask, value), _mm_andnot_pd(mask, infinity)));
+        maximum = _mm_max_pd(maximum, _mm_or_pd(_mm_and_pd(mask, value), _mm_andnot_pd(mask, negativeInfinity)));
+        __m128i bits = _mm_castps_si128(_mm_cvtpd_ps(value));
+        __m128i key = _mm_srli_epi32(_mm_xor_si128(bits, _mm_or_si128(_mm_srai_epi32(bits, 31), signBit)), 16);
+        _mm_store_si128(reinterpret_cast<__m128i*>(keys), key);
+        valid += (lanes & 1) + (lanes >> 1);
+        if (lanes & 1) {
+            ++bins[keys[0]];
+        }
+        if (lanes & 2) {
+            ++bins[keys[1]];
+        }
+    }
+    alignas(16) double lanes[2];
+    _mm_store_pd(lanes, minimum);
+    band.minDepth = std::min(band.minDepth, std::min(lanes[0], lanes[1]));
+    _mm_store_pd(lanes, maximum);
+    band.maxDepth = std::max(band.maxDepth, std::max(lanes[0], lanes[1]));
+    band.validCount += valid;
+    accumulateScalar(data + i, count - i, 1.0f, band);
+}
+
+DEPTH_STATS_AVX2_TARGET
+void accumulateAvx2(const double* data, size_t count, BandStatistics& band) {
+    uint32_t* bins = band.bins.data();
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d infinity = _mm256_set1_pd(std::numeric_limits<double>::infinity());
+    const __m256d negativeInfinity = _mm256_set1_pd(-std::numeric_limits<double>::infinity());
+    const __m128i signBit = _mm_set1_epi32(static_cast<int>(0x80000000u));
+    __m256d minimum = infinity;
+    __m256d maximum = negativeInfinity;
+    uint64_t valid = 0;
+    alignas(16) uint32_t keys[4];
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256d value = _mm256_loadu_pd(data + i);
+        // NEQ_OQ ложно и для нуля, и для NaN
+        __m256d mask = _mm256_cmp_pd(value, zero, _CMP_NEQ_OQ);
+        int lanes = _mm256_movemask_pd(mask);
+        if (lanes == 0) {
+            continue;
+        }
+        minimum = _mm256_min_pd(minimum, _mm256_blendv_pd(infinity, value, mask));
+        maximum = _mm256_max_pd(maximum, _mm256_blendv_pd(negativeInfinity, value, mask));
+        __m128i bits = _mm_castps_si128(_mm256_cvtpd_ps(value));
+        __m128i key = _mm_srli_epi32(_mm_xor_si128(bits, _mm_or_si128(_mm_srai_epi32(bits, 31), signBit)), 16);
+        _mm_store_si128(reinterpret_cast<__m128i*>(keys), key);
+        for (int k = 0; k < 4; ++k) {
+            if (lanes & (1 << k)) {
+                ++bins[keys[k]];
+                ++valid;
+            }
+        }
+    }
+    alignas(32) double lanes[4];
+    _mm256_store_pd(lanes, minimum);
+    band.minDepth = std::min(band.minDepth, std::min(std::min(lanes[0], lanes[1]), std::min(lanes[2], lanes[3])));
+    _mm256_store_pd(lanes, maximum);
+    band.maxDepth = std::max(band.maxDepth, std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3])));
+    band.validCount += valid;
+    accumulateScalar(data + i, count - i, 1.0f, band);
+}
+
+#endif // DEPTH_STATS_X86
+
+void accumulate(NormalKernel kernel, const double* data, size_t count, float, BandStatistics& band) {
+#ifdef DEPTH_STATS_X86
+    if (kernel == NormalKernel::AVX2) {
+        accumulateAvx2(data, count, band);
+        return;
+    }
+    if (kernel == NormalKernel::SSE2) {
+        accumulateSse2(data, count, band);
+        return;
+    }
+#endif
+    accumulateScalar(data, count, 1.0f, band);
+}
+
+void accumulate(NormalKernel, const float* data, size_t count, float, BandStatistics& band) {
+    accumulateScalar(data, count, 1.0f, band);
+}
+
+// uint16: сначала счёт самих отсчётов (всего 65536 значений), затем перенос в интервалы по битам float
+void accumulate(NormalKernel, const uint16_t* data, size_t count, float depthScale, BandStatistics& band) {
+    std::vector<uint32_t> counts(size_t(1) << 16, 0);
+    for (size_t i = 0; i < count; ++i) {
+        ++counts[data[i]];
+    }
+    uint32_t* bins = band.bins.data();
+    for (size_t sample = 1; sample < counts.size(); ++sample) {
+        if (counts[sample] == 0) {
+            continue;
+        }
+        float value = sampleDepth(static_cast<uint16_t>(sample), depthScale);
+        if (value != 0 && value == value) {
+            band.minDepth = std::min(band.minDepth, static_cast<double>(value));
+            band.maxDepth = std::max(band.maxDepth, static_cast<double>(value));
+            band.validCount += counts[sample];
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            bins[orderedKey(bits) >> 16] += counts[sample];
+        }
+    }
+}
+
+// Второй проход: равные интервалы от minDepth, binsPerUnit — число интервалов на единицу глубины
+template <typename T>
+void accumulateHistogram(const T* data, size_t count, float depthScale, double minDepth, double binsPerUnit,
+    std::vector<uint32_t>& histogram) {
+    size_t last = histogram.size() - 1;
+    for (size_t i = 0; i < count; ++i) {
+        double value = sampleDepth(data[i], depthScale);
+        if (value != 0 && value == value) {
+            size_t bin = static_cast<size_t>((value - minDepth) * binsPerUnit);
+            ++histogram[std::min(bin, last)];
+        }
+    }
+}
+
+} // namespace
+
+double DepthStatistics::percentile(double percent) const {
+    if (validCount == 0) {
+        return 0.0;
+    }
+    double rank = std::min(std::max(percent, 0.0), 100.0) / 100.0 * validCount;
+    uint64_t below = 0;
+    for (size_t bin = 0; bin < valueBins.size(); ++bin) {
+        uint64_t count = valueBins[bin];
+        if (count == 0 || below + count < rank) {
+            below += count;
+            continue;
+        }
+        // Отсчёты интервала считаются равномерно распределёнными
+        double lower = valueOfKey(static_cast<uint32_t>(bin << 16));
+        double upper = valueOfKey(static_cast<uint32_t>((bin << 16) | 0xFFFF));
+        double value = lower + (upper - lower) * (rank - below) / count;
+        return std::min(std::max(value, minDepth), maxDepth);
+    }
+    return maxDepth;
+}
+
+DepthStatistics computeDepthStatistics(const AnyDepthMap& depthMap, size_t histogramBins, unsigned threads) {
+    TRACE_ZONE("computeDepthStatistics");
+    size_t count = depthMap.size();
+    threads = workerCount(threads);
+    size_t bands = std::max<size_t>(threads, (count + maxBandSamples - 1) / maxBandSamples);
+    bands = std::max<size_t>(1, std::min(bands, count));
+
+    std::vector<BandStatistics> partial(bands);
+    NormalKernel kernel = bestNormalKernel();
+    parallelForBands(count, bands, threads, [&](size_t begin, size_t end, size_t band) {
+        partial[band].bins.assign(valueBinCount, 0);
+        depthMap.visit([&](const auto& typed) {
+            accumulate(kernel, typed.data.data() + begin, end - begin, typed.depthScale, partial[band]);
+        });
+    });
+
+    DepthStatistics stats;
+    stats.sampleCount = count;
+    stats.valueBins.assign(valueBinCount, 0);
+    double minDepth = std::numeric_limits<double>::infinity();
+    double maxDepth = -std::numeric_limits<double>::infinity();
+    for (const BandStatistics& band : partial) {
+        if (band.bins.empty()) {
+            continue;
+        }
+        minDepth = std::min(minDepth, band.minDepth);
+        maxDepth = std::max(maxDepth, band.maxDepth);
+        stats.validCount += band.validCount;
+        for (size_t bin = 0; bin < valueBinCount; ++bin) {
+            stats.valueBins[bin] += band.bins[bin];
+        }
+    }
+    if (stats.validCount == 0) {
+        stats.histogram.assign(histogramBins, 0);
+        return stats;
+    }
+    stats.minDepth = minDepth;
+    stats.maxDepth = maxDepth;
+
+    // Гистограмма с равными интервалами — вторым проходом по отсчётам, когда известен диапазон
+    stats.histogram.assign(histogramBins, 0);
+    if (histogramBins > 0) {
+        double range = maxDepth - minDepth;
+        double binsPerUnit = range > 0 ? histogramBins / range : 0.0;
+        std::vector<std::vector<uint32_t>> bandHistograms(bands);
+        parallelForBands(count, bands, threads, [&](size_t begin, size_t end, size_t band) {
+            bandHistograms[band].assign(histogramBins, 0);
+            depthMap.visit([&](const auto& typed) {
+                accumulateHistogram(typed.data.data() + begin, end - begin, typed.depthScale, minDepth, binsPerUnit,
+                    bandHistograms[band]);
+            });
+        });
+        for (const std::vector<uint32_t>& bandHistogram : bandHistograms) {
+            for (size_t bin = 0; bin < bandHistogram.size(); ++bin) {
+                stats.histogram[bin] += bandHistogram[bin];
+            }
+        }
+    }
+    return stats;
+}
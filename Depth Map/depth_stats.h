@@ -0,0 +1,31 @@
+﻿#ifndef DEPTH_STATS_H
+#define DEPTH_STATS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "depth_map.h"
+
+// Статистика глубины по ненулевым отсчётам (нули и NaN — пропуски). Первый проход даёт минимум,
+// максимум и гистограмму по старшим битам float. Второй проход — точная гистограмма с равными
+// интервалами — делается только по запросу (histogramBins > 0), для процентилей он не нужен.
+// Процентили приближённые: берутся из гистограммы по битам (ширина интервала — 1/128 значения),
+// внутри интервала значение интерполируется.
+struct DepthStatistics {
+    size_t sampleCount = 0;
+    size_t validCount = 0;
+    double minDepth = 0.0;
+    double maxDepth = 0.0;
+    std::vector<uint64_t> histogram;  // Равные интервалы от minDepth до maxDepth (точная, отсчёт maxDepth — в последнем)
+    std::vector<uint64_t> valueBins;  // 65536 интервалов по битам float, по возрастанию значения
+
+    // Глубина, ниже которой лежит percent процентов отсчётов (0 — минимум, 100 — максимум)
+    double percentile(double percent) const;
+};
+
+// Полосами строк в threads потоках (0 — по числу ядер), для double — AVX2 или SSE2 при наличии,
+// для uint16 — через счёт 65536 возможных значений. По умолчанию (histogramBins = 0) второго
+// прохода нет и histogram пуста
+DepthStatistics computeDepthStatistics(const AnyDepthMap& depthMap, size_t histogramBins = 0, unsigned threads = 0);
+
+#endif // DEPTH_STATS_H
@@ -0,0 +1,766 @@
+﻿#include "exporters.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+#include "binary_writer.h"
+#include "normal_kernel.h"
+#include "parallel.h"
+#include "positional_file.h"
+#include "rtin.h"
+#include "text_writer.h"
+#include "trace.h"
+
+namespace {
+
+// Число треугольников сжатой сетки, у которых есть все три вершины
+uint64_t countValidFaces(const ValidSampleRemap& remap, size_t width, size_t height, QuadDiagonal diagonal,
+    unsigned threads) {
+    size_t quadRows = height > 0 ? height - 1 : 0;
+    threads = workerCount(threads);
+    size_t bands = std::max<size_t>(1, std::min<size_t>(quadRows, threads * 4));
+    std::vector<uint64_t> counts(bands, 0);
+    parallelForBands(quadRows, bands, threads, [&](size_t begin, size_t end, size_t band) {
+        uint64_t count = 0;
+        for (size_t y = begin; y < end; ++y) {
+            const uint32_t* top = remap.vertexOf.data() + y * width;
+            forEachQuadFace(top, top + width, width, diagonal, [&](uint32_t, uint32_t, uint32_t) { ++count; });
+        }
+        counts[band] = count;
+    });
+    uint64_t total = 0;
+    for (uint64_t count : counts) {
+        total += count;
+    }
+    return total;
+}
+
+template <typename T>
+void writePly(const DepthMap<T>& depthMap, const ValidSampleRemap& remap, const std::string& filename,
+    unsigned threads, size_t step) {
+    std::ofstream file(filename);
+    if (!file) {
+        throw std::runtime_error("Unable to open file");
+    }
+    size_t width = depthMap.width;
+    size_t height = depthMap.height;
+    size_t quadRows = height > 0 ? height - 1 : 0;
+    size_t quadColumns = width > 0 ? width - 1 : 0;
+
+    file << "ply\n";
+    file << "format ascii 1.0\n";
+    file << "element vertex " << remap.vertexCount() << "\n";
+    file << "property double x\n";
+    file << "property double y\n";
+    file << "property double z\n";
+    file << "property uchar red\n";
+    file << "property uchar green\n";
+    file << "property uchar blue\n";
+    file << "element face " << countValidFaces(remap, width, height, QuadDiagonal::TopLeft, threads) << "\n";
+    file << "property list uchar uint vertex_indices\n";
+    file << "end_header\n";
+
+    // Координаты x и y печатаются как double, как и раньше; отсчёты без треугольников пропускаются
+    const T* data = depthMap.data.data();
+    float depthScale = depthMap.depthScale;
+    writeTextParallel(file, height, width * plyVertexChars, threads, [&](size_t y, char* out) {
+        const T* row = data + y * width;
+        const uint32_t* vertexOf = remap.vertexOf.data() + y * width;
+        for (size_t x = 0; x < width; ++x) {
+            if (vertexOf[x] == ValidSampleRemap::NoVertex) {
+                continue;
+            }
+            out = putDouble(out, static_cast<double>(x * step));
+            *out++ = ' ';
+            out = putDouble(out, static_cast<double>(y * step));
+            *out++ = ' ';
+            out = putDouble(out, sampleDepth(row[x], depthScale));
+            out = putText(out, " 255 200 100\n");
+        }
+        return out;
+    });
+
+    writeTextParallel(file, quadRows, quadColumns * 2 * plyFaceChars, threads, [&](size_t y, char* out) {
+        const uint32_t* top = remap.vertexOf.data() + y * width;
+        forEachQuadFace(top, top + width, width, QuadDiagonal::TopLeft, [&](uint32_t v1, uint32_t v2, uint32_t v3) {
+            out = putPlyFace(out, v1, v2, v3);
+        });
+        return out;
+    });
+    if (!file) {
+        throw std::runtime_error("Error writing file: " + filename);
+    }
+}
+
+} // namespace
+
+void exportToPly(const AnyDepthMap& depthMap, const std::string& filename, unsigned threads, size_t level) {
+    TRACE_ZONE("exportToPly");
+    AnyDepthMap source = depthMap.level(level);
+    ValidSampleRemap remap;
+    buildValidSampleRemap(source, QuadDiagonal::TopLeft, remap, threads);
+    source.visit([&](const auto& typed) {
+        writePly(typed, remap, filename, threads, size_t(1) << level);
+    });
+}
+
+namespace {
+
+template <typename T>
+void writePlyBinary(const DepthMap<T>& depthMap, const ValidSampleRemap& remap, const std::string& filename,
+    bool normals, unsigned threads, size_t step) {
+    if (!isLittleEndianHost()) {
+        throw std::runtime_error("Binary PLY export requires a little-endian host");
+    }
+    size_t width = depthMap.width;
+    size_t height = depthMap.height;
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Unable to open file");
+    }
+
+    file << "ply\n";
+    file << "format binary_little_endian 1.0\n";
+    file << "element vertex " << remap.vertexCount() << "\n";
+    file << "property float x\n";
+    file << "property float y\n";
+    file << "property float z\n";
+    if (normals) {
+        file << "property float nx\n";
+        file << "property float ny\n";
+        file << "property float nz\n";
+    }
+    file << "property uchar red\n";
+    file << "property uchar green\n";
+    file << "property uchar blue\n";
+    file << "element face " << countValidFaces(remap, width, height, QuadDiagonal::TopLeft, threads) << "\n";
+    file << "property list uchar uint vertex_indices\n";
+    file << "end_header\n";
+
+    BufferedWriter writer(file);
+    const T* data = depthMap.data.data();
+    float depthScale = depthMap.depthScale;
+    NormalRowScratch rowNormals(depthMap, static_cast<float>(step), 1.0f);
+    for (size_t y = 0; y < height; ++y) {
+        const T* row = data + y * width;
+        if (remap.rowStart[y] == remap.rowStart[y + 1]) {
+            continue;
+        }
+        if (normals) {
+            rowNormals.compute(y);
+        }
+        const uint32_t* vertexOf = remap.vertexOf.data() + y * width;
+        for (size_t x = 0; x < width; ++x) {
+            if (vertexOf[x] == ValidSampleRemap::NoVertex) {
+                continue;
+            }
+            writer.put(static_cast<float>(x * step));
+            writer.put(static_cast<float>(y * step));
+            writer.put(static_cast<float>(sampleDepth(row[x], depthScale)));
+            if (normals) {
+                writer.put(rowNormals.nx()[x]);
+                writer.put(rowNormals.ny()[x]);
+                writer.put(rowNormals.nz()[x]);
+            }
+            writer.put<uint8_t>(255);
+            writer.put<uint8_t>(200);
+            writer.put<uint8_t>(100);
+        }
+    }
+
+    // Те же грани, что и в текстовом PLY
+    for (size_t y = 0; y + 1 < height; ++y) {
+        const uint32_t* top = remap.vertexOf.data() + y * width;
+        forEachQuadFace(top, top + width, width, QuadDiagonal::TopLeft, [&](uint32_t v1, uint32_t v2, uint32_t v3) {
+            writer.put<uint8_t>(3);
+            writer.put(v1);
+            writer.put(v2);
+            writer.put(v3);
+        });
+    }
+    writer.flush();
+    if (!file) {
+        throw std::runtime_error("Error writing file: " + filename);
+    }
+}
+
+} // namespace
+
+void exportToPlyBinary(const AnyDepthMap& depthMap, const std::string& filename, bool normals, unsigned threads,
+    size_t level) {
+    TRACE_ZONE("exportToPlyBinary");
+    AnyDepthMap source = depthMap.level(level);
+    ValidSampleRemap remap;
+    buildValidSampleRemap(source, QuadDiagonal::TopLeft, remap, threads);
+    source.visit([&](const auto& typed) {
+        writePlyBinary(typed, remap, filename, normals, threads, size_t(1) << level);
+    });
+}
+
+namespace {
+
+template <typename T>
+void writeStl(const DepthMap<T>& depthMap, const std::string& filename, unsigned threads, size_t step) {
+    std::ofstream file(filename);
+    if (!file) {
+        throw std::runtime_error("Unable to open file");
+    }
+    size_t width = depthMap.width;
+    size_t height = depthMap.height;
+    size_t quadRows = height > 0 ? height - 1 : 0;
+    size_t quadColumns = width > 0 ? width - 1 : 0;
+
+    file << "solid depthmap\n";
+
+    // Треугольники с нулевой глубиной в любой вершине пропускаются, как в бинарном STL; нормали не считаются
+    const T* data = depthMap.data.data();
+    float depthScale = depthMap.depthScale;
+    writeTextParallel(file, quadRows, quadColumns * 2 * stlFacetChars, threads, [&](size_t y, char* out) {
+        const T* top = data + y * width;
+        const T* bottom = top + width;
+        int64_t y1 = static_cast<int64_t>(y * step);
+        int64_t y2 = static_cast<int64_t>((y + 1) * step);
+        for (size_t x = 0; x < quadColumns; ++x) {
+            int64_t x1 = static_cast<int64_t>(x * step);
+            int64_t x2 = static_cast<int64_t>((x + 1) * step);
+            double z1 = sampleDepth(top[x], depthScale);
+            double z2 = sampleDepth(top[x + 1], depthScale);
+            double z3 = sampleDepth(bottom[x], depthScale);
+            double z4 = sampleDepth(bottom[x + 1], depthScale);
+            if (top[x] != 0 && top[x + 1] != 0 && bottom[x] != 0) {
+                out = putStlTextFacet(out, x1, y1, z1, x2, y1, z2, x1, y2, z3);
+            }
+            if (top[x + 1] != 0 && bottom[x + 1] != 0 && bottom[x] != 0) {
+                out = putStlTextFacet(out, x2, y1, z2, x2, y2, z4, x1, y2, z3);
+            }
+        }
+        return out;
+    });
+
+    file << "endsolid depthmap\n";
+    if (!file) {
+        throw std::runtime_error("Error writing file: " + filename);
+    }
+}
+
+} // namespace
+
+void exportToStl(const AnyDepthMap& depthMap, const std::string& filename, unsigned threads, size_t level) {
+    TRACE_ZONE("exportToStl");
+    depthMap.level(level).visit([&](const auto& typed) {
+        writeStl(typed, filename, threads, size_t(1) << level);
+    });
+}
+
+namespace {
+
+template <typename T>
+void writeStlBinary(const DepthMap<T>& depthMap, const std::string& filename, unsigned threads, size_t step) {
+    if (!isLittleEndianHost()) {
+        throw std::runtime_error("Binary STL export requires a little-endian host");
+    }
+    const size_t facetSize = 50;
+    const size_t headerSize = 84;
+    size_t width = depthMap.width;
+    size_t height = depthMap.height;
+    const T* data = depthMap.data.data();
+    float depthScale = depthMap.depthScale;
+    size_t quadRows = height > 0 ? height - 1 : 0;
+    threads = workerCount(threads);
+    size_t bands = std::max<size_t>(1, std::min<size_t>(quadRows, threads * 4));
+
+    // Первый проход: число треугольников в каждой полосе строк
+    std::vector<uint64_t> bandOffsets(bands + 1, 0);
+    parallelForBands(quadRows, bands, threads, [&](size_t begin, size_t end, size_t band) {
+        uint64_t count = 0;
+        for (size_t y = begin; y < end; ++y) {
+            const T* top = data + y * width;
+            const T* bottom = top + width;
+            for (size_t x = 0; x + 1 < width; ++x) {
+                bool z1 = top[x] != 0, z2 = top[x + 1] != 0, z3 = bottom[x] != 0, z4 = bottom[x + 1] != 0;
+                count += (z1 && z2 && z3) + (z4 && z2 && z3);
+            }
+        }
+        bandOffsets[band + 1] = count;
+    });
+    for (size_t band = 0; band < bands; ++band) {
+        bandOffsets[band + 1] += bandOffsets[band];
+    }
+    uint64_t facetCount = bandOffsets[bands];
+    if (facetCount > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error("Too many triangles for binary STL");
+    }
+
+    PositionalFile file(filename, headerSize + facetCount * facetSize);
+    unsigned char header[headerSize] = {};
+    std::memcpy(header, "binary STL depthmap", 19);
+    uint32_t count32 = static_cast<uint32_t>(facetCount);
+    std::memcpy(header + 80, &count32, 4);
+    file.writeAt(0, header, headerSize);
+
+    // Второй проход: каждая полоса пишет свои треугольники с известного смещения
+    parallelForBands(quadRows, bands, threads, [&](size_t begin, size_t end, size_t band) {
+        std::vector<unsigned char> buffer(facetSize * 20000);
+        unsigned char* out = buffer.data();
+        uint64_t offset = headerSize + bandOffsets[band] * facetSize;
+        auto flush = [&]() {
+            size_t used = static_cast<size_t>(out - buffer.data());
+            file.writeAt(offset, buffer.data(), used);
+            offset += used;
+            out = buffer.data();
+        };
+
+        for (size_t y = begin; y < end; ++y) {
+            const T* top = data + y * width;
+            const T* bottom = top + width;
+            float fy = static_cast<float>(y * step);
+            float fy2 = static_cast<float>((y + 1) * step);
+            for (size_t x = 0; x + 1 < width; ++x) {
+                if (static_cast<size_t>(out - buffer.data()) + 2 * facetSize > buffer.size()) {
+                    flush();
+                }
+                float fx = static_cast<float>(x * step);
+                float fx2 = static_cast<float>((x + 1) * step);
+                float p1[3] = { fx, fy, static_cast<float>(sampleDepth(top[x], depthScale)) };
+                float p2[3] = { fx2, fy, static_cast<float>(sampleDepth(top[x + 1], depthScale)) };
+                float p3[3] = { fx, fy2, static_cast<float>(sampleDepth(bottom[x], depthScale)) };
+                float p4[3] = { fx2, fy2, static_cast<float>(sampleDepth(bottom[x + 1], depthScale)) };
+                if (top[x] != 0 && top[x + 1] != 0 && bottom[x] != 0) {
+                    out = putStlFacet(out, p1, p2, p3);
+                }
+                if (bottom[x + 1] != 0 && top[x + 1] != 0 && bottom[x] != 0) {
+                    out = putStlFacet(out, p3, p2, p4);
+                }
+            }
+        }
+        flush();
+    });
+}
+
+} // namespace
+
+void exportToStlBinary(const AnyDepthMap& depthMap, const std::string& filename, unsigned threads, size_t level) {
+    TRACE_ZONE("exportToStlBinary");
+    depthMap.level(level).visit([&](const auto& typed) {
+        writeStlBinary(typed, filename, threads, size_t(1) << level);
+    });
+}
+
+namespace {
+
+template <typename T>
+void writeVrml(const DepthMap<T>& depthMap, const ValidSampleRemap& remap, const std::string& filename,
+    unsigned threads, size_t step) {
+    std::ofstream file(filename);
+    if (!file) {
+        throw std::runtime_error("Unable to open file");
+    }
+    size_t width = depthMap.width;
+    size_t height = depthMap.height;
+    size_t quadRows = height > 0 ? height - 1 : 0;
+    size_t quadColumns = width > 0 ? width - 1 : 0;
+
+    file << "#VRML V2.0 utf8\n";
+    file << "Shape {\n";
+    file << "  appearance Appearance {\n";
+    file << "    material Material {\n";
+    file << "      diffuseColor 1 0.78 0.39\n"; // Цвет вершин
+    file << "    }\n";
+    file << "  }\n";
+    file << "  geometry IndexedFaceSet {\n";
+    file << "    coord Coordinate {\n";
+    file << "      point [\n";
+
+    const T* data = depthMap.data.data();
+    float depthScale = depthMap.depthScale;
+    writeTextParallel(file, height, width * vrmlPointChars, threads, [&](size_t y, char* out) {
+        const T* row = data + y * width;
+        const uint32_t* vertexOf = remap.vertexOf.data() + y * width;
+        for (size_t x = 0; x < width; ++x) {
+            if (vertexOf[x] == ValidSampleRemap::NoVertex) {
+                continue;
+            }
+            out = putText(out, "        ");
+            out = putUnsigned(out, x * step);
+            *out++ = ' ';
+            out = putUnsigned(out, y * step);
+            *out++ = ' ';
+            out = putDouble(out, sampleDepth(row[x], depthScale));
+            out = putText(out, ",\n");
+        }
+        return out;
+    });
+
+    file << "      ]\n";
+    file << "    }\n";
+    file << "    coordIndex [\n";
+
+    writeTextParallel(file, quadRows, quadColumns * 2 * vrmlFaceChars, threads, [&](size_t y, char* out) {
+        const uint32_t* top = remap.vertexOf.data() + y * width;
+        forEachQuadFace(top, top + width, width, QuadDiagonal::TopRight, [&](uint32_t v1, uint32_t v2, uint32_t v3) {
+            out = putVrmlFace(out, v1, v2, v3);
+        });
+        return out;
+    });
+
+    file << "    ]\n";
+    file << "  }\n";
+    file << "}\n";
+    if (!file) {
+        throw std::runtime_error("Error writing file: " + filename);
+    }
+}
+
+} // namespace
+
+void exportToVrml(const AnyDepthMap& depthMap, const std::string& filename, unsigned threads, size_t level) {
+    TRACE_ZONE("exportToVrml");
+    AnyDepthMap source = depthMap.level(level);
+    ValidSampleRemap remap;
+    buildValidSampleRemap(source, QuadDiagonal::TopRight, remap, threads);
+    source.visit([&](const auto& typed) {
+        writeVrml(typed, remap, filename, threads, size_t(1) << level);
+    });
+}
+
+namespace {
+
+// step — шаг сетки в отсчётах полного разрешения (2^level для уровня пирамиды);
+// с облаком точек камеры позиция берётся из него
+template <typename T>
+void samplePosition(const DepthMap<T>& depthMap, const PointCloud* cloud, uint32_t sample, size_t step, float position[3]) {
+    if (cloud) {
+        position[0] = cloud->x[sample];
+        position[1] = cloud->y[sample];
+        position[2] = cloud->z[sample];
+        return;
+    }
+    size_t width = depthMap.width;
+    position[0] = static_cast<float>(sample % width * step);
+    position[1] = static_cast<float>(sample / width * step);
+    position[2] = static_cast<float>(depthMap.depth(sample));
+}
+
+template <typename T>
+void exportSampleMeshPly(const DepthMap<T>& depthMap, const PointCloud* cloud, const SampleMesh& mesh,
+    const std::string& filename, const ExportOptions& options) {
+    TRACE_ZONE("exportSampleMeshPly");
+    size_t step = size_t(1) << options.level;
+    if (options.binary && !isLittleEndianHost()) {
+        throw std::runtime_error("Binary PLY export requires a little-endian host");
+    }
+    std::ofstream file(filename, options.binary ? std::ios::binary : std::ios::out);
+    if (!file) {
+        throw std::runtime_error("Unable to open file");
+    }
+    bool normals = options.binary && options.normals;
+    const char* coordinate = options.binary ? "float" : "double";
+
+    file << "ply\n";
+    file << (options.binary ? "format binary_little_endian 1.0\n" : "format ascii 1.0\n");
+    file << "element vertex " << mesh.samples.size() << "\n";
+    file << "property " << coordinate << " x\n";
+    file << "property " << coordinate << " y\n";
+    file << "property " << coordinate << " z\n";
+    if (normals) {
+        file << "property float nx\n";
+        file << "property float ny\n";
+        file << "property float nz\n";
+    }
+    file << "property uchar red\n";
+    file << "property uchar green\n";
+    file << "property uchar blue\n";
+    file << "element face " << mesh.triangleCount() << "\n";
+    file << "property list uchar uint vertex_indices\n";
+    file << "end_header\n";
+
+    size_t width = depthMap.width;
+    if (!options.binary) {
+        writeTextParallel(file, mesh.samples.size(), plyVertexChars, options.threads, [&](size_t i, char* out) {
+            uint32_t sample = mesh.samples[i];
+            if (cloud) {
+                out = putDouble(out, cloud->x[sample]);
+                *out++ = ' ';
+                out = putDouble(out, cloud->y[sample]);
+                *out++ = ' ';
+                out = putDouble(out, cloud->z[sample]);
+                return putText(out, " 255 200 100\n");
+            }
+            out = putUnsigned(out, sample % width * step);
+            *out++ = ' ';
+            out = putUnsigned(out, sample / width * step);
+            *out++ = ' ';
+            out = putDouble(out, depthMap.depth(sample));
+            return putText(out, " 255 200 100\n");
+        });
+        writeTextParallel(file, mesh.triangleCount(), plyFaceChars, options.threads, [&](size_t i, char* out) {
+            const uint32_t* triangle = mesh.triangles.data() + i * 3;
+            return putPlyFace(out, triangle[0], triangle[1], triangle[2]);
+        });
+        if (!file) {
+            throw std::runtime_error("Error writing file: " + filename);
+        }
+        return;
+    }
+
+    BufferedWriter writer(file);
+    SmoothNormalRows rowNormals(depthMap, static_cast<float>(step), 1.0f);
+    size_t currentRow = static_cast<size_t>(-1);
+    for (uint32_t sample : mesh.samples) {
+        float position[3];
+        samplePosition(depthMap, cloud, sample, step, position);
+        writer.put(position[0]);
+        writer.put(position[1]);
+        writer.put(position[2]);
+        if (normals && cloud) {
+            writer.put(cloud->nx[sample]);
+            writer.put(cloud->ny[sample]);
+            writer.put(cloud->nz[sample]);
+        }
+        else if (normals) {
+            size_t y = sample / width;
+            if (y != currentRow) {
+                rowNormals.compute(y);
+                currentRow = y;
+            }
+            size_t x = sample % width;
+            writer.put(rowNormals.nx()[x]);
+            writer.put(rowNormals.ny()[x]);
+            writer.put(rowNormals.nz()[x]);
+        }
+        writer.put<uint8_t>(255);
+        writer.put<uint8_t>(200);
+        writer.put<uint8_t>(100);
+    }
+    for (size_t i = 0; i < mesh.triangles.size(); i += 3) {
+        writer.put<uint8_t>(3);
+        writer.put(mesh.triangles[i]);
+        writer.put(mesh.triangles[i + 1]);
+        writer.put(mesh.triangles[i + 2]);
+    }
+    writer.flush();
+    if (!file) {
+        throw std::runtime_error("Error writing file: " + filename);
+    }
+}
+
+template <typename T>
+void exportSampleMeshStl(const DepthMap<T>& depthMap, const PointCloud* cloud, const SampleMesh& mesh,
+    const std::string& filename, const ExportOptions& options) {
+    TRACE_ZONE("exportSampleMeshStl");
+    size_t step = size_t(1) << options.level;
+    if (options.binary && !isLittleEndianHost()) {
+        throw std::runtime_error("Binary STL export requires a little-endian host");
+    }
+    if (mesh.triangleCount() > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error("Too many triangles for binary STL");
+    }
+    std::ofstream file(filename, options.binary ? std::ios::binary : std::ios::out);
+    if (!file) {
+        throw std::runtime_error("Unable to open file");
+    }
+
+    if (!options.binary) {
+        file << "solid depthmap\n";
+        // Координаты и нормаль во float, печатаются как раньше через double
+        writeTextParallel(file, mesh.triangleCount(), stlFacetChars, options.threads, [&](size_t i, char* out) {
+            float v[3][3];
+            for (int k = 0; k < 3; ++k) {
+                samplePosition(depthMap, cloud, mesh.samples[mesh.triangles[i * 3 + k]], step, v[k]);
+            }
+            unsigned char facet[50];
+            putStlFacet(facet, v[0], v[1], v[2]);
+            float n[3];
+            std::memcpy(n, facet, sizeof(n));
+            out = putText(out, "facet normal ");
+            for (int k = 0; k < 3; ++k) {
+                out = putDouble(out, n[k]);
+                *out++ = k < 2 ? ' ' : '\n';
+            }
+            out = putText(out, "  outer loop\n");
+            for (int k = 0; k < 3; ++k) {
+                out = putText(out, "    vertex ");
+                out = putDouble(out, v[k][0]);
+                *out++ = ' ';
+                out = putDouble(out, v[k][1]);
+                *out++ = ' ';
+                out = putDouble(out, v[k][2]);
+                *out++ = '\n';
+            }
+            return putText(out, "  endloop\nendfacet\n");
+        });
+        file << "endsolid depthmap\n";
+        if (!file) {
+            throw std::runtime_error("Error writing file: " + filename);
+        }
+        return;
+    }
+
+    unsigned char header[84] = {};
+    std::memcpy(header, "binary STL depthmap", 19);
+    uint32_t count32 = static_cast<uint32_t>(mesh.triangleCount());
+    std::memcpy(header + 80, &count32, 4);
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+    unsigned char facet[50];
+    for (size_t i = 0; i < mesh.triangles.size(); i += 3) {
+        float v[3][3];
+        for (int k = 0; k < 3; ++k) {
+            samplePosition(depthMap, cloud, mesh.samples[mesh.triangles[i + k]], step, v[k]);
+        }
+        putStlFacet(facet, v[0], v[1], v[2]);
+        file.write(reinterpret_cast<const char*>(facet), sizeof(facet));
+    }
+    if (!file) {
+        throw std::runtime_error("Error writing file: " + filename);
+    }
+}
+
+template <typename T>
+void exportSampleMeshVrml(const DepthMap<T>& depthMap, const PointCloud* cloud, const SampleMesh& mesh,
+    const std::string& filename, unsigned threads, size_t step) {
+    TRACE_ZONE("exportSampleMeshVrml");
+    std::ofstream file(filename);
+    if (!file) {
+        throw std::runtime_error("Unable to open file");
+    }
+
+    file << "#VRML V2.0 utf8\n";
+    file << "Shape {\n";
+    file << "  appearance Appearance {\n";
+    file << "    material Material {\n";
+    file << "      diffuseColor 1 0.78 0.39\n";
+    file << "    }\n";
+    file << "  }\n";
+    file << "  geometry IndexedFaceSet {\n";
+    file << "    coord Coordinate {\n";
+    file << "      point [\n";
+
+    size_t width = depthMap.width;
+    writeTextParallel(file, mesh.samples.size(), vrmlPointChars, threads, [&](size_t i, char* out) {
+        uint32_t sample = mesh.samples[i];
+        out = putText(out, "        ");
+        if (cloud) {
+            out = putDouble(out, cloud->x[sample]);
+            *out++ = ' ';
+            out = putDouble(out, cloud->y[sample]);
+            *out++ = ' ';
+            out = putDouble(out, cloud->z[sample]);
+            return putText(out, ",\n");
+        }
+        out = putUnsigned(out, sample % width * step);
+        *out++ = ' ';
+        out = putUnsigned(out, sample / width * step);
+        *out++ = ' ';
+        out = putDouble(out, depthMap.depth(sample));
+        return putText(out, ",\n");
+    });
+
+    file << "      ]\n";
+    file << "    }\n";
+    file << "    coordIndex [\n";
+
+    writeTextParallel(file, mesh.triangleCount(), vrmlFaceChars, threads, [&](size_t i, char* out) {
+        const uint32_t* triangle = mesh.triangles.data() + i * 3;
+        return putVrmlFace(out, triangle[0], triangle[1], triangle[2]);
+    });
+
+    file << "    ]\n";
+    file << "  }\n";
+    file << "}\n";
+    if (!file) {
+        throw std::runtime_error("Error writing file: " + filename);
+    }
+}
+
+void checkSampleMeshFormat(const std::string& format) {
+    if (format != "ply" && format != "stl" && format != "vrml") {
+        throw std::runtime_error("Unsupported output format: " + format);
+    }
+}
+
+// cloud — облако точек камеры уровня options.level или nullptr
+void writeSampleMesh(const AnyDepthMap& depthMap, const PointCloud* cloud, const SampleMesh& mesh,
+    const std::string& format, const std::string& outputFile, const ExportOptions& options) {
+    depthMap.level(options.level).visit([&](const auto& typed) {
+        if (format == "ply") {
+            exportSampleMeshPly(typed, cloud, mesh, outputFile + ".ply", options);
+        }
+        else if (format == "stl") {
+            exportSampleMeshStl(typed, cloud, mesh, outputFile + ".stl", options);
+        }
+        else {
+            exportSampleMeshVrml(typed, cloud, mesh, outputFile + ".vrml", options.threads, size_t(1) << options.level);
+        }
+    });
+}
+
+// Облако точек камеры для экспорта; нормали нужны только двоичному PLY с --normals
+void projectForExport(const AnyDepthMap& depthMap, const std::string& format, const ExportOptions& options,
+    PointCloud& cloud) {
+    backProjectDepthMap(depthMap, options.camera, cloud, options.level, options.threads);
+    if (format == "ply" && options.binary && options.normals) {
+        computePointCloudNormals(cloud, options.threads);
+    }
+}
+
+} // namespace
+
+void exportSampleMesh(const AnyDepthMap& depthMap, const SampleMesh& mesh, const std::string& format,
+    const std::string& outputFile, const ExportOptions& options) {
+    checkSampleMeshFormat(format);
+    if (!options.camera.valid()) {
+        writeSampleMesh(depthMap, nullptr, mesh, format, outputFile, options);
+        return;
+    }
+    PointCloud cloud;
+    projectForExport(depthMap, format, options, cloud);
+    writeSampleMesh(depthMap, &cloud, mesh, format, outputFile, options);
+}
+
+void exportDepthMap(const AnyDepthMap& depthMap, const std::string& format, const std::string& outputFile,
+    const ExportOptions& options) {
+    if (options.maxError > 0) {
+        SampleMesh mesh;
+        buildAdaptiveMesh(depthMap.level(options.level), options.maxError, mesh);
+        exportSampleMesh(depthMap, mesh, format, outputFile, options);
+        return;
+    }
+    if (options.camera.valid()) {
+        // Сетка камеры пишется так же, как адаптивная: вершины — непустые точки облака
+        checkSampleMeshFormat(format);
+        PointCloud cloud;
+        projectForExport(depthMap, format, options, cloud);
+        SampleMesh mesh;
+        buildPointCloudMesh(cloud, mesh, options.threads);
+        writeSampleMesh(depthMap, &cloud, mesh, format, outputFile, options);
+        return;
+    }
+    if (format == "ply") {
+        if (options.binary) {
+            exportToPlyBinary(depthMap, outputFile + ".ply", options.normals, options.threads, options.level);
+        }
+        else {
+            exportToPly(depthMap, outputFile + ".ply", options.threads, options.level);
+        }
+    }
+    else if (format == "stl") {
+        if (options.binary) {
+            exportToStlBinary(depthMap, outputFile + ".stl", options.threads, options.level);
+        }
+        else {
+            exportToStl(depthMap, outputFile + ".stl", options.threads, options.level);
+        }
+    }
+    else if (format == "vrml") {
+        exportToVrml(depthMap, outputFile + ".vrml", options.threads, options.level);
+    }
+    else {
+        throw std::runtime_error("Unsupported output format: " + format);
+    }
+}
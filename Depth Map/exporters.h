@@ -0,0 +1,45 @@
+﻿#ifndef EXPORTERS_H
+#define EXPORTERS_H
+
+#include <string>
+#include "camera_projection.h"
+#include "depth_map.h"
+#include "mesh.h"
+
+struct ExportOptions {
+    bool binary = false;  // Двоичный PLY/STL вместо ascii
+    bool normals = false; // Нормали вершин (пока только двоичный PLY)
+    unsigned threads = 0; // 0 — по числу ядер
+    float maxError = 0.0f; // > 0 — адаптивная сетка с этой погрешностью по глубине
+    size_t level = 0;      // Уровень пирамиды глубины (AnyDepthMap::level); x и y — в отсчётах полного разрешения
+    CameraIntrinsics camera; // При fx, fy > 0 вершины — точки камеры (camera_projection.h), а не x, y в отсчётах
+};
+
+// Экспорт сетки по всем отсчётам пишет треугольники, у которых все три вершины ненулевые,
+// и только вершины, входящие хотя бы в один из них (ValidSampleRemap).
+// Текстовые PLY, STL и VRML: полосы строк форматируются в threads потоках,
+// результат от числа потоков не зависит. level — уровень пирамиды глубины, шаг сетки 2^level
+void exportToPly(const AnyDepthMap& depthMap, const std::string& filename, unsigned threads = 0, size_t level = 0);
+
+// Потоковая запись binary_little_endian PLY: float32 позиции, цвет, опционально нормали.
+// Вершины и грани пишутся прямо из сетки через буфер фиксированного размера;
+// таблица перенумерации и число граней считаются в threads потоках.
+void exportToPlyBinary(const AnyDepthMap& depthMap, const std::string& filename, bool normals, unsigned threads = 0,
+    size_t level = 0);
+void exportToStl(const AnyDepthMap& depthMap, const std::string& filename, unsigned threads = 0, size_t level = 0);
+
+// Двоичный STL с настоящими нормалями граней. Полосы строк пишутся потоками по заранее известным смещениям.
+void exportToStlBinary(const AnyDepthMap& depthMap, const std::string& filename, unsigned threads = 0, size_t level = 0);
+void exportToVrml(const AnyDepthMap& depthMap, const std::string& filename, unsigned threads = 0, size_t level = 0);
+
+// Экспорт адаптивной сетки: только вершины из mesh.samples, нормали граней STL настоящие.
+// mesh строится по карте уровня options.level. С options.camera вершины — точки облака этого уровня.
+void exportSampleMesh(const AnyDepthMap& depthMap, const SampleMesh& mesh, const std::string& format,
+    const std::string& outputFile, const ExportOptions& options = ExportOptions());
+
+// Экспорт в формат ply/stl/vrml, расширение добавляется к outputFile. С options.camera карта
+// проецируется в облако точек, и полная сетка строится по его непустым точкам (buildPointCloudMesh)
+void exportDepthMap(const AnyDepthMap& depthMap, const std::string& format, const std::string& outputFile,
+    const ExportOptions& options = ExportOptions());
+
+#endif // EXPORTERS_H
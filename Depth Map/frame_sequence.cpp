@@ -0,0 +1,227 @@
+﻿#include "frame_sequence.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include "normal_kernel.h"
+#include "parallel.h"
+#include "trace.h"
+
+namespace {
+
+// Шаблон передаётся в snprintf, поэтому в нём ровно одно преобразование %d
+// (допустимы ширина и дополнение нулями, например %04d), остальные знаки процента — %%
+bool validFramePattern(const std::string& pattern) {
+    size_t conversions = 0;
+    for (size_t i = 0; i < pattern.size(); ++i) {
+        if (pattern[i] != '%') {
+            continue;
+        }
+        if (i + 1 < pattern.size() && pattern[i + 1] == '%') {
+            ++i;
+            continue;
+        }
+        size_t digits = i + 1;
+        while (digits < pattern.size() && pattern[digits] >= '0' && pattern[digits] <= '9') {
+            ++digits;
+        }
+        if (digits >= pattern.size() || pattern[digits] != 'd' || digits - i - 1 > 2) {
+            return false;
+        }
+        ++conversions;
+        i = digits;
+    }
+    return conversions == 1;
+}
+
+} // namespace
+
+FrameSequence::FrameSequence(const std::string& namePattern, const DepthLoadOptions& loadOptions)
+    : pattern(namePattern), options(loadOptions) {
+    if (!validFramePattern(pattern)) {
+        throw std::runtime_error("Sequence pattern must contain exactly one frame number (%d or e.g. %04d) "
+            "and write other percent signs as %%: " + pattern);
+    }
+    first = std::ifstream(frameName(0)) ? 0 : 1;
+    while (std::ifstream(frameName(first + count))) {
+        ++count;
+    }
+    if (count == 0) {
+        throw std::runtime_error("No frames found for sequence pattern: " + pattern);
+    }
+}
+
+std::string FrameSequence::frameName(size_t index) const {
+    std::vector<char> name(pattern.size() + 128);
+    std::snprintf(name.data(), name.size(), pattern.c_str(), static_cast<int>(index));
+    return name.data();
+}
+
+AnyDepthMap FrameSequence::next() {
+    TRACE_ZONE("FrameSequence::next");
+    AnyDepthMap frame = readDepthMap(frameName(first + current), options);
+    current = (current + 1) % count;
+    return frame;
+}
+
+SequenceMesh::SequenceMesh(size_t mapWidth, size_t mapHeight, float gridScale, float depthRange, size_t size)
+    : width(mapWidth), height(mapHeight), scale(gridScale), maxDepth(depthRange), tileSize(size) {
+    if (width < 2 || height < 2 || tileSize == 0 || (tileSize + 1) * (tileSize + 1) > std::numeric_limits<uint16_t>::max()) {
+        throw std::runtime_error("Invalid sequence mesh dimensions");
+    }
+    tilesX = (width - 2) / tileSize + 1;
+    tilesY = (height - 2) / tileSize + 1;
+    size_t tiles = tilesX * tilesY;
+    vertexData.assign(tiles * tileVertexCapacity() * 6, 0.0f);
+    indexData.assign(tiles * tileIndexCapacity(), 0);
+    counts.assign(tiles, 0);
+    versions.assign(tiles, 0);
+}
+
+size_t SequenceMesh::update(const AnyDepthMap& frame, unsigned threads) {
+    TRACE_ZONE("SequenceMesh::update");
+    if (frame.width() != width || frame.height() != height) {
+        throw std::runtime_error("Sequence frame size differs from the first frame");
+    }
+    // Кадры сравниваются побайтно в типе отсчёта; при смене типа пересчитывается всё
+    bool rebuildAll = frameNumber == 0 || frame.format() != previousFormat;
+    previousFormat = frame.format();
+    return frame.visit([&](const auto& typed) {
+        return updateTiles(typed, rebuildAll, workerCount(threads));
+    });
+}
+
+template <typename T>
+size_t SequenceMesh::updateTiles(const DepthMap<T>& frame, bool rebuildAll, unsigned threads) {
+    const T* data = frame.data.data();
+
+    // Тайл устарел, если изменился любой отсчёт тайла или соседний с ним (нормали края)
+    std::vector<size_t> dirty;
+    if (rebuildAll || frame.depthScale != previousScale) {
+        for (size_t tile = 0; tile < versions.size(); ++tile) {
+            dirty.push_back(tile);
+        }
+    }
+    else {
+        std::vector<char> changed(versions.size(), 0);
+        parallelForBands(tilesY, tilesY, threads, [&](size_t begin, size_t end, size_t) {
+            for (size_t ty = begin; ty < end; ++ty) {
+                size_t y0 = ty * tileSize > 0 ? ty * tileSize - 1 : 0;
+                size_t y1 = std::min(height - 1, (ty + 1) * tileSize + 1);
+                for (size_t tx = 0; tx < tilesX; ++tx) {
+                    size_t x0 = tx * tileSize > 0 ? tx * tileSize - 1 : 0;
+                    size_t x1 = std::min(width - 1, (tx + 1) * tileSize + 1);
+                    for (size_t y = y0; y <= y1; ++y) {
+                        size_t offset = (y * width + x0) * sizeof(T);
+                        if (std::memcmp(reinterpret_cast<const unsigned char*>(data) + offset, previous.data() + offset,
+                                (x1 - x0 + 1) * sizeof(T)) != 0) {
+                            changed[ty * tilesX + tx] = 1;
+                            break;
+                        }
+                    }
+                }
+            }
+        });
+        for (size_t tile = 0; tile < changed.size(); ++tile) {
+            if (changed[tile]) {
+                dirty.push_back(tile);
+            }
+        }
+    }
+
+    parallelForBands(dirty.size(), std::min<size_t>(dirty.size(), threads * 4), threads, [&](size_t begin, size_t end, size_t) {
+        std::vector<float> scratch;
+        for (size_t i = begin; i < end; ++i) {
+            rebuildTile(dirty[i], frame, scratch);
+        }
+    });
+
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    previous.assign(bytes, bytes + width * height * sizeof(T));
+    previousScale = frame.depthScale;
+    ++frameNumber;
+    for (size_t tile : dirty) {
+        versions[tile] = frameNumber;
+    }
+    return dirty.size();
+}
+
+template <typename T>
+void SequenceMesh::rebuildTile(size_t tile, const DepthMap<T>& frame, std::vector<float>& scratch) {
+    const T* data = frame.data.data();
+    size_t x0 = (tile % tilesX) * tileSize;
+    size_t y0 = (tile / tilesX) * tileSize;
+    size_t x1 = std::min(x0 + tileSize, width - 1);
+    size_t y1 = std::min(y0 + tileSize, height - 1);
+    size_t pitch = tileSize + 1;
+
+    // Строки для нормалей берутся на столбец шире тайла, чтобы край тайла не считался краем сетки
+    size_t spanBegin = x0 > 0 ? x0 - 1 : 0;
+    size_t spanEnd = std::min(x1 + 2, width);
+    size_t span = spanEnd - spanBegin;
+    scratch.resize(span * 6);
+    float* rows = scratch.data();
+    float* normals = scratch.data() + span * 3;
+    float depthScale = 1.0f / maxDepth;
+    auto convert = [&](size_t y, float* out) {
+        convertDepthRow(data + y * width + spanBegin, span, frame.depthScale, depthScale, out);
+    };
+
+    NormalKernel kernel = bestNormalKernel();
+    float* vertices = vertexData.data() + tile * tileVertexCapacity() * 6;
+    for (size_t y = y0; y <= y1; ++y) {
+        float* up = rows + ((y + 2) % 3) * span;
+        float* row = rows + (y % 3) * span;
+        float* down = rows + ((y + 1) % 3) * span;
+        if (y == y0) {
+            if (y > 0) {
+                convert(y - 1, up);
+            }
+            convert(y, row);
+        }
+        if (y + 1 < height) {
+            convert(y + 1, down);
+        }
+        computeNormalRow(kernel, y > 0 ? up : nullptr, row, y + 1 < height ? down : nullptr, span, scale,
+            normals, normals + span, normals + 2 * span);
+
+        const T* source = data + y * width;
+        float* out = vertices + (y - y0) * pitch * 6;
+        for (size_t x = x0; x <= x1; ++x, out += 6) {
+            size_t s = x - spanBegin;
+            out[0] = x * scale;
+            out[1] = y * scale;
+            out[2] = static_cast<float>(sampleDepth(source[x], frame.depthScale) / maxDepth);
+            out[3] = normals[s];
+            out[4] = normals[span + s];
+            out[5] = normals[2 * span + s];
+        }
+    }
+
+    // Те же треугольники, что и в buildGridMesh, номера вершин внутри тайла
+    uint16_t* out = indexData.data() + tile * tileIndexCapacity();
+    uint16_t* start = out;
+    for (size_t y = y0; y < y1; ++y) {
+        const T* top = data + y * width;
+        const T* bottom = top + width;
+        for (size_t x = x0; x < x1; ++x) {
+            uint16_t v1 = static_cast<uint16_t>((y - y0) * pitch + (x - x0));
+            uint16_t v2 = static_cast<uint16_t>(v1 + 1);
+            uint16_t v3 = static_cast<uint16_t>(v1 + pitch);
+            uint16_t v4 = static_cast<uint16_t>(v3 + 1);
+            if (top[x] != 0 && top[x + 1] != 0 && bottom[x] != 0) {
+                *out++ = v1;
+                *out++ = v2;
+                *out++ = v3;
+            }
+            if (bottom[x + 1] != 0 && top[x + 1] != 0 && bottom[x] != 0) {
+                *out++ = v3;
+                *out++ = v2;
+                *out++ = v4;
+            }
+        }
+    }
+    counts[tile] = static_cast<uint32_t>(out - start);
+}
@@ -0,0 +1,75 @@
+﻿#ifndef FRAME_SEQUENCE_H
+#define FRAME_SEQUENCE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "depth_map.h"
+
+// Кадры последовательности по шаблону имени с номером кадра в формате printf,
+// например "frames/DepthMap_%d.dat". Нумерация с 0 или с 1; после последнего кадра — сначала.
+class FrameSequence {
+public:
+    explicit FrameSequence(const std::string& pattern, const DepthLoadOptions& options = DepthLoadOptions());
+
+    AnyDepthMap next();
+    size_t frameCount() const { return count; }
+
+private:
+    std::string frameName(size_t index) const;
+
+    std::string pattern;
+    DepthLoadOptions options;
+    size_t first = 0;
+    size_t count = 0;
+    size_t current = 0;
+};
+
+// Сетка для последовательности кадров с постоянной раскладкой в буферах:
+// у каждого тайла свой участок вершин ((tileSize + 1)^2, x, y, z, nx, ny, nz) и индексов
+// (16 бит, номера внутри тайла). Новый кадр сравнивается с предыдущим по тайлам,
+// пересчитываются только тайлы, в которых (или на соседнем отсчёте) изменилась глубина.
+// Нормали — по центральным разностям (SIMD ядро).
+class SequenceMesh {
+public:
+    SequenceMesh(size_t width, size_t height, float scale, float maxDepth = 500.0f, size_t tileSize = 64);
+
+    // Возвращает число пересчитанных тайлов (все — для первого кадра)
+    size_t update(const AnyDepthMap& frame, unsigned threads = 0);
+
+    size_t tileCount() const { return versions.size(); }
+    size_t tileVertexCapacity() const { return (tileSize + 1) * (tileSize + 1); }
+    size_t tileIndexCapacity() const { return tileSize * tileSize * 6; }
+
+    const std::vector<float>& vertices() const { return vertexData; }
+    const std::vector<uint16_t>& indices() const { return indexData; }
+    const std::vector<uint32_t>& indexCounts() const { return counts; }
+    // Версия тайла растёт при каждом пересчёте; по ней буферы GPU находят устаревшие тайлы
+    const std::vector<uint64_t>& tileVersions() const { return versions; }
+    uint64_t frame() const { return frameNumber; }
+
+private:
+    template <typename T>
+    size_t updateTiles(const DepthMap<T>& frame, bool rebuildAll, unsigned threads);
+    template <typename T>
+    void rebuildTile(size_t tile, const DepthMap<T>& frame, std::vector<float>& scratch);
+
+    size_t width;
+    size_t height;
+    float scale;
+    float maxDepth;
+    size_t tileSize;
+    size_t tilesX;
+    size_t tilesY;
+    std::vector<unsigned char> previous; // Отсчёты предыдущего кадра в их типе
+    SampleFormat previousFormat = SampleFormat::Float64;
+    float previousScale = 1.0f;
+    std::vector<float> vertexData;
+    std::vector<uint16_t> indexData;
+    std::vector<uint32_t> counts;
+    std::vector<uint64_t> versions;
+    uint64_t frameNumber = 0;
+};
+
+#endif // FRAME_SEQUENCE_H
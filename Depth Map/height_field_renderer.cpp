@@ -0,0 +1,155 @@
+﻿#include "height_field_renderer.h"
+#include <algorithm>
+#include <stdexcept>
+#include "mesh.h"
+#include "normal_kernel.h"
+#include "parallel.h"
+#include "trace.h"
+
+namespace {
+
+// Маска непустых отсчётов: бит на отсчёт, строка начинается с нового слова, поэтому полосы
+// строк пишут разные слова. Обновляет mask на месте и возвращает, изменился ли хоть один бит
+template <typename T>
+bool updateSampleMask(const DepthMap<T>& depthMap, size_t rowWords, unsigned threads, std::vector<uint64_t>& mask) {
+    size_t width = depthMap.width;
+    size_t height = depthMap.height;
+    const T* data = depthMap.data.data();
+    unsigned workers = workerCount(threads);
+    size_t bands = workers * 4;
+    std::vector<unsigned char> changed(bands, 0);
+    parallelForBands(height, bands, workers, [&](size_t begin, size_t end, size_t band) {
+        unsigned char bandChanged = 0;
+        for (size_t y = begin; y < end; ++y) {
+            const T* row = data + y * width;
+            uint64_t* words = mask.data() + y * rowWords;
+            for (size_t word = 0; word < rowWords; ++word) {
+                size_t first = word * 64;
+                size_t last = std::min(first + 64, width);
+                uint64_t bits = 0;
+                for (size_t x = first; x < last; ++x) {
+                    bits |= static_cast<uint64_t>(row[x] != 0) << (x - first);
+                }
+                bandChanged |= bits != words[word];
+                words[word] = bits;
+            }
+        }
+        changed[band] = bandChanged;
+    });
+    for (unsigned char bandChanged : changed) {
+        if (bandChanged) {
+            return true;
+        }
+    }
+    return false;
+}
+
+} // namespace
+
+HeightFieldRenderer::HeightFieldRenderer(const AnyDepthMap& depthMap, float depthRange, unsigned threadCount)
+    : width(depthMap.width()), height(depthMap.height()), maxDepth(depthRange), threads(threadCount) {
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &EBO);
+    glGenTextures(1, &texture);
+
+    // Атрибутов нет: вершина — только номер отсчёта
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBindVertexArray(0);
+
+    // Без мип-уровней текстура неполна при фильтре по умолчанию, и texelFetch вернёт 0
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    upload(depthMap);
+}
+
+HeightFieldRenderer::~HeightFieldRenderer() {
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteBuffers(1, &EBO);
+    glDeleteTextures(1, &texture);
+}
+
+size_t HeightFieldRenderer::upload(const AnyDepthMap& depthMap) {
+    TRACE_ZONE("HeightFieldRenderer::upload");
+    if (depthMap.width() != width || depthMap.height() != height) {
+        throw std::runtime_error("Height field frame size differs from the first frame");
+    }
+
+    // Треугольники зависят только от пропусков: индексы пересобираются, если изменилась маска
+    size_t rowWords = (width + 63) / 64;
+    sampleMask.resize(rowWords * height);
+    bool changed = false;
+    depthMap.visit([&](const auto& typed) {
+        changed = updateSampleMask(typed, rowWords, threads, sampleMask);
+    });
+
+    size_t copied = 0;
+    if (!allocated || changed) {
+        buildSampleGridIndices(depthMap, indices, threads);
+        glBindVertexArray(VAO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_DYNAMIC_DRAW);
+        glBindVertexArray(0);
+        copied += indices.size() * sizeof(uint32_t);
+    }
+
+    depthMap.visit([&](const auto& typed) {
+        copied += uploadSamples(typed);
+    });
+    return copied;
+}
+
+size_t HeightFieldRenderer::uploadSamples(const DepthMap<double>& depthMap) {
+    converted.resize(width * height);
+    const double* data = depthMap.data.data();
+    unsigned workers = workerCount(threads);
+    parallelForBands(height, workers * 4, workers, [&](size_t begin, size_t end, size_t) {
+        convertDepthRow(data + begin * width, (end - begin) * width, 1.0f, 1.0f / maxDepth, converted.data() + begin * width);
+    });
+    scale = 1.0f;
+    return uploadTexture(SampleFormat::Float64, GL_R32F, GL_FLOAT, converted.data(), converted.size() * sizeof(float));
+}
+
+size_t HeightFieldRenderer::uploadSamples(const DepthMap<float>& depthMap) {
+    scale = 1.0f / maxDepth;
+    return uploadTexture(SampleFormat::Float32, GL_R32F, GL_FLOAT, depthMap.data.data(), depthMap.data.size() * sizeof(float));
+}
+
+size_t HeightFieldRenderer::uploadSamples(const DepthMap<uint16_t>& depthMap) {
+    // R16 нормирован: в шейдере значение v / 65535
+    scale = 65535.0f * depthMap.depthScale / maxDepth;
+    return uploadTexture(SampleFormat::UInt16, GL_R16, GL_UNSIGNED_SHORT, depthMap.data.data(),
+        depthMap.data.size() * sizeof(uint16_t));
+}
+
+size_t HeightFieldRenderer::uploadTexture(SampleFormat sampleFormat, GLenum internalFormat, GLenum type,
+    const void* data, size_t bytes) {
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    // Хранилище выделяется заново только при смене типа отсчёта
+    if (!allocated || sampleFormat != format) {
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, static_cast<GLsizei>(width), static_cast<GLsizei>(height), 0,
+            GL_RED, type, data);
+        allocated = true;
+        format = sampleFormat;
+    }
+    else {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, static_cast<GLsizei>(width), static_cast<GLsizei>(height), GL_RED, type, data);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return bytes;
+}
+
+void HeightFieldRenderer::draw() const {
+    TRACE_ZONE("HeightFieldRenderer::draw");
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glBindVertexArray(VAO);
+    glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(indices.size()), GL_UNSIGNED_INT, nullptr);
+    glBindVertexArray(0);
+}
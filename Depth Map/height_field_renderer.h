@@ -0,0 +1,53 @@
+﻿#ifndef HEIGHT_FIELD_RENDERER_H
+#define HEIGHT_FIELD_RENDERER_H
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "depth_map.h"
+
+// Сетка по карте высот: в GPU только глубина отсчётов (текстура) и индексы треугольников
+// по номерам отсчётов y * width + x. Позицию вершины вершинный шейдер восстанавливает
+// из gl_VertexID, нормаль считает по соседним текселям. float карта копируется в R32F,
+// uint16 — в R16 без преобразования, double переводится во float (R32F).
+class HeightFieldRenderer {
+public:
+    HeightFieldRenderer(const AnyDepthMap& depthMap, float maxDepth = 500.0f, unsigned threads = 0);
+    ~HeightFieldRenderer();
+
+    // Новый кадр того же размера; индексы пересобираются и загружаются, только если изменилась
+    // маска пропусков.
+    // Возвращает число скопированных байт
+    size_t upload(const AnyDepthMap& depthMap);
+    void draw() const;
+
+    // Множитель значения текстуры до глубины в единицах сетки (глубина / maxDepth)
+    float heightScale() const { return scale; }
+    size_t triangleCount() const { return indices.size() / 3; }
+
+private:
+    HeightFieldRenderer(const HeightFieldRenderer&) = delete;
+    HeightFieldRenderer& operator=(const HeightFieldRenderer&) = delete;
+
+    size_t uploadSamples(const DepthMap<double>& depthMap);
+    size_t uploadSamples(const DepthMap<float>& depthMap);
+    size_t uploadSamples(const DepthMap<uint16_t>& depthMap);
+    size_t uploadTexture(SampleFormat sampleFormat, GLenum internalFormat, GLenum type, const void* data, size_t bytes);
+
+    GLuint VAO = 0;
+    GLuint EBO = 0;
+    GLuint texture = 0;
+    size_t width;
+    size_t height;
+    float maxDepth;
+    unsigned threads;
+    bool allocated = false;
+    SampleFormat format = SampleFormat::Float64;
+    float scale = 1.0f;
+    std::vector<uint32_t> indices;
+    std::vector<uint64_t> sampleMask; // Непустые отсчёты прошлого кадра, по строкам из целых слов
+    std::vector<float> converted; // Отсчёты double, переведённые во float
+};
+
+#endif // HEIGHT_FIELD_RENDERER_H
@@ -0,0 +1,293 @@
+﻿#include "image_writer.h"
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include "trace.h"
+
+namespace {
+
+std::vector<uint32_t> makeCrcTable() {
+    std::vector<uint32_t> table(256);
+    for (uint32_t n = 0; n < 256; ++n) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; ++k) {
+            c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        table[n] = c;
+    }
+    return table;
+}
+
+uint32_t crc32(const uint8_t* data, size_t size) {
+    static const std::vector<uint32_t> table = makeCrcTable();
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < size; ++i) {
+        crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+uint32_t adler32(const uint8_t* data, size_t size) {
+    uint32_t a = 1;
+    uint32_t b = 0;
+    while (size > 0) {
+        size_t block = std::min<size_t>(size, 5552);
+        for (size_t i = 0; i < block; ++i) {
+            a += data[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+        data += block;
+        size -= block;
+    }
+    return (b << 16) | a;
+}
+
+// Поток бит deflate: младшие биты первыми
+class BitWriter {
+public:
+    explicit BitWriter(std::vector<uint8_t>& output) : out(output) {}
+
+    void put(uint32_t value, int count) {
+        bits |= static_cast<uint64_t>(value) << used;
+        used += count;
+        while (used >= 8) {
+            out.push_back(static_cast<uint8_t>(bits));
+            bits >>= 8;
+            used -= 8;
+        }
+    }
+
+    // Коды Хаффмана пишутся старшим битом вперёд
+    void putCode(uint32_t code, int length) {
+        uint32_t reversed = 0;
+        for (int i = 0; i < length; ++i) {
+            reversed = (reversed << 1) | ((code >> i) & 1);
+        }
+        put(reversed, length);
+    }
+
+    void align() {
+        if (used > 0) {
+            put(0, 8 - used);
+        }
+    }
+
+private:
+    std::vector<uint8_t>& out;
+    uint64_t bits = 0;
+    int used = 0;
+};
+
+void putLiteral(BitWriter& writer, unsigned symbol) {
+    if (symbol < 144) {
+        writer.putCode(0x30 + symbol, 8);
+    }
+    else if (symbol < 256) {
+        writer.putCode(0x190 + symbol - 144, 9);
+    }
+    else if (symbol < 280) {
+        writer.putCode(symbol - 256, 7);
+    }
+    else {
+        writer.putCode(0xC0 + symbol - 280, 8);
+    }
+}
+
+const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+const uint16_t distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+const uint8_t distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+void putMatch(BitWriter& writer, size_t length, size_t distance) {
+    int code = 28;
+    while (lengthBase[code] > length) {
+        --code;
+    }
+    putLiteral(writer, 257 + code);
+    writer.put(static_cast<uint32_t>(length - lengthBase[code]), lengthExtra[code]);
+
+    code = 29;
+    while (distanceBase[code] > distance) {
+        --code;
+    }
+    writer.putCode(code, 5);
+    writer.put(static_cast<uint32_t>(distance - distanceBase[code]), distanceExtra[code]);
+}
+
+// Поток zlib: один блок с фиксированными кодами, совпадения ищутся по хешу трёх байт
+std::vector<uint8_t> deflate(const std::vector<uint8_t>& data) {
+    const size_t window = 32768;
+    const size_t maxMatch = 258;
+    const int maxChain = 16;
+    const int hashBits = 15;
+
+    std::vector<uint8_t> out = { 0x78, 0x01 };
+    BitWriter writer(out);
+    writer.put(1, 1); // Последний блок
+    writer.put(1, 2); // Фиксированные коды
+
+    std::vector<int64_t> head(size_t(1) << hashBits, -1);
+    std::vector<int64_t> previous(window, -1);
+    auto hashAt = [&](size_t i) {
+        uint32_t value = data[i] | (data[i + 1] << 8) | (data[i + 2] << 16);
+        return (value * 2654435761u) >> (32 - hashBits);
+    };
+    auto insert = [&](size_t i) {
+        if (i + 2 < data.size()) {
+            uint32_t hash = hashAt(i);
+            previous[i % window] = head[hash];
+            head[hash] = static_cast<int64_t>(i);
+        }
+    };
+
+    size_t i = 0;
+    while (i < data.size()) {
+        size_t bestLength = 0;
+        size_t bestDistance = 0;
+        if (i + 2 < data.size()) {
+            int64_t candidate = head[hashAt(i)];
+            size_t limit = std::min(maxMatch, data.size() - i);
+            for (int chain = 0; chain < maxChain && candidate >= 0 && i - static_cast<size_t>(candidate) <= window; ++chain) {
+                size_t length = 0;
+                while (length < limit && data[candidate + length] == data[i + length]) {
+                    ++length;
+                }
+                if (length > bestLength) {
+                    bestLength = length;
+                    bestDistance = i - static_cast<size_t>(candidate);
+                    if (length == limit) {
+                        break;
+                    }
+                }
+                int64_t next = previous[candidate % window];
+                if (next >= candidate) {
+                    break;
+                }
+                candidate = next;
+            }
+        }
+
+        if (bestLength >= 3) {
+            putMatch(writer, bestLength, bestDistance);
+            for (size_t k = 0; k < bestLength; ++k) {
+                insert(i + k);
+            }
+            i += bestLength;
+        }
+        else {
+            putLiteral(writer, data[i]);
+            insert(i);
+            ++i;
+        }
+    }
+    putLiteral(writer, 256);
+    writer.align();
+
+    uint32_t checksum = adler32(data.data(), data.size());
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<uint8_t>(checksum >> shift));
+    }
+    return out;
+}
+
+void putBigEndian(std::vector<uint8_t>& out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<uint8_t>(value >> shift));
+    }
+}
+
+void writeChunk(std::ofstream& file, const char* type, const std::vector<uint8_t>& payload) {
+    std::vector<uint8_t> chunk;
+    putBigEndian(chunk, static_cast<uint32_t>(payload.size()));
+    chunk.insert(chunk.end(), type, type + 4);
+    chunk.insert(chunk.end(), payload.begin(), payload.end());
+    putBigEndian(chunk, crc32(chunk.data() + 4, chunk.size() - 4));
+    file.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+}
+
+bool endsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+} // namespace
+
+void writePpm(const RgbImage& image, const std::string& filename) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open file for writing: " + filename);
+    }
+    file << "P6\n" << image.width << " " << image.height << "\n255\n";
+    file.write(reinterpret_cast<const char*>(image.pixels.data()), image.pixels.size());
+}
+
+void writePng(const RgbImage& image, const std::string& filename) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Failed to open file for writing: " + filename);
+    }
+
+    // Для каждой строки фильтр с наименьшей суммой модулей остатков
+    size_t stride = image.width * 3;
+    std::vector<uint8_t> filtered;
+    filtered.reserve((stride + 1) * image.height);
+    std::vector<uint8_t> candidate[3];
+    for (size_t y = 0; y < image.height; ++y) {
+        const uint8_t* row = image.pixels.data() + y * stride;
+        const uint8_t* up = y > 0 ? row - stride : nullptr;
+        size_t bestCost = 0;
+        int best = 0;
+        for (int filter = 0; filter < 3; ++filter) {
+            candidate[filter].resize(stride);
+            size_t cost = 0;
+            for (size_t i = 0; i < stride; ++i) {
+                uint8_t predicted = 0;
+                if (filter == 1 && i >= 3) {
+                    predicted = row[i - 3];
+                }
+                else if (filter == 2 && up) {
+                    predicted = up[i];
+                }
+                uint8_t residual = static_cast<uint8_t>(row[i] - predicted);
+                candidate[filter][i] = residual;
+                cost += residual < 128 ? residual : 256 - residual;
+            }
+            if (filter == 0 || cost < bestCost) {
+                bestCost = cost;
+                best = filter;
+            }
+        }
+        filtered.push_back(static_cast<uint8_t>(best));
+        filtered.insert(filtered.end(), candidate[best].begin(), candidate[best].end());
+    }
+
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+    std::vector<uint8_t> header;
+    putBigEndian(header, static_cast<uint32_t>(image.width));
+    putBigEndian(header, static_cast<uint32_t>(image.height));
+    header.push_back(8); // Бит на канал
+    header.push_back(2); // RGB
+    header.push_back(0);
+    header.push_back(0);
+    header.push_back(0);
+    writeChunk(file, "IHDR", header);
+    writeChunk(file, "IDAT", deflate(filtered));
+    writeChunk(file, "IEND", std::vector<uint8_t>());
+}
+
+void writeImage(const RgbImage& image, const std::string& filename) {
+    TRACE_ZONE("writeImage");
+    if (endsWith(filename, ".png")) {
+        writePng(image, filename);
+    }
+    else {
+        writePpm(image, filename);
+    }
+}
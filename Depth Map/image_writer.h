@@ -0,0 +1,25 @@
+﻿#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Изображение RGB, 8 бит на канал, строки сверху вниз
+struct RgbImage {
+    size_t width = 0;
+    size_t height = 0;
+    std::vector<uint8_t> pixels;
+};
+
+void writePpm(const RgbImage& image, const std::string& filename);
+
+// PNG без внешних библиотек: фильтр строки (None, Sub или Up) и deflate
+// с фиксированными кодами Хаффмана
+void writePng(const RgbImage& image, const std::string& filename);
+
+// Формат по расширению: .png, иначе PPM
+void writeImage(const RgbImage& image, const std::string& filename);
+
+#endif // IMAGE_WRITER_H
@@ -0,0 +1,37 @@
+﻿#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+// Файл, отображённый в память только для чтения (mmap / MapViewOfFile)
+class MappedFile {
+public:
+    MappedFile() = default;
+    explicit MappedFile(const std::string& filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&& other) noexcept;
+    MappedFile& operator=(MappedFile&& other) noexcept;
+
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+
+    // Подсказка системе: страницы диапазона больше не нужны и могут быть вытеснены
+    // (файл только для чтения, повторное обращение снова прочитает их с диска)
+    void release(const void* address, size_t size) const;
+
+private:
+    void close();
+
+    const unsigned char* bytes = nullptr;
+    size_t length = 0;
+#ifdef _WIN32
+    void* fileHandle = nullptr;
+    void* mappingHandle = nullptr;
+#endif
+};
+
+#endif // MAPPED_FILE_H
@@ -0,0 +1,492 @@
+﻿#include "mesh.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include "normal_kernel.h"
+#include "parallel.h"
+#include "trace.h"
+
+namespace {
+
+// Как glm::normalize: v * (1 / sqrt(dot(v, v)))
+void normalizeVector(float v[3]) {
+    float inverseLength = 1.0f / std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+    v[0] *= inverseLength;
+    v[1] *= inverseLength;
+    v[2] *= inverseLength;
+}
+
+struct DepthRange {
+    float minZ = std::numeric_limits<float>::max();
+    float maxZ = std::numeric_limits<float>::lowest();
+
+    void add(float z) {
+        if (z != 0) {
+            minZ = std::min(minZ, z);
+            maxZ = std::max(maxZ, z);
+        }
+    }
+    void merge(const DepthRange& other) {
+        minZ = std::min(minZ, other.minZ);
+        maxZ = std::max(maxZ, other.maxZ);
+    }
+};
+
+size_t bandCount(size_t rows, unsigned threads) {
+    return std::max<size_t>(1, std::min<size_t>(rows, static_cast<size_t>(threads) * 4));
+}
+
+// Число треугольников квадов строк [begin, end) по правилу generateDepthMapVertices
+template <typename T>
+size_t countGridTriangles(const T* data, size_t width, size_t begin, size_t end) {
+    size_t count = 0;
+    for (size_t y = begin; y < end; ++y) {
+        const T* top = data + y * width;
+        const T* bottom = top + width;
+        for (size_t x = 0; x + 1 < width; ++x) {
+            bool z2 = top[x + 1] != 0;
+            bool z3 = bottom[x] != 0;
+            count += (z2 && z3) * ((top[x] != 0) + (bottom[x + 1] != 0));
+        }
+    }
+    return count;
+}
+
+// Префиксные суммы по полосам: offsets[band] — начало полосы в общем буфере
+void prefixSum(std::vector<size_t>& offsets) {
+    size_t total = 0;
+    for (size_t& value : offsets) {
+        size_t count = value;
+        value = total;
+        total += count;
+    }
+}
+
+template <typename T>
+void writeDepthMapTriangles(const DepthMap<T>& depthMap, std::vector<float>& vertices, float scale, float maxDepth, unsigned threads) {
+    size_t width = depthMap.width;
+    size_t height = depthMap.height;
+    const T* data = depthMap.data.data();
+    float depthScale = depthMap.depthScale;
+    size_t quadRows = height > 0 ? height - 1 : 0;
+    threads = workerCount(threads);
+    size_t bands = bandCount(quadRows, threads);
+
+    // Первый проход: треугольники каждой полосы, затем смещения полос в буфере
+    std::vector<size_t> offsets(bands + 1, 0);
+    parallelForBands(quadRows, bands, threads, [&](size_t begin, size_t end, size_t band) {
+        offsets[band] = countGridTriangles(data, width, begin, end);
+    });
+    prefixSum(offsets);
+    size_t base = vertices.size();
+    vertices.resize(base + offsets[bands] * 9);
+
+    // Второй проход: каждая полоса пишет свои треугольники
+    parallelForBands(quadRows, bands, threads, [&](size_t begin, size_t end, size_t band) {
+        float* out = vertices.data() + base + offsets[band] * 9;
+        for (size_t y = begin; y < end; ++y) {
+            const T* top = data + y * width;
+            const T* bottom = top + width;
+            float y0 = y * scale;
+            float y1 = (y + 1) * scale;
+            for (size_t x = 0; x + 1 < width; ++x) {
+                float z1 = static_cast<float>(sampleDepth(top[x], depthScale) / maxDepth);
+                float z2 = static_cast<float>(sampleDepth(top[x + 1], depthScale) / maxDepth);
+                float z3 = static_cast<float>(sampleDepth(bottom[x], depthScale) / maxDepth);
+                float z4 = static_cast<float>(sampleDepth(bottom[x + 1], depthScale) / maxDepth);
+
+                float x0 = x * scale;
+                float x1 = (x + 1) * scale;
+                if (z1 != 0 && z2 != 0 && z3 != 0) {
+                    *out++ = x0; *out++ = y0; *out++ = z1;
+                    *out++ = x1; *out++ = y0; *out++ = z2;
+                    *out++ = x0; *out++ = y1; *out++ = z3;
+                }
+                if (z4 != 0 && z2 != 0 && z3 != 0) {
+                    *out++ = x0; *out++ = y1; *out++ = z3;
+                    *out++ = x1; *out++ = y0; *out++ = z2;
+                    *out++ = x1; *out++ = y1; *out++ = z4;
+                }
+            }
+        }
+    });
+}
+
+} // namespace
+
+void generateDepthMapVertices(const AnyDepthMap& depthMap, std::vector<float>& vertices, float scale, float maxDepth, unsigned threads) {
+    TRACE_ZONE("generateDepthMapVertices");
+    depthMap.visit([&](const auto& typed) {
+        writeDepthMapTriangles(typed, vertices, scale, maxDepth, threads);
+    });
+}
+
+void generateNormals(const std::vector<float>& vertices, std::vector<float>& normals, unsigned threads) {
+    TRACE_ZONE("generateNormals");
+    size_t triangles = vertices.size() / 9;
+    size_t base = normals.size();
+    normals.resize(base + triangles * 9);
+    threads = workerCount(threads);
+
+    parallelForBands(triangles, static_cast<size_t>(threads) * 4, threads, [&](size_t begin, size_t end, size_t) {
+        for (size_t t = begin; t < end; ++t) {
+            const float* v = vertices.data() + t * 9;
+            float edge1[3] = { v[3] - v[0], v[4] - v[1], v[5] - v[2] };
+            float edge2[3] = { v[6] - v[0], v[7] - v[1], v[8] - v[2] };
+            float normal[3] = {
+                edge1[1] * edge2[2] - edge2[1] * edge1[2],
+                edge1[2] * edge2[0] - edge2[2] * edge1[0],
+                edge1[0] * edge2[1] - edge2[0] * edge1[1]
+            };
+            normalizeVector(normal);
+
+            float* out = normals.data() + base + t * 9;
+            for (int j = 0; j < 3; ++j) {
+                out[j * 3] = normal[0];
+                out[j * 3 + 1] = normal[1];
+                out[j * 3 + 2] = normal[2];
+            }
+        }
+    });
+}
+
+namespace {
+
+// Номер вершины для каждого отсчёта строки (или -1 для нулевой глубины)
+template <typename T>
+void remapRow(const T* row, size_t width, uint32_t first, std::vector<int64_t>& remap) {
+    uint32_t next = first;
+    for (size_t x = 0; x < width; ++x) {
+        remap[x] = row[x] != 0 ? static_cast<int64_t>(next++) : -1;
+    }
+}
+
+// Индексы квадов строк [begin, end), начиная с out
+template <typename T, typename Index>
+void emitGridIndices(const T* data, size_t width, const std::vector<uint32_t>& rowStart,
+    size_t begin, size_t end, Index* out) {
+    std::vector<int64_t> top(width), bottom(width);
+    remapRow(data + begin * width, width, rowStart[begin], bottom);
+    for (size_t y = begin; y < end; ++y) {
+        top.swap(bottom);
+        remapRow(data + (y + 1) * width, width, rowStart[y + 1], bottom);
+        for (size_t x = 0; x + 1 < width; ++x) {
+            int64_t v1 = top[x];
+            int64_t v2 = top[x + 1];
+            int64_t v3 = bottom[x];
+            int64_t v4 = bottom[x + 1];
+            if (v1 >= 0 && v2 >= 0 && v3 >= 0) {
+                *out++ = static_cast<Index>(v1);
+                *out++ = static_cast<Index>(v2);
+                *out++ = static_cast<Index>(v3);
+            }
+            if (v4 >= 0 && v2 >= 0 && v3 >= 0) {
+                *out++ = static_cast<Index>(v3);
+                *out++ = static_cast<Index>(v2);
+                *out++ = static_cast<Index>(v4);
+            }
+        }
+    }
+}
+
+template <typename T, typename Index>
+void buildGridIndices(const T* data, size_t width, size_t height, const std::vector<uint32_t>& rowStart,
+    unsigned threads, std::vector<Index>& indices) {
+    size_t quadRows = height > 0 ? height - 1 : 0;
+    size_t bands = bandCount(quadRows, threads);
+    std::vector<size_t> offsets(bands + 1, 0);
+    parallelForBands(quadRows, bands, threads, [&](size_t begin, size_t end, size_t band) {
+        offsets[band] = countGridTriangles(data, width, begin, end);
+    });
+    prefixSum(offsets);
+    indices.resize(offsets[bands] * 3);
+    parallelForBands(quadRows, bands, threads, [&](size_t begin, size_t end, size_t band) {
+        emitGridIndices(data, width, rowStart, begin, end, indices.data() + offsets[band] * 3);
+    });
+}
+
+// Позиции вершин строк [begin, end); нормали дописывает computeGridNormals
+template <typename T>
+void writeGridVertices(const DepthMap<T>& depthMap, const std::vector<uint32_t>& rowStart, float scale, float maxDepth,
+    size_t begin, size_t end, float* vertices, DepthRange& range) {
+    size_t width = depthMap.width;
+    const T* data = depthMap.data.data();
+    for (size_t y = begin; y < end; ++y) {
+        const T* row = data + y * width;
+        float* out = vertices + static_cast<size_t>(rowStart[y]) * 6;
+        for (size_t x = 0; x < width; ++x) {
+            if (row[x] == 0) {
+                continue;
+            }
+            float z = static_cast<float>(sampleDepth(row[x], depthMap.depthScale) / maxDepth);
+            range.add(z);
+            out[0] = x * scale;
+            out[1] = y * scale;
+            out[2] = z;
+            out += 6;
+        }
+    }
+}
+
+template <typename T>
+void buildTypedGridMesh(const DepthMap<T>& depthMap, GridMesh& mesh, float scale, float maxDepth, unsigned threads,
+    VertexNormals normals, bool withIndices) {
+    size_t width = depthMap.width;
+    size_t height = depthMap.height;
+    const T* data = depthMap.data.data();
+    threads = workerCount(threads);
+    size_t bands = bandCount(height, threads);
+
+    // Первый проход: число вершин в каждой строке
+    std::vector<uint32_t> rowStart(height + 1, 0);
+    parallelForBands(height, bands, threads, [&](size_t begin, size_t end, size_t) {
+        for (size_t y = begin; y < end; ++y) {
+            const T* row = data + y * width;
+            uint32_t valid = 0;
+            for (size_t x = 0; x < width; ++x) {
+                valid += row[x] != 0;
+            }
+            rowStart[y + 1] = valid;
+        }
+    });
+    for (size_t y = 0; y < height; ++y) {
+        rowStart[y + 1] += rowStart[y];
+    }
+    mesh.vertexCount = rowStart[height];
+    mesh.vertices.resize(mesh.vertexCount * 6);
+
+    // Второй проход: позиции
+    std::vector<DepthRange> ranges(bands);
+    parallelForBands(height, bands, threads, [&](size_t begin, size_t end, size_t band) {
+        writeGridVertices(depthMap, rowStart, scale, maxDepth, begin, end, mesh.vertices.data(), ranges[band]);
+    });
+    DepthRange range;
+    for (const DepthRange& bandRange : ranges) {
+        range.merge(bandRange);
+    }
+    mesh.minZ = mesh.vertexCount ? range.minZ : 0.0f;
+    mesh.maxZ = mesh.vertexCount ? range.maxZ : 0.0f;
+
+    // Третий проход: нормали в те же вершины, через шаг 6 float
+    NormalOutput output;
+    output.data = mesh.vertices.data() + 3;
+    output.stride = 6;
+    output.rowStart = rowStart.data();
+    if (normals == VertexNormals::AreaWeighted) {
+        computeSmoothGridNormals(depthMap, scale, 1.0f / maxDepth, output, threads);
+    }
+    else {
+        computeGridNormals(depthMap, scale, 1.0f / maxDepth, output, threads);
+    }
+
+    // Четвёртый проход: индексы, 16 бит если хватает
+    mesh.indices16.clear();
+    mesh.indices32.clear();
+    if (!withIndices) {
+        return;
+    }
+    if (mesh.vertexCount <= std::numeric_limits<uint16_t>::max()) {
+        buildGridIndices(data, width, height, rowStart, threads, mesh.indices16);
+    }
+    else {
+        buildGridIndices(data, width, height, rowStart, threads, mesh.indices32);
+    }
+}
+
+} // namespace
+
+void buildGridMesh(const AnyDepthMap& depthMap, GridMesh& mesh, float scale, float maxDepth, unsigned threads,
+    VertexNormals normals) {
+    TRACE_ZONE("buildGridMesh");
+    // Начала строк и номера вершин 32-битные
+    if (depthMap.size() >= ValidSampleRemap::NoVertex) {
+        throw std::runtime_error("Depth map is too large for 32-bit vertex indices");
+    }
+    depthMap.visit([&](const auto& typed) {
+        buildTypedGridMesh(typed, mesh, scale, maxDepth, threads, normals, true);
+    });
+}
+
+void buildGridVertices(const AnyDepthMap& depthMap, GridMesh& mesh, float scale, float maxDepth, unsigned threads,
+    VertexNormals normals) {
+    TRACE_ZONE("buildGridVertices");
+    if (depthMap.size() >= ValidSampleRemap::NoVertex) {
+        throw std::runtime_error("Depth map is too large for 32-bit vertex indices");
+    }
+    depthMap.visit([&](const auto& typed) {
+        buildTypedGridMesh(typed, mesh, scale, maxDepth, threads, normals, false);
+    });
+}
+
+void buildGridMesh(const AnyDepthMap& depthMap, size_t level, GridMesh& mesh, float scale, float maxDepth,
+    unsigned threads, VertexNormals normals) {
+    buildGridMesh(depthMap.level(level), mesh, scale * static_cast<float>(size_t(1) << level), maxDepth, threads, normals);
+}
+
+namespace {
+
+template <typename T>
+void buildTypedSampleRemap(const DepthMap<T>& depthMap, QuadDiagonal diagonal, ValidSampleRemap& remap,
+    unsigned threads) {
+    size_t width = depthMap.width;
+    size_t height = depthMap.height;
+    const T* data = depthMap.data.data();
+    threads = workerCount(threads);
+    size_t bands = bandCount(height, threads);
+
+    // Первый проход: маска отсчётов с треугольниками (0 или NoVertex) и их число в строках,
+    // затем префиксная сумма по строкам
+    remap.rowStart.assign(height + 1, 0);
+    remap.vertexOf.resize(width * height);
+    parallelForBands(height, bands, threads, [&](size_t begin, size_t end, size_t) {
+        std::vector<unsigned char> used(width);
+        for (size_t y = begin; y < end; ++y) {
+            const T* row = data + y * width;
+            markUsedSamples(y > 0 ? row - width : nullptr, row, y + 1 < height ? row + width : nullptr, width, diagonal,
+                used.data());
+            uint32_t* out = remap.vertexOf.data() + y * width;
+            uint32_t count = 0;
+            for (size_t x = 0; x < width; ++x) {
+                out[x] = used[x] ? 0 : ValidSampleRemap::NoVertex;
+                count += used[x];
+            }
+            remap.rowStart[y + 1] = count;
+        }
+    });
+    for (size_t y = 0; y < height; ++y) {
+        remap.rowStart[y + 1] += remap.rowStart[y];
+    }
+
+    // Второй проход: каждая строка нумерует свои вершины со своего начала
+    parallelForBands(height, bands, threads, [&](size_t begin, size_t end, size_t) {
+        for (size_t y = begin; y < end; ++y) {
+            uint32_t* out = remap.vertexOf.data() + y * width;
+            uint32_t next = remap.rowStart[y];
+            for (size_t x = 0; x < width; ++x) {
+                if (out[x] != ValidSampleRemap::NoVertex) {
+                    out[x] = next++;
+                }
+            }
+        }
+    });
+}
+
+// Индексы квадов строк [begin, end) по номерам отсчётов, начиная с out
+template <typename T>
+void emitSampleIndices(const T* data, size_t width, size_t begin, size_t end, uint32_t* out) {
+    std::vector<uint32_t> top(width), bottom(width);
+    auto sampleRow = [&](size_t y, std::vector<uint32_t>& row) {
+        const T* source = data + y * width;
+        for (size_t x = 0; x < width; ++x) {
+            row[x] = source[x] != 0 ? static_cast<uint32_t>(y * width + x) : ValidSampleRemap::NoVertex;
+        }
+    };
+    sampleRow(begin, bottom);
+    for (size_t y = begin; y < end; ++y) {
+        top.swap(bottom);
+        sampleRow(y + 1, bottom);
+        forEachQuadFace(top.data(), bottom.data(), width, QuadDiagonal::TopRight, [&](uint32_t v1, uint32_t v2, uint32_t v3) {
+            *out++ = v1;
+            *out++ = v2;
+            *out++ = v3;
+        });
+    }
+}
+
+template <typename T>
+void buildTypedSampleGridIndices(const DepthMap<T>& depthMap, std::vector<uint32_t>& indices, unsigned threads) {
+    size_t width = depthMap.width;
+    size_t quadRows = depthMap.height > 0 ? depthMap.height - 1 : 0;
+    const T* data = depthMap.data.data();
+    indices.clear();
+    if (quadRows == 0) {
+        return;
+    }
+    threads = workerCount(threads);
+    size_t bands = bandCount(quadRows, threads);
+    std::vector<size_t> offsets(bands + 1, 0);
+    parallelForBands(quadRows, bands, threads, [&](size_t begin, size_t end, size_t band) {
+        offsets[band] = countGridTriangles(data, width, begin, end);
+    });
+    prefixSum(offsets);
+    indices.resize(offsets[bands] * 3);
+    parallelForBands(quadRows, bands, threads, [&](size_t begin, size_t end, size_t band) {
+        emitSampleIndices(data, width, begin, end, indices.data() + offsets[band] * 3);
+    });
+}
+
+template <typename T>
+void buildTypedSampleGridMesh(const DepthMap<T>& depthMap, const SampleMesh& sampleMesh, GridMesh& mesh, float scale,
+    float maxDepth) {
+    size_t width = depthMap.width;
+    mesh.vertexCount = sampleMesh.samples.size();
+    mesh.vertices.resize(mesh.vertexCount * 6);
+
+    // Отсчёты отсортированы, поэтому нормали строк считаются подряд
+    SmoothNormalRows rows(depthMap, scale, 1.0f / maxDepth);
+    DepthRange range;
+    size_t currentRow = static_cast<size_t>(-1);
+    float* out = mesh.vertices.data();
+    for (uint32_t sample : sampleMesh.samples) {
+        size_t y = sample / width;
+        size_t x = sample % width;
+        if (y != currentRow) {
+            rows.compute(y);
+            currentRow = y;
+        }
+        float z = static_cast<float>(depthMap.depth(sample) / maxDepth);
+        range.add(z);
+        out[0] = x * scale;
+        out[1] = y * scale;
+        out[2] = z;
+        out[3] = rows.nx()[x];
+        out[4] = rows.ny()[x];
+        out[5] = rows.nz()[x];
+        out += 6;
+    }
+    mesh.minZ = mesh.vertexCount ? range.minZ : 0.0f;
+    mesh.maxZ = mesh.vertexCount ? range.maxZ : 0.0f;
+
+    mesh.indices16.clear();
+    mesh.indices32.clear();
+    if (mesh.vertexCount <= std::numeric_limits<uint16_t>::max()) {
+        mesh.indices16.reserve(sampleMesh.triangles.size());
+        for (uint32_t index : sampleMesh.triangles) {
+            mesh.indices16.push_back(static_cast<uint16_t>(index));
+        }
+    }
+    else {
+        mesh.indices32 = sampleMesh.triangles;
+    }
+}
+
+} // namespace
+
+void buildSampleGridMesh(const AnyDepthMap& depthMap, const SampleMesh& sampleMesh, GridMesh& mesh, float scale,
+    float maxDepth) {
+    depthMap.visit([&](const auto& typed) {
+        buildTypedSampleGridMesh(typed, sampleMesh, mesh, scale, maxDepth);
+    });
+}
+
+void buildSampleGridIndices(const AnyDepthMap& depthMap, std::vector<uint32_t>& indices, unsigned threads) {
+    TRACE_ZONE("buildSampleGridIndices");
+    if (depthMap.size() >= ValidSampleRemap::NoVertex) {
+        throw std::runtime_error("Depth map is too large for 32-bit vertex indices");
+    }
+    depthMap.visit([&](const auto& typed) {
+        buildTypedSampleGridIndices(typed, indices, threads);
+    });
+}
+
+void buildValidSampleRemap(const AnyDepthMap& depthMap, QuadDiagonal diagonal, ValidSampleRemap& remap,
+    unsigned threads) {
+    TRACE_ZONE("buildValidSampleRemap");
+    if (depthMap.size() >= ValidSampleRemap::NoVertex) {
+        throw std::runtime_error("Depth map is too large for 32-bit vertex indices");
+    }
+    depthMap.visit([&](const auto& typed) {
+        buildTypedSampleRemap(typed, diagonal, remap, threads);
+    });
+}
@@ -0,0 +1,162 @@
+﻿#ifndef MESH_H
+#define MESH_H
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "depth_map.h"
+
+// Построение сетки идёт полосами строк в threads потоках (0 — по числу ядер):
+// первый проход считает треугольники полос, префиксные суммы дают смещения в общем буфере.
+
+// Треугольники по сетке карты глубины (квады с нулевой глубиной пропускаются)
+void generateDepthMapVertices(const AnyDepthMap& depthMap, std::vector<float>& vertices, float scale, float maxDepth = 500.0f, unsigned threads = 0);
+
+// Плоская нормаль каждого треугольника, продублированная на три вершины
+void generateNormals(const std::vector<float>& vertices, std::vector<float>& normals, unsigned threads = 0);
+
+// Индексированная сетка: каждый ненулевой отсчёт хранится один раз
+struct GridMesh {
+    std::vector<float> vertices;    // x, y, z, nx, ny, nz
+    std::vector<uint16_t> indices16; // Используется, если вершин не больше 65535
+    std::vector<uint32_t> indices32;
+    size_t vertexCount = 0;
+    float minZ = 0.0f;
+    float maxZ = 0.0f;
+
+    bool wideIndices() const { return !indices32.empty(); }
+    size_t indexCount() const { return wideIndices() ? indices32.size() : indices16.size(); }
+};
+
+enum class VertexNormals {
+    AreaWeighted,     // Гладкие, по площадям смежных треугольников
+    CentralDifference // По соседним отсчётам (SIMD ядро)
+};
+
+// Те же треугольники, что и generateDepthMapVertices, но с общими вершинами
+void buildGridMesh(const AnyDepthMap& depthMap, GridMesh& mesh, float scale, float maxDepth = 500.0f, unsigned threads = 0,
+    VertexNormals normals = VertexNormals::AreaWeighted);
+
+// Сетка по уровню level пирамиды глубины (AnyDepthMap::level): шаг сетки scale * 2^level,
+// чтобы размеры совпадали с сеткой полного разрешения
+void buildGridMesh(const AnyDepthMap& depthMap, size_t level, GridMesh& mesh, float scale, float maxDepth = 500.0f,
+    unsigned threads = 0, VertexNormals normals = VertexNormals::AreaWeighted);
+
+// Только вершины buildGridMesh (позиции и нормали), без прохода по индексам: indices16 и indices32 пусты
+void buildGridVertices(const AnyDepthMap& depthMap, GridMesh& mesh, float scale, float maxDepth = 500.0f,
+    unsigned threads = 0, VertexNormals normals = VertexNormals::AreaWeighted);
+
+// Сетка из части отсчётов карты (адаптивная триангуляция): samples — номера
+// отсчётов y * width + x по возрастанию, triangles — тройки индексов в samples
+struct SampleMesh {
+    std::vector<uint32_t> samples;
+    std::vector<uint32_t> triangles;
+
+    size_t triangleCount() const { return triangles.size() / 3; }
+};
+
+// Деление квада на два треугольника (tl, tr, bl, br — углы квада)
+enum class QuadDiagonal {
+    TopRight, // (tl, tr, bl) и (tr, br, bl), как в generateDepthMapVertices
+    TopLeft   // (tl, bl, br) и (tl, tr, br), грани PLY
+};
+
+// Сжатие сетки для экспорта: вершины только у отсчётов, на которые ссылается хотя бы один
+// треугольник (с диагональю квадов diagonal), номера по порядку строк. Маска и перенумерация
+// в одной таблице: vertexOf[y * width + x] — номер вершины или NoVertex.
+// rowStart — префиксная сумма числа вершин по строкам, rowStart[height] — всего вершин.
+struct ValidSampleRemap {
+    static const uint32_t NoVertex = 0xFFFFFFFFu;
+    std::vector<uint32_t> vertexOf;
+    std::vector<uint32_t> rowStart;
+
+    size_t vertexCount() const { return rowStart.empty() ? 0 : rowStart.back(); }
+};
+
+// Отметка и подсчёт по строкам и нумерация идут полосами в threads потоках
+void buildValidSampleRemap(const AnyDepthMap& depthMap, QuadDiagonal diagonal, ValidSampleRemap& remap,
+    unsigned threads = 0);
+
+// used[x] = 1 у отсчётов строки row, входящих хотя бы в один треугольник forEachQuadFace
+// с соседними строками up и down (nullptr на краю сетки), иначе 0. Нулевые отсчёты — пропуски.
+template <typename T>
+void markUsedSamples(const T* up, const T* row, const T* down, size_t width, QuadDiagonal diagonal,
+    unsigned char* used) {
+    for (size_t x = 0; x < width; ++x) {
+        used[x] = 0;
+    }
+    for (size_t x = 0; x + 1 < width; ++x) {
+        bool left = row[x] != 0;
+        bool right = row[x + 1] != 0;
+        if (down) {
+            // Строка — верх квада: left и right — tl и tr
+            bool bl = down[x] != 0;
+            bool br = down[x + 1] != 0;
+            if (diagonal == QuadDiagonal::TopRight) {
+                bool first = left && right && bl;
+                bool second = right && br && bl;
+                used[x] |= first;
+                used[x + 1] |= first || second;
+            }
+            else {
+                bool first = left && bl && br;
+                bool second = left && right && br;
+                used[x] |= first || second;
+                used[x + 1] |= second;
+            }
+        }
+        if (up) {
+            // Строка — низ квада: left и right — bl и br
+            bool tl = up[x] != 0;
+            bool tr = up[x + 1] != 0;
+            if (diagonal == QuadDiagonal::TopRight) {
+                bool first = tl && tr && left;
+                bool second = tr && right && left;
+                used[x] |= first || second;
+                used[x + 1] |= second;
+            }
+            else {
+                bool first = tl && left && right;
+                bool second = tl && tr && right;
+                used[x] |= first;
+                used[x + 1] |= first || second;
+            }
+        }
+    }
+}
+
+// Треугольники строки квадов, у которых есть все три вершины. top и bottom — номера вершин
+// двух соседних строк, у отсутствующей вершины номер — максимальное значение Index.
+template <typename Index, typename Fn>
+void forEachQuadFace(const Index* top, const Index* bottom, size_t width, QuadDiagonal diagonal, Fn emit) {
+    const Index none = std::numeric_limits<Index>::max();
+    for (size_t x = 0; x + 1 < width; ++x) {
+        Index tl = top[x], tr = top[x + 1], bl = bottom[x], br = bottom[x + 1];
+        if (diagonal == QuadDiagonal::TopRight) {
+            if (tl != none && tr != none && bl != none) {
+                emit(tl, tr, bl);
+            }
+            if (tr != none && br != none && bl != none) {
+                emit(tr, br, bl);
+            }
+        }
+        else {
+            if (tl != none && bl != none && br != none) {
+                emit(tl, bl, br);
+            }
+            if (tl != none && tr != none && br != none) {
+                emit(tl, tr, br);
+            }
+        }
+    }
+}
+
+// Треугольники buildGridMesh, но вершина — номер отсчёта y * width + x: для отрисовки
+// по карте высот, где позиция и нормаль вершины считаются в шейдере из gl_VertexID
+void buildSampleGridIndices(const AnyDepthMap& depthMap, std::vector<uint32_t>& indices, unsigned threads = 0);
+
+// Вершины в формате GridMesh с гладкими нормалями полной сетки
+void buildSampleGridMesh(const AnyDepthMap& depthMap, const SampleMesh& sampleMesh, GridMesh& mesh, float scale,
+    float maxDepth = 500.0f);
+
+#endif // MESH_H
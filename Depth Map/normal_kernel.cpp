@@ -0,0 +1,428 @@
+﻿#include "normal_kernel.h"
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include <vector>
+#include "parallel.h"
+#include "trace.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define NORMAL_KERNEL_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define NORMAL_KERNEL_AVX2_TARGET
+#else
+#define NORMAL_KERNEL_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+
+// Скалярная формула для отсчётов [begin, end); ею же обрабатываются края строки
+void normalRange(const float* up, const float* row, const float* down, size_t width,
+    size_t begin, size_t end, float spacing, float* nx, float* ny, float* nz) {
+    for (size_t x = begin; x < end; ++x) {
+        float z = row[x];
+        bool hasLeft = x > 0 && row[x - 1] != 0;
+        bool hasRight = x + 1 < width && row[x + 1] != 0;
+        bool hasTop = up && up[x] != 0;
+        bool hasBottom = down && down[x] != 0;
+
+        float left = hasLeft ? row[x - 1] : z;
+        float right = hasRight ? row[x + 1] : z;
+        float top = hasTop ? up[x] : z;
+        float bottom = hasBottom ? down[x] : z;
+        float spanX = (hasLeft + hasRight) * spacing;
+        float spanY = (hasTop + hasBottom) * spacing;
+        float dzdx = spanX > 0 ? (right - left) / spanX : 0.0f;
+        float dzdy = spanY > 0 ? (bottom - top) / spanY : 0.0f;
+
+        float inverseLength = 1.0f / std::sqrt(dzdx * dzdx + dzdy * dzdy + 1.0f);
+        nx[x] = -dzdx * inverseLength;
+        ny[x] = -dzdy * inverseLength;
+        nz[x] = inverseLength;
+    }
+}
+
+#ifdef NORMAL_KERNEL_X86
+
+void normalRowSse2(const float* up, const float* row, const float* down, size_t width, float spacing,
+    float* nx, float* ny, float* nz) {
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 step = _mm_set1_ps(spacing);
+
+    size_t x = 1;
+    for (; x + 4 < width; x += 4) {
+        __m128 z = _mm_loadu_ps(row + x);
+        __m128 l = _mm_loadu_ps(row + x - 1);
+        __m128 r = _mm_loadu_ps(row + x + 1);
+        __m128 t = up ? _mm_loadu_ps(up + x) : zero;
+        __m128 b = down ? _mm_loadu_ps(down + x) : zero;
+
+        __m128 hasL = _mm_cmpneq_ps(l, zero);
+        __m128 hasR = _mm_cmpneq_ps(r, zero);
+        __m128 hasT = _mm_cmpneq_ps(t, zero);
+        __m128 hasB = _mm_cmpneq_ps(b, zero);
+        l = _mm_or_ps(_mm_and_ps(hasL, l), _mm_andnot_ps(hasL, z));
+        r = _mm_or_ps(_mm_and_ps(hasR, r), _mm_andnot_ps(hasR, z));
+        t = _mm_or_ps(_mm_and_ps(hasT, t), _mm_andnot_ps(hasT, z));
+        b = _mm_or_ps(_mm_and_ps(hasB, b), _mm_andnot_ps(hasB, z));
+
+        __m128 spanX = _mm_mul_ps(_mm_add_ps(_mm_and_ps(hasL, one), _mm_and_ps(hasR, one)), step);
+        __m128 spanY = _mm_mul_ps(_mm_add_ps(_mm_and_ps(hasT, one), _mm_and_ps(hasB, one)), step);
+        __m128 dzdx = _mm_and_ps(_mm_cmpgt_ps(spanX, zero), _mm_div_ps(_mm_sub_ps(r, l), spanX));
+        __m128 dzdy = _mm_and_ps(_mm_cmpgt_ps(spanY, zero), _mm_div_ps(_mm_sub_ps(b, t), spanY));
+
+        __m128 length2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dzdx, dzdx), _mm_mul_ps(dzdy, dzdy)), one);
+        __m128 inverseLength = _mm_div_ps(one, _mm_sqrt_ps(length2));
+        _mm_storeu_ps(nx + x, _mm_mul_ps(_mm_xor_ps(dzdx, sign), inverseLength));
+        _mm_storeu_ps(ny + x, _mm_mul_ps(_mm_xor_ps(dzdy, sign), inverseLength));
+        _mm_storeu_ps(nz + x, inverseLength);
+    }
+    normalRange(up, row, down, width, 0, 1, spacing, nx, ny, nz);
+    normalRange(up, row, down, width, x, width, spacing, nx, ny, nz);
+}
+
+NORMAL_KERNEL_AVX2_TARGET
+void normalRowAvx2(const float* up, const float* row, const float* down, size_t width, float spacing,
+    float* nx, float* ny, float* nz) {
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 step = _mm256_set1_ps(spacing);
+
+    size_t x = 1;
+    for (; x + 8 < width; x += 8) {
+        __m256 z = _mm256_loadu_ps(row + x);
+        __m256 l = _mm256_loadu_ps(row + x - 1);
+        __m256 r = _mm256_loadu_ps(row + x + 1);
+        __m256 t = up ? _mm256_loadu_ps(up + x) : zero;
+        __m256 b = down ? _mm256_loadu_ps(down + x) : zero;
+
+        __m256 hasL = _mm256_cmp_ps(l, zero, _CMP_NEQ_UQ);
+        __m256 hasR = _mm256_cmp_ps(r, zero, _CMP_NEQ_UQ);
+        __m256 hasT = _mm256_cmp_ps(t, zero, _CMP_NEQ_UQ);
+        __m256 hasB = _mm256_cmp_ps(b, zero, _CMP_NEQ_UQ);
+        l = _mm256_blendv_ps(z, l, hasL);
+        r = _mm256_blendv_ps(z, r, hasR);
+        t = _mm256_blendv_ps(z, t, hasT);
+        b = _mm256_blendv_ps(z, b, hasB);
+
+        __m256 spanX = _mm256_mul_ps(_mm256_add_ps(_mm256_and_ps(hasL, one), _mm256_and_ps(hasR, one)), step);
+        __m256 spanY = _mm256_mul_ps(_mm256_add_ps(_mm256_and_ps(hasT, one), _mm256_and_ps(hasB, one)), step);
+        __m256 dzdx = _mm256_and_ps(_mm256_cmp_ps(spanX, zero, _CMP_GT_OQ), _mm256_div_ps(_mm256_sub_ps(r, l), spanX));
+        __m256 dzdy = _mm256_and_ps(_mm256_cmp_ps(spanY, zero, _CMP_GT_OQ), _mm256_div_ps(_mm256_sub_ps(b, t), spanY));
+
+        __m256 length2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dzdx, dzdx), _mm256_mul_ps(dzdy, dzdy)), one);
+        __m256 inverseLength = _mm256_div_ps(one, _mm256_sqrt_ps(length2));
+        _mm256_storeu_ps(nx + x, _mm256_mul_ps(_mm256_xor_ps(dzdx, sign), inverseLength));
+        _mm256_storeu_ps(ny + x, _mm256_mul_ps(_mm256_xor_ps(dzdy, sign), inverseLength));
+        _mm256_storeu_ps(nz + x, inverseLength);
+    }
+    normalRange(up, row, down, width, 0, 1, spacing, nx, ny, nz);
+    normalRange(up, row, down, width, x, width, spacing, nx, ny, nz);
+}
+
+bool cpuHasAvx2() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) {
+        return false;
+    }
+    __cpuid(info, 1);
+    bool osSavesYmm = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && ((_xgetbv(0) & 6) == 6);
+    if (!osSavesYmm) {
+        return false;
+    }
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif // NORMAL_KERNEL_X86
+
+NormalKernel detectNormalKernel() {
+#ifdef NORMAL_KERNEL_X86
+    if (cpuHasAvx2()) {
+        return NormalKernel::AVX2;
+    }
+    return NormalKernel::SSE2;
+#else
+    return NormalKernel::Scalar;
+#endif
+}
+
+} // namespace
+
+NormalKernel bestNormalKernel() {
+    static const NormalKernel kernel = detectNormalKernel();
+    return kernel;
+}
+
+const char* normalKernelName(NormalKernel kernel) {
+    switch (kernel) {
+    case NormalKernel::Scalar: return "scalar";
+    case NormalKernel::SSE2: return "sse2";
+    case NormalKernel::AVX2: return "avx2";
+    }
+    return "unknown";
+}
+
+void computeNormalRow(NormalKernel kernel, const float* up, const float* row, const float* down,
+    size_t width, float spacing, float* nx, float* ny, float* nz) {
+#ifdef NORMAL_KERNEL_X86
+    if (kernel == NormalKernel::AVX2) {
+        normalRowAvx2(up, row, down, width, spacing, nx, ny, nz);
+        return;
+    }
+    if (kernel == NormalKernel::SSE2) {
+        normalRowSse2(up, row, down, width, spacing, nx, ny, nz);
+        return;
+    }
+#endif
+    normalRange(up, row, down, width, 0, width, spacing, nx, ny, nz);
+}
+
+namespace {
+
+template <typename T>
+void convertRow(const void* source, size_t count, float sampleScale, float depthScale, float* out) {
+    convertDepthRow(static_cast<const T*>(source), count, sampleScale, depthScale, out);
+}
+
+} // namespace
+
+DepthRowCache::DepthRowCache(const AnyDepthMap& depthMap, float scale)
+    : width(depthMap.width()),
+      height(depthMap.height()),
+      depthScale(scale),
+      rows(3 * width) {
+    depthMap.visit([&](const auto& typed) {
+        typedef typename std::decay<decltype(typed)>::type::Sample Sample;
+        data = reinterpret_cast<const unsigned char*>(typed.data.data());
+        sampleBytes = sizeof(Sample);
+        convert = &convertRow<Sample>;
+        sampleScale = typed.depthScale;
+    });
+    cachedRow[0] = cachedRow[1] = cachedRow[2] = static_cast<size_t>(-1);
+}
+
+const float* DepthRowCache::row(size_t y) {
+    size_t slot = y % 3;
+    float* target = rows.data() + slot * width;
+    if (cachedRow[slot] != y) {
+        convert(data + y * width * sampleBytes, width, sampleScale, depthScale, target);
+        cachedRow[slot] = y;
+    }
+    return target;
+}
+
+NormalRowScratch::NormalRowScratch(const AnyDepthMap& depthMap, float gridSpacing, float depthScale, NormalKernel normalKernel)
+    : depth(depthMap, depthScale),
+      spacing(gridSpacing),
+      kernel(normalKernel),
+      normals(3 * depth.rowWidth()) {
+}
+
+void NormalRowScratch::compute(size_t y) {
+    size_t width = depth.rowWidth();
+    const float* row = depth.row(y);
+    const float* up = y > 0 ? depth.row(y - 1) : nullptr;
+    const float* down = y + 1 < depth.rowCount() ? depth.row(y + 1) : nullptr;
+    computeNormalRow(kernel, up, row, down, width, spacing,
+        normals.data(), normals.data() + width, normals.data() + 2 * width);
+}
+
+SmoothNormalRows::SmoothNormalRows(const AnyDepthMap& depthMap, float gridSpacing, float depthScale)
+    : depth(depthMap, depthScale),
+      spacing(gridSpacing),
+      above(6 * (depth.rowWidth() + 1)),
+      below(6 * (depth.rowWidth() + 1)),
+      normals(3 * depth.rowWidth()) {
+}
+
+// Ненормированные нормали двух треугольников каждого квада строки квадов q
+// (длина равна удвоенной площади). Квад x хранится по индексу x + 1,
+// индексы 0 и width остаются нулевыми, чтобы не проверять края.
+void SmoothNormalRows::computeFaces(size_t q, std::vector<float>& faces) {
+    size_t width = depth.rowWidth();
+    size_t stride = width + 1;
+    float* t1x = faces.data();
+    float* t1y = t1x + stride;
+    float* t1z = t1y + stride;
+    float* t2x = t1z + stride;
+    float* t2y = t2x + stride;
+    float* t2z = t2y + stride;
+    std::fill(faces.begin(), faces.end(), 0.0f);
+
+    const float* top = depth.row(q);
+    const float* bottom = depth.row(q + 1);
+    float area = spacing * spacing;
+    for (size_t x = 0; x + 1 < width; ++x) {
+        float z1 = top[x], z2 = top[x + 1], z3 = bottom[x], z4 = bottom[x + 1];
+        // Те же условия, что и в generateDepthMapVertices
+        float valid1 = (z1 != 0 && z2 != 0 && z3 != 0) ? 1.0f : 0.0f;
+        float valid2 = (z4 != 0 && z2 != 0 && z3 != 0) ? 1.0f : 0.0f;
+        t1x[x + 1] = valid1 * -spacing * (z2 - z1);
+        t1y[x + 1] = valid1 * -spacing * (z3 - z1);
+        t1z[x + 1] = valid1 * area;
+        t2x[x + 1] = valid2 * -spacing * (z4 - z3);
+        t2y[x + 1] = valid2 * spacing * (z2 - z4);
+        t2z[x + 1] = valid2 * area;
+    }
+}
+
+void SmoothNormalRows::compute(size_t y) {
+    size_t width = depth.rowWidth();
+    size_t height = depth.rowCount();
+    size_t stride = width + 1;
+
+    // Строки квадов y - 1 и y; при обходе подряд верхняя берётся из предыдущего вызова
+    bool hasAbove = y > 0;
+    bool hasBelow = y + 1 < height;
+    if (hasAbove) {
+        if (belowRow == y - 1) {
+            above.swap(below);
+            belowRow = static_cast<size_t>(-1);
+        }
+        else {
+            computeFaces(y - 1, above);
+        }
+    }
+    if (hasBelow) {
+        computeFaces(y, below);
+        belowRow = y;
+    }
+
+    float* nx = normals.data();
+    float* ny = nx + width;
+    float* nz = ny + width;
+    std::fill(normals.begin(), normals.end(), 0.0f);
+    // Вершина (x, y) — левая нижняя для квада x сверху (оба треугольника) и правая нижняя
+    // для квада x - 1 (второй треугольник); левая верхняя для квада x снизу (первый треугольник)
+    // и правая верхняя для квада x - 1 (оба треугольника)
+    for (int part = 0; part < 2; ++part) {
+        bool present = part == 0 ? hasAbove : hasBelow;
+        if (!present) {
+            continue;
+        }
+        const float* faces = part == 0 ? above.data() : below.data();
+        for (int axis = 0; axis < 3; ++axis) {
+            const float* t1 = faces + axis * stride;
+            const float* t2 = faces + (3 + axis) * stride;
+            float* n = normals.data() + axis * width;
+            if (part == 0) {
+                for (size_t x = 0; x < width; ++x) {
+                    n[x] += t1[x + 1] + t2[x + 1] + t2[x];
+                }
+            }
+            else {
+                for (size_t x = 0; x < width; ++x) {
+                    n[x] += t1[x + 1] + t1[x] + t2[x];
+                }
+            }
+        }
+    }
+
+    for (size_t x = 0; x < width; ++x) {
+        float length = std::sqrt(nx[x] * nx[x] + ny[x] * ny[x] + nz[x] * nz[x]);
+        if (length > 0) {
+            float inverseLength = 1.0f / length;
+            nx[x] *= inverseLength;
+            ny[x] *= inverseLength;
+            nz[x] *= inverseLength;
+        }
+        else {
+            nz[x] = 1.0f; // Отсчёт без треугольников
+        }
+    }
+}
+
+namespace {
+
+template <typename Rows>
+void writeGridNormals(const AnyDepthMap& depthMap, const NormalOutput& output, unsigned threads, Rows makeRows) {
+    size_t width = depthMap.width();
+    size_t height = depthMap.height();
+    threads = workerCount(threads);
+    size_t bands = std::max<size_t>(1, std::min<size_t>(height, static_cast<size_t>(threads) * 4));
+
+    depthMap.visit([&](const auto& typed) {
+        parallelForBands(height, bands, threads, [&](size_t begin, size_t end, size_t) {
+            auto rows = makeRows();
+            for (size_t y = begin; y < end; ++y) {
+                rows.compute(y);
+                size_t first = y * width;
+                if (output.layout == NormalLayout::SoA) {
+                    std::copy(rows.nx(), rows.nx() + width, output.nx + first);
+                    std::copy(rows.ny(), rows.ny() + width, output.ny + first);
+                    std::copy(rows.nz(), rows.nz() + width, output.nz + first);
+                    continue;
+                }
+                if (output.rowStart) {
+                    // Только ненулевые отсчёты, по порядку вершин сетки
+                    const auto* samples = typed.data.data() + first;
+                    float* out = output.data + static_cast<size_t>(output.rowStart[y]) * output.stride;
+                    for (size_t x = 0; x < width; ++x) {
+                        if (samples[x] == 0) {
+                            continue;
+                        }
+                        out[0] = rows.nx()[x];
+                        out[1] = rows.ny()[x];
+                        out[2] = rows.nz()[x];
+                        out += output.stride;
+                    }
+                    continue;
+                }
+                float* out = output.data + first * output.stride;
+                for (size_t x = 0; x < width; ++x) {
+                    out[0] = rows.nx()[x];
+                    out[1] = rows.ny()[x];
+                    out[2] = rows.nz()[x];
+                    out += output.stride;
+                }
+            }
+        });
+    });
+}
+
+} // namespace
+
+void computeGridNormals(const AnyDepthMap& depthMap, float spacing, float depthScale, const NormalOutput& output,
+    unsigned threads, NormalKernel kernel) {
+    TRACE_ZONE("computeGridNormals");
+    if (output.layout == NormalLayout::SoA) {
+        // Отдельные массивы: ядро пишет сразу в них
+        size_t width = depthMap.width();
+        size_t height = depthMap.height();
+        threads = workerCount(threads);
+        size_t bands = std::max<size_t>(1, std::min<size_t>(height, static_cast<size_t>(threads) * 4));
+        parallelForBands(height, bands, threads, [&](size_t begin, size_t end, size_t) {
+            DepthRowCache depth(depthMap, depthScale);
+            for (size_t y = begin; y < end; ++y) {
+                size_t first = y * width;
+                computeNormalRow(kernel, y > 0 ? depth.row(y - 1) : nullptr, depth.row(y),
+                    y + 1 < height ? depth.row(y + 1) : nullptr, width, spacing,
+                    output.nx + first, output.ny + first, output.nz + first);
+            }
+        });
+        return;
+    }
+    writeGridNormals(depthMap, output, threads, [&]() {
+        return NormalRowScratch(depthMap, spacing, depthScale, kernel);
+    });
+}
+
+void computeSmoothGridNormals(const AnyDepthMap& depthMap, float spacing, float depthScale, const NormalOutput& output,
+    unsigned threads) {
+    TRACE_ZONE("computeSmoothGridNormals");
+    writeGridNormals(depthMap, output, threads, [&]() {
+        return SmoothNormalRows(depthMap, spacing, depthScale);
+    });
+}
@@ -0,0 +1,125 @@
+﻿#ifndef NORMAL_KERNEL_H
+#define NORMAL_KERNEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "depth_map.h"
+
+// Нормали по центральным разностям; spacing — шаг сетки, depthScale — множитель глубины,
+// у края и у нулевых соседей разность односторонняя.
+// Внутренние отсчёты строки считаются в SIMD регистрах, крайние столбцы — скалярно.
+enum class NormalKernel {
+    Scalar,
+    SSE2,
+    AVX2
+};
+
+// Лучшее ядро, поддерживаемое процессором (определяется один раз при первом вызове)
+NormalKernel bestNormalKernel();
+const char* normalKernelName(NormalKernel kernel);
+
+enum class NormalLayout {
+    Interleaved, // data + i * stride
+    SoA          // nx[i], ny[i], nz[i]
+};
+
+struct NormalOutput {
+    NormalLayout layout = NormalLayout::Interleaved;
+    float* data = nullptr;
+    size_t stride = 3; // Число float между соседними нормалями
+    // Если задан (только Interleaved) — нормали пишутся лишь ненулевым отсчётам подряд,
+    // первый ненулевой отсчёт строки y получает номер rowStart[y] (как вершины GridMesh)
+    const uint32_t* rowStart = nullptr;
+    float* nx = nullptr;
+    float* ny = nullptr;
+    float* nz = nullptr;
+};
+
+// Одна строка: up/down — соседние строки (nullptr на краю сетки), глубина уже умножена на depthScale.
+// Нулевые отсчёты считаются отсутствующими.
+void computeNormalRow(NormalKernel kernel, const float* up, const float* row, const float* down,
+    size_t width, float spacing, float* nx, float* ny, float* nz);
+
+// Строка отсчётов в float, умноженная на depthScale (uint16 — ещё и на sampleScale)
+template <typename T>
+void convertDepthRow(const T* source, size_t count, float sampleScale, float depthScale, float* out) {
+    for (size_t x = 0; x < count; ++x) {
+        out[x] = static_cast<float>(sampleDepth(source[x], sampleScale) * depthScale);
+    }
+}
+
+// Строки глубины в float, умноженные на depthScale; хранит три последние строки,
+// так что при обходе подряд каждая строка конвертируется один раз.
+// Конвертация строки выбирается по типу отсчёта при создании.
+class DepthRowCache {
+public:
+    DepthRowCache(const AnyDepthMap& depthMap, float depthScale);
+
+    const float* row(size_t y);
+    size_t rowWidth() const { return width; }
+    size_t rowCount() const { return height; }
+
+private:
+    typedef void (*RowConverter)(const void* source, size_t count, float sampleScale, float depthScale, float* out);
+
+    const unsigned char* data;
+    size_t sampleBytes;
+    RowConverter convert;
+    size_t width;
+    size_t height;
+    float sampleScale;
+    float depthScale;
+    std::vector<float> rows; // Слот y % 3
+    size_t cachedRow[3];
+};
+
+// Нормали по центральным разностям для строки y в строковом буфере (SoA, width значений)
+class NormalRowScratch {
+public:
+    NormalRowScratch(const AnyDepthMap& depthMap, float spacing, float depthScale, NormalKernel kernel = bestNormalKernel());
+
+    void compute(size_t y);
+    const float* nx() const { return normals.data(); }
+    const float* ny() const { return normals.data() + depth.rowWidth(); }
+    const float* nz() const { return normals.data() + 2 * depth.rowWidth(); }
+
+private:
+    DepthRowCache depth;
+    float spacing;
+    NormalKernel kernel;
+    std::vector<float> normals;
+};
+
+// Гладкие нормали: сумма нормалей смежных треугольников с весом по площади.
+// Треугольники с нулевой вершиной не учитываются (как в generateDepthMapVertices),
+// у отсчёта без треугольников нормаль (0, 0, 1). Нормали граней строки квадов
+// переиспользуются для следующей строки, так что читаются только соседние строки.
+class SmoothNormalRows {
+public:
+    SmoothNormalRows(const AnyDepthMap& depthMap, float spacing, float depthScale);
+
+    void compute(size_t y);
+    const float* nx() const { return normals.data(); }
+    const float* ny() const { return normals.data() + depth.rowWidth(); }
+    const float* nz() const { return normals.data() + 2 * depth.rowWidth(); }
+
+private:
+    void computeFaces(size_t q, std::vector<float>& faces);
+
+    DepthRowCache depth;
+    float spacing;
+    std::vector<float> above; // Треугольники строки квадов y - 1
+    std::vector<float> below; // Треугольники строки квадов y
+    size_t belowRow = static_cast<size_t>(-1);
+    std::vector<float> normals;
+};
+
+// Нормали всех отсчётов сетки в output, полосами строк в threads потоках
+void computeGridNormals(const AnyDepthMap& depthMap, float spacing, float depthScale, const NormalOutput& output,
+    unsigned threads = 0, NormalKernel kernel = bestNormalKernel());
+
+void computeSmoothGridNormals(const AnyDepthMap& depthMap, float spacing, float depthScale, const NormalOutput& output,
+    unsigned threads = 0);
+
+#endif // NORMAL_KERNEL_H
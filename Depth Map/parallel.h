@@ -0,0 +1,60 @@
+﻿#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+#include "trace.h"
+
+// Число рабочих потоков: requested, либо по числу ядер
+inline unsigned workerCount(unsigned requested = 0) {
+    if (requested > 0) {
+        return requested;
+    }
+    unsigned hardware = std::thread::hardware_concurrency();
+    return hardware > 0 ? hardware : 1;
+}
+
+// Делит [0, count) на bands непрерывных полос и вызывает fn(begin, end, band)
+// в threads потоках. Первое исключение из потоков пробрасывается вызывающему.
+template <typename Fn>
+void parallelForBands(size_t count, size_t bands, unsigned threads, Fn fn) {
+    bands = std::max<size_t>(1, std::min(bands, count));
+    threads = static_cast<unsigned>(std::max<size_t>(1, std::min<size_t>(threads, bands)));
+    auto bandBegin = [&](size_t band) { return count * band / bands; };
+
+    if (threads == 1) {
+        for (size_t band = 0; band < bands; ++band) {
+            fn(bandBegin(band), bandBegin(band + 1), band);
+        }
+        return;
+    }
+
+    std::vector<std::thread> pool;
+    std::vector<std::exception_ptr> errors(threads);
+    for (unsigned t = 0; t < threads; ++t) {
+        pool.emplace_back([&, t]() {
+            TRACE_ZONE("parallel worker");
+            try {
+                for (size_t band = t; band < bands; band += threads) {
+                    fn(bandBegin(band), bandBegin(band + 1), band);
+                }
+            }
+            catch (...) {
+                errors[t] = std::current_exception();
+            }
+        });
+    }
+    for (std::thread& thread : pool) {
+        thread.join();
+    }
+    for (const std::exception_ptr& error : errors) {
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+#endif // PARALLEL_H
@@ -0,0 +1,207 @@
+﻿#include "pipeline.h"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include "depth_pyramid.h"
+#include "depth_stats.h"
+#include "rtin.h"
+#include "software_renderer.h"
+#include "streaming.h"
+
+namespace {
+
+double millisecondsSince(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+uint64_t fileSize(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    return file ? static_cast<uint64_t>(file.tellg()) : 0;
+}
+
+bool endsWith(const std::string& text, const std::string& suffix) {
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Загрузка, фильтры и пирамида глубины (loadOptions.pyramidLevels) отдельными этапами отчёта;
+// пирамида строится по отфильтрованной карте
+AnyDepthMap loadDepthMap(const std::string& filename, const DepthLoadOptions& loadOptions,
+    const DepthFilterOptions& filterOptions, unsigned threads, ExportReport& report) {
+    DepthLoadOptions mapOnly = loadOptions;
+    mapOnly.pyramidLevels = 0;
+    auto start = std::chrono::steady_clock::now();
+    AnyDepthMap depthMap = readDepthMap(filename, mapOnly);
+    report.stages.push_back({ "load", millisecondsSince(start) });
+    report.samples = depthMap.size();
+
+    if (filterOptions.enabled()) {
+        start = std::chrono::steady_clock::now();
+        depthMap = filterDepthMap(depthMap, filterOptions);
+        report.stages.push_back({ "filter", millisecondsSince(start) });
+    }
+
+    if (loadOptions.pyramidLevels > 0) {
+        start = std::chrono::steady_clock::now();
+        depthMap.setPyramid(buildDepthPyramid(depthMap, loadOptions.pyramidLevels, threads));
+        report.stages.push_back({ "depth pyramid", millisecondsSince(start) });
+    }
+    return depthMap;
+}
+
+} // namespace
+
+ExportReport runHeadlessExport(const ExportJob& job) {
+    ExportReport report;
+
+    if (job.streaming) {
+        if (job.filterOptions.enabled()) {
+            throw std::runtime_error("Depth filters are not supported in streaming mode");
+        }
+        auto start = std::chrono::steady_clock::now();
+        StreamingStats stats = streamDepthMapExport(job.inputFile, job.outputFormat, job.outputFile,
+            job.loadOptions, job.exportOptions, job.memoryBudget);
+        report.stages.push_back({ "stream export " + job.outputFormat, millisecondsSince(start) });
+        report.samples = static_cast<size_t>(stats.samples);
+        report.bands = stats.bands;
+        report.peakResidentBytes = peakResidentBytes();
+        return report;
+    }
+
+    AnyDepthMap depthMap = loadDepthMap(job.inputFile, job.loadOptions, job.filterOptions, job.exportOptions.threads, report);
+
+    auto start = std::chrono::steady_clock::now();
+    if (job.exportOptions.maxError > 0) {
+        SampleMesh mesh;
+        buildAdaptiveMesh(depthMap.level(job.exportOptions.level), job.exportOptions.maxError, mesh);
+        report.stages.push_back({ "adaptive mesh", millisecondsSince(start) });
+        report.triangles = mesh.triangleCount();
+
+        start = std::chrono::steady_clock::now();
+        exportSampleMesh(depthMap, mesh, job.outputFormat, job.outputFile, job.exportOptions);
+    }
+    else {
+        exportDepthMap(depthMap, job.outputFormat, job.outputFile, job.exportOptions);
+    }
+    report.stages.push_back({ "export " + job.outputFormat, millisecondsSince(start) });
+
+    report.peakResidentBytes = peakResidentBytes();
+    return report;
+}
+
+ExportReport runConversion(const ConvertJob& job) {
+    ExportReport report;
+
+    auto start = std::chrono::steady_clock::now();
+    AnyDepthMap depthMap = readDepthMap(job.inputFile, job.loadOptions);
+    report.stages.push_back({ "load", millisecondsSince(start) });
+    report.samples = depthMap.size();
+
+    start = std::chrono::steady_clock::now();
+    if (endsWith(job.outputFile, ".dmt")) {
+        writeTiledDepthMap(depthMap, job.outputFile, job.tiledOptions);
+        report.stages.push_back({ "write dmt", millisecondsSince(start) });
+    }
+    else {
+        writeLegacyDepthMap(depthMap, job.outputFile);
+        report.stages.push_back({ "write dat", millisecondsSince(start) });
+    }
+    report.inputBytes = fileSize(job.inputFile);
+    report.outputBytes = fileSize(job.outputFile);
+    report.peakResidentBytes = peakResidentBytes();
+    return report;
+}
+
+ExportReport runHeadlessRender(const RenderJob& job) {
+    ExportReport report;
+    const float scale = 0.2f; // Шаг сетки окна просмотра
+    ShadingModel shading = shadingModelFromName(job.reflectionModel);
+
+    AnyDepthMap depthMap = loadDepthMap(job.inputFile, job.loadOptions, job.filterOptions, job.threads, report);
+
+    auto start = std::chrono::steady_clock::now();
+    GridMesh mesh;
+    bool sensor = job.camera.valid();
+    if (sensor) {
+        PointCloud cloud;
+        backProjectDepthMap(depthMap, job.camera, cloud, job.level, job.threads);
+        computePointCloudNormals(cloud, job.threads);
+        report.stages.push_back({ "back-projection", millisecondsSince(start) });
+
+        start = std::chrono::steady_clock::now();
+        SampleMesh sampleMesh;
+        if (job.maxError > 0) {
+            buildAdaptiveMesh(depthMap.level(job.level), job.maxError, sampleMesh);
+            report.triangles = sampleMesh.triangleCount();
+        }
+        else {
+            buildPointCloudMesh(cloud, sampleMesh, job.threads);
+        }
+        buildPointCloudGridMesh(cloud, sampleMesh, mesh);
+    }
+    else if (job.maxError > 0) {
+        AnyDepthMap source = depthMap.level(job.level);
+        SampleMesh adaptive;
+        buildAdaptiveMesh(source, job.maxError, adaptive);
+        buildSampleGridMesh(source, adaptive, mesh, scale * static_cast<float>(size_t(1) << job.level));
+        report.triangles = adaptive.triangleCount();
+    }
+    else {
+        buildGridMesh(depthMap, job.level, mesh, scale, 500.0f, job.threads);
+    }
+    report.stages.push_back({ "mesh", millisecondsSince(start) });
+
+    start = std::chrono::steady_clock::now();
+    DepthStatistics depthStats = computeDepthStatistics(depthMap.level(job.level), 0, job.threads);
+    report.stages.push_back({ "depth statistics", millisecondsSince(start) });
+
+    // z вершин облака — сама глубина, сетки окна — глубина / 500
+    double depthUnit = sensor ? 1.0 : 500.0;
+    RenderCamera camera = sensor
+        ? sensorCamera(job.camera, depthMap.width(), depthMap.height(), depthStats.minDepth, depthStats.maxDepth)
+        : viewerCamera(depthMap.width(), depthMap.height(), scale);
+    camera.depthRange[0] = static_cast<float>(depthStats.percentile(2.0) / depthUnit);
+    camera.depthRange[1] = static_cast<float>(depthStats.percentile(98.0) / depthUnit);
+    SoftwareRenderer renderer(job.threads);
+    RgbImage image;
+    unsigned repeat = job.repeat > 0 ? job.repeat : 1;
+    start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < repeat; ++i) {
+        renderer.render(mesh, camera, shading, job.width, job.height, image);
+    }
+    double renderTime = millisecondsSince(start);
+    report.stages.push_back({ "render " + job.reflectionModel, renderTime });
+    report.images = repeat;
+    report.imagesPerSecond = renderTime > 0 ? repeat * 1000.0 / renderTime : 0.0;
+
+    start = std::chrono::steady_clock::now();
+    writeImage(image, job.outputFile);
+    report.stages.push_back({ "write image", millisecondsSince(start) });
+    report.outputBytes = fileSize(job.outputFile);
+    report.peakResidentBytes = peakResidentBytes();
+    return report;
+}
+
+void printExportReport(const ExportReport& report) {
+    double total = 0.0;
+    for (const StageTiming& stage : report.stages) {
+        std::cout << stage.name << ": " << stage.milliseconds << " ms" << std::endl;
+        total += stage.milliseconds;
+    }
+    std::cout << "total: " << total << " ms (" << report.samples << " samples)" << std::endl;
+    if (report.triangles > 0) {
+        std::cout << "adaptive mesh: " << report.triangles << " triangles" << std::endl;
+    }
+    if (report.bands > 0) {
+        std::cout << "row bands: " << report.bands << std::endl;
+    }
+    if (report.images > 0) {
+        std::cout << "render: " << report.images << " images, " << report.imagesPerSecond << " images/s" << std::endl;
+    }
+    if (report.outputBytes > 0 && report.inputBytes > 0) {
+        std::cout << "size: " << report.inputBytes << " -> " << report.outputBytes << " bytes" << std::endl;
+    }
+    if (report.peakResidentBytes > 0) {
+        std::cout << "peak RSS: " << report.peakResidentBytes / (1024.0 * 1024.0) << " MB" << std::endl;
+    }
+}
@@ -0,0 +1,74 @@
+﻿#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <string>
+#include <vector>
+#include "depth_filter.h"
+#include "depth_map.h"
+#include "exporters.h"
+#include "tiled_depth.h"
+
+struct StageTiming {
+    std::string name;
+    double milliseconds;
+};
+
+struct ExportJob {
+    std::string inputFile;
+    std::string outputFile;   // Без расширения, как outputFile в config.json
+    std::string outputFormat; // ply, stl или vrml
+    DepthLoadOptions loadOptions;
+    DepthFilterOptions filterOptions; // Фильтры после загрузки, до пирамиды глубины и сетки
+    ExportOptions exportOptions;
+    bool streaming = false;             // Читать полосами строк, не загружая карту целиком
+    size_t memoryBudget = 256u << 20;   // Байт на полосу при streaming
+};
+
+struct ExportReport {
+    std::vector<StageTiming> stages;
+    size_t samples = 0;
+    size_t triangles = 0; // Только для адаптивной сетки
+    size_t bands = 0;     // Только для потокового экспорта
+    size_t peakResidentBytes = 0;
+    uint64_t inputBytes = 0;  // Размеры файлов при конвертации
+    uint64_t outputBytes = 0;
+    size_t images = 0;        // Только для отрисовки на CPU
+    double imagesPerSecond = 0.0;
+};
+
+// Конвертация между форматами карт глубины: в .dmt, если у outputFile такое расширение,
+// иначе в старый .dat
+struct ConvertJob {
+    std::string inputFile;
+    std::string outputFile;
+    DepthLoadOptions loadOptions;
+    TiledDepthOptions tiledOptions;
+};
+
+// Конвертация карты глубины в файл сетки без окна и контекста OpenGL
+ExportReport runHeadlessExport(const ExportJob& job);
+
+ExportReport runConversion(const ConvertJob& job);
+
+// Изображение сетки с камерой и освещением окна просмотра, отрисованное на CPU
+// (SoftwareRenderer); repeat > 1 повторяет отрисовку для замера пропускной способности
+struct RenderJob {
+    std::string inputFile;
+    std::string outputFile; // .png или .ppm
+    DepthLoadOptions loadOptions;
+    DepthFilterOptions filterOptions;
+    std::string reflectionModel = "Torrens";
+    size_t width = 1200;
+    size_t height = 1200;
+    float maxError = 0.0f; // Адаптивная сетка, как в окне
+    size_t level = 0;      // Уровень пирамиды глубины (нужен loadOptions.pyramidLevels >= level)
+    CameraIntrinsics camera; // При fx, fy > 0 — облако точек камеры, вид из камеры (sensorCamera)
+    unsigned threads = 0;
+    unsigned repeat = 1;
+};
+
+ExportReport runHeadlessRender(const RenderJob& job);
+
+void printExportReport(const ExportReport& report);
+
+#endif // PIPELINE_H
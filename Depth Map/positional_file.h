@@ -0,0 +1,28 @@
+﻿#ifndef POSITIONAL_FILE_H
+#define POSITIONAL_FILE_H
+
+#include <cstdint>
+#include <string>
+
+// Файл заданного размера для записи по смещению (pwrite / WriteFile с OVERLAPPED).
+// writeAt можно вызывать из нескольких потоков для непересекающихся диапазонов.
+class PositionalFile {
+public:
+    PositionalFile(const std::string& filename, uint64_t size);
+    ~PositionalFile();
+
+    PositionalFile(const PositionalFile&) = delete;
+    PositionalFile& operator=(const PositionalFile&) = delete;
+
+    void writeAt(uint64_t offset, const void* data, size_t size);
+
+private:
+    std::string name;
+#ifdef _WIN32
+    void* handle = nullptr;
+#else
+    int fd = -1;
+#endif
+};
+
+#endif // POSITIONAL_FILE_H
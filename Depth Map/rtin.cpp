@@ -0,0 +1,243 @@
+﻿#include "rtin.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+#include "trace.h"
+
+namespace {
+
+const uint8_t HasValid = 1;
+const uint8_t HasInvalid = 2;
+
+struct Point {
+    int x;
+    int y;
+};
+
+Point middle(Point a, Point b) {
+    return { (a.x + b.x) >> 1, (a.y + b.y) >> 1 };
+}
+
+int legLength(Point a, Point c) {
+    return std::abs(a.x - c.x) + std::abs(a.y - c.y);
+}
+
+// Карта покрывается квадратами 2^k + 1 по короткой стороне, идущими вдоль длинной
+// (соседние квадраты делят край), так что дополнение не больше квадрата на каждую сторону
+// даже у вытянутых карт. Ошибки и покрытие общие для всех квадратов: середина общего края —
+// гипотенуза треугольников обоих соседей, поэтому край делится одинаково и трещин нет.
+template <typename T>
+class Rtin {
+public:
+    Rtin(const DepthMap<T>& depthMap)
+        : data(depthMap.data.data()),
+          depthScale(depthMap.depthScale),
+          width(static_cast<int>(depthMap.width)),
+          height(static_cast<int>(depthMap.height)) {
+        tile = 1;
+        while (tile < std::min(width, height) - 1) {
+            tile <<= 1;
+        }
+        blocksX = std::max(1, (width - 1 + tile - 1) / tile);
+        blocksY = std::max(1, (height - 1 + tile - 1) / tile);
+        stride = blocksX * tile + 1;
+        size_t points = static_cast<size_t>(stride) * (blocksY * tile + 1);
+        errors.assign(points, 0.0f);
+        coverage.assign(points, 0);
+    }
+
+    // Ошибки считаются по уровням от мелких треугольников к крупным, чтобы
+    // к моменту чтения ошибка середины потомка учитывала оба смежных треугольника
+    void computeErrors() {
+        int maxDepth = 0;
+        for (int side = tile; side > 1; side >>= 1) {
+            maxDepth += 2;
+        }
+        for (int depth = maxDepth - 1; depth >= 0; --depth) {
+            for (int by = 0; by < blocksY; ++by) {
+                for (int bx = 0; bx < blocksX; ++bx) {
+                    Point corner = { bx * tile, by * tile };
+                    visitLevel(root1a(corner), root1b(corner), root1c(corner), 0, depth);
+                    visitLevel(root2a(corner), root2b(corner), root2c(corner), 0, depth);
+                }
+            }
+        }
+    }
+
+    void emit(float maxError, std::vector<uint32_t>& triangles) {
+        threshold = maxError;
+        output = &triangles;
+        for (int by = 0; by < blocksY; ++by) {
+            for (int bx = 0; bx < blocksX; ++bx) {
+                Point corner = { bx * tile, by * tile };
+                emitTriangle(root1a(corner), root1b(corner), root1c(corner));
+                emitTriangle(root2a(corner), root2b(corner), root2c(corner));
+            }
+        }
+    }
+
+private:
+    // Два корневых треугольника квадрата с левым верхним углом corner
+    Point root1a(Point corner) const { return corner; }
+    Point root1b(Point corner) const { return { corner.x + tile, corner.y + tile }; }
+    Point root1c(Point corner) const { return { corner.x + tile, corner.y }; }
+    Point root2a(Point corner) const { return { corner.x + tile, corner.y + tile }; }
+    Point root2b(Point corner) const { return corner; }
+    Point root2c(Point corner) const { return { corner.x, corner.y + tile }; }
+
+    size_t index(Point p) const {
+        return static_cast<size_t>(p.y) * stride + p.x;
+    }
+
+    bool inside(Point p) const {
+        return p.x < width && p.y < height;
+    }
+
+    double depthAt(Point p) const {
+        return inside(p) ? sampleDepth(data[static_cast<size_t>(p.y) * width + p.x], depthScale) : 0.0;
+    }
+
+    uint8_t validity(Point p) const {
+        return depthAt(p) != 0 ? HasValid : HasInvalid;
+    }
+
+    void visitLevel(Point a, Point b, Point c, int depth, int target) {
+        if (legLength(a, c) <= 1) {
+            return;
+        }
+        Point m = middle(a, b);
+        if (depth < target) {
+            visitLevel(c, a, m, depth + 1, target);
+            visitLevel(b, c, m, depth + 1, target);
+            return;
+        }
+
+        uint8_t cover = validity(a) | validity(b) | validity(c) | validity(m);
+        float error = 0.0f;
+        if (legLength(c, m) > 1) {
+            size_t left = index(middle(c, a));
+            size_t right = index(middle(b, c));
+            error = std::max(error, std::max(errors[left], errors[right]));
+            cover |= coverage[left] | coverage[right];
+        }
+        if (cover == HasValid) {
+            error = std::max(error, planeError(a, b, c));
+        }
+        size_t mi = index(m);
+        errors[mi] = std::max(errors[mi], error);
+        coverage[mi] |= cover;
+    }
+
+    // Наибольшее отклонение отсчётов внутри треугольника (и на его сторонах) от плоскости
+    // через вершины. Оценка только по середине гипотенузы может занизить ошибку.
+    float planeError(Point a, Point b, Point c) const {
+        double za = depthAt(a), zb = depthAt(b), zc = depthAt(c);
+        long long area = edge(a, b, c);
+        if (area == 0) {
+            return 0.0f;
+        }
+        int minX = std::min(a.x, std::min(b.x, c.x));
+        int maxX = std::max(a.x, std::max(b.x, c.x));
+        int minY = std::min(a.y, std::min(b.y, c.y));
+        int maxY = std::max(a.y, std::max(b.y, c.y));
+        double error = 0.0;
+        for (int y = minY; y <= maxY; ++y) {
+            for (int x = minX; x <= maxX; ++x) {
+                Point p = { x, y };
+                long long wa = edge(b, c, p);
+                long long wb = edge(c, a, p);
+                long long wc = area - wa - wb;
+                if ((area > 0 && (wa < 0 || wb < 0 || wc < 0)) || (area < 0 && (wa > 0 || wb > 0 || wc > 0))) {
+                    continue;
+                }
+                double z = (wa * za + wb * zb + wc * zc) / static_cast<double>(area);
+                error = std::max(error, std::fabs(z - depthAt(p)));
+            }
+        }
+        return static_cast<float>(error);
+    }
+
+    static long long edge(Point a, Point b, Point p) {
+        return static_cast<long long>(b.x - a.x) * (p.y - a.y) - static_cast<long long>(b.y - a.y) * (p.x - a.x);
+    }
+
+    void emitTriangle(Point a, Point b, Point c) {
+        if (legLength(a, c) > 1) {
+            size_t mi = index(middle(a, b));
+            if (!(coverage[mi] & HasValid)) {
+                return; // Только нулевая глубина или поле дополнения
+            }
+            if ((coverage[mi] & HasInvalid) || errors[mi] > threshold) {
+                Point m = middle(a, b);
+                emitTriangle(c, a, m);
+                emitTriangle(b, c, m);
+                return;
+            }
+        }
+        if (validity(a) != HasValid || validity(b) != HasValid || validity(c) != HasValid) {
+            return;
+        }
+        // Обход против часовой стрелки в плоскости xy, как у generateDepthMapVertices
+        if (edge(a, b, c) < 0) {
+            std::swap(b, c);
+        }
+        output->push_back(static_cast<uint32_t>(static_cast<size_t>(a.y) * width + a.x));
+        output->push_back(static_cast<uint32_t>(static_cast<size_t>(b.y) * width + b.x));
+        output->push_back(static_cast<uint32_t>(static_cast<size_t>(c.y) * width + c.x));
+    }
+
+    const T* data;
+    float depthScale;
+    int width;
+    int height;
+    int tile;    // Сторона квадрата в шагах сетки
+    int blocksX;
+    int blocksY;
+    int stride;  // Точек в строке errors и coverage
+    std::vector<float> errors;
+    std::vector<uint8_t> coverage;
+    float threshold = 0.0f;
+    std::vector<uint32_t>* output = nullptr;
+};
+
+template <typename T>
+void emitAdaptiveTriangles(const DepthMap<T>& depthMap, float maxError, std::vector<uint32_t>& triangles) {
+    Rtin<T> rtin(depthMap);
+    rtin.computeErrors();
+    rtin.emit(maxError, triangles);
+}
+
+} // namespace
+
+void buildAdaptiveMesh(const AnyDepthMap& depthMap, float maxError, SampleMesh& mesh) {
+    TRACE_ZONE("buildAdaptiveMesh");
+    size_t width = depthMap.width();
+    size_t height = depthMap.height();
+    if (width * height > std::numeric_limits<uint32_t>::max() || width > (1u << 30) || height > (1u << 30)) {
+        throw std::runtime_error("Depth map is too large for adaptive triangulation");
+    }
+
+    // Треугольники ссылаются на отсчёты, затем отсчёты нумеруются по порядку строк
+    std::vector<uint32_t> triangles;
+    depthMap.visit([&](const auto& typed) {
+        emitAdaptiveTriangles(typed, maxError, triangles);
+    });
+    std::vector<uint32_t> remap(width * height, 0);
+    for (uint32_t sample : triangles) {
+        remap[sample] = 1;
+    }
+    mesh.samples.clear();
+    for (size_t i = 0; i < remap.size(); ++i) {
+        if (remap[i]) {
+            remap[i] = static_cast<uint32_t>(mesh.samples.size());
+            mesh.samples.push_back(static_cast<uint32_t>(i));
+        }
+    }
+    for (uint32_t& sample : triangles) {
+        sample = remap[sample];
+    }
+    mesh.triangles.swap(triangles);
+}
@@ -0,0 +1,17 @@
+﻿#ifndef RTIN_H
+#define RTIN_H
+
+#include "depth_map.h"
+#include "mesh.h"
+
+// Адаптивная триангуляция (RTIN, right-triangulated irregular network): сетка
+// прямоугольных треугольников делится пополам, пока отклонение отсчётов от плоскости
+// треугольника (с учётом потомков) больше maxError. Ошибка хранится в середине
+// гипотенузы и общая для двух соседей, поэтому сетка без трещин.
+// Карта покрывается квадратами 2^k + 1 по короткой стороне вдоль длинной и дополняется
+// нулями до целого числа квадратов; треугольники, задевающие нулевую глубину,
+// делятся до шага сетки и отбрасываются, как в generateDepthMapVertices.
+// maxError задаётся в единицах карты глубины.
+void buildAdaptiveMesh(const AnyDepthMap& depthMap, float maxError, SampleMesh& mesh);
+
+#endif // RTIN_H
@@ -0,0 +1,139 @@
+﻿#include "sequence_renderer.h"
+#include <cstring>
+#include <stdexcept>
+#include "trace.h"
+
+namespace {
+
+// Отображает диапазон от первого до последнего тайла и копирует в него только эти тайлы
+size_t writeTiles(GLuint buffer, const std::vector<size_t>& tiles, const void* source, size_t tileBytes,
+    const std::vector<size_t>& bytes) {
+    if (tiles.empty()) {
+        return 0;
+    }
+    size_t begin = tiles.front() * tileBytes;
+    size_t end = tiles.back() * tileBytes + tileBytes;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    char* mapped = static_cast<char*>(glMapBufferRange(GL_COPY_WRITE_BUFFER, begin, end - begin,
+        GL_MAP_WRITE_BIT | GL_MAP_FLUSH_EXPLICIT_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+    if (!mapped) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        throw std::runtime_error("Failed to map sequence buffer");
+    }
+    size_t copied = 0;
+    for (size_t i = 0; i < tiles.size(); ++i) {
+        size_t offset = tiles[i] * tileBytes - begin;
+        std::memcpy(mapped + offset, static_cast<const char*>(source) + begin + offset, bytes[i]);
+        glFlushMappedBufferRange(GL_COPY_WRITE_BUFFER, offset, bytes[i]);
+        copied += bytes[i];
+    }
+    glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return copied;
+}
+
+} // namespace
+
+SequenceRenderer::SequenceRenderer(const SequenceMesh& mesh) {
+    size_t vertexBytes = mesh.vertices().size() * sizeof(float);
+    size_t indexBytes = mesh.indices().size() * sizeof(uint16_t);
+    for (Slot& slot : slots) {
+        glGenVertexArrays(1, &slot.VAO);
+        glGenBuffers(1, &slot.VBO);
+        glGenBuffers(1, &slot.EBO);
+
+        glBindVertexArray(slot.VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, slot.VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertexBytes, nullptr, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, slot.EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, nullptr, GL_DYNAMIC_DRAW);
+
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
+        glEnableVertexAttribArray(1);
+
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        slot.versions.assign(mesh.tileCount(), 0);
+    }
+}
+
+SequenceRenderer::~SequenceRenderer() {
+    for (Slot& slot : slots) {
+        if (slot.fence) {
+            glDeleteSync(slot.fence);
+        }
+        glDeleteVertexArrays(1, &slot.VAO);
+        glDeleteBuffers(1, &slot.VBO);
+        glDeleteBuffers(1, &slot.EBO);
+    }
+}
+
+size_t SequenceRenderer::upload(const SequenceMesh& mesh) {
+    TRACE_ZONE("SequenceRenderer::upload");
+    if (slots[current].frame == mesh.frame()) {
+        return 0;
+    }
+    current = (current + 1) % slotCount;
+    Slot& slot = slots[current];
+
+    // Комплект мог ещё читаться GPU два кадра назад
+    if (slot.fence) {
+        while (glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED) {
+        }
+        glDeleteSync(slot.fence);
+        slot.fence = nullptr;
+    }
+
+    const std::vector<uint64_t>& versions = mesh.tileVersions();
+    std::vector<size_t> stale;
+    for (size_t tile = 0; tile < versions.size(); ++tile) {
+        if (slot.versions[tile] != versions[tile]) {
+            stale.push_back(tile);
+        }
+    }
+
+    size_t vertexTileBytes = mesh.tileVertexCapacity() * 6 * sizeof(float);
+    size_t indexTileBytes = mesh.tileIndexCapacity() * sizeof(uint16_t);
+    std::vector<size_t> vertexBytes(stale.size(), vertexTileBytes);
+    std::vector<size_t> indexBytes(stale.size());
+    for (size_t i = 0; i < stale.size(); ++i) {
+        indexBytes[i] = mesh.indexCounts()[stale[i]] * sizeof(uint16_t);
+    }
+
+    size_t copied = writeTiles(slot.VBO, stale, mesh.vertices().data(), vertexTileBytes, vertexBytes);
+    copied += writeTiles(slot.EBO, stale, mesh.indices().data(), indexTileBytes, indexBytes);
+    for (size_t tile : stale) {
+        slot.versions[tile] = versions[tile];
+    }
+    slot.frame = mesh.frame();
+    return copied;
+}
+
+void SequenceRenderer::draw(const SequenceMesh& mesh) {
+    TRACE_ZONE("SequenceRenderer::draw");
+    counts.clear();
+    offsets.clear();
+    baseVertices.clear();
+    const std::vector<uint32_t>& indexCounts = mesh.indexCounts();
+    for (size_t tile = 0; tile < indexCounts.size(); ++tile) {
+        if (indexCounts[tile] == 0) {
+            continue;
+        }
+        counts.push_back(static_cast<GLsizei>(indexCounts[tile]));
+        offsets.push_back(reinterpret_cast<const void*>(tile * mesh.tileIndexCapacity() * sizeof(uint16_t)));
+        baseVertices.push_back(static_cast<GLint>(tile * mesh.tileVertexCapacity()));
+    }
+
+    Slot& slot = slots[current];
+    glBindVertexArray(slot.VAO);
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, counts.data(), GL_UNSIGNED_SHORT, offsets.data(),
+        static_cast<GLsizei>(counts.size()), baseVertices.data());
+    glBindVertexArray(0);
+
+    if (slot.fence) {
+        glDeleteSync(slot.fence);
+    }
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
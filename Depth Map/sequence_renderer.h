@@ -0,0 +1,45 @@
+﻿#ifndef SEQUENCE_RENDERER_H
+#define SEQUENCE_RENDERER_H
+
+#include <glad/glad.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "frame_sequence.h"
+
+// Буферы OpenGL для SequenceMesh. Три комплекта VBO/EBO выделяются один раз под полную
+// раскладку тайлов; новый кадр пишется в следующий комплект, пока GPU рисует предыдущие.
+// Копируются только тайлы, изменившиеся с последней записи в этот комплект: диапазон
+// отображается без синхронизации (glMapBufferRange) после ожидания fence этого комплекта.
+class SequenceRenderer {
+public:
+    explicit SequenceRenderer(const SequenceMesh& mesh);
+    ~SequenceRenderer();
+
+    // Возвращает число скопированных байт (0, если кадр уже в буфере)
+    size_t upload(const SequenceMesh& mesh);
+    // Все непустые тайлы одним вызовом glMultiDrawElementsBaseVertex
+    void draw(const SequenceMesh& mesh);
+
+private:
+    struct Slot {
+        GLuint VAO = 0;
+        GLuint VBO = 0;
+        GLuint EBO = 0;
+        GLsync fence = nullptr;
+        std::vector<uint64_t> versions;
+        uint64_t frame = 0;
+    };
+
+    SequenceRenderer(const SequenceRenderer&) = delete;
+    SequenceRenderer& operator=(const SequenceRenderer&) = delete;
+
+    static const size_t slotCount = 3;
+    Slot slots[slotCount];
+    size_t current = 0;
+    std::vector<GLsizei> counts;
+    std::vector<const void*> offsets;
+    std::vector<GLint> baseVertices;
+};
+
+#endif // SEQUENCE_RENDERER_H
@@ -0,0 +1,636 @@
+﻿#include "software_renderer.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include "normal_kernel.h"
+#include "parallel.h"
+#include "trace.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RASTER_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define RASTER_AVX2_TARGET
+#else
+#define RASTER_AVX2_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace {
+
+const size_t rasterTile = 64;
+const uint32_t noTriangle = std::numeric_limits<uint32_t>::max();
+const float PI = 3.14159265359f;
+
+struct Vec3 {
+    float x, y, z;
+};
+
+Vec3 operator+(Vec3 a, Vec3 b) { return { a.x + b.x, a.y + b.y, a.z + b.z }; }
+Vec3 operator-(Vec3 a, Vec3 b) { return { a.x - b.x, a.y - b.y, a.z - b.z }; }
+Vec3 operator*(Vec3 a, Vec3 b) { return { a.x * b.x, a.y * b.y, a.z * b.z }; }
+Vec3 operator*(Vec3 a, float s) { return { a.x * s, a.y * s, a.z * s }; }
+float dot(Vec3 a, Vec3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+Vec3 cross(Vec3 a, Vec3 b) { return { a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x }; }
+Vec3 fromArray(const float* v) { return { v[0], v[1], v[2] }; }
+Vec3 splat(float s) { return { s, s, s }; }
+
+Vec3 normalize(Vec3 v) {
+    float length = std::sqrt(dot(v, v));
+    return length > 0 ? v * (1.0f / length) : v;
+}
+
+// out = a * b для матриц по столбцам
+void multiply(const float* a, const float* b, float* out) {
+    for (int column = 0; column < 4; ++column) {
+        for (int row = 0; row < 4; ++row) {
+            float sum = 0.0f;
+            for (int k = 0; k < 4; ++k) {
+                sum += a[k * 4 + row] * b[column * 4 + k];
+            }
+            out[column * 4 + row] = sum;
+        }
+    }
+}
+
+// mat3(transpose(inverse(model))) — матрица нормалей из вершинных шейдеров
+void normalMatrix(const float* m, float out[9]) {
+    float a = m[0], b = m[4], c = m[8];
+    float d = m[1], e = m[5], f = m[9];
+    float g = m[2], h = m[6], i = m[10];
+    float cofactors[9] = {
+        e * i - f * h, -(d * i - f * g), d * h - e * g,
+        -(b * i - c * h), a * i - c * g, -(a * h - b * g),
+        b * f - c * e, -(a * f - c * d), a * e - b * d
+    };
+    float determinant = a * cofactors[0] + b * cofactors[1] + c * cofactors[2];
+    float inverse = determinant != 0 ? 1.0f / determinant : 0.0f;
+    // Строки матрицы кофакторов — столбцы результата
+    for (int row = 0; row < 3; ++row) {
+        for (int column = 0; column < 3; ++column) {
+            out[column * 3 + row] = cofactors[row * 3 + column] * inverse;
+        }
+    }
+}
+
+float fresnelTerm(float cosTheta, float f0) {
+    float m = 1.0f - cosTheta;
+    float m2 = m * m;
+    return f0 + (1.0f - f0) * (m2 * m2 * m); // pow(1 - cosTheta, 5)
+}
+
+float geometrySchlickGGX(float NdotV, float roughness) {
+    float r = roughness + 1.0f;
+    float k = r * r / 8.0f;
+    return NdotV / (NdotV * (1.0f - k) + k);
+}
+
+// Те же формулы, что во фрагментных шейдерах Depth Map.cpp
+Vec3 shade(ShadingModel shading, const RenderCamera& camera, Vec3 fragPos, Vec3 normal) {
+    Vec3 lightColor = fromArray(camera.lightColor);
+    Vec3 objectColor = fromArray(camera.objectColor);
+    Vec3 N = normalize(normal);
+    Vec3 L = normalize(fromArray(camera.lightPosition) - fragPos);
+
+    if (shading == ShadingModel::Lambert) {
+        float depthSpan = std::max(camera.depthRange[1] - camera.depthRange[0], 1e-6f);
+        float depthNormalized = std::min(std::max((fragPos.z - camera.depthRange[0]) / depthSpan, 0.0f), 1.0f);
+        float diff = std::max(dot(N, L), 0.0f);
+        return lightColor * diff * objectColor * depthNormalized;
+    }
+
+    Vec3 V = normalize(fromArray(camera.viewPosition) - fragPos);
+    if (shading == ShadingModel::Phong) {
+        float diff = std::max(dot(N, L), 0.0f);
+        Vec3 diffuse = lightColor * (diff * 0.45f);
+        Vec3 incident = splat(0.0f) - L;
+        Vec3 reflectDir = incident - N * (2.0f * dot(N, incident));
+        float spec = std::max(dot(V, reflectDir), 0.0f);
+        for (int i = 0; i < 5; ++i) {
+            spec *= spec; // pow(spec, 32)
+        }
+        Vec3 specular = lightColor * (2.1f * spec);
+        return (diffuse + specular) * objectColor;
+    }
+
+    // Torrens
+    Vec3 H = normalize(V + L);
+    const float metallic = 0.4f;
+    const float roughness = 0.32f;
+    Vec3 F0 = splat(0.04f) * (1.0f - metallic) + objectColor * metallic;
+    float HdotV = std::max(dot(H, V), 0.0f);
+    Vec3 F = { fresnelTerm(HdotV, F0.x), fresnelTerm(HdotV, F0.y), fresnelTerm(HdotV, F0.z) };
+
+    float a = roughness * roughness;
+    float a2 = a * a;
+    float NdotH = std::max(dot(N, H), 0.0f);
+    float denom = NdotH * NdotH * (a2 - 1.0f) + 1.0f;
+    float NDF = a2 / (PI * denom * denom);
+
+    float NdotV = std::max(dot(N, V), 0.0f);
+    float NdotL = std::max(dot(N, L), 0.0f);
+    float G = geometrySchlickGGX(NdotV, roughness) * geometrySchlickGGX(NdotL, roughness);
+
+    Vec3 specular = F * (NDF * G / std::max(4.0f * NdotV * NdotL, 0.001f));
+    Vec3 kD = (splat(1.0f) - F) * (1.0f - metallic);
+    Vec3 Lo = (kD * objectColor * (1.0f / PI) + specular) * lightColor * NdotL;
+    Vec3 color = objectColor * 0.03f + Lo;
+    return { std::sqrt(color.x), std::sqrt(color.y), std::sqrt(color.z) };
+}
+
+uint8_t toByte(float value) {
+    return static_cast<uint8_t>(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+enum class RasterKernel {
+    Scalar,
+    SSE2,
+    AVX2
+};
+
+// Прямоугольник пикселей [x0, x1] x [y0, y1] треугольника внутри тайла с началом (tileX, tileY)
+struct RasterSpan {
+    int x0, y0, x1, y1;
+    int tileX, tileY;
+};
+
+// E_k в точке (px, py), отсчитанной от вершины k + 1: без потери точности на больших координатах
+inline float edgeAt(const SoftwareRenderer::RasterTriangle& t, int k, float px, float py) {
+    int a = (k + 1) % 3;
+    return t.edgeA[k] * (px - t.x[a]) + t.edgeB[k] * (py - t.y[a]);
+}
+
+void rasterScalar(const SoftwareRenderer::RasterTriangle& t, uint32_t id, const RasterSpan& span,
+    float* depth, uint32_t* ids) {
+    for (int y = span.y0; y <= span.y1; ++y) {
+        float py = y + 0.5f;
+        size_t row = (y - span.tileY) * rasterTile;
+        for (int x = span.x0; x <= span.x1; ++x) {
+            float px = x + 0.5f;
+            float e0 = edgeAt(t, 0, px, py);
+            float e1 = edgeAt(t, 1, px, py);
+            float e2 = edgeAt(t, 2, px, py);
+            if (e0 < 0 || e1 < 0 || e2 < 0) {
+                continue;
+            }
+            float z = t.z[0] + e1 * t.depthStep[0] + e2 * t.depthStep[1];
+            size_t i = row + (x - span.tileX);
+            if (z < depth[i]) {
+                depth[i] = z;
+                ids[i] = id;
+            }
+        }
+    }
+}
+
+#ifdef RASTER_X86
+
+// Блоки по 4 пикселя, выровненные относительно начала тайла (ширина тайла кратна 8)
+void rasterSse2(const SoftwareRenderer::RasterTriangle& t, uint32_t id, const RasterSpan& span,
+    float* depth, uint32_t* ids) {
+    const __m128 lanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 z0 = _mm_set1_ps(t.z[0]);
+    const __m128 dz1 = _mm_set1_ps(t.depthStep[0]);
+    const __m128 dz2 = _mm_set1_ps(t.depthStep[1]);
+    const __m128 idValue = _mm_castsi128_ps(_mm_set1_epi32(static_cast<int>(id)));
+    __m128 stepA[3];
+    for (int k = 0; k < 3; ++k) {
+        stepA[k] = _mm_mul_ps(_mm_set1_ps(t.edgeA[k]), lanes);
+    }
+
+    int start = span.tileX + ((span.x0 - span.tileX) & ~3);
+    for (int y = span.y0; y <= span.y1; ++y) {
+        float py = y + 0.5f;
+        size_t row = (y - span.tileY) * rasterTile;
+        for (int x = start; x <= span.x1; x += 4) {
+            float px = x + 0.5f;
+            __m128 e0 = _mm_add_ps(_mm_set1_ps(edgeAt(t, 0, px, py)), stepA[0]);
+            __m128 e1 = _mm_add_ps(_mm_set1_ps(edgeAt(t, 1, px, py)), stepA[1]);
+            __m128 e2 = _mm_add_ps(_mm_set1_ps(edgeAt(t, 2, px, py)), stepA[2]);
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+            if (_mm_movemask_ps(inside) == 0) {
+                continue;
+            }
+            size_t i = row + (x - span.tileX);
+            __m128 z = _mm_add_ps(z0, _mm_add_ps(_mm_mul_ps(e1, dz1), _mm_mul_ps(e2, dz2)));
+            __m128 old = _mm_loadu_ps(depth + i);
+            __m128 mask = _mm_and_ps(inside, _mm_cmplt_ps(z, old));
+            _mm_storeu_ps(depth + i, _mm_or_ps(_mm_and_ps(mask, z), _mm_andnot_ps(mask, old)));
+            __m128 oldIds = _mm_loadu_ps(reinterpret_cast<const float*>(ids + i));
+            _mm_storeu_ps(reinterpret_cast<float*>(ids + i), _mm_or_ps(_mm_and_ps(mask, idValue), _mm_andnot_ps(mask, oldIds)));
+        }
+    }
+}
+
+RASTER_AVX2_TARGET
+void rasterAvx2(const SoftwareRenderer::RasterTriangle& t, uint32_t id, const RasterSpan& span,
+    float* depth, uint32_t* ids) {
+    const __m256 lanes = _mm256_set_ps(7.0f, 6.0f, 5.0f, 4.0f, 3.0f, 2.0f, 1.0f, 0.0f);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 z0 = _mm256_set1_ps(t.z[0]);
+    const __m256 dz1 = _mm256_set1_ps(t.depthStep[0]);
+    const __m256 dz2 = _mm256_set1_ps(t.depthStep[1]);
+    const __m256 idValue = _mm256_castsi256_ps(_mm256_set1_epi32(static_cast<int>(id)));
+    __m256 stepA[3];
+    for (int k = 0; k < 3; ++k) {
+        stepA[k] = _mm256_mul_ps(_mm256_set1_ps(t.edgeA[k]), lanes);
+    }
+
+    int start = span.tileX + ((span.x0 - span.tileX) & ~7);
+    for (int y = span.y0; y <= span.y1; ++y) {
+        float py = y + 0.5f;
+        size_t row = (y - span.tileY) * rasterTile;
+        for (int x = start; x <= span.x1; x += 8) {
+            float px = x + 0.5f;
+            __m256 e0 = _mm256_add_ps(_mm256_set1_ps(edgeAt(t, 0, px, py)), stepA[0]);
+            __m256 e1 = _mm256_add_ps(_mm256_set1_ps(edgeAt(t, 1, px, py)), stepA[1]);
+            __m256 e2 = _mm256_add_ps(_mm256_set1_ps(edgeAt(t, 2, px, py)), stepA[2]);
+            __m256 inside = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(e0, zero, _CMP_GE_OQ),
+                _mm256_cmp_ps(e1, zero, _CMP_GE_OQ)), _mm256_cmp_ps(e2, zero, _CMP_GE_OQ));
+            if (_mm256_movemask_ps(inside) == 0) {
+                continue;
+            }
+            size_t i = row + (x - span.tileX);
+            __m256 z = _mm256_add_ps(z0, _mm256_add_ps(_mm256_mul_ps(e1, dz1), _mm256_mul_ps(e2, dz2)));
+            __m256 old = _mm256_loadu_ps(depth + i);
+            __m256 mask = _mm256_and_ps(inside, _mm256_cmp_ps(z, old, _CMP_LT_OQ));
+            _mm256_storeu_ps(depth + i, _mm256_blendv_ps(old, z, mask));
+            __m256 oldIds = _mm256_loadu_ps(reinterpret_cast<const float*>(ids + i));
+            _mm256_storeu_ps(reinterpret_cast<float*>(ids + i), _mm256_blendv_ps(oldIds, idValue, mask));
+        }
+    }
+}
+
+#endif // RASTER_X86
+
+RasterKernel bestRasterKernel() {
+    // Возможности процессора те же, что уже определены для ядра нормалей
+    switch (bestNormalKernel()) {
+    case NormalKernel::AVX2:
+        return RasterKernel::AVX2;
+    case NormalKernel::SSE2:
+        return RasterKernel::SSE2;
+    default:
+        return RasterKernel::Scalar;
+    }
+}
+
+void rasterTriangle(RasterKernel kernel, const SoftwareRenderer::RasterTriangle& t, uint32_t id,
+    const RasterSpan& span, float* depth, uint32_t* ids) {
+#ifdef RASTER_X86
+    if (kernel == RasterKernel::AVX2) {
+        rasterAvx2(t, id, span, depth, ids);
+        return;
+    }
+    if (kernel == RasterKernel::SSE2) {
+        rasterSse2(t, id, span, depth, ids);
+        return;
+    }
+#endif
+    (void)kernel;
+    rasterScalar(t, id, span, depth, ids);
+}
+
+// Отсечение многоугольника по ближней плоскости z >= -w (Сазерленд — Ходжмен)
+size_t clipNear(const SoftwareRenderer::ClipVertex* const* input, SoftwareRenderer::ClipVertex* output) {
+    size_t count = 0;
+    for (int i = 0; i < 3; ++i) {
+        const SoftwareRenderer::ClipVertex& a = *input[i];
+        const SoftwareRenderer::ClipVertex& b = *input[(i + 1) % 3];
+        float da = a.clip[2] + a.clip[3];
+        float db = b.clip[2] + b.clip[3];
+        if (da >= 0) {
+            output[count++] = a;
+        }
+        if ((da >= 0) != (db >= 0)) {
+            float s = da / (da - db);
+            SoftwareRenderer::ClipVertex& v = output[count++];
+            for (int k = 0; k < 4; ++k) {
+                v.clip[k] = a.clip[k] + (b.clip[k] - a.clip[k]) * s;
+            }
+            for (int k = 0; k < 6; ++k) {
+                v.attributes[k] = a.attributes[k] + (b.attributes[k] - a.attributes[k]) * s;
+            }
+        }
+    }
+    return count;
+}
+
+// Целиком за одной из плоскостей пирамиды видимости
+bool outsideFrustum(const SoftwareRenderer::ClipVertex* const* v) {
+    for (int axis = 0; axis < 3; ++axis) {
+        if (v[0]->clip[axis] > v[0]->clip[3] && v[1]->clip[axis] > v[1]->clip[3] && v[2]->clip[axis] > v[2]->clip[3]) {
+            return true;
+        }
+        if (v[0]->clip[axis] < -v[0]->clip[3] && v[1]->clip[axis] < -v[1]->clip[3] && v[2]->clip[axis] < -v[2]->clip[3]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename Index>
+void setupTriangles(const Index* indices, size_t begin, size_t end, const SoftwareRenderer::ClipVertex* vertices,
+    size_t width, size_t height, size_t tilesX, std::vector<SoftwareRenderer::RasterTriangle>& out,
+    std::vector<std::vector<uint32_t>>& bins) {
+    const SoftwareRenderer::ClipVertex* corners[4];
+    SoftwareRenderer::ClipVertex polygon[4];
+    for (size_t triangle = begin; triangle < end; ++triangle) {
+        for (int k = 0; k < 3; ++k) {
+            corners[k] = &vertices[indices[triangle * 3 + k]];
+        }
+        if (outsideFrustum(corners)) {
+            continue;
+        }
+        // Отсечение нужно, только если вершина перед ближней плоскостью
+        size_t count = 3;
+        if (corners[0]->clip[2] < -corners[0]->clip[3] || corners[1]->clip[2] < -corners[1]->clip[3]
+            || corners[2]->clip[2] < -corners[2]->clip[3]) {
+            count = clipNear(corners, polygon);
+            for (size_t k = 0; k < count; ++k) {
+                corners[k] = &polygon[k];
+            }
+        }
+
+        for (size_t fan = 1; fan + 1 < count; ++fan) {
+            SoftwareRenderer::RasterTriangle t;
+            const SoftwareRenderer::ClipVertex* source[3] = { corners[0], corners[fan], corners[fan + 1] };
+            for (int k = 0; k < 3; ++k) {
+                float invW = 1.0f / source[k]->clip[3];
+                t.x[k] = (source[k]->clip[0] * invW * 0.5f + 0.5f) * width;
+                t.y[k] = (0.5f - source[k]->clip[1] * invW * 0.5f) * height; // Строки изображения сверху вниз
+                t.z[k] = source[k]->clip[2] * invW * 0.5f + 0.5f;
+                t.invW[k] = invW;
+                std::copy(source[k]->attributes, source[k]->attributes + 6, t.attributes[k]);
+            }
+            float area = (t.x[1] - t.x[0]) * (t.y[2] - t.y[0]) - (t.x[2] - t.x[0]) * (t.y[1] - t.y[0]);
+            if (!(std::fabs(area) > 0)) {
+                continue;
+            }
+            if (area < 0) {
+                std::swap(t.x[1], t.x[2]);
+                std::swap(t.y[1], t.y[2]);
+                std::swap(t.z[1], t.z[2]);
+                std::swap(t.invW[1], t.invW[2]);
+                std::swap(t.attributes[1], t.attributes[2]);
+                area = -area;
+            }
+            t.invArea = 1.0f / area;
+            for (int k = 0; k < 3; ++k) {
+                int a = (k + 1) % 3;
+                int b = (k + 2) % 3;
+                t.edgeA[k] = t.y[a] - t.y[b];
+                t.edgeB[k] = t.x[b] - t.x[a];
+            }
+            t.depthStep[0] = (t.z[1] - t.z[0]) * t.invArea;
+            t.depthStep[1] = (t.z[2] - t.z[0]) * t.invArea;
+
+            // Пиксели, центры которых попадают в описанный прямоугольник
+            float minX = std::min(t.x[0], std::min(t.x[1], t.x[2]));
+            float maxX = std::max(t.x[0], std::max(t.x[1], t.x[2]));
+            float minY = std::min(t.y[0], std::min(t.y[1], t.y[2]));
+            float maxY = std::max(t.y[0], std::max(t.y[1], t.y[2]));
+            float x0 = std::max(std::ceil(minX - 0.5f), 0.0f);
+            float x1 = std::min(std::floor(maxX - 0.5f), static_cast<float>(width - 1));
+            float y0 = std::max(std::ceil(minY - 0.5f), 0.0f);
+            float y1 = std::min(std::floor(maxY - 0.5f), static_cast<float>(height - 1));
+            if (x0 > x1 || y0 > y1) {
+                continue;
+            }
+
+            t.bounds[0] = static_cast<int>(x0);
+            t.bounds[1] = static_cast<int>(y0);
+            t.bounds[2] = static_cast<int>(x1);
+            t.bounds[3] = static_cast<int>(y1);
+            uint32_t id = static_cast<uint32_t>(out.size());
+            out.push_back(t);
+            size_t tx0 = static_cast<size_t>(x0) / rasterTile;
+            size_t tx1 = static_cast<size_t>(x1) / rasterTile;
+            size_t ty0 = static_cast<size_t>(y0) / rasterTile;
+            size_t ty1 = static_cast<size_t>(y1) / rasterTile;
+            for (size_t ty = ty0; ty <= ty1; ++ty) {
+                for (size_t tx = tx0; tx <= tx1; ++tx) {
+                    bins[ty * tilesX + tx].push_back(id);
+                }
+            }
+        }
+    }
+}
+
+} // namespace
+
+ShadingModel shadingModelFromName(const std::string& name) {
+    if (name == "Lambert") {
+        return ShadingModel::Lambert;
+    }
+    if (name == "Phong") {
+        return ShadingModel::Phong;
+    }
+    if (name == "Torrens") {
+        return ShadingModel::Torrens;
+    }
+    throw std::runtime_error("Unknown shader type: " + name);
+}
+
+void lookAtMatrix(const float eye[3], const float center[3], const float up[3], float out[16]) {
+    Vec3 f = normalize(fromArray(center) - fromArray(eye));
+    Vec3 s = normalize(cross(f, fromArray(up)));
+    Vec3 u = cross(s, f);
+    Vec3 e = fromArray(eye);
+    float m[16] = {
+        s.x, u.x, -f.x, 0.0f,
+        s.y, u.y, -f.y, 0.0f,
+        s.z, u.z, -f.z, 0.0f,
+        -dot(s, e), -dot(u, e), dot(f, e), 1.0f
+    };
+    std::copy(m, m + 16, out);
+}
+
+void perspectiveMatrix(float fieldOfView, float aspect, float zNear, float zFar, float out[16]) {
+    float t = std::tan(fieldOfView / 2.0f);
+    std::fill(out, out + 16, 0.0f);
+    out[0] = 1.0f / (aspect * t);
+    out[5] = 1.0f / t;
+    out[10] = -(zFar + zNear) / (zFar - zNear);
+    out[11] = -1.0f;
+    out[14] = -(2.0f * zFar * zNear) / (zFar - zNear);
+}
+
+RenderCamera viewerCamera(size_t mapWidth, size_t mapHeight, float scale) {
+    RenderCamera camera;
+    const float eye[3] = { 100.0f, 100.0f, 60.0f };
+    const float center[3] = { mapWidth * scale / 2.0f, mapHeight * scale / 2.0f, 0.0f };
+    const float up[3] = { 0.0f, -1.0f, 0.0f };
+    std::fill(camera.model, camera.model + 16, 0.0f);
+    camera.model[0] = camera.model[5] = camera.model[10] = camera.model[15] = 1.0f;
+    lookAtMatrix(eye, center, up, camera.view);
+    const float fieldOfView = 45.0f * 3.14159265358979f / 180.0f;
+    perspectiveMatrix(fieldOfView, static_cast<float>(mapWidth) / static_cast<float>(mapHeight), 0.1f, 1000.0f, camera.projection);
+    std::copy(eye, eye + 3, camera.viewPosition);
+    std::fill(camera.lightPosition, camera.lightPosition + 3, 200.0f);
+    return camera;
+}
+
+RenderCamera sensorCamera(const CameraIntrinsics& intrinsics, size_t mapWidth, size_t mapHeight,
+    double minDepth, double maxDepth) {
+    RenderCamera camera;
+    const float eye[3] = { 0.0f, 0.0f, 0.0f };
+    const float center[3] = { 0.0f, 0.0f, 1.0f };
+    const float up[3] = { 0.0f, -1.0f, 0.0f };
+    std::fill(camera.model, camera.model + 16, 0.0f);
+    camera.model[0] = camera.model[5] = camera.model[10] = camera.model[15] = 1.0f;
+    lookAtMatrix(eye, center, up, camera.view);
+    float fieldOfView = 2.0f * std::atan(mapHeight / (2.0f * intrinsics.fy));
+    float aspect = (mapWidth / intrinsics.fx) / (mapHeight / intrinsics.fy);
+    float nearDepth = minDepth > 0 ? static_cast<float>(minDepth * 0.5) : 0.1f;
+    float farDepth = maxDepth > minDepth ? static_cast<float>(maxDepth * 2.0) : nearDepth * 1000.0f;
+    perspectiveMatrix(fieldOfView, aspect, nearDepth, farDepth, camera.projection);
+    std::copy(eye, eye + 3, camera.viewPosition);
+    std::copy(eye, eye + 3, camera.lightPosition);
+    return camera;
+}
+
+SoftwareRenderer::SoftwareRenderer(unsigned threadCount) : threads(workerCount(threadCount)) {
+}
+
+void SoftwareRenderer::render(const GridMesh& mesh, const RenderCamera& camera, ShadingModel shading,
+    size_t width, size_t height, RgbImage& image) {
+    TRACE_ZONE("SoftwareRenderer::render");
+    if (width == 0 || height == 0) {
+        throw std::runtime_error("Invalid render size");
+    }
+    image.width = width;
+    image.height = height;
+    image.pixels.resize(width * height * 3);
+
+    // Вершины: позиция и нормаль в мировых координатах, позиция в пространстве отсечения
+    float viewProjection[16];
+    multiply(camera.projection, camera.view, viewProjection);
+    float normals[9];
+    normalMatrix(camera.model, normals);
+    const float* m = camera.model;
+    vertices.resize(mesh.vertexCount);
+    parallelForBands(mesh.vertexCount, threads, threads, [&](size_t begin, size_t end, size_t) {
+        for (size_t i = begin; i < end; ++i) {
+            const float* v = mesh.vertices.data() + i * 6;
+            ClipVertex& out = vertices[i];
+            float world[4];
+            for (int row = 0; row < 4; ++row) {
+                world[row] = m[row] * v[0] + m[4 + row] * v[1] + m[8 + row] * v[2] + m[12 + row];
+            }
+            world[3] = 1.0f;
+            for (int row = 0; row < 4; ++row) {
+                out.clip[row] = viewProjection[row] * world[0] + viewProjection[4 + row] * world[1]
+                    + viewProjection[8 + row] * world[2] + viewProjection[12 + row];
+            }
+            for (int row = 0; row < 3; ++row) {
+                out.attributes[row] = world[row];
+                out.attributes[3 + row] = normals[row] * v[3] + normals[3 + row] * v[4] + normals[6 + row] * v[5];
+            }
+        }
+    });
+
+    // Треугольники полосами; порядок полос сохраняется при растеризации
+    size_t tilesX = (width + rasterTile - 1) / rasterTile;
+    size_t tilesY = (height + rasterTile - 1) / rasterTile;
+    size_t tileCount = tilesX * tilesY;
+    size_t triangleCount = mesh.indexCount() / 3;
+    size_t bands = std::max<size_t>(1, std::min<size_t>(triangleCount, threads * 2));
+    triangles.resize(bands);
+    bins.resize(bands);
+    for (size_t band = 0; band < bands; ++band) {
+        triangles[band].clear();
+        bins[band].resize(tileCount);
+        for (std::vector<uint32_t>& bin : bins[band]) {
+            bin.clear();
+        }
+    }
+    parallelForBands(triangleCount, bands, threads, [&](size_t begin, size_t end, size_t band) {
+        if (mesh.wideIndices()) {
+            setupTriangles(mesh.indices32.data(), begin, end, vertices.data(), width, height, tilesX, triangles[band], bins[band]);
+        }
+        else {
+            setupTriangles(mesh.indices16.data(), begin, end, vertices.data(), width, height, tilesX, triangles[band], bins[band]);
+        }
+    });
+
+    // Сквозные номера треугольников: полоса находится по смещениям
+    std::vector<uint32_t> offsets(bands + 1, 0);
+    for (size_t band = 0; band < bands; ++band) {
+        if (offsets[band] + triangles[band].size() >= noTriangle) {
+            throw std::runtime_error("Too many triangles for the software renderer");
+        }
+        offsets[band + 1] = offsets[band] + static_cast<uint32_t>(triangles[band].size());
+    }
+
+    // Растеризация и освещение по тайлам: каждый видимый пиксель освещается один раз
+    RasterKernel kernel = bestRasterKernel();
+    const uint8_t background[3] = { toByte(camera.background[0]), toByte(camera.background[1]), toByte(camera.background[2]) };
+    parallelForBands(tileCount, tileCount, threads, [&](size_t begin, size_t end, size_t) {
+        std::vector<float> depth(rasterTile * rasterTile);
+        std::vector<uint32_t> ids(rasterTile * rasterTile);
+        for (size_t tile = begin; tile < end; ++tile) {
+            int tileX = static_cast<int>((tile % tilesX) * rasterTile);
+            int tileY = static_cast<int>((tile / tilesX) * rasterTile);
+            int tileRight = std::min(tileX + static_cast<int>(rasterTile), static_cast<int>(width)) - 1;
+            int tileBottom = std::min(tileY + static_cast<int>(rasterTile), static_cast<int>(height)) - 1;
+            std::fill(depth.begin(), depth.end(), 1.0f);
+            std::fill(ids.begin(), ids.end(), noTriangle);
+
+            for (size_t band = 0; band < bands; ++band) {
+                for (uint32_t id : bins[band][tile]) {
+                    const RasterTriangle& t = triangles[band][id];
+                    RasterSpan span;
+                    span.x0 = std::max(tileX, t.bounds[0]);
+                    span.y0 = std::max(tileY, t.bounds[1]);
+                    span.x1 = std::min(tileRight, t.bounds[2]);
+                    span.y1 = std::min(tileBottom, t.bounds[3]);
+                    span.tileX = tileX;
+                    span.tileY = tileY;
+                    rasterTriangle(kernel, t, offsets[band] + id, span, depth.data(), ids.data());
+                }
+            }
+
+            for (int y = tileY; y <= tileBottom; ++y) {
+                uint8_t* out = image.pixels.data() + (y * width + tileX) * 3;
+                const uint32_t* row = ids.data() + (y - tileY) * rasterTile;
+                for (int x = 0; x <= tileRight - tileX; ++x, out += 3) {
+                    uint32_t id = row[x];
+                    if (id == noTriangle) {
+                        out[0] = background[0];
+                        out[1] = background[1];
+                        out[2] = background[2];
+                        continue;
+                    }
+                    size_t band = std::upper_bound(offsets.begin(), offsets.end(), id) - offsets.begin() - 1;
+                    const RasterTriangle& t = triangles[band][id - offsets[band]];
+
+                    // Барицентрические координаты в центре пикселя с поправкой на перспективу
+                    float px = tileX + x + 0.5f;
+                    float py = y + 0.5f;
+                    float weights[3];
+                    float sum = 0.0f;
+                    for (int k = 0; k < 3; ++k) {
+                        weights[k] = std::max(edgeAt(t, k, px, py), 0.0f) * t.invW[k];
+                        sum += weights[k];
+                    }
+                    float attributes[6] = {};
+                    if (sum > 0) {
+                        for (int k = 0; k < 3; ++k) {
+                            float w = weights[k] / sum;
+                            for (int i = 0; i < 6; ++i) {
+                                attributes[i] += t.attributes[k][i] * w;
+                            }
+                        }
+                    }
+                    Vec3 color = shade(shading, camera, fromArray(attributes), fromArray(attributes + 3));
+                    out[0] = toByte(color.x);
+                    out[1] = toByte(color.y);
+                    out[2] = toByte(color.z);
+                }
+            }
+        }
+    });
+}
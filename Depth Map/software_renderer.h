@@ -0,0 +1,88 @@
+﻿#ifndef SOFTWARE_RENDERER_H
+#define SOFTWARE_RENDERER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "camera_projection.h"
+#include "image_writer.h"
+#include "mesh.h"
+
+// Модели отражения шейдеров из Depth Map.cpp
+enum class ShadingModel {
+    Lambert,
+    Phong,
+    Torrens
+};
+
+// Имя как reflectionModel в config.json: Lambert, Phong или Torrens
+ShadingModel shadingModelFromName(const std::string& name);
+
+// Матрицы по столбцам, как glm::lookAt и glm::perspective
+void lookAtMatrix(const float eye[3], const float center[3], const float up[3], float out[16]);
+void perspectiveMatrix(float fieldOfView, float aspect, float zNear, float zFar, float out[16]);
+
+struct RenderCamera {
+    float model[16];
+    float view[16];
+    float projection[16];
+    float viewPosition[3];
+    float lightPosition[3];
+    float lightColor[3] = { 0.64f, 0.57f, 0.88f };
+    float objectColor[3] = { 0.88f, 0.71f, 0.53f };
+    float background[3] = { 0.4f, 0.4f, 0.4f };
+    float depthRange[2] = { 0.4f, 0.73f }; // Нормировка глубины в модели Ламберта, как depthRange в шейдере
+};
+
+// Камера, свет и проекция окна просмотра для карты mapWidth x mapHeight с шагом сетки scale
+RenderCamera viewerCamera(size_t mapWidth, size_t mapHeight, float scale);
+
+// Камера датчика для облака точек (camera_projection.h): в начале координат, смотрит вдоль z,
+// поле зрения и соотношение сторон по fx, fy и размеру карты (главная точка считается в центре).
+// Свет — в точке камеры. Ближняя и дальняя плоскости — половина наименьшей и удвоенная наибольшая
+// глубина облака (minDepth, maxDepth)
+RenderCamera sensorCamera(const CameraIntrinsics& intrinsics, size_t mapWidth, size_t mapHeight,
+    double minDepth, double maxDepth);
+
+// Растеризация на CPU без OpenGL. Вершины преобразуются полосами в threads потоках,
+// треугольники отсекаются по ближней плоскости и раскладываются по экранным тайлам 64x64.
+// Каждый тайл растеризуется одним потоком: функции рёбер и тест глубины считаются по 8 (AVX2)
+// или 4 (SSE2) пикселя, в тайле запоминается ближайший треугольник, а затем каждый видимый
+// пиксель освещается один раз по формулам шейдеров. Задние грани не отбрасываются, как в окне.
+// Буферы сохраняются между вызовами render.
+class SoftwareRenderer {
+public:
+    explicit SoftwareRenderer(unsigned threads = 0);
+
+    void render(const GridMesh& mesh, const RenderCamera& camera, ShadingModel shading,
+        size_t width, size_t height, RgbImage& image);
+
+    struct ClipVertex {
+        float clip[4];
+        float attributes[6]; // Позиция и нормаль в мировых координатах
+    };
+
+    struct RasterTriangle {
+        float x[3];
+        float y[3];
+        float z[3];
+        float invW[3];
+        float invArea;
+        // Функция ребра напротив вершины k: E_k(p) = edgeA[k] * (p.x - x[k + 1]) + edgeB[k] * (p.y - y[k + 1]),
+        // внутри треугольника все E_k >= 0, барицентрическая координата вершины k — E_k * invArea
+        float edgeA[3];
+        float edgeB[3];
+        float depthStep[2]; // z = z[0] + E_1 * depthStep[0] + E_2 * depthStep[1]
+        int bounds[4]; // Пиксели x0, y0, x1, y1 включительно
+        float attributes[3][6];
+    };
+
+private:
+    unsigned threads;
+    std::vector<ClipVertex> vertices;
+    std::vector<std::vector<RasterTriangle>> triangles;   // По полосам треугольников сетки
+    std::vector<std::vector<std::vector<uint32_t>>> bins; // [полоса][тайл] -> номера в triangles[полоса]
+};
+
+#endif // SOFTWARE_RENDERER_H
@@ -0,0 +1,646 @@
+﻿#include "streaming.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+#include "binary_writer.h"
+#include "mesh.h"
+#include "normal_kernel.h"
+#include "text_writer.h"
+#include "trace.h"
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+namespace {
+
+// Полоса строк [begin, end) с соседними строками begin - 1, end и end + 1, если они есть
+// (вершины строки end зависят от строки end + 1)
+class RowBands {
+public:
+    RowBands(const MappedDepthMap& source, size_t memoryBudget)
+        : map(source), view(source.view()) {
+        size_t rowBytes = view.width * sizeof(double);
+        if (memoryBudget / rowBytes < 4) {
+            throw std::runtime_error("Memory budget is too small for one row band");
+        }
+        rows = std::min(view.height, memoryBudget / rowBytes - 3);
+    }
+
+    size_t width() const { return view.width; }
+    size_t height() const { return view.height; }
+    size_t bandRows() const { return rows; }
+    size_t bandCount() const { return (view.height + rows - 1) / rows; }
+
+    void load(size_t begin, size_t end) {
+        size_t newFirst = begin > 0 ? begin - 1 : 0;
+        size_t newLast = std::min(view.height, end + 2);
+        // Строки выше новой полосы больше не понадобятся
+        if (count > 0 && newFirst > first) {
+            map.releaseRows(first, newFirst - first);
+        }
+        first = newFirst;
+        count = newLast - newFirst;
+        buffer.resize(count * view.width);
+        view.readRows(first, count, buffer.data());
+    }
+
+    void releaseAll() {
+        if (count > 0) {
+            map.releaseRows(first, count);
+        }
+    }
+
+    const double* row(size_t y) const {
+        return buffer.data() + (y - first) * view.width;
+    }
+
+    // Загруженные строки как DepthMap (для нормалей), строка y — это y - firstRow()
+    DepthMap<double> loaded() const {
+        DepthMap<double> depthMap;
+        depthMap.width = view.width;
+        depthMap.height = count;
+        depthMap.data = DepthSamples<double>(nullptr, buffer.data(), buffer.size());
+        return depthMap;
+    }
+    size_t firstRow() const { return first; }
+
+    template <typename Fn>
+    void forEachBand(Fn fn) {
+        for (size_t begin = 0; begin < view.height; begin += rows) {
+            size_t end = std::min(view.height, begin + rows);
+            load(begin, end);
+            fn(begin, end);
+        }
+        releaseAll();
+    }
+
+private:
+    const MappedDepthMap& map;
+    const DepthMapView& view;
+    size_t rows = 0;
+    std::vector<double> buffer;
+    size_t first = 0;
+    size_t count = 0;
+};
+
+void checkWritten(std::ofstream& file, const std::string& filename) {
+    if (!file) {
+        throw std::runtime_error("Error writing file: " + filename);
+    }
+}
+
+const uint64_t noVertex = std::numeric_limits<uint64_t>::max();
+
+// Отметки markUsedSamples отсчётов [x0, x1) строки y загруженной полосы. Считаются по столбцам
+// от x0 - 1 до x1 (все квады этих отсчётов), поэтому в used нужно x1 - x0 + 2 байт;
+// возвращает указатель на отметку отсчёта x0
+const unsigned char* usedSamples(const RowBands& bands, size_t y, size_t x0, size_t x1, QuadDiagonal diagonal,
+    unsigned char* used) {
+    size_t from = x0 > 0 ? x0 - 1 : 0;
+    size_t to = std::min(bands.width(), x1 + 1);
+    const double* up = y > 0 ? bands.row(y - 1) + from : nullptr;
+    const double* down = y + 1 < bands.height() ? bands.row(y + 1) + from : nullptr;
+    markUsedSamples(up, bands.row(y) + from, down, to - from, diagonal, used);
+    return used + (x0 - from);
+}
+
+// Отсчёты всей строки y, входящие в треугольники
+void usedSamples(const RowBands& bands, size_t y, QuadDiagonal diagonal, unsigned char* used) {
+    usedSamples(bands, y, 0, bands.width(), diagonal, used);
+}
+
+// Номера вершин строки сжатой сетки: отсчёты с треугольниками по порядку начиная с first
+void rowVertices(const unsigned char* used, size_t width, uint64_t first, uint64_t* out) {
+    for (size_t x = 0; x < width; ++x) {
+        out[x] = used[x] ? first++ : noVertex;
+    }
+}
+
+// Сжатая сетка без таблицы на всю карту (ValidSampleRemap не помещается в память):
+// первый проход по полосам отмечает отсчёты с треугольниками и считает начало каждой строки
+// в нумерации вершин и число граней, номера вершин строки затем восстанавливаются из rowStart
+// и отметок строки
+struct CompactRows {
+    std::vector<uint64_t> rowStart;
+    uint64_t faces = 0;
+
+    uint64_t vertexCount() const { return rowStart.back(); }
+};
+
+CompactRows countCompactRows(RowBands& bands, QuadDiagonal diagonal) {
+    size_t width = bands.width();
+    size_t height = bands.height();
+    CompactRows compact;
+    compact.rowStart.assign(height + 1, 0);
+    std::vector<uint64_t> top(width);
+    std::vector<uint64_t> bottom(width);
+    std::vector<unsigned char> used(width);
+    std::vector<unsigned char> usedBelow(width);
+    bands.forEachBand([&](size_t begin, size_t end) {
+        usedSamples(bands, begin, diagonal, used.data());
+        for (size_t y = begin; y < end; ++y) {
+            uint64_t count = 0;
+            for (size_t x = 0; x < width; ++x) {
+                count += used[x];
+            }
+            compact.rowStart[y + 1] = compact.rowStart[y] + count;
+            if (y + 1 < height) {
+                usedSamples(bands, y + 1, diagonal, usedBelow.data());
+                rowVertices(used.data(), width, 0, top.data());
+                rowVertices(usedBelow.data(), width, 0, bottom.data());
+                forEachQuadFace(top.data(), bottom.data(), width, diagonal,
+                    [&](uint64_t, uint64_t, uint64_t) { ++compact.faces; });
+                used.swap(usedBelow);
+            }
+        }
+    });
+    return compact;
+}
+
+// Текстовые форматы пишутся кусками строк по columns столбцов, чтобы буферы writeTextParallel
+// (slots по bandChars байт) укладывались в textBytes при любой ширине карты.
+// columnChars — наибольшая длина текста на столбец куска
+struct TextChunks {
+    size_t slots;
+    size_t bandChars;
+    size_t columns;
+
+    TextChunks(size_t textBytes, size_t columnChars, unsigned threads)
+        : slots(textBandSlots(threads)), bandChars(textBytes / slots),
+          columns(std::max<size_t>(1, bandChars / columnChars)) {}
+
+    size_t count(size_t width) const { return (width + columns - 1) / columns; }
+};
+
+// Рабочая память одного буфера writeTextParallel: отметки и номера вершин куска двух строк
+struct ChunkScratch {
+    std::vector<unsigned char> used;
+    std::vector<uint64_t> vertices;
+};
+
+std::vector<ChunkScratch> chunkScratch(const TextChunks& chunks) {
+    std::vector<ChunkScratch> scratch(chunks.slots);
+    for (ChunkScratch& work : scratch) {
+        work.used.resize(2 * (chunks.columns + 3));
+        work.vertices.resize(2 * (chunks.columns + 1));
+    }
+    return scratch;
+}
+
+// Вершины сжатой сетки по кускам строк: putVertex(out, x, y, depth) для отсчётов с треугольниками
+template <typename PutVertex>
+void writeChunkVertices(std::ofstream& file, RowBands& bands, const TextChunks& chunks, QuadDiagonal diagonal,
+    size_t vertexChars, unsigned threads, PutVertex putVertex) {
+    size_t width = bands.width();
+    size_t rowChunks = chunks.count(width);
+    std::vector<ChunkScratch> scratch = chunkScratch(chunks);
+    bands.forEachBand([&](size_t begin, size_t end) {
+        writeTextParallel(file, (end - begin) * rowChunks, chunks.columns * vertexChars, threads, chunks.bandChars,
+            [&](size_t i, char* out, size_t slot) {
+                size_t y = begin + i / rowChunks;
+                size_t x0 = i % rowChunks * chunks.columns;
+                size_t x1 = std::min(width, x0 + chunks.columns);
+                const double* row = bands.row(y);
+                const unsigned char* used = usedSamples(bands, y, x0, x1, diagonal, scratch[slot].used.data());
+                for (size_t x = x0; x < x1; ++x) {
+                    if (used[x - x0]) {
+                        out = putVertex(out, x, y, row[x]);
+                    }
+                }
+                return out;
+            });
+    });
+}
+
+// Номера первых вершин кусков строк [begin, last): starts[(y - begin) * count(width) + c] —
+// номер первой вершины среди отсчётов x >= c * columns строки y
+void chunkVertexStarts(const RowBands& bands, const CompactRows& compact, const TextChunks& chunks, size_t begin,
+    size_t last, QuadDiagonal diagonal, unsigned threads, std::vector<ChunkScratch>& scratch,
+    std::vector<uint64_t>& starts) {
+    size_t width = bands.width();
+    size_t rowChunks = chunks.count(width);
+    starts.resize((last - begin) * rowChunks);
+    parallelForBands(last - begin, scratch.size(), workerCount(threads), [&](size_t first, size_t end, size_t band) {
+        unsigned char* used = scratch[band].used.data();
+        for (size_t y = begin + first; y < begin + end; ++y) {
+            uint64_t next = compact.rowStart[y];
+            for (size_t c = 0; c < rowChunks; ++c) {
+                size_t x0 = c * chunks.columns;
+                size_t x1 = std::min(width, x0 + chunks.columns);
+                starts[(y - begin) * rowChunks + c] = next;
+                const unsigned char* marks = usedSamples(bands, y, x0, x1, diagonal, used);
+                for (size_t x = 0; x < x1 - x0; ++x) {
+                    next += marks[x];
+                }
+            }
+        }
+    });
+}
+
+// Грани сжатой сетки по кускам строк квадов: putFace(out, v1, v2, v3)
+template <typename PutFace>
+void writeChunkFaces(std::ofstream& file, RowBands& bands, const CompactRows& compact, const TextChunks& chunks,
+    QuadDiagonal diagonal, size_t faceChars, unsigned threads, PutFace putFace) {
+    size_t width = bands.width();
+    size_t height = bands.height();
+    size_t rowChunks = chunks.count(width);
+    size_t quadChunks = chunks.count(width - 1);
+    std::vector<ChunkScratch> scratch = chunkScratch(chunks);
+    std::vector<uint64_t> starts;
+    bands.forEachBand([&](size_t begin, size_t end) {
+        size_t rows = std::min(end, height - 1) - std::min(begin, height - 1);
+        if (rows == 0 || quadChunks == 0) {
+            return;
+        }
+        chunkVertexStarts(bands, compact, chunks, begin, begin + rows + 1, diagonal, threads, scratch, starts);
+        writeTextParallel(file, rows * quadChunks, chunks.columns * 2 * faceChars, threads, chunks.bandChars,
+            [&](size_t i, char* out, size_t slot) {
+                size_t y = begin + i / quadChunks;
+                size_t c = i % quadChunks;
+                // Квады [x0, x1), их отсчёты [x0, x1]
+                size_t x0 = c * chunks.columns;
+                size_t x1 = std::min(width - 1, x0 + chunks.columns);
+                size_t samples = x1 + 1 - x0;
+                ChunkScratch& work = scratch[slot];
+                const unsigned char* top = usedSamples(bands, y, x0, x1 + 1, diagonal, work.used.data());
+                const unsigned char* bottom = usedSamples(bands, y + 1, x0, x1 + 1, diagonal,
+                    work.used.data() + chunks.columns + 3);
+                uint64_t* vertices = work.vertices.data();
+                rowVertices(top, samples, starts[(y - begin) * rowChunks + c], vertices);
+                rowVertices(bottom, samples, starts[(y + 1 - begin) * rowChunks + c], vertices + samples);
+                forEachQuadFace(vertices, vertices + samples, samples, diagonal,
+                    [&](uint64_t v1, uint64_t v2, uint64_t v3) { out = putFace(out, v1, v2, v3); });
+                return out;
+            });
+    });
+}
+
+void streamPly(RowBands& bands, const std::string& filename, unsigned threads, size_t textBytes,
+    StreamingStats& stats) {
+    std::ofstream file(filename);
+    if (!file) {
+        throw std::runtime_error("Unable to open file");
+    }
+    CompactRows compact = countCompactRows(bands, QuadDiagonal::TopLeft);
+    stats.faces = compact.faces;
+
+    file << "ply\n";
+    file << "format ascii 1.0\n";
+    file << "element vertex " << compact.vertexCount() << "\n";
+    file << "property double x\n";
+    file << "property double y\n";
+    file << "property double z\n";
+    file << "property uchar red\n";
+    file << "property uchar green\n";
+    file << "property uchar blue\n";
+    file << "element face " << stats.faces << "\n";
+    file << "property list uchar uint vertex_indices\n";
+    file << "end_header\n";
+
+    TextChunks chunks(textBytes, std::max(plyVertexChars, 2 * plyFaceChars), threads);
+    writeChunkVertices(file, bands, chunks, QuadDiagonal::TopLeft, plyVertexChars, threads,
+        [](char* out, size_t x, size_t y, double depth) {
+            out = putUnsigned(out, x);
+            *out++ = ' ';
+            out = putUnsigned(out, y);
+            *out++ = ' ';
+            out = putDouble(out, depth);
+            return putText(out, " 255 200 100\n");
+        });
+
+    // Третий проход: грани по номерам вершин двух соседних строк
+    writeChunkFaces(file, bands, compact, chunks, QuadDiagonal::TopLeft, plyFaceChars, threads, putPlyFace);
+    checkWritten(file, filename);
+}
+
+void streamPlyBinary(RowBands& bands, const std::string& filename, bool normals, StreamingStats& stats) {
+    if (!isLittleEndianHost()) {
+        throw std::runtime_error("Binary PLY export requires a little-endian host");
+    }
+    uint64_t width = bands.width();
+    uint64_t height = bands.height();
+    CompactRows compact = countCompactRows(bands, QuadDiagonal::TopLeft);
+    if (compact.vertexCount() > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error("Depth map is too large for binary PLY (no 64-bit index type); use ascii");
+    }
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Unable to open file");
+    }
+    stats.faces = compact.faces;
+
+    file << "ply\n";
+    file << "format binary_little_endian 1.0\n";
+    file << "element vertex " << compact.vertexCount() << "\n";
+    file << "property float x\n";
+    file << "property float y\n";
+    file << "property float z\n";
+    if (normals) {
+        file << "property float nx\n";
+        file << "property float ny\n";
+        file << "property float nz\n";
+    }
+    file << "property uchar red\n";
+    file << "property uchar green\n";
+    file << "property uchar blue\n";
+    file << "element face " << stats.faces << "\n";
+    file << "property list uchar uint vertex_indices\n";
+    file << "end_header\n";
+
+    BufferedWriter writer(file);
+    bands.forEachBand([&](size_t begin, size_t end) {
+        DepthMap<double> loaded = bands.loaded();
+        std::unique_ptr<NormalRowScratch> rowNormals;
+        if (normals) {
+            rowNormals.reset(new NormalRowScratch(loaded, 1.0f, 1.0f));
+        }
+        std::vector<unsigned char> used(width);
+        for (size_t y = begin; y < end; ++y) {
+            const double* row = bands.row(y);
+            if (compact.rowStart[y] == compact.rowStart[y + 1]) {
+                continue;
+            }
+            if (normals) {
+                rowNormals->compute(y - bands.firstRow());
+            }
+            usedSamples(bands, y, QuadDiagonal::TopLeft, used.data());
+            for (size_t x = 0; x < width; ++x) {
+                if (!used[x]) {
+                    continue;
+                }
+                writer.put(static_cast<float>(x));
+                writer.put(static_cast<float>(y));
+                writer.put(static_cast<float>(row[x]));
+                if (normals) {
+                    writer.put(rowNormals->nx()[x]);
+                    writer.put(rowNormals->ny()[x]);
+                    writer.put(rowNormals->nz()[x]);
+                }
+                writer.put<uint8_t>(255);
+                writer.put<uint8_t>(200);
+                writer.put<uint8_t>(100);
+            }
+        }
+    });
+
+    std::vector<uint64_t> vertices(2 * width);
+    std::vector<unsigned char> used(2 * width);
+    bands.forEachBand([&](size_t begin, size_t end) {
+        for (size_t y = begin; y < end && y + 1 < height; ++y) {
+            usedSamples(bands, y, QuadDiagonal::TopLeft, used.data());
+            usedSamples(bands, y + 1, QuadDiagonal::TopLeft, used.data() + width);
+            rowVertices(used.data(), width, compact.rowStart[y], vertices.data());
+            rowVertices(used.data() + width, width, compact.rowStart[y + 1], vertices.data() + width);
+            forEachQuadFace(vertices.data(), vertices.data() + width, width, QuadDiagonal::TopLeft,
+                [&](uint64_t v1, uint64_t v2, uint64_t v3) {
+                    writer.put<uint8_t>(3);
+                    writer.put(static_cast<uint32_t>(v1));
+                    writer.put(static_cast<uint32_t>(v2));
+                    writer.put(static_cast<uint32_t>(v3));
+                });
+        }
+    });
+    writer.flush();
+    checkWritten(file, filename);
+}
+
+void streamStl(RowBands& bands, const std::string& filename, unsigned threads, size_t textBytes,
+    StreamingStats& stats) {
+    std::ofstream file(filename);
+    if (!file) {
+        throw std::runtime_error("Unable to open file");
+    }
+    size_t width = bands.width();
+    size_t height = bands.height();
+
+    TextChunks chunks(textBytes, 2 * stlFacetChars, threads);
+    size_t quadChunks = chunks.count(width - 1);
+
+    file << "solid depthmap\n";
+    bands.forEachBand([&](size_t begin, size_t end) {
+        size_t rows = std::min(end, height - 1) - std::min(begin, height - 1);
+        writeTextParallel(file, rows * quadChunks, chunks.columns * 2 * stlFacetChars, threads, chunks.bandChars,
+            [&](size_t i, char* out, size_t) {
+                size_t y = begin + i / quadChunks;
+                size_t x0 = i % quadChunks * chunks.columns;
+                size_t x1 = std::min(width - 1, x0 + chunks.columns);
+                const double* top = bands.row(y);
+                const double* bottom = bands.row(y + 1);
+                for (size_t x = x0; x < x1; ++x) {
+                    if (top[x] != 0 && top[x + 1] != 0 && bottom[x] != 0) {
+                        out = putStlTextFacet(out, x, y, top[x], x + 1, y, top[x + 1], x, y + 1, bottom[x]);
+                    }
+                    if (top[x + 1] != 0 && bottom[x + 1] != 0 && bottom[x] != 0) {
+                        out = putStlTextFacet(out, x + 1, y, top[x + 1], x + 1, y + 1, bottom[x + 1], x, y + 1, bottom[x]);
+                    }
+                }
+                return out;
+            });
+        for (size_t y = begin; y < begin + rows; ++y) {
+            const double* top = bands.row(y);
+            const double* bottom = bands.row(y + 1);
+            for (size_t x = 0; x + 1 < width; ++x) {
+                stats.faces += (top[x] != 0 && top[x + 1] != 0 && bottom[x] != 0) +
+                    (top[x + 1] != 0 && bottom[x + 1] != 0 && bottom[x] != 0);
+            }
+        }
+    });
+    file << "endsolid depthmap\n";
+    checkWritten(file, filename);
+}
+
+// Число треугольников заранее неизвестно: заголовок дописывается в конце
+void streamStlBinary(RowBands& bands, const std::string& filename, StreamingStats& stats) {
+    if (!isLittleEndianHost()) {
+        throw std::runtime_error("Binary STL export requires a little-endian host");
+    }
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Unable to open file");
+    }
+    size_t width = bands.width();
+    size_t height = bands.height();
+    unsigned char header[84] = {};
+    std::memcpy(header, "binary STL depthmap", 19);
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+
+    BufferedWriter writer(file);
+    bands.forEachBand([&](size_t begin, size_t end) {
+        unsigned char facet[50];
+        for (size_t y = begin; y < end && y + 1 < height; ++y) {
+            const double* top = bands.row(y);
+            const double* bottom = bands.row(y + 1);
+            float fy = static_cast<float>(y);
+            for (size_t x = 0; x + 1 < width; ++x) {
+                float fx = static_cast<float>(x);
+                float p1[3] = { fx, fy, static_cast<float>(top[x]) };
+                float p2[3] = { fx + 1, fy, static_cast<float>(top[x + 1]) };
+                float p3[3] = { fx, fy + 1, static_cast<float>(bottom[x]) };
+                float p4[3] = { fx + 1, fy + 1, static_cast<float>(bottom[x + 1]) };
+                if (top[x] != 0 && top[x + 1] != 0 && bottom[x] != 0) {
+                    putStlFacet(facet, p1, p2, p3);
+                    writer.write(facet, sizeof(facet));
+                    ++stats.faces;
+                }
+                if (bottom[x + 1] != 0 && top[x + 1] != 0 && bottom[x] != 0) {
+                    putStlFacet(facet, p3, p2, p4);
+                    writer.write(facet, sizeof(facet));
+                    ++stats.faces;
+                }
+            }
+        }
+    });
+    writer.flush();
+    if (stats.faces > std::numeric_limits<uint32_t>::max()) {
+        throw std::runtime_error("Too many triangles for binary STL");
+    }
+    uint32_t count32 = static_cast<uint32_t>(stats.faces);
+    file.seekp(80);
+    file.write(reinterpret_cast<const char*>(&count32), sizeof(count32));
+    checkWritten(file, filename);
+}
+
+void streamVrml(RowBands& bands, const std::string& filename, unsigned threads, size_t textBytes,
+    StreamingStats& stats) {
+    std::ofstream file(filename);
+    if (!file) {
+        throw std::runtime_error("Unable to open file");
+    }
+    CompactRows compact = countCompactRows(bands, QuadDiagonal::TopRight);
+    stats.faces = compact.faces;
+
+    file << "#VRML V2.0 utf8\n";
+    file << "Shape {\n";
+    file << "  appearance Appearance {\n";
+    file << "    material Material {\n";
+    file << "      diffuseColor 1 0.78 0.39\n";
+    file << "    }\n";
+    file << "  }\n";
+    file << "  geometry IndexedFaceSet {\n";
+    file << "    coord Coordinate {\n";
+    file << "      point [\n";
+
+    TextChunks chunks(textBytes, std::max(vrmlPointChars, 2 * vrmlFaceChars), threads);
+    writeChunkVertices(file, bands, chunks, QuadDiagonal::TopRight, vrmlPointChars, threads,
+        [](char* out, size_t x, size_t y, double depth) {
+            out = putText(out, "        ");
+            out = putUnsigned(out, x);
+            *out++ = ' ';
+            out = putUnsigned(out, y);
+            *out++ = ' ';
+            out = putDouble(out, depth);
+            return putText(out, ",\n");
+        });
+
+    file << "      ]\n";
+    file << "    }\n";
+    file << "    coordIndex [\n";
+
+    writeChunkFaces(file, bands, compact, chunks, QuadDiagonal::TopRight, vrmlFaceChars, threads, putVrmlFace);
+
+    file << "    ]\n";
+    file << "  }\n";
+    file << "}\n";
+    checkWritten(file, filename);
+}
+
+} // namespace
+
+StreamingStats streamDepthMapExport(const std::string& inputFile, const std::string& format,
+    const std::string& outputFile, const DepthLoadOptions& loadOptions, const ExportOptions& options,
+    size_t memoryBudget) {
+    TRACE_ZONE("streamDepthMapExport");
+    if (options.maxError > 0) {
+        throw std::runtime_error("Adaptive meshes are not supported in streaming mode");
+    }
+    if (options.level > 0) {
+        throw std::runtime_error("Depth pyramid levels are not supported in streaming mode");
+    }
+    if (options.camera.valid()) {
+        throw std::runtime_error("Camera back-projection is not supported in streaming mode");
+    }
+    DepthLoadOptions streamingLoad = loadOptions;
+    streamingLoad.streaming = true;
+    std::shared_ptr<MappedDepthMap> map = MappedDepthMap::open(inputFile, streamingLoad);
+    // Текстовым форматам четверть бюджета отводится под буферы форматирования
+    bool text = !options.binary || format == "vrml";
+    size_t textBytes = text ? memoryBudget / 4 : 0;
+    RowBands bands(*map, memoryBudget - textBytes);
+
+    StreamingStats stats;
+    stats.bandRows = bands.bandRows();
+    stats.bands = bands.bandCount();
+    stats.samples = static_cast<uint64_t>(bands.width()) * bands.height();
+    if (format == "ply") {
+        if (options.binary) {
+            streamPlyBinary(bands, outputFile + ".ply", options.normals, stats);
+        }
+        else {
+            streamPly(bands, outputFile + ".ply", options.threads, textBytes, stats);
+        }
+    }
+    else if (format == "stl") {
+        if (options.binary) {
+            streamStlBinary(bands, outputFile + ".stl", stats);
+        }
+        else {
+            streamStl(bands, outputFile + ".stl", options.threads, textBytes, stats);
+        }
+    }
+    else if (format == "vrml") {
+        streamVrml(bands, outputFile + ".vrml", options.threads, textBytes, stats);
+    }
+    else {
+        throw std::runtime_error("Unsupported output format: " + format);
+    }
+    return stats;
+}
+
+size_t peakResidentBytes() {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return counters.PeakWorkingSetSize;
+    }
+    return 0;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#ifdef __APPLE__
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024; // Килобайты в Linux
+#endif
+#endif
+}
+
+double processCpuSeconds() {
+#ifdef _WIN32
+    FILETIME created, exited, kernel, user;
+    if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) {
+        return 0.0;
+    }
+    auto seconds = [](const FILETIME& time) {
+        return ((static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime) * 1e-7; // Интервалы по 100 нс
+    };
+    return seconds(kernel) + seconds(user);
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0.0;
+    }
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+#endif
+}
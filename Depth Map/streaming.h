@@ -0,0 +1,35 @@
+﻿#ifndef STREAMING_H
+#define STREAMING_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include "depth_map.h"
+#include "exporters.h"
+
+// Потоковый экспорт для карт больше оперативной памяти: файл читается полосами строк,
+// в памяти только текущая полоса и по одной строке сверху и снизу (для граней и нормалей).
+// Прочитанные страницы отображения отдаются системе. Результат тот же, что у exportDepthMap
+// для полной сетки; номера вершин 64-битные (в двоичном PLY и STL ограничены форматом).
+// PLY и VRML читают файл трижды: подсчёт вершин и граней сжатой сетки, вершины, грани.
+struct StreamingStats {
+    size_t bandRows = 0;  // Строк в полосе при заданном бюджете
+    size_t bands = 0;
+    uint64_t samples = 0;
+    uint64_t faces = 0;
+};
+
+// memoryBudget — байт на буфер полосы (double на отсчёт); у текстовых форматов четверть бюджета
+// отдаётся буферам форматирования, строки пишутся кусками столбцов, так что их размер
+// не зависит от ширины карты
+StreamingStats streamDepthMapExport(const std::string& inputFile, const std::string& format,
+    const std::string& outputFile, const DepthLoadOptions& loadOptions, const ExportOptions& options,
+    size_t memoryBudget);
+
+// Пиковый размер резидентной памяти процесса в байтах (0, если неизвестен)
+size_t peakResidentBytes();
+
+// Процессорное время процесса (пользователь и ядро) в секундах
+double processCpuSeconds();
+
+#endif // STREAMING_H
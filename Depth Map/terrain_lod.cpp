@@ -0,0 +1,299 @@
+﻿#include "terrain_lod.h"
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include "parallel.h"
+#include "trace.h"
+
+namespace {
+
+const uint32_t NoVertex = std::numeric_limits<uint32_t>::max();
+
+// Координаты узлов грубого уровня на отрезке [first, last]: шаг step, последний узел всегда last
+void levelNodes(size_t first, size_t last, size_t step, std::vector<size_t>& nodes) {
+    nodes.clear();
+    for (size_t i = first; i < last; i += step) {
+        nodes.push_back(i);
+    }
+    nodes.push_back(last);
+}
+
+struct TileRange {
+    size_t x0, y0, x1, y1; // Отсчёты включительно
+};
+
+// Отклонение ячеек уровня от полной сетки; FLT_MAX, если ячейка задевает край пропуска
+template <typename T>
+float levelError(const T* data, float depthScale, size_t width, const TileRange& tile, size_t step, double maxDepth) {
+    std::vector<size_t> xs, ys;
+    levelNodes(tile.x0, tile.x1, step, xs);
+    levelNodes(tile.y0, tile.y1, step, ys);
+    double error = 0.0;
+    for (size_t j = 0; j + 1 < ys.size(); ++j) {
+        for (size_t i = 0; i + 1 < xs.size(); ++i) {
+            size_t xa = xs[i], xb = xs[i + 1], ya = ys[j], yb = ys[j + 1];
+            double z1 = sampleDepth(data[ya * width + xa], depthScale);
+            double z2 = sampleDepth(data[ya * width + xb], depthScale);
+            double z3 = sampleDepth(data[yb * width + xa], depthScale);
+            double z4 = sampleDepth(data[yb * width + xb], depthScale);
+            size_t valid = 0;
+            for (size_t y = ya; y <= yb; ++y) {
+                for (size_t x = xa; x <= xb; ++x) {
+                    valid += data[y * width + x] != 0;
+                }
+            }
+            if (valid == 0) {
+                continue;
+            }
+            if (valid != (xb - xa + 1) * (yb - ya + 1)) {
+                return FLT_MAX;
+            }
+            // Те же два треугольника, что и в сетке: диагональ v2-v3
+            for (size_t y = ya; y <= yb; ++y) {
+                double v = static_cast<double>(y - ya) / (yb - ya);
+                for (size_t x = xa; x <= xb; ++x) {
+                    double u = static_cast<double>(x - xa) / (xb - xa);
+                    double z = u + v <= 1.0
+                        ? z1 + u * (z2 - z1) + v * (z3 - z1)
+                        : z4 + (1.0 - u) * (z3 - z4) + (1.0 - v) * (z2 - z4);
+                    error = std::max(error, std::fabs(z - sampleDepth(data[y * width + x], depthScale)));
+                }
+            }
+        }
+    }
+    return static_cast<float>(error / maxDepth);
+}
+
+template <typename T>
+void buildTypedTerrainLod(const DepthMap<T>& depthMap, TerrainLod& terrain, float scale, float maxDepth,
+    size_t tileSize, unsigned threads) {
+    size_t width = depthMap.width;
+    size_t height = depthMap.height;
+    const T* data = depthMap.data.data();
+    float depthScale = depthMap.depthScale;
+    threads = workerCount(threads);
+
+    // Вершины полного разрешения с гладкими нормалями, индексы строятся только по тайлам
+    GridMesh& mesh = terrain.mesh;
+    buildGridVertices(depthMap, mesh, scale, maxDepth, threads);
+    terrain.tiles.clear();
+    terrain.tileSize = tileSize;
+    if (width < 2 || height < 2) {
+        return;
+    }
+
+    if (mesh.vertexCount >= NoVertex) {
+        throw std::runtime_error("Too many vertices for 32-bit terrain indices");
+    }
+    std::vector<uint32_t> vertexOf(width * height, NoVertex);
+    uint32_t next = 0;
+    for (size_t i = 0; i < width * height; ++i) {
+        if (data[i] != 0) {
+            vertexOf[i] = next++;
+        }
+    }
+
+    size_t levels = 1;
+    while ((static_cast<size_t>(1) << (levels - 1)) < tileSize) {
+        ++levels;
+    }
+    size_t tilesX = (width - 2) / tileSize + 1;
+    size_t tilesY = (height - 2) / tileSize + 1;
+    std::vector<TileRange> ranges(tilesX * tilesY);
+    terrain.tiles.resize(tilesX * tilesY);
+
+    // Первый проход: границы и ошибки уровней, тайлы независимы
+    parallelForBands(tilesY, tilesY, threads, [&](size_t begin, size_t end, size_t) {
+        for (size_t ty = begin; ty < end; ++ty) {
+            for (size_t tx = 0; tx < tilesX; ++tx) {
+                TileRange range = { tx * tileSize, ty * tileSize,
+                    std::min(width - 1, (tx + 1) * tileSize), std::min(height - 1, (ty + 1) * tileSize) };
+                ranges[ty * tilesX + tx] = range;
+                TerrainTile& tile = terrain.tiles[ty * tilesX + tx];
+                tile.boundsMin[2] = FLT_MAX;
+                tile.boundsMax[2] = -FLT_MAX;
+                for (size_t y = range.y0; y <= range.y1; ++y) {
+                    for (size_t x = range.x0; x <= range.x1; ++x) {
+                        double depth = sampleDepth(data[y * width + x], depthScale);
+                        if (depth != 0) {
+                            float z = static_cast<float>(depth / maxDepth);
+                            tile.boundsMin[2] = std::min(tile.boundsMin[2], z);
+                            tile.boundsMax[2] = std::max(tile.boundsMax[2], z);
+                        }
+                    }
+                }
+                tile.boundsMin[0] = range.x0 * scale;
+                tile.boundsMin[1] = range.y0 * scale;
+                tile.boundsMax[0] = range.x1 * scale;
+                tile.boundsMax[1] = range.y1 * scale;
+                tile.lods.resize(levels);
+                for (size_t level = 1; level < levels; ++level) {
+                    tile.lods[level].error = levelError(data, depthScale, width, range, static_cast<size_t>(1) << level, maxDepth);
+                }
+            }
+        }
+    });
+
+    // Второй проход: индексы всех уровней и вершины юбок
+    std::vector<uint32_t> indices;
+    std::vector<size_t> xs, ys;
+    auto addSkirtVertex = [&](uint32_t vertex, float drop) {
+        size_t index = mesh.vertices.size() / 6;
+        if (index >= NoVertex) {
+            throw std::runtime_error("Too many vertices for 32-bit terrain indices");
+        }
+        float copy[6];
+        std::copy(mesh.vertices.begin() + vertex * 6, mesh.vertices.begin() + vertex * 6 + 6, copy);
+        copy[2] -= drop;
+        mesh.vertices.insert(mesh.vertices.end(), copy, copy + 6);
+        return static_cast<uint32_t>(index);
+    };
+    for (size_t t = 0; t < terrain.tiles.size(); ++t) {
+        TerrainTile& tile = terrain.tiles[t];
+        const TileRange& range = ranges[t];
+        float maxDrop = 0.0f;
+        for (size_t level = 0; level < levels; ++level) {
+            TileLod& lod = tile.lods[level];
+            lod.firstIndex = indices.size();
+            if (lod.error == FLT_MAX || tile.boundsMin[2] > tile.boundsMax[2]) {
+                continue;
+            }
+            size_t step = static_cast<size_t>(1) << level;
+            levelNodes(range.x0, range.x1, step, xs);
+            levelNodes(range.y0, range.y1, step, ys);
+            for (size_t j = 0; j + 1 < ys.size(); ++j) {
+                for (size_t i = 0; i + 1 < xs.size(); ++i) {
+                    uint32_t v1 = vertexOf[ys[j] * width + xs[i]];
+                    uint32_t v2 = vertexOf[ys[j] * width + xs[i + 1]];
+                    uint32_t v3 = vertexOf[ys[j + 1] * width + xs[i]];
+                    uint32_t v4 = vertexOf[ys[j + 1] * width + xs[i + 1]];
+                    if (v1 != NoVertex && v2 != NoVertex && v3 != NoVertex) {
+                        indices.insert(indices.end(), { v1, v2, v3 });
+                    }
+                    if (v4 != NoVertex && v2 != NoVertex && v3 != NoVertex) {
+                        indices.insert(indices.end(), { v3, v2, v4 });
+                    }
+                }
+            }
+
+            // Юбка по краю тайла опущена на ошибку уровня: щель с соседом не больше неё
+            if (level > 0 && lod.error > 0) {
+                float drop = lod.error;
+                maxDrop = std::max(maxDrop, drop);
+                auto skirt = [&](size_t xa, size_t ya, size_t xb, size_t yb) {
+                    uint32_t a = vertexOf[ya * width + xa];
+                    uint32_t b = vertexOf[yb * width + xb];
+                    if (a == NoVertex || b == NoVertex) {
+                        return;
+                    }
+                    uint32_t a2 = addSkirtVertex(a, drop);
+                    uint32_t b2 = addSkirtVertex(b, drop);
+                    indices.insert(indices.end(), { a, b, b2, a, b2, a2 });
+                };
+                for (size_t i = 0; i + 1 < xs.size(); ++i) {
+                    skirt(xs[i], range.y0, xs[i + 1], range.y0);
+                    skirt(xs[i], range.y1, xs[i + 1], range.y1);
+                }
+                for (size_t j = 0; j + 1 < ys.size(); ++j) {
+                    skirt(range.x0, ys[j], range.x0, ys[j + 1]);
+                    skirt(range.x1, ys[j], range.x1, ys[j + 1]);
+                }
+            }
+            lod.indexCount = indices.size() - lod.firstIndex;
+        }
+        tile.boundsMin[2] -= maxDrop;
+    }
+
+    mesh.vertexCount = mesh.vertices.size() / 6;
+    if (mesh.vertexCount <= std::numeric_limits<uint16_t>::max()) {
+        mesh.indices16.reserve(indices.size());
+        for (uint32_t index : indices) {
+            mesh.indices16.push_back(static_cast<uint16_t>(index));
+        }
+    }
+    else {
+        mesh.indices32.swap(indices);
+    }
+}
+
+} // namespace
+
+void buildTerrainLod(const AnyDepthMap& depthMap, TerrainLod& terrain, float scale, float maxDepth,
+    size_t tileSize, unsigned threads) {
+    TRACE_ZONE("buildTerrainLod");
+    if (tileSize == 0 || (tileSize & (tileSize - 1)) != 0) {
+        throw std::runtime_error("Terrain tile size must be a power of two");
+    }
+    depthMap.visit([&](const auto& typed) {
+        buildTypedTerrainLod(typed, terrain, scale, maxDepth, tileSize, threads);
+    });
+}
+
+Frustum Frustum::fromMatrix(const float matrix[16]) {
+    // Плоскости как суммы и разности строк матрицы (Gribb, Hartmann)
+    float row[4][4];
+    for (int i = 0; i < 4; ++i) {
+        for (int j = 0; j < 4; ++j) {
+            row[i][j] = matrix[j * 4 + i];
+        }
+    }
+    Frustum frustum;
+    for (int axis = 0; axis < 3; ++axis) {
+        for (int j = 0; j < 4; ++j) {
+            frustum.planes[axis * 2][j] = row[3][j] + row[axis][j];
+            frustum.planes[axis * 2 + 1][j] = row[3][j] - row[axis][j];
+        }
+    }
+    return frustum;
+}
+
+bool Frustum::intersects(const float boundsMin[3], const float boundsMax[3]) const {
+    for (const float* plane : planes) {
+        // Вершина коробки, дальше всех продвинутая вдоль нормали плоскости
+        float distance = plane[3];
+        for (int i = 0; i < 3; ++i) {
+            distance += plane[i] * (plane[i] >= 0 ? boundsMax[i] : boundsMin[i]);
+        }
+        if (distance < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void selectTerrainTiles(const TerrainLod& terrain, const Frustum& frustum, const float camera[3],
+    float pixelsPerUnit, float maxPixelError, std::vector<TileDraw>& draws, RenderStats& stats) {
+    TRACE_ZONE("selectTerrainTiles");
+    draws.clear();
+    stats = RenderStats();
+    for (const TerrainTile& tile : terrain.tiles) {
+        if (tile.lods.empty() || tile.lods[0].indexCount == 0) {
+            continue;
+        }
+        if (!frustum.intersects(tile.boundsMin, tile.boundsMax)) {
+            ++stats.culledTiles;
+            continue;
+        }
+        float distance2 = 0.0f;
+        for (int i = 0; i < 3; ++i) {
+            float d = std::max(tile.boundsMin[i] - camera[i], std::max(0.0f, camera[i] - tile.boundsMax[i]));
+            distance2 += d * d;
+        }
+        float distance = std::max(std::sqrt(distance2), 1e-3f);
+
+        size_t level = tile.lods.size() - 1;
+        while (level > 0 && tile.lods[level].error * pixelsPerUnit / distance > maxPixelError) {
+            --level;
+        }
+        const TileLod& lod = tile.lods[level];
+        if (lod.indexCount == 0) {
+            continue;
+        }
+        draws.push_back({ lod.firstIndex, lod.indexCount });
+        ++stats.visibleTiles;
+        ++stats.drawCalls;
+        stats.triangles += lod.indexCount / 3;
+    }
+}
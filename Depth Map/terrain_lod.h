@@ -0,0 +1,63 @@
+﻿#ifndef TERRAIN_LOD_H
+#define TERRAIN_LOD_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "depth_map.h"
+#include "mesh.h"
+
+// Уровень детализации тайла: отсчёты берутся с шагом 2^level,
+// error — наибольшее отклонение по z от полной сетки (в координатах сетки)
+struct TileLod {
+    size_t firstIndex = 0;
+    size_t indexCount = 0;
+    float error = 0.0f;
+};
+
+struct TerrainTile {
+    float boundsMin[3];
+    float boundsMax[3];
+    std::vector<TileLod> lods; // lods[0] — полное разрешение
+};
+
+// Сетка, разбитая на квадратные тайлы. Вершины общие для всех уровней;
+// к ним добавлены вершины «юбок» по краю грубых уровней, закрывающих щели
+// между соседними тайлами разной детализации.
+struct TerrainLod {
+    GridMesh mesh;
+    std::vector<TerrainTile> tiles;
+    size_t tileSize = 0;
+};
+
+// Тайлы по tileSize квадов (степень двойки). Уровень, на котором грубая ячейка задевает
+// и нулевые, и ненулевые отсчёты, не используется (error = FLT_MAX), чтобы не менять край пропусков.
+void buildTerrainLod(const AnyDepthMap& depthMap, TerrainLod& terrain, float scale, float maxDepth = 500.0f,
+    size_t tileSize = 64, unsigned threads = 0);
+
+// Пирамида видимости из матрицы projection * view * model (16 float по столбцам, как в glm)
+struct Frustum {
+    float planes[6][4];
+
+    static Frustum fromMatrix(const float matrix[16]);
+    bool intersects(const float boundsMin[3], const float boundsMax[3]) const;
+};
+
+struct TileDraw {
+    size_t firstIndex;
+    size_t indexCount;
+};
+
+struct RenderStats {
+    size_t drawCalls = 0;
+    size_t triangles = 0;
+    size_t visibleTiles = 0;
+    size_t culledTiles = 0;
+};
+
+// Видимые тайлы и самый грубый уровень, ошибка которого на экране не больше maxPixelError.
+// pixelsPerUnit — высота окна в пикселях / (2 * tan(fovy / 2)).
+void selectTerrainTiles(const TerrainLod& terrain, const Frustum& frustum, const float camera[3],
+    float pixelsPerUnit, float maxPixelError, std::vector<TileDraw>& draws, RenderStats& stats);
+
+#endif // TERRAIN_LOD_H
@@ -0,0 +1,114 @@
+﻿#include "text_writer.h"
+#include <cmath>
+#include <cstdio>
+
+namespace {
+
+const double powersOfTen[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11
+};
+
+// Медленный путь: редкие значения и случаи, когда округление нельзя решить в double
+char* putDoublePrintf(char* out, double value) {
+    char text[32];
+    int length = std::snprintf(text, sizeof(text), "%g", value);
+    std::memcpy(out, text, length);
+    return out + length;
+}
+
+} // namespace
+
+char* putDouble(char* out, double value) {
+    double magnitude = std::fabs(value);
+    if (value == 0) {
+        return std::signbit(value) ? putText(out, "-0") : putText(out, "0");
+    }
+    if (!(magnitude >= 1e-5 && magnitude < 1e15)) {
+        return putDoublePrintf(out, value);
+    }
+    char* start = out;
+    if (value < 0) {
+        *out++ = '-';
+    }
+    // Целые до 999999 печатаются без точки и экспоненты
+    if (magnitude < 1e6 && magnitude == std::floor(magnitude)) {
+        return putUnsigned(out, static_cast<uint64_t>(magnitude));
+    }
+
+    // Десятичный порядок: 6 значащих цифр — целое scaled из [1e5, 1e6).
+    // Умножение или деление на точную степень десяти даёт одно округление.
+    int exponent2;
+    std::frexp(magnitude, &exponent2);
+    int exponent = static_cast<int>(std::floor((exponent2 - 1) * 0.30102999566398120));
+    auto scale = [&](int decimalExponent) {
+        int shift = 5 - decimalExponent;
+        return shift >= 0 ? magnitude * powersOfTen[shift] : magnitude / powersOfTen[-shift];
+    };
+    double scaled = scale(exponent);
+    if (scaled >= 1e6) {
+        scaled = scale(++exponent);
+    }
+    else if (scaled < 1e5) {
+        scaled = scale(--exponent);
+    }
+    double whole = std::floor(scaled);
+    double fraction = scaled - whole;
+    if (scaled < 1e5 || scaled >= 1e6 || std::fabs(fraction - 0.5) < 1e-6) {
+        return putDoublePrintf(start, value);
+    }
+    uint32_t mantissa = static_cast<uint32_t>(whole) + (fraction > 0.5 ? 1 : 0);
+    if (mantissa == 1000000) {
+        mantissa = 100000;
+        ++exponent;
+    }
+    char digits[6];
+    for (int i = 5; i >= 0; --i) {
+        digits[i] = static_cast<char>('0' + mantissa % 10);
+        mantissa /= 10;
+    }
+    int significant = 6;
+    while (significant > 1 && digits[significant - 1] == '0') {
+        --significant;
+    }
+
+    if (exponent >= -4 && exponent < 6) {
+        if (exponent >= 0) {
+            int integerDigits = exponent + 1;
+            for (int i = 0; i < integerDigits; ++i) {
+                *out++ = digits[i];
+            }
+            if (significant > integerDigits) {
+                *out++ = '.';
+                for (int i = integerDigits; i < significant; ++i) {
+                    *out++ = digits[i];
+                }
+            }
+        }
+        else {
+            *out++ = '0';
+            *out++ = '.';
+            for (int i = 1; i < -exponent; ++i) {
+                *out++ = '0';
+            }
+            for (int i = 0; i < significant; ++i) {
+                *out++ = digits[i];
+            }
+        }
+        return out;
+    }
+
+    *out++ = digits[0];
+    if (significant > 1) {
+        *out++ = '.';
+        for (int i = 1; i < significant; ++i) {
+            *out++ = digits[i];
+        }
+    }
+    *out++ = 'e';
+    *out++ = exponent < 0 ? '-' : '+';
+    int absolute = exponent < 0 ? -exponent : exponent;
+    if (absolute < 10) {
+        *out++ = '0';
+    }
+    return putUnsigned(out, static_cast<uint64_t>(absolute));
+}
@@ -0,0 +1,146 @@
+﻿#ifndef TEXT_WRITER_H
+#define TEXT_WRITER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+#include "parallel.h"
+
+// Форматирование чисел для текстовых экспортёров без потоков ввода-вывода и локали.
+// Функции пишут в буфер и возвращают указатель за последним символом.
+
+const size_t maxIntegerChars = 20; // uint64_t или int64_t со знаком
+const size_t maxDoubleChars = 16;  // "-1.23457e+308"
+
+inline char* putUnsigned(char* out, uint64_t value) {
+    char digits[maxIntegerChars];
+    size_t count = 0;
+    do {
+        digits[count++] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (count > 0) {
+        *out++ = digits[--count];
+    }
+    return out;
+}
+
+inline char* putInt(char* out, int64_t value) {
+    if (value < 0) {
+        *out++ = '-';
+        return putUnsigned(out, 0 - static_cast<uint64_t>(value));
+    }
+    return putUnsigned(out, static_cast<uint64_t>(value));
+}
+
+// То же, что std::ostream << value с настройками по умолчанию (printf "%g", 6 значащих цифр)
+char* putDouble(char* out, double value);
+
+template <size_t N>
+char* putText(char* out, const char (&text)[N]) {
+    std::memcpy(out, text, N - 1);
+    return out + N - 1;
+}
+
+// Наибольшая длина строк экспортёров: вершина или грань PLY, треугольник STL, точка или грань VRML
+const size_t plyVertexChars = 3 * maxDoubleChars + 16;
+const size_t plyFaceChars = 3 * maxIntegerChars + 6;
+const size_t stlFacetChars = 3 * (2 * maxIntegerChars + maxDoubleChars + 14) + 64;
+const size_t vrmlPointChars = 2 * maxIntegerChars + maxDoubleChars + 12;
+const size_t vrmlFaceChars = 3 * maxIntegerChars + 16;
+
+inline char* putStlTextVertex(char* out, int64_t x, int64_t y, double z) {
+    out = putText(out, "    vertex ");
+    out = putInt(out, x);
+    *out++ = ' ';
+    out = putInt(out, y);
+    *out++ = ' ';
+    out = putDouble(out, z);
+    *out++ = '\n';
+    return out;
+}
+
+// Треугольник текстового STL с нулевой нормалью, координаты x и y целые
+inline char* putStlTextFacet(char* out, int64_t x1, int64_t y1, double z1, int64_t x2, int64_t y2, double z2,
+    int64_t x3, int64_t y3, double z3) {
+    out = putText(out, "facet normal 0 0 0\n  outer loop\n");
+    out = putStlTextVertex(out, x1, y1, z1);
+    out = putStlTextVertex(out, x2, y2, z2);
+    out = putStlTextVertex(out, x3, y3, z3);
+    return putText(out, "  endloop\nendfacet\n");
+}
+
+inline char* putPlyFace(char* out, uint64_t v1, uint64_t v2, uint64_t v3) {
+    out = putText(out, "3 ");
+    out = putUnsigned(out, v1);
+    *out++ = ' ';
+    out = putUnsigned(out, v2);
+    *out++ = ' ';
+    out = putUnsigned(out, v3);
+    *out++ = '\n';
+    return out;
+}
+
+inline char* putVrmlFace(char* out, uint64_t v1, uint64_t v2, uint64_t v3) {
+    out = putText(out, "      ");
+    out = putUnsigned(out, v1);
+    out = putText(out, ", ");
+    out = putUnsigned(out, v2);
+    out = putText(out, ", ");
+    out = putUnsigned(out, v3);
+    return putText(out, ", -1,\n");
+}
+
+// Число буферов (полос одного круга) writeTextParallel при threads потоках
+inline size_t textBandSlots(unsigned threads) {
+    return workerCount(threads) * 2;
+}
+
+// Записывает count элементов (строк карты, треугольников), каждый не длиннее maxItemChars.
+// Элементы форматируются полосами не больше bandChars символов (но не меньше одного элемента)
+// в нескольких потоках и пишутся в файл по порядку, поэтому результат не зависит от числа потоков.
+// В памяти textBandSlots(threads) буферов полос. formatItem(i, out, slot) возвращает указатель
+// за последним записанным символом; slot < textBandSlots(threads) — номер буфера, элементы
+// одного буфера форматируются по очереди, так что по нему можно брать рабочую память.
+template <typename Fn>
+void writeTextParallel(std::ofstream& file, size_t count, size_t maxItemChars, unsigned threads, size_t bandChars,
+    Fn formatItem) {
+    threads = workerCount(threads);
+    size_t itemsPerBand = std::max<size_t>(1, bandChars / std::max<size_t>(1, maxItemChars));
+    size_t bandsPerRound = textBandSlots(threads);
+    std::vector<std::vector<char>> buffers(bandsPerRound);
+    std::vector<size_t> used(bandsPerRound);
+
+    for (size_t first = 0; first < count; first += itemsPerBand * bandsPerRound) {
+        size_t roundItems = std::min(count - first, itemsPerBand * bandsPerRound);
+        size_t bands = (roundItems + itemsPerBand - 1) / itemsPerBand;
+        parallelForBands(bands, bands, threads, [&](size_t begin, size_t end, size_t) {
+            for (size_t band = begin; band < end; ++band) {
+                size_t itemBegin = first + band * itemsPerBand;
+                size_t itemEnd = std::min(count, itemBegin + itemsPerBand);
+                std::vector<char>& buffer = buffers[band];
+                buffer.resize(std::max(buffer.size(), (itemEnd - itemBegin) * maxItemChars));
+                char* out = buffer.data();
+                for (size_t i = itemBegin; i < itemEnd; ++i) {
+                    out = formatItem(i, out, band);
+                }
+                used[band] = static_cast<size_t>(out - buffer.data());
+            }
+        });
+        for (size_t band = 0; band < bands; ++band) {
+            file.write(buffers[band].data(), used[band]);
+        }
+    }
+}
+
+// То же с полосами по мегабайту, formatItem(i, out)
+template <typename Fn>
+void writeTextParallel(std::ofstream& file, size_t count, size_t maxItemChars, unsigned threads, Fn formatItem) {
+    writeTextParallel(file, count, maxItemChars, threads, size_t(1) << 20,
+        [&](size_t i, char* out, size_t) { return formatItem(i, out); });
+}
+
+#endif // TEXT_WRITER_H
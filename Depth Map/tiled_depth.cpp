@@ -0,0 +1,474 @@
+﻿#include "tiled_depth.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include "binary_writer.h"
+#include "parallel.h"
+#include "trace.h"
+
+namespace {
+
+const char Magic[4] = { 'D', 'M', 'T', '1' };
+const uint32_t Version = 1;
+const size_t HeaderSize = 48; // magic, version, width, height, tileSize, format, step, depthScale, reserved
+const size_t IndexEntrySize = 16; // Смещение и размер тайла, uint64
+
+template <typename T>
+T readValue(const unsigned char* bytes) {
+    T value;
+    std::memcpy(&value, bytes, sizeof(T));
+    return value;
+}
+
+uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+void putVarint(std::vector<unsigned char>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<unsigned char>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<unsigned char>(value));
+}
+
+class TileInput {
+public:
+    TileInput(const unsigned char* data, size_t size) : cursor(data), end(data + size) {
+    }
+
+    uint64_t varint() {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (cursor == end) {
+                break;
+            }
+            unsigned char byte = *cursor++;
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) {
+                return value;
+            }
+        }
+        throw std::runtime_error("Corrupted depth map tile");
+    }
+
+    template <typename T>
+    T raw() {
+        if (end - cursor < static_cast<std::ptrdiff_t>(sizeof(T))) {
+            throw std::runtime_error("Corrupted depth map tile");
+        }
+        T value = readValue<T>(cursor);
+        cursor += sizeof(T);
+        return value;
+    }
+
+private:
+    const unsigned char* cursor;
+    const unsigned char* end;
+};
+
+// Предсказание по соседям слева (a), сверху (b) и слева сверху (c), MED из LOCO-I
+int64_t predict(const int64_t* row, const int64_t* up, const unsigned char* rowValid, const unsigned char* upValid, size_t x) {
+    bool hasA = x > 0 && rowValid[x - 1];
+    bool hasB = up && upValid[x];
+    if (hasA && hasB && x > 0 && upValid[x - 1]) {
+        int64_t a = row[x - 1], b = up[x], c = up[x - 1];
+        if (c >= std::max(a, b)) {
+            return std::min(a, b);
+        }
+        if (c <= std::min(a, b)) {
+            return std::max(a, b);
+        }
+        return static_cast<int64_t>(static_cast<uint64_t>(a) + static_cast<uint64_t>(b) - static_cast<uint64_t>(c));
+    }
+    if (hasA) {
+        return row[x - 1];
+    }
+    if (hasB) {
+        return up[x];
+    }
+    return 0;
+}
+
+// Битовый образ отсчёта в его ширине: соседние значения дают близкие образы
+int64_t sampleBits(double value) {
+    int64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+int64_t sampleBits(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+int64_t sampleBits(uint16_t value) {
+    return value;
+}
+
+double bitsSample(int64_t bits, double) {
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+float bitsSample(int64_t bits, float) {
+    uint32_t narrow = static_cast<uint32_t>(bits);
+    float value;
+    std::memcpy(&value, &narrow, sizeof(value));
+    return value;
+}
+
+uint16_t bitsSample(int64_t bits, uint16_t) {
+    return static_cast<uint16_t>(bits);
+}
+
+// Код отсчёта: битовый образ либо номер шага квантования. step — шаг в единицах отсчёта
+// (для uint16 — целое число единиц, глубина делится на масштаб при записи)
+template <typename T>
+int64_t sampleCode(T value, double step) {
+    if (step == 0) {
+        return sampleBits(value);
+    }
+    double steps = std::round(value / step);
+    // NaN и бесконечность получают код 0 и хранятся как есть, как отсчёты меньше половины шага
+    if (std::isnan(steps) || std::isinf(steps)) {
+        return 0;
+    }
+    if (!(std::fabs(steps) < 4.0e18)) {
+        throw std::runtime_error("Depth value is out of range for the quantization step");
+    }
+    return static_cast<int64_t>(steps);
+}
+
+template <typename T>
+T quantizedSample(int64_t code, double step) {
+    return static_cast<T>(code * step);
+}
+
+template <>
+uint16_t quantizedSample<uint16_t>(int64_t code, double step) {
+    return static_cast<uint16_t>(std::min(code * step, 65535.0));
+}
+
+// Отсчёт файла в буфер чтения: double — глубина (uint16 умножается на масштаб),
+// буфер типа отсчётов файла получает отсчёты как есть
+template <typename T, typename Out>
+void storeSample(T value, float depthScale, Out& out) {
+    out = static_cast<Out>(sampleDepth(value, depthScale));
+}
+
+template <typename T>
+void storeSample(T value, float, T& out) {
+    out = value;
+}
+
+// Буфер чтения — double (глубина) или тип отсчётов файла
+template <typename T, typename Out>
+void checkOutput() {
+    if (!std::is_same<Out, double>::value && !std::is_same<Out, T>::value) {
+        throw std::runtime_error("Tiled depth map samples do not match the output buffer type");
+    }
+}
+
+template <typename T>
+std::vector<unsigned char> encodeTile(const T* data, size_t width, size_t x0, size_t y0, size_t w, size_t h, double step) {
+    std::vector<unsigned char> out;
+    std::vector<int64_t> codes(2 * w);
+    std::vector<unsigned char> validity(2 * w);
+    size_t runStart = 0;
+    bool runValid = false;
+    size_t position = 0;
+    std::vector<unsigned char> residuals;
+
+    // Серия записывается как varint(длина * 2 + ненулевая), затем остатки её отсчётов
+    auto closeRun = [&]() {
+        if (position > runStart) {
+            putVarint(out, (static_cast<uint64_t>(position - runStart) << 1) | (runValid ? 1 : 0));
+            out.insert(out.end(), residuals.begin(), residuals.end());
+        }
+        residuals.clear();
+        runStart = position;
+    };
+
+    for (size_t y = 0; y < h; ++y) {
+        const T* source = data + (y0 + y) * width + x0;
+        int64_t* row = codes.data() + (y % 2) * w;
+        const int64_t* up = y > 0 ? codes.data() + ((y + 1) % 2) * w : nullptr;
+        unsigned char* rowValid = validity.data() + (y % 2) * w;
+        const unsigned char* upValid = validity.data() + ((y + 1) % 2) * w;
+        for (size_t x = 0; x < w; ++x, ++position) {
+            T sample = source[x];
+            bool valid = sample != 0;
+            if (valid != runValid) {
+                closeRun();
+                runValid = valid;
+            }
+            rowValid[x] = valid;
+            if (!valid) {
+                row[x] = 0;
+                continue;
+            }
+            row[x] = sampleCode(sample, step);
+            int64_t prediction = predict(row, up, rowValid, upValid, x);
+            putVarint(residuals, zigzag(static_cast<int64_t>(static_cast<uint64_t>(row[x]) - static_cast<uint64_t>(prediction))));
+            if (step != 0 && row[x] == 0) {
+                // Ненулевой отсчёт меньше половины шага (и NaN) хранится как есть, чтобы не стать пропуском
+                unsigned char bytes[sizeof(T)];
+                std::memcpy(bytes, &sample, sizeof(T));
+                residuals.insert(residuals.end(), bytes, bytes + sizeof(T));
+            }
+        }
+    }
+    closeRun();
+    return out;
+}
+
+template <typename T, typename Out>
+void decodeTile(const unsigned char* payload, size_t size, double step, float depthScale, size_t w, size_t h,
+    Out* out, size_t outStride) {
+    TileInput input(payload, size);
+    std::vector<int64_t> codes(2 * w);
+    std::vector<unsigned char> validity(2 * w);
+    uint64_t runLeft = 0;
+    bool runValid = false;
+    for (size_t y = 0; y < h; ++y) {
+        Out* target = out + y * outStride;
+        int64_t* row = codes.data() + (y % 2) * w;
+        const int64_t* up = y > 0 ? codes.data() + ((y + 1) % 2) * w : nullptr;
+        unsigned char* rowValid = validity.data() + (y % 2) * w;
+        const unsigned char* upValid = validity.data() + ((y + 1) % 2) * w;
+        for (size_t x = 0; x < w; ++x) {
+            while (runLeft == 0) {
+                uint64_t token = input.varint();
+                runLeft = token >> 1;
+                runValid = (token & 1) != 0;
+            }
+            --runLeft;
+            rowValid[x] = runValid;
+            if (!runValid) {
+                row[x] = 0;
+                target[x] = 0;
+                continue;
+            }
+            int64_t prediction = predict(row, up, rowValid, upValid, x);
+            row[x] = static_cast<int64_t>(static_cast<uint64_t>(prediction) + static_cast<uint64_t>(unzigzag(input.varint())));
+            T sample;
+            if (step == 0) {
+                sample = bitsSample(row[x], T());
+            }
+            else if (row[x] == 0) {
+                sample = input.raw<T>();
+            }
+            else {
+                sample = quantizedSample<T>(row[x], step);
+            }
+            storeSample(sample, depthScale, target[x]);
+        }
+    }
+}
+
+} // namespace
+
+void writeTiledDepthMap(const AnyDepthMap& depthMap, const std::string& filename, const TiledDepthOptions& options) {
+    TRACE_ZONE("writeTiledDepthMap");
+    if (!isLittleEndianHost()) {
+        throw std::runtime_error("Tiled depth maps require a little-endian host");
+    }
+    if (options.tileSize == 0 || options.maxError < 0) {
+        throw std::runtime_error("Invalid tiled depth map options");
+    }
+    size_t width = depthMap.width();
+    size_t height = depthMap.height();
+    size_t tile = options.tileSize;
+    size_t columns = (width + tile - 1) / tile;
+    size_t rows = (height + tile - 1) / tile;
+
+    // Отсчёты кодируются в своём типе; шаг квантования uint16 — целое число единиц отсчёта
+    float depthScale = depthMap.format() == SampleFormat::UInt16
+        ? depthMap.visit([](const auto& typed) { return typed.depthScale; })
+        : 1.0f;
+    double sampleStep = options.maxError * 2.0;
+    if (depthMap.format() == SampleFormat::UInt16) {
+        sampleStep = std::floor(sampleStep / depthScale);
+        sampleStep = sampleStep > 1 ? sampleStep : 0.0;
+    }
+
+    // Тайлы сжимаются независимо, по строке тайлов на полосу
+    std::vector<std::vector<unsigned char>> payloads(columns * rows);
+    unsigned threads = workerCount(options.threads);
+    parallelForBands(rows, rows, threads, [&](size_t begin, size_t end, size_t) {
+        for (size_t ty = begin; ty < end; ++ty) {
+            for (size_t tx = 0; tx < columns; ++tx) {
+                size_t x0 = tx * tile, y0 = ty * tile;
+                depthMap.visit([&](const auto& typed) {
+                    payloads[ty * columns + tx] = encodeTile(typed.data.data(), width, x0, y0,
+                        std::min(tile, width - x0), std::min(tile, height - y0), sampleStep);
+                });
+            }
+        }
+    });
+
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Unable to open file");
+    }
+    BufferedWriter writer(file);
+    writer.write(Magic, sizeof(Magic));
+    writer.put<uint32_t>(Version);
+    writer.put<uint64_t>(width);
+    writer.put<uint64_t>(height);
+    writer.put<uint32_t>(static_cast<uint32_t>(tile));
+    writer.put<uint32_t>(static_cast<uint32_t>(depthMap.format()));
+    writer.put<double>(sampleStep * depthScale);
+    writer.put<float>(depthScale);
+    writer.put<uint32_t>(0);
+    uint64_t offset = HeaderSize + IndexEntrySize * payloads.size();
+    for (const std::vector<unsigned char>& payload : payloads) {
+        writer.put<uint64_t>(offset);
+        writer.put<uint64_t>(payload.size());
+        offset += payload.size();
+    }
+    for (const std::vector<unsigned char>& payload : payloads) {
+        writer.write(payload.data(), payload.size());
+    }
+    writer.flush();
+    if (!file) {
+        throw std::runtime_error("Error writing file: " + filename);
+    }
+}
+
+void writeLegacyDepthMap(const AnyDepthMap& depthMap, const std::string& filename) {
+    std::ofstream file(filename, std::ios::binary);
+    if (!file) {
+        throw std::runtime_error("Unable to open file");
+    }
+    double header[2] = { static_cast<double>(depthMap.height()), static_cast<double>(depthMap.width()) };
+    file.write(reinterpret_cast<const char*>(header), sizeof(header));
+    depthMap.visit([&](const auto& typed) {
+        file.write(reinterpret_cast<const char*>(typed.data.data()), typed.data.size() * sizeof(*typed.data.data()));
+    });
+    if (!file) {
+        throw std::runtime_error("Error writing file: " + filename);
+    }
+}
+
+TiledDepthReader::TiledDepthReader(const std::string& filename) : file(filename) {
+    if (!isLittleEndianHost()) {
+        throw std::runtime_error("Tiled depth maps require a little-endian host");
+    }
+    const unsigned char* bytes = file.data();
+    if (file.size() < HeaderSize || std::memcmp(bytes, Magic, sizeof(Magic)) != 0) {
+        throw std::runtime_error("Not a tiled depth map file: " + filename);
+    }
+    uint32_t version = readValue<uint32_t>(bytes + 4);
+    if (version != Version) {
+        throw std::runtime_error("Unsupported tiled depth map version: " + filename);
+    }
+    uint64_t width = readValue<uint64_t>(bytes + 8);
+    uint64_t height = readValue<uint64_t>(bytes + 16);
+    uint32_t tileSize = readValue<uint32_t>(bytes + 24);
+    uint32_t format = readValue<uint32_t>(bytes + 28);
+    quantization = readValue<double>(bytes + 32);
+    scale = readValue<float>(bytes + 40);
+    if (width == 0 || height == 0 || tileSize == 0 || width > (1ull << 32) || height > (1ull << 32) || !(quantization >= 0)
+        || format > static_cast<uint32_t>(SampleFormat::UInt16) || !(scale > 0)) {
+        throw std::runtime_error("Malformed tiled depth map header: " + filename);
+    }
+    sampleFormat = static_cast<SampleFormat>(format);
+    sampleStep = sampleFormat == SampleFormat::UInt16 ? std::round(quantization / scale) : quantization;
+    mapWidth = static_cast<size_t>(width);
+    mapHeight = static_cast<size_t>(height);
+    tile = tileSize;
+    columns = (mapWidth + tile - 1) / tile;
+    rows = (mapHeight + tile - 1) / tile;
+    if ((file.size() - HeaderSize) / IndexEntrySize < columns * rows) {
+        throw std::runtime_error("Truncated tiled depth map index: " + filename);
+    }
+    index = bytes + HeaderSize;
+    for (size_t i = 0; i < columns * rows; ++i) {
+        uint64_t offset = readValue<uint64_t>(index + i * IndexEntrySize);
+        uint64_t size = readValue<uint64_t>(index + i * IndexEntrySize + 8);
+        if (offset > file.size() || size > file.size() - offset) {
+            throw std::runtime_error("Tile is out of file bounds: " + filename);
+        }
+    }
+}
+
+template <typename Out>
+void TiledDepthReader::readTile(size_t tx, size_t ty, Out* out, size_t outStride) const {
+    if (tx >= columns || ty >= rows) {
+        throw std::runtime_error("Tile index is out of range");
+    }
+    const unsigned char* entry = index + (ty * columns + tx) * IndexEntrySize;
+    const unsigned char* payload = file.data() + readValue<uint64_t>(entry);
+    size_t size = static_cast<size_t>(readValue<uint64_t>(entry + 8));
+    size_t x0 = tx * tile, y0 = ty * tile;
+    size_t w = std::min(tile, mapWidth - x0), h = std::min(tile, mapHeight - y0);
+    switch (sampleFormat) {
+    case SampleFormat::Float32:
+        checkOutput<float, Out>();
+        decodeTile<float>(payload, size, sampleStep, scale, w, h, out, outStride);
+        break;
+    case SampleFormat::UInt16:
+        checkOutput<uint16_t, Out>();
+        decodeTile<uint16_t>(payload, size, sampleStep, scale, w, h, out, outStride);
+        break;
+    default:
+        checkOutput<double, Out>();
+        decodeTile<double>(payload, size, sampleStep, scale, w, h, out, outStride);
+        break;
+    }
+}
+
+template <typename Out>
+void TiledDepthReader::readRegion(size_t x, size_t y, size_t w, size_t h, Out* out) const {
+    if (x + w > mapWidth || y + h > mapHeight || w == 0 || h == 0) {
+        throw std::runtime_error("Region is out of depth map bounds");
+    }
+    std::vector<Out> buffer(tile * tile);
+    for (size_t ty = y / tile; ty <= (y + h - 1) / tile; ++ty) {
+        for (size_t tx = x / tile; tx <= (x + w - 1) / tile; ++tx) {
+            readTile(tx, ty, buffer.data(), tile);
+            size_t x0 = tx * tile, y0 = ty * tile;
+            size_t left = std::max(x, x0), right = std::min(x + w, std::min(x0 + tile, mapWidth));
+            size_t top = std::max(y, y0), bottom = std::min(y + h, std::min(y0 + tile, mapHeight));
+            for (size_t row = top; row < bottom; ++row) {
+                std::copy(buffer.data() + (row - y0) * tile + (left - x0), buffer.data() + (row - y0) * tile + (right - x0),
+                    out + (row - y) * w + (left - x));
+            }
+        }
+    }
+}
+
+template <typename Out>
+void TiledDepthReader::readAll(Out* out, unsigned threads) const {
+    TRACE_ZONE("TiledDepthReader::readAll");
+    threads = workerCount(threads);
+    parallelForBands(rows, rows, threads, [&](size_t begin, size_t end, size_t) {
+        for (size_t ty = begin; ty < end; ++ty) {
+            for (size_t tx = 0; tx < columns; ++tx) {
+                readTile(tx, ty, out + ty * tile * mapWidth + tx * tile, mapWidth);
+            }
+        }
+    });
+}
+
+template void TiledDepthReader::readTile(size_t, size_t, double*, size_t) const;
+template void TiledDepthReader::readTile(size_t, size_t, float*, size_t) const;
+template void TiledDepthReader::readTile(size_t, size_t, uint16_t*, size_t) const;
+template void TiledDepthReader::readRegion(size_t, size_t, size_t, size_t, double*) const;
+template void TiledDepthReader::readRegion(size_t, size_t, size_t, size_t, float*) const;
+template void TiledDepthReader::readRegion(size_t, size_t, size_t, size_t, uint16_t*) const;
+template void TiledDepthReader::readAll(double*, unsigned) const;
+template void TiledDepthReader::readAll(float*, unsigned) const;
+template void TiledDepthReader::readAll(uint16_t*, unsigned) const;
@@ -0,0 +1,74 @@
+﻿#ifndef TILED_DEPTH_H
+#define TILED_DEPTH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "depth_map.h"
+#include "mapped_file.h"
+
+// Контейнер .dmt: карта делится на квадратные тайлы, каждый сжимается независимо.
+// В начале файла заголовок и таблица смещений тайлов, так что любой участок
+// читается без распаковки остальных.
+//
+// Внутри тайла (по строкам) чередуются серии нулей и серии ненулевых отсчётов.
+// Ненулевой отсчёт предсказывается по соседям слева, сверху и слева сверху (MED, как в LOCO-I),
+// остаток кодируется zigzag + varint. Отсчёты хранятся в типе карты (double, float или uint16,
+// тип и масштаб uint16 — в заголовке). Без квантования предсказываются битовые образы отсчётов
+// в их ширине (сжатие без потерь), с квантованием — номера шагов 2 * maxError
+// (для uint16 — целого числа единиц отсчёта, не больше 2 * maxError; float отсчёты
+// вдобавок округляются до float). NaN и бесконечности при квантовании хранятся без изменений.
+struct TiledDepthOptions {
+    uint32_t tileSize = 64;
+    double maxError = 0.0; // 0 — без потерь
+    unsigned threads = 0;
+};
+
+void writeTiledDepthMap(const AnyDepthMap& depthMap, const std::string& filename,
+    const TiledDepthOptions& options = TiledDepthOptions());
+
+// Старый формат .dat: height, width и отсчёты в типе карты (double, float или uint16 без масштаба)
+void writeLegacyDepthMap(const AnyDepthMap& depthMap, const std::string& filename);
+
+// Чтение отдельных тайлов и участков .dmt
+class TiledDepthReader {
+public:
+    explicit TiledDepthReader(const std::string& filename);
+
+    size_t width() const { return mapWidth; }
+    size_t height() const { return mapHeight; }
+    size_t tileSize() const { return tile; }
+    size_t tilesX() const { return columns; }
+    size_t tilesY() const { return rows; }
+    double maxError() const { return quantization / 2.0; }
+    SampleFormat format() const { return sampleFormat; }
+    float depthScale() const { return scale; } // Масштаб uint16 отсчётов, для остальных 1
+
+    // Out — double (глубина, uint16 умножаются на масштаб) или тип отсчётов файла (format()),
+    // тогда отсчёты выдаются как есть; иначе исключение.
+    // Тайл (tx, ty) в out с шагом строки outStride (в отсчётах)
+    template <typename Out>
+    void readTile(size_t tx, size_t ty, Out* out, size_t outStride) const;
+    // Прямоугольник [x, x + w) x [y, y + h), распаковываются только задетые тайлы
+    template <typename Out>
+    void readRegion(size_t x, size_t y, size_t w, size_t h, Out* out) const;
+    // Вся карта (width * height отсчётов), тайлы распаковываются в threads потоках
+    template <typename Out>
+    void readAll(Out* out, unsigned threads = 0) const;
+
+private:
+    MappedFile file;
+    size_t mapWidth = 0;
+    size_t mapHeight = 0;
+    size_t tile = 0;
+    size_t columns = 0;
+    size_t rows = 0;
+    double quantization = 0.0; // Шаг квантования в единицах глубины, 0 — без потерь
+    double sampleStep = 0.0;   // Тот же шаг в единицах отсчёта
+    SampleFormat sampleFormat = SampleFormat::Float64;
+    float scale = 1.0f;
+    const unsigned char* index = nullptr;
+};
+
+#endif // TILED_DEPTH_H
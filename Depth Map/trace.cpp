@@ -0,0 +1,205 @@
+﻿#include "trace.h"
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> traceActive(false);
+
+namespace {
+
+struct TraceEvent {
+    const char* name;
+    int64_t start;    // Наносекунды от начала трассировки
+    int64_t duration;
+};
+
+// Кольцо событий одного потока: пишет только владелец, при переполнении
+// затираются старые события. Читается при записи файла.
+struct TraceRing {
+    static const size_t capacity = size_t(1) << 16;
+
+    explicit TraceRing(unsigned id) : events(capacity), lane(id) {}
+
+    std::vector<TraceEvent> events;
+    std::atomic<uint64_t> written{ 0 };
+    unsigned lane;
+    uint64_t generation = 0; // Сессия, в которой кольцо выдано владельцу (под mutex)
+};
+
+// Кольца не удаляются: поток может ещё писать в кольцо прошлой сессии. Кольцо возвращает
+// в список свободных только владелец — при завершении потока или заметив новую сессию, —
+// и следующий поток (например, из parallelForBands) пишет в него же
+struct TraceRegistry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<TraceRing>> rings;
+    std::vector<TraceRing*> freeRings;
+    std::string filename;
+    std::chrono::steady_clock::time_point origin;
+    std::atomic<uint64_t> generation{ 0 }; // Номер сессии, меняется под mutex
+};
+
+TraceRegistry& registry() {
+    static TraceRegistry instance;
+    return instance;
+}
+
+// Кольцо потока и снимок сессии, в которой оно получено: начало отсчёта времени
+// читается отсюда, а не из реестра
+struct ThreadRing {
+    TraceRing* ring = nullptr;
+    uint64_t generation = 0;
+    std::chrono::steady_clock::time_point origin;
+
+    ~ThreadRing() {
+        if (ring) {
+            TraceRegistry& traces = registry();
+            std::lock_guard<std::mutex> lock(traces.mutex);
+            traces.freeRings.push_back(ring);
+        }
+    }
+};
+
+thread_local ThreadRing threadRing;
+
+// Возвращает прежнее кольцо потока и берёт кольцо текущей сессии
+void acquireRing(ThreadRing& owner) {
+    TraceRegistry& traces = registry();
+    std::lock_guard<std::mutex> lock(traces.mutex);
+    if (owner.ring) {
+        traces.freeRings.push_back(owner.ring);
+    }
+    TraceRing* ring;
+    if (!traces.freeRings.empty()) {
+        ring = traces.freeRings.back();
+        traces.freeRings.pop_back();
+    }
+    else {
+        traces.rings.push_back(std::unique_ptr<TraceRing>(new TraceRing(static_cast<unsigned>(traces.rings.size()))));
+        ring = traces.rings.back().get();
+    }
+    // Кольцо той же сессии дописывается дальше, прошлой — очищается
+    uint64_t generation = traces.generation.load(std::memory_order_relaxed);
+    if (ring->generation != generation) {
+        ring->written.store(0, std::memory_order_relaxed);
+        ring->generation = generation;
+    }
+    owner.ring = ring;
+    owner.generation = ring->generation;
+    owner.origin = traces.origin;
+}
+
+void writeEscaped(std::ostream& out, const char* text) {
+    for (; *text; ++text) {
+        if (*text == '"' || *text == '\\') {
+            out << '\\';
+        }
+        out << *text;
+    }
+}
+
+} // namespace
+
+void startTracing(const std::string& filename) {
+    TraceRegistry& traces = registry();
+    {
+        std::lock_guard<std::mutex> lock(traces.mutex);
+        traces.filename = filename;
+        traces.origin = std::chrono::steady_clock::now();
+        traces.generation.fetch_add(1, std::memory_order_relaxed);
+    }
+    traceActive.store(true, std::memory_order_release);
+}
+
+void recordTraceEvent(const char* name, std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end) {
+    if (!tracingEnabled()) {
+        return;
+    }
+    // Сессия опубликована до флага (release в startTracing), поэтому номер здесь не старее флага
+    if (!threadRing.ring || threadRing.generation != registry().generation.load(std::memory_order_relaxed)) {
+        acquireRing(threadRing);
+    }
+    TraceRing& ring = *threadRing.ring;
+    uint64_t index = ring.written.load(std::memory_order_relaxed);
+    TraceEvent& event = ring.events[index & (TraceRing::capacity - 1)];
+    event.name = name;
+    event.start = std::chrono::duration_cast<std::chrono::nanoseconds>(start - threadRing.origin).count();
+    event.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    ring.written.store(index + 1, std::memory_order_release);
+}
+
+void stopTracing() {
+    if (!traceActive.exchange(false)) {
+        return;
+    }
+    TraceRegistry& traces = registry();
+    std::lock_guard<std::mutex> lock(traces.mutex);
+    std::ofstream file(traces.filename);
+    if (!file) {
+        std::cerr << "Failed to open trace file: " << traces.filename << std::endl;
+        return;
+    }
+
+    file << std::fixed << std::setprecision(3); // Микросекунды с точностью до наносекунды
+    file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    uint64_t dropped = 0;
+    uint64_t generation = traces.generation.load(std::memory_order_relaxed);
+    for (const std::unique_ptr<TraceRing>& ring : traces.rings) {
+        if (ring->generation != generation) {
+            continue;
+        }
+        // Владелец мог пройти проверку флага до выключения и дописывать событие в слот written,
+        // который после переполнения совпадает со старейшим, — такой слот пропускается
+        uint64_t written = ring->written.load(std::memory_order_acquire);
+        uint64_t begin = written >= TraceRing::capacity ? written - TraceRing::capacity + 1 : 0;
+        dropped += begin;
+        for (uint64_t i = begin; i < written; ++i) {
+            const TraceEvent& event = ring->events[i & (TraceRing::capacity - 1)];
+            file << (first ? "" : ",\n") << "{\"name\":\"";
+            writeEscaped(file, event.name);
+            file << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << ring->lane
+                << ",\"ts\":" << event.start / 1000.0 << ",\"dur\":" << event.duration / 1000.0 << "}";
+            first = false;
+        }
+        file << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << ring->lane
+            << ",\"args\":{\"name\":\"";
+        if (ring->lane == 0) {
+            file << "main";
+        }
+        else {
+            file << "worker " << ring->lane;
+        }
+        file << "\"}}";
+        first = false;
+    }
+    file << "\n]}\n";
+    if (dropped > 0) {
+        std::cerr << "trace: " << dropped << " oldest events overwritten" << std::endl;
+    }
+    std::cout << "trace: " << traces.filename << std::endl;
+}
+
+TraceSession::TraceSession(const std::string& filename) {
+    std::string target = filename;
+    if (target.empty()) {
+        const char* variable = std::getenv("DEPTH_MAP_TRACE");
+        if (variable) {
+            target = variable;
+        }
+    }
+    if (!target.empty()) {
+        startTracing(target);
+        active = true;
+    }
+}
+
+TraceSession::~TraceSession() {
+    if (active) {
+        stopTracing();
+    }
+}
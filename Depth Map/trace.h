@@ -0,0 +1,70 @@
+﻿#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+// Трассировка участков кода в формате Chrome trace events (chrome://tracing, ui.perfetto.dev).
+// Каждый поток пишет события в своё кольцо без блокировок; при выключенной трассировке
+// TRACE_ZONE стоит одной проверки флага. С DEPTH_MAP_NO_TRACE зоны не компилируются вовсе.
+// Имена зон — строковые литералы (хранится только указатель).
+
+extern std::atomic<bool> traceActive;
+
+inline bool tracingEnabled() {
+    return traceActive.load(std::memory_order_acquire);
+}
+
+void startTracing(const std::string& filename);
+// Записывает собранные события в файл и выключает трассировку
+void stopTracing();
+
+void recordTraceEvent(const char* name, std::chrono::steady_clock::time_point start,
+    std::chrono::steady_clock::time_point end);
+
+class TraceZone {
+public:
+    explicit TraceZone(const char* zoneName) : name(tracingEnabled() ? zoneName : nullptr) {
+        if (name) {
+            start = std::chrono::steady_clock::now();
+        }
+    }
+    ~TraceZone() {
+        if (name) {
+            recordTraceEvent(name, start, std::chrono::steady_clock::now());
+        }
+    }
+
+    TraceZone(const TraceZone&) = delete;
+    TraceZone& operator=(const TraceZone&) = delete;
+
+private:
+    const char* name;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Трассировка на время жизни объекта: файл из filename, а если он пуст —
+// из переменной окружения DEPTH_MAP_TRACE; без обоих ничего не делает
+class TraceSession {
+public:
+    explicit TraceSession(const std::string& filename);
+    ~TraceSession();
+
+    TraceSession(const TraceSession&) = delete;
+    TraceSession& operator=(const TraceSession&) = delete;
+
+private:
+    bool active = false;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+#ifdef DEPTH_MAP_NO_TRACE
+#define TRACE_ZONE(name) ((void)0)
+#else
+#define TRACE_ZONE(name) TraceZone TRACE_CONCAT(traceZone, __LINE__)(name)
+#endif
+
+#endif // TRACE_H
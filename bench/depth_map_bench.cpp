@@ -0,0 +1,548 @@
+// Замеры загрузки, построения сетки, нормалей и экспортёров на синтетических картах глубины.
+// Результаты печатаются таблицей и (--json) пишутся по одной записи в строке,
+// чтобы сравнивать версии между собой (--baseline).
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <new>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include "camera_projection.h"
+#include "depth_filter.h"
+#include "depth_map.h"
+#include "depth_pyramid.h"
+#include "exporters.h"
+#include "mesh.h"
+#include "normal_kernel.h"
+#include "streaming.h"
+#include "tiled_depth.h"
+
+// Подсчёт выделений памяти во всём процессе
+namespace {
+
+std::atomic<uint64_t> allocationCount(0);
+std::atomic<uint64_t> allocationBytes(0);
+
+void* countedAllocate(size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    allocationBytes.fetch_add(size, std::memory_order_relaxed);
+    void* pointer = std::malloc(size > 0 ? size : 1);
+    if (!pointer) {
+        throw std::bad_alloc();
+    }
+    return pointer;
+}
+
+} // namespace
+
+void* operator new(size_t size) { return countedAllocate(size); }
+void* operator new[](size_t size) { return countedAllocate(size); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return countedAllocate(size);
+    }
+    catch (...) {
+        return nullptr;
+    }
+}
+void* operator new[](size_t size, const std::nothrow_t& tag) noexcept { return operator new(size, tag); }
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+void operator delete[](void* pointer) noexcept { std::free(pointer); }
+void operator delete(void* pointer, size_t) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, size_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, const std::nothrow_t&) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept { std::free(pointer); }
+
+namespace {
+
+struct BenchOptions {
+    std::vector<std::pair<size_t, size_t>> sizes = { { 320, 240 }, { 640, 480 }, { 1280, 960 } };
+    std::vector<std::string> maps = { "flat", "noisy", "sparse" };
+    std::vector<std::string> samples = { "f64" }; // Тип отсчётов карты: f64, f32, u16
+    unsigned repeat = 3;
+    unsigned threads = 0;
+    std::string jsonFile;
+    std::string baselineFile;
+    std::string tempDirectory;
+};
+
+struct BenchResult {
+    std::string map;
+    size_t width = 0;
+    size_t height = 0;
+    std::string operation;
+    double milliseconds = 0.0; // Медиана повторов
+    uint64_t bytes = 0;        // Прочитанные или записанные байты
+    uint64_t allocations = 0;
+    uint64_t allocatedBytes = 0;
+
+    double megapixelsPerSecond() const {
+        return milliseconds > 0 ? width * height / 1e6 / (milliseconds / 1000.0) : 0.0;
+    }
+    double megabytesPerSecond() const {
+        return milliseconds > 0 ? bytes / (1024.0 * 1024.0) / (milliseconds / 1000.0) : 0.0;
+    }
+    std::string key() const {
+        std::ostringstream out;
+        out << map << " " << width << "x" << height << " " << operation;
+        return out.str();
+    }
+};
+
+const float uint16DepthScale = 1.0f / 64.0f; // Шаг глубины синтетической uint16 карты
+
+template <typename T>
+DepthMap<T> typedDepthMap(const std::vector<double>& values, size_t width, size_t height, float depthScale) {
+    DepthMap<T> depthMap;
+    depthMap.width = width;
+    depthMap.height = height;
+    depthMap.depthScale = depthScale;
+    std::vector<T> samples(values.size());
+    for (size_t i = 0; i < values.size(); ++i) {
+        double sample = values[i] / depthScale;
+        samples[i] = static_cast<T>(std::is_integral<T>::value ? std::round(sample) : sample);
+    }
+    depthMap.data = DepthSamples<T>(std::move(samples));
+    return depthMap;
+}
+
+// Синтетические карты: ровная плоскость, рельеф с шумом и редкие пятна среди нулей.
+// Генератор с фиксированным зерном, так что карты одинаковы между запусками.
+AnyDepthMap makeDepthMap(const std::string& kind, const std::string& samples, size_t width, size_t height) {
+    std::vector<double> values(width * height);
+    std::mt19937 random(12345);
+    std::uniform_real_distribution<double> noise(-2.0, 2.0);
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    for (size_t y = 0; y < height; ++y) {
+        for (size_t x = 0; x < width; ++x) {
+            double u = static_cast<double>(x) / width;
+            double v = static_cast<double>(y) / height;
+            double relief = 300.0 + 40.0 * std::sin(u * 6.0) * std::cos(v * 4.0);
+            double& value = values[y * width + x];
+            if (kind == "flat") {
+                value = 300.0;
+            }
+            else if (kind == "noisy") {
+                value = relief + noise(random);
+            }
+            else if (kind == "sparse") {
+                double blobs = std::sin(u * 23.0) * std::sin(v * 17.0);
+                value = blobs > 0.5 && unit(random) > 0.1 ? relief : 0.0;
+            }
+            else {
+                throw std::runtime_error("Unknown synthetic map: " + kind);
+            }
+        }
+    }
+    if (samples == "f32") {
+        return typedDepthMap<float>(values, width, height, 1.0f);
+    }
+    if (samples == "u16") {
+        return typedDepthMap<uint16_t>(values, width, height, uint16DepthScale);
+    }
+    if (samples != "f64") {
+        throw std::runtime_error("Unknown sample type: " + samples);
+    }
+    DepthMap<double> depthMap;
+    depthMap.width = width;
+    depthMap.height = height;
+    depthMap.data = DepthSamples<double>(std::move(values));
+    return depthMap;
+}
+
+uint64_t fileSize(const std::string& filename) {
+    std::ifstream file(filename, std::ios::binary | std::ios::ate);
+    return file ? static_cast<uint64_t>(file.tellg()) : 0;
+}
+
+// fn возвращает число обработанных байт; время — медиана повторов, выделения — последнего повтора
+template <typename Fn>
+BenchResult measure(const std::string& map, const AnyDepthMap& depthMap, const std::string& operation,
+    unsigned repeat, Fn fn) {
+    BenchResult result;
+    result.map = map;
+    result.width = depthMap.width();
+    result.height = depthMap.height();
+    result.operation = operation;
+
+    std::vector<double> times;
+    for (unsigned i = 0; i < std::max(1u, repeat); ++i) {
+        uint64_t allocationsBefore = allocationCount.load();
+        uint64_t bytesBefore = allocationBytes.load();
+        auto start = std::chrono::steady_clock::now();
+        result.bytes = fn();
+        times.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+        result.allocations = allocationCount.load() - allocationsBefore;
+        result.allocatedBytes = allocationBytes.load() - bytesBefore;
+    }
+    std::sort(times.begin(), times.end());
+    result.milliseconds = times[times.size() / 2];
+    return result;
+}
+
+// Сумма всех отсчётов: загрузчик отображает файл без копии, и без чтения отсчётов замер
+// readDepthMap покрыл бы только mmap и разбор заголовка
+volatile double sampleSink = 0.0;
+
+void touchSamples(const AnyDepthMap& depthMap) {
+    double sum = 0.0;
+    depthMap.visit([&](const auto& typed) {
+        for (auto value : typed.data) {
+            sum += value;
+        }
+    });
+    sampleSink = sum;
+}
+
+// Карты с отсчётами не f64 подписываются типом, например noisy-u16
+std::vector<BenchResult> runMap(const std::string& map, const std::string& samples, size_t width, size_t height,
+    const BenchOptions& options) {
+    std::vector<BenchResult> results;
+    AnyDepthMap depthMap = makeDepthMap(map, samples, width, height);
+    std::string kind = samples == "f64" ? map : map + "-" + samples;
+    std::ostringstream base;
+    base << options.tempDirectory << "/depth_map_bench_" << kind << "_" << width << "x" << height;
+    std::string inputFile = base.str() + ".dat";
+    writeLegacyDepthMap(depthMap, inputFile);
+
+    DepthLoadOptions loadOptions;
+    loadOptions.depthScale = uint16DepthScale;
+    // Только отображение и разбор заголовка, затем загрузка с чтением каждого отсчёта
+    results.push_back(measure(kind, depthMap, "readDepthMap-mapped", options.repeat, [&]() {
+        AnyDepthMap loaded = readDepthMap(inputFile, loadOptions);
+        return fileSize(inputFile);
+    }));
+    results.push_back(measure(kind, depthMap, "readDepthMap", options.repeat, [&]() {
+        AnyDepthMap loaded = readDepthMap(inputFile, loadOptions);
+        touchSamples(loaded);
+        return fileSize(inputFile);
+    }));
+
+    std::vector<float> vertices;
+    results.push_back(measure(kind, depthMap, "generateDepthMapVertices", options.repeat, [&]() {
+        vertices = std::vector<float>();
+        generateDepthMapVertices(depthMap, vertices, 0.2f, 500.0f, options.threads);
+        return static_cast<uint64_t>(vertices.size() * sizeof(float));
+    }));
+
+    results.push_back(measure(kind, depthMap, "generateNormals", options.repeat, [&]() {
+        std::vector<float> normals;
+        generateNormals(vertices, normals, options.threads);
+        return static_cast<uint64_t>(normals.size() * sizeof(float));
+    }));
+
+    results.push_back(measure(kind, depthMap, "buildGridMesh", options.repeat, [&]() {
+        GridMesh mesh;
+        buildGridMesh(depthMap, mesh, 0.2f, 500.0f, options.threads);
+        size_t indexSize = mesh.wideIndices() ? sizeof(uint32_t) : sizeof(uint16_t);
+        return static_cast<uint64_t>(mesh.vertices.size() * sizeof(float) + mesh.indexCount() * indexSize);
+    }));
+
+    // Нормали по центральным разностям каждым ядром, доступным процессору, в отдельные плоскости.
+    // Для сравнения ядер на кадрах датчика: --sizes 640x480,1920x1080,7680x4320
+    const NormalKernel kernels[] = { NormalKernel::Scalar, NormalKernel::SSE2, NormalKernel::AVX2 };
+    std::vector<float> planes(depthMap.size() * 3);
+    NormalOutput planeOutput;
+    planeOutput.layout = NormalLayout::SoA;
+    planeOutput.nx = planes.data();
+    planeOutput.ny = planes.data() + depthMap.size();
+    planeOutput.nz = planes.data() + 2 * depthMap.size();
+    for (NormalKernel kernel : kernels) {
+        if (static_cast<int>(kernel) > static_cast<int>(bestNormalKernel())) {
+            continue;
+        }
+        std::string operation = std::string("computeGridNormals-") + normalKernelName(kernel);
+        results.push_back(measure(kind, depthMap, operation, options.repeat, [&]() {
+            computeGridNormals(depthMap, 0.2f, 1.0f / 500.0f, planeOutput, options.threads, kernel);
+            return static_cast<uint64_t>(depthMap.size() * (sampleSize(depthMap.format()) + 3 * sizeof(float)));
+        }));
+    }
+
+    // Медиана, три итерации заполнения и двусторонний фильтр, как для кадров датчика
+    results.push_back(measure(kind, depthMap, "filterDepthMap", options.repeat, [&]() {
+        DepthFilterOptions filterOptions;
+        filterOptions.medianPasses = 1;
+        filterOptions.holeFillIterations = 3;
+        filterOptions.bilateralSigmaSpace = 2.0f;
+        filterOptions.bilateralSigmaDepth = 5.0f;
+        filterOptions.threads = options.threads;
+        AnyDepthMap filtered = filterDepthMap(depthMap, filterOptions);
+        return static_cast<uint64_t>(filtered.size() * sampleSize(filtered.format()));
+    }));
+
+    // Обратная проекция камерой с дисторсией, как для кадров датчика: таблица лучей считается
+    // до замера, облако того же размера переиспользуется. Байты — отсчёты, лучи и три плоскости облака
+    CameraIntrinsics camera;
+    camera.fx = camera.fy = 0.8f * width;
+    camera.cx = 0.5f * width;
+    camera.cy = 0.5f * height;
+    camera.k1 = -0.1f;
+    camera.k2 = 0.02f;
+    BackProjector projector(camera, options.threads);
+    PointCloud cloud;
+    projector.project(depthMap, 0, cloud);
+    results.push_back(measure(kind, depthMap, "backProjectDepthMap", options.repeat, [&]() {
+        projector.project(depthMap, 0, cloud);
+        return static_cast<uint64_t>(cloud.size() * (sampleSize(depthMap.format()) + 5 * sizeof(float)));
+    }));
+
+    // Пирамида глубины и сетка предпросмотра по её уровню 4 (в 256 раз меньше отсчётов)
+    AnyDepthMap withPyramid = depthMap;
+    results.push_back(measure(kind, depthMap, "buildDepthPyramid", options.repeat, [&]() {
+        std::shared_ptr<const DepthPyramid> pyramid = buildDepthPyramid(depthMap, 4, options.threads);
+        withPyramid.setPyramid(pyramid);
+        uint64_t bytes = 0;
+        for (const DepthPyramidLevel& level : pyramid->levels) {
+            bytes += level.depthMap.size() * (sampleSize(level.depthMap.format()) + 2 * sizeof(float));
+        }
+        return bytes;
+    }));
+
+    results.push_back(measure(kind, depthMap, "buildGridMeshLevel4", options.repeat, [&]() {
+        GridMesh mesh;
+        buildGridMesh(withPyramid, 4, mesh, 0.2f, 500.0f, options.threads);
+        size_t indexSize = mesh.wideIndices() ? sizeof(uint32_t) : sizeof(uint16_t);
+        return static_cast<uint64_t>(mesh.vertices.size() * sizeof(float) + mesh.indexCount() * indexSize);
+    }));
+
+    struct ExportCase {
+        const char* operation;
+        const char* format;
+        bool binary;
+    };
+    const ExportCase exports[] = {
+        { "exportPly", "ply", false },
+        { "exportPlyBinary", "ply", true },
+        { "exportStl", "stl", false },
+        { "exportStlBinary", "stl", true },
+        { "exportVrml", "vrml", false }
+    };
+    for (const ExportCase& exportCase : exports) {
+        ExportOptions exportOptions;
+        exportOptions.binary = exportCase.binary;
+        exportOptions.threads = options.threads;
+        std::string outputFile = base.str() + "_" + exportCase.operation;
+        std::string writtenFile = outputFile + "." + exportCase.format;
+        results.push_back(measure(kind, depthMap, exportCase.operation, options.repeat, [&]() {
+            exportDepthMap(depthMap, exportCase.format, outputFile, exportOptions);
+            return fileSize(writtenFile);
+        }));
+        std::remove(writtenFile.c_str());
+    }
+
+    std::remove(inputFile.c_str());
+    return results;
+}
+
+void printTable(const std::vector<BenchResult>& results) {
+    std::cout << std::left << std::setw(28) << "map / operation" << std::right
+        << std::setw(12) << "ms" << std::setw(10) << "MP/s" << std::setw(10) << "MB/s"
+        << std::setw(10) << "allocs" << std::setw(12) << "alloc MB" << std::endl;
+    std::string current;
+    for (const BenchResult& result : results) {
+        std::ostringstream group;
+        group << result.map << " " << result.width << "x" << result.height;
+        if (group.str() != current) {
+            current = group.str();
+            std::cout << current << std::endl;
+        }
+        std::cout << std::left << std::setw(28) << ("  " + result.operation) << std::right << std::fixed
+            << std::setprecision(2) << std::setw(12) << result.milliseconds
+            << std::setprecision(1) << std::setw(10) << result.megapixelsPerSecond()
+            << std::setw(10) << result.megabytesPerSecond()
+            << std::setw(10) << result.allocations
+            << std::setw(12) << result.allocatedBytes / (1024.0 * 1024.0) << std::endl;
+    }
+    std::cout.unsetf(std::ios::fixed);
+    std::cout.precision(6);
+}
+
+// Одна запись на строку, чтобы файл можно было разбирать и построчно
+void writeJson(const std::vector<BenchResult>& results, const BenchOptions& options, const std::string& filename) {
+    std::ofstream file(filename);
+    if (!file) {
+        throw std::runtime_error("Failed to open file for writing: " + filename);
+    }
+    file << "{\n\"schema\": 1,\n\"repeat\": " << options.repeat << ",\n\"threads\": " << options.threads
+        << ",\n\"results\": [\n";
+    file << std::setprecision(6);
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& r = results[i];
+        file << "{\"map\": \"" << r.map << "\", \"width\": " << r.width << ", \"height\": " << r.height
+            << ", \"operation\": \"" << r.operation << "\", \"milliseconds\": " << r.milliseconds
+            << ", \"megapixelsPerSecond\": " << r.megapixelsPerSecond()
+            << ", \"megabytesPerSecond\": " << r.megabytesPerSecond()
+            << ", \"bytes\": " << r.bytes << ", \"allocations\": " << r.allocations
+            << ", \"allocatedBytes\": " << r.allocatedBytes << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    file << "]\n}\n";
+}
+
+std::string jsonValue(const std::string& line, const std::string& key) {
+    std::string pattern = "\"" + key + "\": ";
+    size_t start = line.find(pattern);
+    if (start == std::string::npos) {
+        return std::string();
+    }
+    start += pattern.size();
+    if (line[start] == '"') {
+        return line.substr(start + 1, line.find('"', start + 1) - start - 1);
+    }
+    return line.substr(start, line.find_first_of(",}", start) - start);
+}
+
+// Сравнение с прошлым файлом --json: изменение времени по каждой строке
+void compareWithBaseline(const std::vector<BenchResult>& results, const std::string& filename) {
+    std::ifstream file(filename);
+    if (!file) {
+        throw std::runtime_error("Failed to open baseline file: " + filename);
+    }
+    std::map<std::string, BenchResult> baseline;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.find("\"operation\"") == std::string::npos) {
+            continue;
+        }
+        BenchResult result;
+        result.map = jsonValue(line, "map");
+        result.width = static_cast<size_t>(std::stoull(jsonValue(line, "width")));
+        result.height = static_cast<size_t>(std::stoull(jsonValue(line, "height")));
+        result.operation = jsonValue(line, "operation");
+        result.milliseconds = std::stod(jsonValue(line, "milliseconds"));
+        result.allocations = std::stoull(jsonValue(line, "allocations"));
+        baseline[result.key()] = result;
+    }
+
+    std::cout << "\ncompared with " << filename << " (time change, allocation change)" << std::endl;
+    for (const BenchResult& result : results) {
+        auto previous = baseline.find(result.key());
+        if (previous == baseline.end() || previous->second.milliseconds <= 0) {
+            continue;
+        }
+        double change = (result.milliseconds / previous->second.milliseconds - 1.0) * 100.0;
+        long long allocations = static_cast<long long>(result.allocations) - static_cast<long long>(previous->second.allocations);
+        std::cout << std::left << std::setw(48) << result.key() << std::right << std::fixed << std::setprecision(1)
+            << std::setw(8) << std::showpos << change << "%" << std::setw(10) << allocations << std::noshowpos << std::endl;
+    }
+    std::cout.unsetf(std::ios::fixed);
+    std::cout.precision(6);
+}
+
+std::vector<std::string> split(const std::string& text, char separator) {
+    std::vector<std::string> parts;
+    std::stringstream stream(text);
+    std::string part;
+    while (std::getline(stream, part, separator)) {
+        if (!part.empty()) {
+            parts.push_back(part);
+        }
+    }
+    return parts;
+}
+
+std::string defaultTempDirectory() {
+    for (const char* name : { "TMPDIR", "TEMP", "TMP" }) {
+        const char* value = std::getenv(name);
+        if (value && *value) {
+            return value;
+        }
+    }
+    return "/tmp";
+}
+
+BenchOptions parseOptions(int argc, char** argv) {
+    BenchOptions options;
+    options.tempDirectory = defaultTempDirectory();
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--quick") {
+            options.sizes = { { 320, 240 } };
+            options.repeat = 1;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            throw std::runtime_error("Missing value for command line option: " + arg);
+        }
+        std::string value = argv[++i];
+        if (arg == "--sizes") {
+            options.sizes.clear();
+            for (const std::string& size : split(value, ',')) {
+                size_t separator = size.find('x');
+                if (separator == std::string::npos) {
+                    throw std::runtime_error("Size must look like 640x480: " + size);
+                }
+                options.sizes.push_back({ std::stoul(size.substr(0, separator)), std::stoul(size.substr(separator + 1)) });
+            }
+        }
+        else if (arg == "--maps") {
+            options.maps = split(value, ',');
+        }
+        else if (arg == "--samples") {
+            options.samples = split(value, ',');
+        }
+        else if (arg == "--repeat") {
+            options.repeat = static_cast<unsigned>(std::stoul(value));
+        }
+        else if (arg == "--threads") {
+            options.threads = static_cast<unsigned>(std::stoul(value));
+        }
+        else if (arg == "--json") {
+            options.jsonFile = value;
+        }
+        else if (arg == "--baseline") {
+            options.baselineFile = value;
+        }
+        else if (arg == "--temp") {
+            options.tempDirectory = value;
+        }
+        else {
+            throw std::runtime_error("Unknown command line option: " + arg);
+        }
+    }
+    return options;
+}
+
+} // namespace
+
+// depth_map_bench [--quick] [--sizes 320x240,640x480] [--maps flat,noisy,sparse] [--samples f64,f32,u16]
+//                 [--repeat n] [--threads n] [--json results.json] [--baseline previous.json] [--temp dir]
+int main(int argc, char** argv) {
+    try {
+        BenchOptions options = parseOptions(argc, argv);
+        std::vector<BenchResult> results;
+        for (const auto& size : options.sizes) {
+            for (const std::string& map : options.maps) {
+                for (const std::string& samples : options.samples) {
+                    std::vector<BenchResult> mapResults = runMap(map, samples, size.first, size.second, options);
+                    results.insert(results.end(), mapResults.begin(), mapResults.end());
+                }
+            }
+        }
+
+        printTable(results);
+        std::cout << "peak RSS: " << peakResidentBytes() / (1024.0 * 1024.0) << " MB" << std::endl;
+        if (!options.jsonFile.empty()) {
+            writeJson(results, options, options.jsonFile);
+        }
+        if (!options.baselineFile.empty()) {
+            compareWithBaseline(results, options.baselineFile);
+        }
+        return 0;
+    }
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+}